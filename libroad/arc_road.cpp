@@ -337,6 +337,67 @@ static std::vector<vec3f> remove_proximity(const std::vector<vec3f> &v, const fl
     return res;
 }
 
+// Squared distance from p to the segment [a, b]
+static float segment_point_distance2(const vec3f &a, const vec3f &b, const vec3f &p)
+{
+    const vec3f ab(b - a);
+    const float len2 = tvmet::dot(ab, ab);
+    if(len2 <= 0.0f)
+        return distance2(a, p);
+
+    const float t = std::min(1.0f, std::max(0.0f, tvmet::dot(vec3f(p - a), ab)/len2));
+    return distance2(vec3f(a + ab*t), p);
+}
+
+std::vector<vec3f> simplify_polyline(const std::vector<vec3f> &v, const float tolerance, float *max_deviation)
+{
+    if(max_deviation)
+        *max_deviation = 0.0f;
+    if(v.size() < 3 || !(tolerance > 0.0f))
+        return v;
+
+    // Douglas-Peucker, with an explicit stack of spans so long ways don't recurse deeply
+    const float          tol2 = tolerance*tolerance;
+    std::vector<char>    keep(v.size(), 0);
+    std::vector<vec2i>   spans;
+    keep.front() = keep.back() = 1;
+    spans.push_back(vec2i(0, v.size()-1));
+    while(!spans.empty())
+    {
+        const vec2i span(spans.back());
+        spans.pop_back();
+
+        float far2 = -1.0f;
+        int   far  = -1;
+        for(int i = span[0]+1; i < span[1]; ++i)
+        {
+            const float d2 = segment_point_distance2(v[span[0]], v[span[1]], v[i]);
+            if(d2 > far2)
+            {
+                far2 = d2;
+                far  = i;
+            }
+        }
+
+        if(far < 0)
+            continue;
+        if(far2 > tol2)
+        {
+            keep[far] = 1;
+            spans.push_back(vec2i(span[0], far));
+            spans.push_back(vec2i(far, span[1]));
+        }
+        else if(max_deviation)
+            *max_deviation = std::max(*max_deviation, std::sqrt(far2));
+    }
+
+    std::vector<vec3f> res;
+    for(size_t i = 0; i < v.size(); ++i)
+        if(keep[i])
+            res.push_back(v[i]);
+    return res;
+}
+
 static vec3f center(const vec3f &point, const vec3f &normal0, const vec3f &normal1, const float radius)
 {
     const float alpha(radius/cot_theta(normal0, normal1));
@@ -390,6 +451,12 @@ bool arc_road::initialize_from_polyline(const float cull_prox, const std::vector
     return initialize(alphas, lengths);
 }
 
+bool arc_road::refit(const float tolerance, const float cull_prox, float *max_deviation)
+{
+    const std::vector<vec3f> simplified(simplify_polyline(points_, tolerance, max_deviation));
+    return initialize_from_polyline(cull_prox, simplified);
+}
+
 bool arc_road::initialize_from_points_radii(const std::vector<vec3f> &points, const std::vector<float> &radii)
 {
     if(points.size() != radii_.size() + 2)
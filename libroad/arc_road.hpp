@@ -6,6 +6,7 @@
 #include "polyline_road.hpp"
 #include "rtree.hpp"
 #include "geometric.hpp"
+#include "xml_writer.hpp"
 
 struct vertex
 {
@@ -61,6 +62,8 @@ struct arc_road
 
     bool   compute_geometric(std::vector<float> &lengths, std::vector<float> &factors);
     bool   initialize_from_polyline(float cull_prox, const std::vector<vec3f> &points, bool rem_redundant=true);
+    // Simplifies the control polygon to within tolerance and fits it again; max_deviation gets how far off the dropped points are
+    bool   refit(float tolerance, float cull_prox, float *max_deviation=0);
     bool   initialize_from_points_radii(const std::vector<vec3f> &points, const std::vector<float> &radii);
     void   remove_redundant();
 
@@ -80,6 +83,7 @@ struct arc_road
     void   xml_write_as_poly(xmlpp::Element *elt) const;
     void   xml_read(xmlpp::TextReader &reader, const vec3f &scale=vec3f(1.0f, 1.0f, 1.0f));
     void   xml_write(xmlpp::Element *elt) const;
+    void   xml_write(xml_writer &w) const;
     void   check() const;
 
     path svg_arc_path_center (const vec2f &interval, const float offset) const;
@@ -101,6 +105,10 @@ struct arc_road
     std::vector<vec3f>   normals_;
 };
 
+// Douglas-Peucker: drops points of v that are within tolerance of the polyline through the points kept.
+// max_deviation, if given, gets the largest distance of a dropped point from that polyline.
+std::vector<vec3f> simplify_polyline(const std::vector<vec3f> &v, float tolerance, float *max_deviation=0);
+
 bool projection_intersect(vec3f &result,
                           const vec3f &o0, const vec3f &n0,
                           const vec3f &o1, const vec3f &n1,
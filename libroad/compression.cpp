@@ -0,0 +1,288 @@
+#include "compression.hpp"
+#include <cstring>
+#include <stdexcept>
+#include <zlib.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+compression &default_compression()
+{
+    static compression c;
+    return c;
+}
+
+static int thread_count(const int threads)
+{
+#ifdef _OPENMP
+    return threads > 0 ? threads : omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+static inline void put_le16(unsigned char *p, const size_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+}
+
+static inline void put_le32(unsigned char *p, const size_t v)
+{
+    put_le16(p,   v & 0xffff);
+    put_le16(p+2, (v >> 16) & 0xffff);
+}
+
+static inline size_t get_le16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static inline size_t get_le32(const unsigned char *p)
+{
+    return get_le16(p) | (get_le16(p+2) << 16);
+}
+
+namespace pgzip
+{
+    bool member_header(const unsigned char *h, size_t &member_bytes)
+    {
+        // magic, deflate, FEXTRA only; XLEN 8 holding a single 4-byte 'LR' subfield
+        if(h[0] != 0x1f || h[1] != 0x8b || h[2] != 8 || h[3] != 4 ||
+           get_le16(h+10) != 8 || h[12] != 'L' || h[13] != 'R' || get_le16(h+14) != 4)
+            return false;
+        member_bytes = get_le32(h+16);
+        return member_bytes >= header_bytes + trailer_bytes;
+    }
+
+    static bool deflate_member(std::string &res, const char *data, const size_t len, const int level)
+    {
+        z_stream z;
+        std::memset(&z, 0, sizeof(z));
+        if(deflateInit2(&z, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            return false;
+
+        res.resize(header_bytes + deflateBound(&z, len) + trailer_bytes);
+        unsigned char *base = reinterpret_cast<unsigned char*>(&(res[0]));
+        z.next_in   = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        z.avail_in  = len;
+        z.next_out  = base + header_bytes;
+        z.avail_out = res.size() - header_bytes - trailer_bytes;
+        const bool ok = deflate(&z, Z_FINISH) == Z_STREAM_END;
+        const size_t clen = z.total_out;
+        deflateEnd(&z);
+        if(!ok)
+            return false;
+
+        const size_t total = header_bytes + clen + trailer_bytes;
+        base[0] = 0x1f;
+        base[1] = 0x8b;
+        base[2] = 8;
+        base[3] = 4;
+        put_le32(base+4, 0);
+        base[8] = level == 9 ? 2 : (level == 1 ? 4 : 0);
+        base[9] = 3;
+        put_le16(base+10, 8);
+        base[12] = 'L';
+        base[13] = 'R';
+        put_le16(base+14, 4);
+        put_le32(base+16, total);
+
+        unsigned char *trailer = base + header_bytes + clen;
+        put_le32(trailer,   crc32(crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef*>(data), len));
+        put_le32(trailer+4, len);
+        res.resize(total);
+        return true;
+    }
+
+    void deflate_blocks(std::string &out, const char *data, const size_t len, const size_t block_size, const int level, const int threads)
+    {
+        const long               nblocks = std::max(static_cast<size_t>(1), (len + block_size - 1)/block_size);
+        std::vector<std::string> members(nblocks);
+        std::vector<char>        ok(nblocks);
+
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(thread_count(threads))
+        for(long i = 0; i < nblocks; ++i)
+        {
+            const size_t begin = std::min(len, i*block_size);
+            ok[i] = deflate_member(members[i], data + begin, std::min(len - begin, block_size), level);
+        }
+
+        size_t total = out.size();
+        for(long i = 0; i < nblocks; ++i)
+        {
+            if(!ok[i])
+                throw std::runtime_error(boost::str(boost::format("Failed to deflate block %d") % i));
+            total += members[i].size();
+        }
+        out.reserve(total);
+        BOOST_FOREACH(const std::string &m, members)
+        {
+            out.append(m);
+        }
+    }
+
+    static bool inflate_member(std::string &res, const std::string &member)
+    {
+        const unsigned char *base    = reinterpret_cast<const unsigned char*>(member.data());
+        const unsigned char *trailer = base + member.size() - trailer_bytes;
+        res.resize(get_le32(trailer+4));
+
+        z_stream z;
+        std::memset(&z, 0, sizeof(z));
+        if(inflateInit2(&z, -MAX_WBITS) != Z_OK)
+            return false;
+        // A spare output byte catches members longer than their trailer claims
+        char spare;
+        z.next_in   = const_cast<Bytef*>(base + header_bytes);
+        z.avail_in  = member.size() - header_bytes - trailer_bytes;
+        z.next_out  = res.empty() ? reinterpret_cast<Bytef*>(&spare) : reinterpret_cast<Bytef*>(&(res[0]));
+        z.avail_out = res.empty() ? 1 : res.size();
+        const bool ok = inflate(&z, Z_FINISH) == Z_STREAM_END && z.total_out == res.size();
+        inflateEnd(&z);
+
+        return ok && crc32(crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef*>(res.data()), res.size()) == get_le32(trailer);
+    }
+
+    void inflate_members(std::string &out, const std::vector<std::string> &members, const int threads)
+    {
+        const long               nmembers = members.size();
+        std::vector<std::string> blocks(nmembers);
+        std::vector<char>        ok(nmembers);
+
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(thread_count(threads))
+        for(long i = 0; i < nmembers; ++i)
+            ok[i] = inflate_member(blocks[i], members[i]);
+
+        for(long i = 0; i < nmembers; ++i)
+        {
+            if(!ok[i])
+                throw std::runtime_error(boost::str(boost::format("Corrupt gzip member %d") % i));
+            out.append(blocks[i]);
+        }
+    }
+
+    compressor::compressor(const compression &c) : st(new state)
+    {
+        st->block_size  = std::min(std::max(c.block_size, static_cast<size_t>(1 << 16)), static_cast<size_t>(1 << 30));
+        st->level       = c.level;
+        st->threads     = thread_count(c.threads);
+        st->batch_bytes = 2*st->threads*st->block_size;
+        st->wrote       = false;
+        st->pending.reserve(st->batch_bytes);
+    }
+
+    source::state::~state()
+    {
+        if(fp)
+            std::fclose(fp);
+    }
+
+    source::source(const str &filename, const int threads) : st(new state)
+    {
+        st->fp = std::fopen(filename.c_str(), "rb");
+        if(!st->fp)
+            throw std::runtime_error(boost::str(boost::format("Couldn't open %s") % filename));
+        st->threads = thread_count(threads);
+        st->batch   = 2*st->threads;
+    }
+
+    bool source::fill()
+    {
+        std::vector<std::string> members;
+        while(st->fp && members.size() < st->batch)
+        {
+            unsigned char header[header_bytes];
+            const size_t  got = std::fread(header, 1, header_bytes, st->fp);
+            if(got == 0)
+            {
+                std::fclose(st->fp);
+                st->fp = 0;
+                break;
+            }
+
+            size_t member_bytes;
+            if(got != header_bytes || !member_header(header, member_bytes))
+                throw std::runtime_error("Not a parallel gzip member");
+
+            members.push_back(std::string());
+            std::string &m = members.back();
+            m.resize(member_bytes);
+            std::memcpy(&(m[0]), header, header_bytes);
+            if(std::fread(&(m[header_bytes]), 1, member_bytes - header_bytes, st->fp) != member_bytes - header_bytes)
+                throw std::runtime_error("Truncated gzip member");
+        }
+
+        st->buffer.clear();
+        st->pos = 0;
+        inflate_members(st->buffer, members, st->threads);
+        return !st->buffer.empty() || st->fp;
+    }
+
+    std::streamsize source::read(char *s, const std::streamsize n)
+    {
+        while(st->pos == st->buffer.size())
+            if(!fill())
+                return -1;
+
+        const size_t count = std::min(static_cast<size_t>(n), st->buffer.size() - st->pos);
+        std::memcpy(s, st->buffer.data() + st->pos, count);
+        st->pos += count;
+        return count;
+    }
+
+    void source::close()
+    {
+        if(st->fp)
+            std::fclose(st->fp);
+        st->fp = 0;
+        st->buffer.clear();
+        st->pos = 0;
+    }
+}
+
+boost::iostreams::filtering_ostream *compressing_ostream(const str &filename, const compression &c)
+{
+    boost::iostreams::filtering_ostream *out_stream = new boost::iostreams::filtering_ostream();
+    str zip_name(filename);
+#ifndef _MSC_VER
+    if(c.codec != compression::NONE)
+    {
+        if(c.codec == compression::GZIP)
+            out_stream->push(boost::iostreams::gzip_compressor(boost::iostreams::gzip_params(c.level)));
+        else
+            out_stream->push(pgzip::compressor(c));
+        if(filename.empty() || filename[filename.size()-1] != 'z')
+            zip_name = boost::str(boost::format("%s.gz") % filename);
+    }
+#endif
+    out_stream->push(boost::iostreams::file_descriptor_sink(zip_name.raw()));
+    return out_stream;
+}
+
+boost::iostreams::filtering_istream *decompressing_istream(const str &filename)
+{
+    unsigned char header[pgzip::header_bytes];
+    size_t        got = 0;
+    {
+        FILE *fp = std::fopen(filename.c_str(), "rb");
+        if(!fp)
+            throw std::runtime_error(boost::str(boost::format("Couldn't open %s") % filename));
+        got = std::fread(header, 1, sizeof(header), fp);
+        std::fclose(fp);
+    }
+
+    boost::iostreams::filtering_istream *in_stream = new boost::iostreams::filtering_istream();
+    size_t member_bytes;
+    if(got == pgzip::header_bytes && pgzip::member_header(header, member_bytes))
+        in_stream->push(pgzip::source(filename));
+    else
+    {
+#ifndef _MSC_VER
+        if(got >= 2 && header[0] == 0x1f && header[1] == 0x8b)
+            in_stream->push(boost::iostreams::gzip_decompressor());
+#endif
+        in_stream->push(boost::iostreams::file_descriptor_source(filename.raw()));
+    }
+    return in_stream;
+}
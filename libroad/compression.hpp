@@ -0,0 +1,103 @@
+#ifndef _COMPRESSION_HPP_
+#define _COMPRESSION_HPP_
+
+#include "libroad_common.hpp"
+#include <boost/iostreams/categories.hpp>
+#include <boost/iostreams/operations.hpp>
+#include <boost/shared_ptr.hpp>
+#include <cstdio>
+
+// Block-parallel gzip, as written by compressing_ostream with compression::PARALLEL_GZIP.
+// Every member is a complete gzip stream (RFC 1952) whose header carries an 'LR' extra field
+// holding the member's total size, so a reader can split a batch of members without inflating them.
+namespace pgzip
+{
+    static const size_t header_bytes  = 20;
+    static const size_t trailer_bytes = 8;
+
+    // Whether h (header_bytes long) starts a member written by deflate_blocks; if so, its size goes in member_bytes
+    bool member_header(const unsigned char *h, size_t &member_bytes);
+
+    // Deflates nblocks pieces of data, each block_size long (the last may be shorter), into consecutive members appended to out.
+    // nblocks == 0 writes a single empty member.
+    void deflate_blocks(std::string &out, const char *data, size_t len, size_t block_size, int level, int threads);
+
+    // Inflates the whole members in members[i] and appends their contents to out in order; throws on corrupt data
+    void inflate_members(std::string &out, const std::vector<std::string> &members, int threads);
+
+    struct compressor
+    {
+        typedef char char_type;
+        struct category : boost::iostreams::output_filter_tag, boost::iostreams::multichar_tag, boost::iostreams::closable_tag {};
+
+        compressor(const compression &c);
+
+        template <typename Sink>
+        std::streamsize write(Sink &snk, const char *s, std::streamsize n)
+        {
+            st->pending.append(s, n);
+            if(st->pending.size() >= st->batch_bytes)
+                flush(snk);
+            return n;
+        }
+
+        template <typename Sink>
+        void close(Sink &snk)
+        {
+            if(!st->pending.empty() || !st->wrote)
+                flush(snk);
+            st->wrote = false;
+        }
+
+        template <typename Sink>
+        void flush(Sink &snk)
+        {
+            std::string out;
+            deflate_blocks(out, st->pending.data(), st->pending.size(), st->block_size, st->level, st->threads);
+            st->pending.clear();
+            boost::iostreams::write(snk, out.data(), static_cast<std::streamsize>(out.size()));
+            st->wrote = true;
+        }
+
+        struct state
+        {
+            std::string pending;
+            size_t      block_size;
+            size_t      batch_bytes;
+            int         level;
+            int         threads;
+            bool        wrote;
+        };
+
+        boost::shared_ptr<state> st;
+    };
+
+    // Reads batches of members from a file and inflates each batch in parallel
+    struct source
+    {
+        typedef char char_type;
+        struct category : boost::iostreams::source_tag, boost::iostreams::closable_tag {};
+
+        source(const str &filename, int threads = 0);
+
+        std::streamsize read(char *s, std::streamsize n);
+        void            close();
+
+        bool fill();
+
+        struct state
+        {
+            state() : fp(0), pos(0) {}
+            ~state();
+
+            FILE        *fp;
+            std::string  buffer;
+            size_t       pos;
+            size_t       batch;
+            int          threads;
+        };
+
+        boost::shared_ptr<state> st;
+    };
+}
+#endif
@@ -2,6 +2,9 @@
 #define _HILBERT_HPP_
 
 #include "libroad/libroad_common.hpp"
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
 
 struct hilbert
 {
@@ -49,12 +52,207 @@ struct hilbert
 
     static size_t order(const float x, const float y)
     {
-        return order_num(static_cast<size_t>(std::floor(x*((1LL << 24)-1))), static_cast<size_t>(std::floor(y*((1LL << 24)-1))), 24);
+        return encode2(static_cast<size_t>(std::floor(x*((1LL << 24)-1))), static_cast<size_t>(std::floor(y*((1LL << 24)-1))), 24);
     }
 
     static double order_norm(const float x, const float y)
     {
-        return order_num(static_cast<size_t>(std::floor(x*((1LL << 24)-1))), static_cast<size_t>(std::floor(y*((1LL << 24)-1))), 24)/static_cast<double>((1LL << (2*24)) -1);
+        return encode2(static_cast<size_t>(std::floor(x*((1LL << 24)-1))), static_cast<size_t>(std::floor(y*((1LL << 24)-1))), 24)/static_cast<double>((1LL << (2*24)) -1);
+    }
+
+    // Table-driven versions of the above.
+    // The 2d curve is the one order_num() produces: the state is the
+    // transform (bit 0: transpose, bit 1: complement) accumulated so far,
+    // and each table entry consumes 4 levels (a nibble of x and y) at once.
+    // The 3d curve follows Hamilton's formulation ("Compact Hilbert Indices"),
+    // with state (entry, direction) and one level (3 bits) per lookup.
+    struct tables
+    {
+        tables()
+        {
+            static const size_t next[4] = {1, 0, 0, 3};
+
+            for(size_t s = 0; s < 4; ++s)
+                for(size_t xy = 0; xy < 256; ++xy)
+                {
+                    size_t state = s;
+                    size_t key   = 0;
+                    for(int l = 3; l >= 0; --l)
+                    {
+                        size_t ex = ((xy >> (4 + l)) & 1);
+                        size_t ey = ((xy >> l)       & 1);
+                        if(state & 1)
+                            std::swap(ex, ey);
+                        ex ^= (state >> 1);
+                        ey ^= (state >> 1);
+                        const size_t q = (ex << 1) | (ex ^ ey);
+                        key            = (key << 2) | q;
+                        state         ^= next[q];
+                    }
+                    enc2[(s << 8) | xy] = static_cast<unsigned short>(key | (state << 8));
+
+                    state = s;
+                    size_t x = 0;
+                    size_t y = 0;
+                    for(int l = 3; l >= 0; --l)
+                    {
+                        const size_t q  = (xy >> (2*l)) & 3;
+                        size_t       ex = (q >> 1);
+                        size_t       ey = (q >> 1) ^ (q & 1);
+                        ex ^= (state >> 1);
+                        ey ^= (state >> 1);
+                        if(state & 1)
+                            std::swap(ex, ey);
+                        x      = (x << 1) | ex;
+                        y      = (y << 1) | ey;
+                        state ^= next[q];
+                    }
+                    dec2[(s << 8) | xy] = static_cast<unsigned short>((x << 4) | y | (state << 8));
+                }
+
+            for(size_t e = 0; e < 8; ++e)
+                for(size_t d = 0; d < 3; ++d)
+                    for(size_t b = 0; b < 8; ++b)
+                    {
+                        const size_t s = e*3 + d;
+
+                        // b is the cell at this level
+                        const size_t w  = gray_inverse(rotr3(b ^ e, d + 1));
+                        const size_t ew = e ^ rotl3(entry3(w), d + 1);
+                        const size_t dw = (d + direction3(w) + 1) % 3;
+                        enc3[(s << 3) | b] = static_cast<unsigned char>(w | ((ew*3 + dw) << 3));
+
+                        // b is the key digit at this level
+                        const size_t l  = rotl3(b ^ (b >> 1), d + 1) ^ e;
+                        const size_t eb = e ^ rotl3(entry3(b), d + 1);
+                        const size_t db = (d + direction3(b) + 1) % 3;
+                        dec3[(s << 3) | b] = static_cast<unsigned char>(l | ((eb*3 + db) << 3));
+                    }
+        }
+
+        static size_t rotl3(const size_t b, const size_t i)
+        {
+            const size_t r = i % 3;
+            return ((b << r) | (b >> (3 - r))) & 7;
+        }
+
+        static size_t rotr3(const size_t b, const size_t i)
+        {
+            const size_t r = i % 3;
+            return ((b >> r) | (b << (3 - r))) & 7;
+        }
+
+        static size_t gray_inverse(size_t g)
+        {
+            size_t i = g;
+            while(g >>= 1)
+                i ^= g;
+            return i;
+        }
+
+        static size_t trailing_ones(size_t i)
+        {
+            size_t c = 0;
+            while(i & 1)
+            {
+                ++c;
+                i >>= 1;
+            }
+            return c;
+        }
+
+        static size_t entry3(const size_t w)
+        {
+            if(w == 0)
+                return 0;
+            const size_t i = 2*((w - 1)/2);
+            return i ^ (i >> 1);
+        }
+
+        static size_t direction3(const size_t w)
+        {
+            if(w == 0)
+                return 0;
+            if(w & 1)
+                return trailing_ones(w) % 3;
+            return trailing_ones(w - 1) % 3;
+        }
+
+        unsigned short enc2[4*256];
+        unsigned short dec2[4*256];
+        unsigned char  enc3[24*8];
+        unsigned char  dec3[24*8];
+    };
+
+    static const tables &lut()
+    {
+        static const tables t;
+        return t;
+    }
+
+    // Same result as order_num(x, y, n) for n <= 32 and x, y < 2^n
+    static size_t encode2(const size_t x, const size_t y, const size_t n)
+    {
+        const tables  &t      = lut();
+        const size_t   nibs   = (n + 3) >> 2;
+        size_t         state  = ((nibs << 2) - n) & 1;
+        size_t         z      = 0;
+        for(size_t i = nibs; i > 0; --i)
+        {
+            const size_t shift = (i - 1) << 2;
+            const size_t v     = t.enc2[(state << 8) | (((x >> shift) & 0xf) << 4) | ((y >> shift) & 0xf)];
+            z                  = (z << 8) | (v & 0xff);
+            state              = v >> 8;
+        }
+        return z;
+    }
+
+    static void decode2(size_t &x, size_t &y, const size_t z, const size_t n)
+    {
+        const tables  &t      = lut();
+        const size_t   nibs   = (n + 3) >> 2;
+        size_t         state  = ((nibs << 2) - n) & 1;
+        x = 0;
+        y = 0;
+        for(size_t i = nibs; i > 0; --i)
+        {
+            const size_t v = t.dec2[(state << 8) | ((z >> ((i - 1) << 3)) & 0xff)];
+            x              = (x << 4) | ((v >> 4) & 0xf);
+            y              = (y << 4) | (v & 0xf);
+            state          = v >> 8;
+        }
+    }
+
+    // n <= 21 bits per coordinate
+    static size_t encode3(const size_t x, const size_t y, const size_t z, const size_t n)
+    {
+        const tables  &t     = lut();
+        size_t         state = 0;
+        size_t         h     = 0;
+        for(size_t i = n; i > 0; --i)
+        {
+            const size_t b = i - 1;
+            const size_t l = (((x >> b) & 1) << 2) | (((y >> b) & 1) << 1) | ((z >> b) & 1);
+            const size_t v = t.enc3[(state << 3) | l];
+            h              = (h << 3) | (v & 7);
+            state          = v >> 3;
+        }
+        return h;
+    }
+
+    static void decode3(size_t &x, size_t &y, size_t &z, const size_t h, const size_t n)
+    {
+        const tables  &t     = lut();
+        size_t         state = 0;
+        x = y = z = 0;
+        for(size_t i = n; i > 0; --i)
+        {
+            const size_t v = t.dec3[(state << 3) | ((h >> (3*(i - 1))) & 7)];
+            x              = (x << 1) | ((v >> 2) & 1);
+            y              = (y << 1) | ((v >> 1) & 1);
+            z              = (z << 1) | (v & 1);
+            state          = v >> 3;
+        }
     }
 
     static size_t order_num(size_t x, size_t y, const size_t n)
@@ -103,4 +301,95 @@ struct hilbert
     }
 };
 
+struct morton
+{
+    // x in the even bits, y in the odd bits; 32 bits per coordinate
+    static size_t encode2(const size_t x, const size_t y)
+    {
+#ifdef __BMI2__
+        return _pdep_u64(x, 0x5555555555555555ULL) | _pdep_u64(y, 0xAAAAAAAAAAAAAAAAULL);
+#else
+        return spread2(x) | (spread2(y) << 1);
+#endif
+    }
+
+    static void decode2(size_t &x, size_t &y, const size_t m)
+    {
+#ifdef __BMI2__
+        x = _pext_u64(m, 0x5555555555555555ULL);
+        y = _pext_u64(m, 0xAAAAAAAAAAAAAAAAULL);
+#else
+        x = compact2(m);
+        y = compact2(m >> 1);
+#endif
+    }
+
+    // x in bits 0, 3, 6...; 21 bits per coordinate
+    static size_t encode3(const size_t x, const size_t y, const size_t z)
+    {
+#ifdef __BMI2__
+        return _pdep_u64(x, 0x1249249249249249ULL) | _pdep_u64(y, 0x2492492492492492ULL) | _pdep_u64(z, 0x4924924924924924ULL);
+#else
+        return spread3(x) | (spread3(y) << 1) | (spread3(z) << 2);
+#endif
+    }
+
+    static void decode3(size_t &x, size_t &y, size_t &z, const size_t m)
+    {
+#ifdef __BMI2__
+        x = _pext_u64(m, 0x1249249249249249ULL);
+        y = _pext_u64(m, 0x2492492492492492ULL);
+        z = _pext_u64(m, 0x4924924924924924ULL);
+#else
+        x = compact3(m);
+        y = compact3(m >> 1);
+        z = compact3(m >> 2);
+#endif
+    }
+
+    static size_t spread2(size_t v)
+    {
+        v &= 0x00000000FFFFFFFFULL;
+        v  = (v | (v << 16)) & 0x0000FFFF0000FFFFULL;
+        v  = (v | (v <<  8)) & 0x00FF00FF00FF00FFULL;
+        v  = (v | (v <<  4)) & 0x0F0F0F0F0F0F0F0FULL;
+        v  = (v | (v <<  2)) & 0x3333333333333333ULL;
+        v  = (v | (v <<  1)) & 0x5555555555555555ULL;
+        return v;
+    }
+
+    static size_t compact2(size_t v)
+    {
+        v &= 0x5555555555555555ULL;
+        v  = (v | (v >>  1)) & 0x3333333333333333ULL;
+        v  = (v | (v >>  2)) & 0x0F0F0F0F0F0F0F0FULL;
+        v  = (v | (v >>  4)) & 0x00FF00FF00FF00FFULL;
+        v  = (v | (v >>  8)) & 0x0000FFFF0000FFFFULL;
+        v  = (v | (v >> 16)) & 0x00000000FFFFFFFFULL;
+        return v;
+    }
+
+    static size_t spread3(size_t v)
+    {
+        v &= 0x00000000001FFFFFULL;
+        v  = (v | (v << 32)) & 0x001F00000000FFFFULL;
+        v  = (v | (v << 16)) & 0x001F0000FF0000FFULL;
+        v  = (v | (v <<  8)) & 0x100F00F00F00F00FULL;
+        v  = (v | (v <<  4)) & 0x10C30C30C30C30C3ULL;
+        v  = (v | (v <<  2)) & 0x1249249249249249ULL;
+        return v;
+    }
+
+    static size_t compact3(size_t v)
+    {
+        v &= 0x1249249249249249ULL;
+        v  = (v | (v >>  2)) & 0x10C30C30C30C30C3ULL;
+        v  = (v | (v >>  4)) & 0x100F00F00F00F00FULL;
+        v  = (v | (v >>  8)) & 0x001F0000FF0000FFULL;
+        v  = (v | (v >> 16)) & 0x001F00000000FFFFULL;
+        v  = (v | (v >> 32)) & 0x00000000001FFFFFULL;
+        return v;
+    }
+};
+
 #endif
@@ -0,0 +1,587 @@
+#include "hwm_binary.hpp"
+#include <cstring>
+#include <stdexcept>
+#if HAVE_MMAP
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace hwm
+{
+    namespace binary
+    {
+        static const size_t record_size[NSECTIONS] = {sizeof(char),
+                                                      sizeof(float),
+                                                      sizeof(uint32_t),
+                                                      sizeof(road),
+                                                      sizeof(membership),
+                                                      sizeof(adjacency),
+                                                      sizeof(lane),
+                                                      sizeof(intersection),
+                                                      sizeof(state),
+                                                      sizeof(state_pair)};
+
+        static void release(void *map_root, const size_t map_bytes)
+        {
+            if(!map_root)
+                return;
+#if HAVE_MMAP
+            munmap(map_root, map_bytes);
+#else
+            delete[] static_cast<char*>(map_root);
+#endif
+        }
+
+        file::file(const char *filename) : hdr(0), map_root(0), map_bytes(0)
+        {
+#if HAVE_MMAP
+            const int fi = open(filename, O_RDONLY);
+            if(fi < 0)
+                throw std::runtime_error(boost::str(boost::format("Can't open binary network %s") % filename));
+
+            struct stat fs;
+            if(fstat(fi, &fs) == -1)
+            {
+                close(fi);
+                throw std::runtime_error(boost::str(boost::format("Stat of binary network %s failed") % filename));
+            }
+            map_bytes = fs.st_size;
+
+            if(map_bytes >= sizeof(header))
+            {
+                map_root = mmap(0, map_bytes, PROT_READ, MAP_SHARED, fi, 0);
+                if(map_root == MAP_FAILED)
+                    map_root = 0;
+            }
+            close(fi);
+#else
+            std::ifstream in(filename, std::ios::binary);
+            if(!in)
+                throw std::runtime_error(boost::str(boost::format("Can't open binary network %s") % filename));
+
+            in.seekg(0, std::ios::end);
+            map_bytes = in.tellg();
+            in.seekg(0, std::ios::beg);
+            if(map_bytes >= sizeof(header))
+            {
+                map_root = new char[map_bytes];
+                in.read(static_cast<char*>(map_root), map_bytes);
+            }
+#endif
+            if(!map_root)
+                throw std::runtime_error(boost::str(boost::format("Can't map binary network %s") % filename));
+
+            hdr = static_cast<const header*>(map_root);
+
+            const char *err = 0;
+            if(std::memcmp(hdr->magic, magic, sizeof(magic)) != 0)
+                err = "not a binary network";
+            else if(hdr->byte_order != byte_order)
+                err = "written with a different byte order";
+            else if(hdr->version != version)
+                err = "unsupported version";
+            else
+            {
+                for(int s = 0; s < NSECTIONS && !err; ++s)
+                {
+                    const section &sec = hdr->sections[s];
+                    if(sec.offset % 8 || sec.offset > map_bytes || sec.count > (map_bytes - sec.offset)/record_size[s])
+                        err = "section out of bounds";
+                }
+                if(!err && (hdr->sections[STRINGS].count == 0 || records<char>(STRINGS)[hdr->sections[STRINGS].count-1] != 0))
+                    err = "bad string table";
+            }
+
+            if(err)
+            {
+                release(map_root, map_bytes);
+                throw std::runtime_error(boost::str(boost::format("Binary network %s: %s") % filename % err));
+            }
+        }
+
+        file::~file()
+        {
+            release(map_root, map_bytes);
+        }
+
+        size_t file::count(const section_t s) const
+        {
+            return hdr->sections[s].count;
+        }
+
+        const char *file::string(const uint32_t s) const
+        {
+            if(s >= count(STRINGS))
+                throw std::runtime_error("Binary network string out of bounds");
+            return records<char>(STRINGS) + s;
+        }
+
+        uint32_t string_table::add(const str &s)
+        {
+            std::tr1::unordered_map<const str, uint32_t, hash<const str> >::const_iterator f = index.find(s);
+            if(f != index.end())
+                return f->second;
+
+            const uint32_t res = chars.size();
+            chars.insert(chars.end(), s.raw().begin(), s.raw().end());
+            chars.push_back(0);
+            index.insert(std::make_pair(s, res));
+            return res;
+        }
+
+        template <class V>
+        static span add_vectors(std::vector<float> &floats, const std::vector<V> &v, const size_t width)
+        {
+            span res;
+            res.begin = floats.size();
+            res.count = v.size();
+            BOOST_FOREACH(const V &x, v)
+            {
+                for(size_t d = 0; d < width; ++d)
+                    floats.push_back(x[d]);
+            }
+            return res;
+        }
+
+        static span add_frames(std::vector<float> &floats, const std::vector<mat4x4f> &v)
+        {
+            span res;
+            res.begin = floats.size();
+            res.count = v.size();
+            BOOST_FOREACH(const mat4x4f &m, v)
+            {
+                for(int r = 0; r < 4; ++r)
+                    for(int c = 0; c < 4; ++c)
+                        floats.push_back(m(r, c));
+            }
+            return res;
+        }
+
+        static span add_floats(std::vector<float> &floats, const std::vector<float> &v)
+        {
+            span res;
+            res.begin = floats.size();
+            res.count = v.size();
+            floats.insert(floats.end(), v.begin(), v.end());
+            return res;
+        }
+
+        template <class M>
+        static uint32_t lookup(const M &m, const typename M::key_type &k)
+        {
+            const typename M::const_iterator f = m.find(k);
+            if(f == m.end())
+                throw std::runtime_error("Network references an object it doesn't contain");
+            return f->second;
+        }
+
+        static const float *float_span(const float *floats, const size_t nfloats, const span &s, const size_t width)
+        {
+            if(static_cast<uint64_t>(s.begin) + static_cast<uint64_t>(s.count)*width > nfloats)
+                throw std::runtime_error("Binary network float span out of bounds");
+            return floats + s.begin;
+        }
+
+        static void check_span(const file &f, const span &s, const section_t sec)
+        {
+            if(static_cast<uint64_t>(s.begin) + s.count > f.count(sec))
+                throw std::runtime_error("Binary network span out of bounds");
+        }
+
+        static uint32_t check_index(const uint32_t i, const size_t n)
+        {
+            if(i >= n)
+                throw std::runtime_error("Binary network index out of bounds");
+            return i;
+        }
+
+        template <class V>
+        static void read_vectors(std::vector<V> &v, const float *floats, const size_t nfloats, const span &s, const size_t width)
+        {
+            const float *src = float_span(floats, nfloats, s, width);
+            v.resize(s.count);
+            for(size_t i = 0; i < s.count; ++i)
+                for(size_t d = 0; d < width; ++d)
+                    v[i][d] = src[i*width + d];
+        }
+
+        static void read_frames(std::vector<mat4x4f> &v, const float *floats, const size_t nfloats, const span &s)
+        {
+            const float *src = float_span(floats, nfloats, s, 16);
+            v.resize(s.count);
+            for(size_t i = 0; i < s.count; ++i)
+                for(int r = 0; r < 4; ++r)
+                    for(int c = 0; c < 4; ++c)
+                        v[i](r, c) = src[i*16 + r*4 + c];
+        }
+
+        static void read_floats(std::vector<float> &v, const float *floats, const size_t nfloats, const span &s)
+        {
+            const float *src = float_span(floats, nfloats, s, 1);
+            v.assign(src, src + s.count);
+        }
+
+        void write_road(road &br, std::vector<float> &floats, const hwm::road &r)
+        {
+            const arc_road &ar = r.rep;
+            br.points       = add_vectors(floats, ar.points_,       3);
+            br.normals      = add_vectors(floats, ar.normals_,      3);
+            br.radii        = add_floats (floats, ar.radii_);
+            br.arcs         = add_floats (floats, ar.arcs_);
+            br.frames       = add_frames (floats, ar.frames_);
+            br.seg_clengths = add_floats (floats, ar.seg_clengths_);
+            br.arc_clengths = add_vectors(floats, ar.arc_clengths_, 2);
+        }
+
+        void read_road(hwm::road &r, const road &br, const float *floats, const size_t nfloats)
+        {
+            read_vectors(r.rep.points_,       floats, nfloats, br.points,  3);
+            read_vectors(r.rep.normals_,      floats, nfloats, br.normals, 3);
+            read_floats (r.rep.radii_,        floats, nfloats, br.radii);
+            read_floats (r.rep.arcs_,         floats, nfloats, br.arcs);
+            read_frames (r.rep.frames_,       floats, nfloats, br.frames);
+            read_floats (r.rep.seg_clengths_, floats, nfloats, br.seg_clengths);
+            read_vectors(r.rep.arc_clengths_, floats, nfloats, br.arc_clengths, 2);
+        }
+    }
+
+    void write_binary_network(const network &n, const char *filename)
+    {
+        typedef std::tr1::unordered_map<const road*,         uint32_t> road_idx_map;
+        typedef std::tr1::unordered_map<const lane*,         uint32_t> lane_idx_map;
+        typedef std::tr1::unordered_map<const intersection*, uint32_t> intersection_idx_map;
+
+        road_idx_map         road_idx;
+        lane_idx_map         lane_idx;
+        intersection_idx_map intersection_idx;
+        BOOST_FOREACH(const road_pair &rp, n.roads)
+        {
+            road_idx.insert(std::make_pair(&(rp.second), static_cast<uint32_t>(road_idx.size())));
+        }
+        BOOST_FOREACH(const lane_pair &lp, n.lanes)
+        {
+            lane_idx.insert(std::make_pair(&(lp.second), static_cast<uint32_t>(lane_idx.size())));
+        }
+        BOOST_FOREACH(const intersection_pair &ip, n.intersections)
+        {
+            intersection_idx.insert(std::make_pair(&(ip.second), static_cast<uint32_t>(intersection_idx.size())));
+        }
+
+        binary::string_table                 strings;
+        std::vector<float>                   floats;
+        std::vector<uint32_t>                lane_refs;
+        std::vector<binary::road>            roads;
+        std::vector<binary::membership>      memberships;
+        std::vector<binary::adjacency>       adjacencies;
+        std::vector<binary::lane>            lanes;
+        std::vector<binary::intersection>    intersections;
+        std::vector<binary::state>           states;
+        std::vector<binary::state_pair>      state_pairs;
+
+        binary::header hdr;
+        std::memset(&hdr, 0, sizeof(hdr));
+        std::memcpy(hdr.magic, binary::magic, sizeof(binary::magic));
+        hdr.version    = binary::version;
+        hdr.byte_order = binary::byte_order;
+        hdr.name       = strings.add(n.name);
+        hdr.gamma      = n.gamma;
+        hdr.lane_width = n.lane_width;
+
+        roads.reserve(n.roads.size());
+        BOOST_FOREACH(const road_pair &rp, n.roads)
+        {
+            binary::road br;
+            br.id   = strings.add(rp.second.id);
+            br.name = strings.add(rp.second.name);
+            binary::write_road(br, floats, rp.second);
+            roads.push_back(br);
+        }
+
+        lanes.reserve(n.lanes.size());
+        BOOST_FOREACH(const lane_pair &lp, n.lanes)
+        {
+            const lane   &l = lp.second;
+            binary::lane  bl;
+            bl.id         = strings.add(l.id);
+            bl.speedlimit = l.speedlimit;
+
+            const lane::terminus *terms[2]  = {l.start, l.end};
+            binary::terminus     *bterms[2] = {&(bl.start), &(bl.end)};
+            for(int t = 0; t < 2; ++t)
+            {
+                const lane::intersection_terminus *it = dynamic_cast<const lane::intersection_terminus*>(terms[t]);
+                const lane::lane_terminus         *lt = dynamic_cast<const lane::lane_terminus*>(terms[t]);
+                bterms[t]->intersect_in_ref = -1;
+                if(it)
+                {
+                    bterms[t]->type             = binary::INTERSECTION;
+                    bterms[t]->ref              = binary::lookup(intersection_idx, it->adjacent_intersection);
+                    bterms[t]->intersect_in_ref = it->intersect_in_ref;
+                }
+                else if(lt)
+                {
+                    bterms[t]->type = binary::LANE;
+                    bterms[t]->ref  = binary::lookup(lane_idx, lt->adjacent_lane);
+                }
+                else
+                {
+                    bterms[t]->type = binary::DEAD_END;
+                    bterms[t]->ref  = binary::npos;
+                }
+            }
+
+            bl.memberships.begin = memberships.size();
+            bl.memberships.count = l.road_memberships.size();
+            typedef lane::road_membership::intervals::entry rme;
+            BOOST_FOREACH(const rme &rm, l.road_memberships)
+            {
+                binary::membership bm;
+                bm.divider       = rm.first;
+                bm.road          = rm.second.empty() ? binary::npos : binary::lookup(road_idx, rm.second.parent_road);
+                bm.interval[0]   = rm.second.interval[0];
+                bm.interval[1]   = rm.second.interval[1];
+                bm.lane_position = rm.second.lane_position;
+                memberships.push_back(bm);
+            }
+
+            const lane::adjacency::intervals *adjs[2]  = {&(l.left), &(l.right)};
+            binary::span                     *badjs[2] = {&(bl.left), &(bl.right)};
+            for(int a = 0; a < 2; ++a)
+            {
+                badjs[a]->begin = adjacencies.size();
+                badjs[a]->count = adjs[a]->size();
+                typedef lane::adjacency::intervals::entry ae;
+                BOOST_FOREACH(const ae &adj, *adjs[a])
+                {
+                    binary::adjacency ba;
+                    ba.divider              = adj.first;
+                    ba.neighbor             = adj.second.empty() ? binary::npos : binary::lookup(lane_idx, adj.second.neighbor);
+                    ba.neighbor_interval[0] = adj.second.neighbor_interval[0];
+                    ba.neighbor_interval[1] = adj.second.neighbor_interval[1];
+                    adjacencies.push_back(ba);
+                }
+            }
+
+            lanes.push_back(bl);
+        }
+
+        intersections.reserve(n.intersections.size());
+        BOOST_FOREACH(const intersection_pair &ip, n.intersections)
+        {
+            const intersection   &is = ip.second;
+            binary::intersection  bi;
+            bi.id = strings.add(is.id);
+
+            bi.incoming.begin = lane_refs.size();
+            bi.incoming.count = is.incoming.size();
+            BOOST_FOREACH(const lane *l, is.incoming)
+            {
+                lane_refs.push_back(binary::lookup(lane_idx, l));
+            }
+
+            bi.outgoing.begin = lane_refs.size();
+            bi.outgoing.count = is.outgoing.size();
+            BOOST_FOREACH(const lane *l, is.outgoing)
+            {
+                lane_refs.push_back(binary::lookup(lane_idx, l));
+            }
+
+            bi.states.begin = states.size();
+            bi.states.count = is.states.size();
+            BOOST_FOREACH(const intersection::state &s, is.states)
+            {
+                binary::state bs;
+                bs.duration    = s.duration;
+                bs.pairs.begin = state_pairs.size();
+                bs.pairs.count = s.state_pairs.size();
+                BOOST_FOREACH(const intersection::state::state_pair &sp, s.in_pair())
+                {
+                    binary::state_pair bsp;
+                    bsp.in_idx  = sp.in_idx;
+                    bsp.out_idx = sp.out_idx;
+                    state_pairs.push_back(bsp);
+                }
+                states.push_back(bs);
+            }
+
+            intersections.push_back(bi);
+        }
+
+        const size_t counts[binary::NSECTIONS] = {strings.chars.size(),
+                                                  floats.size(),
+                                                  lane_refs.size(),
+                                                  roads.size(),
+                                                  memberships.size(),
+                                                  adjacencies.size(),
+                                                  lanes.size(),
+                                                  intersections.size(),
+                                                  states.size(),
+                                                  state_pairs.size()};
+        uint64_t pos = binary::align8(sizeof(hdr));
+        for(int s = 0; s < binary::NSECTIONS; ++s)
+        {
+            hdr.sections[s].offset = pos;
+            hdr.sections[s].count  = counts[s];
+            pos = binary::align8(pos + counts[s]*binary::record_size[s]);
+        }
+
+        std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+        if(!out)
+            throw std::runtime_error(boost::str(boost::format("Can't open %s for writing") % filename));
+
+        out.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+        pos = sizeof(hdr);
+        binary::write_section(out, pos, hdr.sections[binary::STRINGS],       strings.chars);
+        binary::write_section(out, pos, hdr.sections[binary::FLOATS],        floats);
+        binary::write_section(out, pos, hdr.sections[binary::LANE_REFS],     lane_refs);
+        binary::write_section(out, pos, hdr.sections[binary::ROADS],         roads);
+        binary::write_section(out, pos, hdr.sections[binary::MEMBERSHIPS],   memberships);
+        binary::write_section(out, pos, hdr.sections[binary::ADJACENCIES],   adjacencies);
+        binary::write_section(out, pos, hdr.sections[binary::LANES],         lanes);
+        binary::write_section(out, pos, hdr.sections[binary::INTERSECTIONS], intersections);
+        binary::write_section(out, pos, hdr.sections[binary::STATES],        states);
+        binary::write_section(out, pos, hdr.sections[binary::STATE_PAIRS],   state_pairs);
+
+        if(!out)
+            throw std::runtime_error(boost::str(boost::format("Error writing binary network %s") % filename));
+    }
+
+    network load_binary_network(const char *filename)
+    {
+        const binary::file f(filename);
+
+        network n;
+        n.name       = f.string(f.hdr->name);
+        n.gamma      = f.hdr->gamma;
+        n.lane_width = f.hdr->lane_width;
+
+        const binary::road         *broads         = f.records<binary::road>(binary::ROADS);
+        const binary::lane         *blanes         = f.records<binary::lane>(binary::LANES);
+        const binary::intersection *bintersections = f.records<binary::intersection>(binary::INTERSECTIONS);
+        const binary::membership   *bmemberships   = f.records<binary::membership>(binary::MEMBERSHIPS);
+        const binary::adjacency    *badjacencies   = f.records<binary::adjacency>(binary::ADJACENCIES);
+        const binary::state        *bstates        = f.records<binary::state>(binary::STATES);
+        const binary::state_pair   *bstate_pairs   = f.records<binary::state_pair>(binary::STATE_PAIRS);
+        const uint32_t             *blane_refs     = f.records<uint32_t>(binary::LANE_REFS);
+
+        // Sections are written in map order, so inserting at the end is constant time
+        std::vector<road*> roads(f.count(binary::ROADS));
+        for(size_t i = 0; i < roads.size(); ++i)
+        {
+            const binary::road &br = broads[i];
+            road               &r  = n.roads.insert(n.roads.end(), std::make_pair(str(f.string(br.id)), road()))->second;
+            r.id                   = f.string(br.id);
+            r.name                 = f.string(br.name);
+            binary::read_road(r, br, f.records<float>(binary::FLOATS), f.count(binary::FLOATS));
+            roads[i] = &r;
+        }
+
+        std::vector<lane*> lanes(f.count(binary::LANES));
+        for(size_t i = 0; i < lanes.size(); ++i)
+        {
+            lane &l = n.lanes.insert(n.lanes.end(), std::make_pair(str(f.string(blanes[i].id)), lane()))->second;
+            lanes[i] = &l;
+        }
+
+        std::vector<intersection*> intersections(f.count(binary::INTERSECTIONS));
+        for(size_t i = 0; i < intersections.size(); ++i)
+        {
+            intersection &is = n.intersections.insert(n.intersections.end(), std::make_pair(str(f.string(bintersections[i].id)), intersection()))->second;
+            intersections[i] = &is;
+        }
+
+        for(size_t i = 0; i < lanes.size(); ++i)
+        {
+            const binary::lane &bl = blanes[i];
+            lane               &l  = *lanes[i];
+            l.id         = f.string(bl.id);
+            l.speedlimit = bl.speedlimit;
+            l.active     = true;
+            l.user_datum = 0;
+
+            const binary::terminus *bterms[2] = {&(bl.start), &(bl.end)};
+            lane::terminus        **terms[2]  = {&(l.start), &(l.end)};
+            for(int t = 0; t < 2; ++t)
+            {
+                switch(bterms[t]->type)
+                {
+                case binary::INTERSECTION:
+                    *terms[t] = new lane::intersection_terminus(intersections[binary::check_index(bterms[t]->ref, intersections.size())], bterms[t]->intersect_in_ref);
+                    break;
+                case binary::LANE:
+                    *terms[t] = new lane::lane_terminus(lanes[binary::check_index(bterms[t]->ref, lanes.size())]);
+                    break;
+                case binary::DEAD_END:
+                    *terms[t] = new lane::terminus();
+                    break;
+                default:
+                    throw std::runtime_error(boost::str(boost::format("Bad terminus type in lane %s") % l.id));
+                }
+            }
+
+            binary::check_span(f, bl.memberships, binary::MEMBERSHIPS);
+            for(size_t m = 0; m < bl.memberships.count; ++m)
+            {
+                const binary::membership    &bm = bmemberships[bl.memberships.begin + m];
+                lane::road_membership        rm;
+                rm.parent_road   = bm.road == binary::npos ? 0 : roads[binary::check_index(bm.road, roads.size())];
+                rm.interval[0]   = bm.interval[0];
+                rm.interval[1]   = bm.interval[1];
+                rm.lane_position = bm.lane_position;
+                l.road_memberships.insert(bm.divider, rm);
+            }
+
+            const binary::span          *badjs[2] = {&(bl.left), &(bl.right)};
+            lane::adjacency::intervals  *adjs[2]  = {&(l.left), &(l.right)};
+            for(int a = 0; a < 2; ++a)
+            {
+                binary::check_span(f, *badjs[a], binary::ADJACENCIES);
+                for(size_t j = 0; j < badjs[a]->count; ++j)
+                {
+                    const binary::adjacency &ba = badjacencies[badjs[a]->begin + j];
+                    lane::adjacency          adj;
+                    adj.neighbor             = ba.neighbor == binary::npos ? 0 : lanes[binary::check_index(ba.neighbor, lanes.size())];
+                    adj.neighbor_interval[0] = ba.neighbor_interval[0];
+                    adj.neighbor_interval[1] = ba.neighbor_interval[1];
+                    adjs[a]->insert(ba.divider, adj);
+                }
+            }
+        }
+
+        for(size_t i = 0; i < intersections.size(); ++i)
+        {
+            const binary::intersection &bi = bintersections[i];
+            intersection               &is = *intersections[i];
+            is.id = f.string(bi.id);
+
+            binary::check_span(f, bi.incoming, binary::LANE_REFS);
+            binary::check_span(f, bi.outgoing, binary::LANE_REFS);
+            is.incoming.resize(bi.incoming.count);
+            for(size_t j = 0; j < bi.incoming.count; ++j)
+                is.incoming[j] = lanes[binary::check_index(blane_refs[bi.incoming.begin + j], lanes.size())];
+            is.outgoing.resize(bi.outgoing.count);
+            for(size_t j = 0; j < bi.outgoing.count; ++j)
+                is.outgoing[j] = lanes[binary::check_index(blane_refs[bi.outgoing.begin + j], lanes.size())];
+
+            binary::check_span(f, bi.states, binary::STATES);
+            is.states.resize(bi.states.count);
+            for(size_t s = 0; s < bi.states.count; ++s)
+            {
+                const binary::state &bs = bstates[bi.states.begin + s];
+                is.states[s].duration = bs.duration;
+
+                binary::check_span(f, bs.pairs, binary::STATE_PAIRS);
+                for(size_t p = 0; p < bs.pairs.count; ++p)
+                {
+                    const binary::state_pair &bsp = bstate_pairs[bs.pairs.begin + p];
+                    is.states[s].state_pairs.insert(intersection::state::state_pair(binary::check_index(bsp.in_idx,  is.incoming.size()),
+                                                                                   binary::check_index(bsp.out_idx, is.outgoing.size())));
+                }
+            }
+        }
+
+        return n;
+    }
+}
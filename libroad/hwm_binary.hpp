@@ -0,0 +1,169 @@
+#ifndef _HWM_BINARY_HPP_
+#define _HWM_BINARY_HPP_
+
+#include "hwm_network.hpp"
+#include <stdint.h>
+
+namespace hwm
+{
+    // Flat on-disk layout of a network, written by write_binary_network.
+    // Every record is plain data and every link is an index into another section,
+    // so a mapped file can be read in place; load_binary_network just copies out of it.
+    // Strings are offsets of NUL-terminated strings in STRINGS.
+    namespace binary
+    {
+        static const char     magic[8]   = {'H', 'W', 'M', 'B', 'I', 'N', 0, 0};
+        static const uint32_t version    = 1;
+        static const uint32_t byte_order = 0x01020304;
+        static const uint32_t npos       = 0xffffffff;
+
+        enum section_t {STRINGS, FLOATS, LANE_REFS, ROADS, MEMBERSHIPS, ADJACENCIES, LANES, INTERSECTIONS, STATES, STATE_PAIRS, NSECTIONS};
+
+        struct section
+        {
+            uint64_t offset;
+            uint64_t count;
+        };
+
+        struct span
+        {
+            uint32_t begin;
+            uint32_t count;
+        };
+
+        struct header
+        {
+            char     magic[8];
+            uint32_t version;
+            uint32_t byte_order;
+            uint32_t name;
+            float    gamma;
+            float    lane_width;
+            uint32_t pad;
+            section  sections[NSECTIONS];
+        };
+
+        // The arc_road arrays, as they are after initialization.
+        // Spans begin at a float index in FLOATS and count elements (vec3f, vec2f, mat4x4f in row-major order, ...)
+        struct road
+        {
+            uint32_t id;
+            uint32_t name;
+            span     points;
+            span     normals;
+            span     radii;
+            span     arcs;
+            span     frames;
+            span     seg_clengths;
+            span     arc_clengths;
+        };
+
+        // Entries of a partition01; divider is the entry's key
+        struct membership
+        {
+            float    divider;
+            uint32_t road;
+            float    interval[2];
+            float    lane_position;
+        };
+
+        struct adjacency
+        {
+            float    divider;
+            uint32_t neighbor;
+            float    neighbor_interval[2];
+        };
+
+        enum terminus_t {DEAD_END, INTERSECTION, LANE};
+
+        struct terminus
+        {
+            uint32_t type;
+            uint32_t ref;
+            int32_t  intersect_in_ref;
+        };
+
+        struct lane
+        {
+            uint32_t id;
+            float    speedlimit;
+            terminus start;
+            terminus end;
+            span     memberships;
+            span     left;
+            span     right;
+        };
+
+        // incoming and outgoing are spans of LANE_REFS
+        struct intersection
+        {
+            uint32_t id;
+            span     incoming;
+            span     outgoing;
+            span     states;
+        };
+
+        struct state
+        {
+            float duration;
+            span  pairs;
+        };
+
+        struct state_pair
+        {
+            int32_t in_idx;
+            int32_t out_idx;
+        };
+
+        // Strings written once each; add returns the offset of s in chars
+        struct string_table
+        {
+            uint32_t add(const str &s);
+
+            std::vector<char>                                               chars;
+            std::tr1::unordered_map<const str, uint32_t, hash<const str> > index;
+        };
+
+        // A road's arc_road arrays to and from FLOATS; id and name are left to the caller.
+        // read_road checks its spans against the nfloats floats given.
+        void write_road(road &br, std::vector<float> &floats, const hwm::road &r);
+        void read_road(hwm::road &r, const road &br, const float *floats, size_t nfloats);
+
+        inline uint64_t align8(const uint64_t x)
+        {
+            return (x + 7) & ~static_cast<uint64_t>(7);
+        }
+
+        // Pads out to s.offset from pos, then writes v there
+        template <class T>
+        void write_section(std::ostream &out, uint64_t &pos, const section &s, const std::vector<T> &v)
+        {
+            static const char zeros[8] = {0};
+            out.write(zeros, s.offset - pos);
+            if(!v.empty())
+                out.write(reinterpret_cast<const char*>(&(v[0])), v.size()*sizeof(T));
+            pos = s.offset + v.size()*sizeof(T);
+        }
+
+        // Read-only view of a binary network file; the header and section bounds are checked on open
+        struct file
+        {
+            file(const char *filename);
+            ~file();
+
+            template <typename T>
+            const T *records(const section_t s) const
+            {
+                return reinterpret_cast<const T*>(static_cast<const char*>(map_root) + hdr->sections[s].offset);
+            }
+
+            size_t      count (section_t s) const;
+            const char *string(uint32_t s)  const;
+
+            const header *hdr;
+            void         *map_root;
+            size_t        map_bytes;
+        };
+    }
+}
+#endif
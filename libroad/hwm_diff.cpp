@@ -0,0 +1,767 @@
+#include "hwm_diff.hpp"
+#include "profile.hpp"
+#include <cstring>
+#include <stdexcept>
+
+namespace hwm
+{
+    network_diff::terminus_record::terminus_record() : type(binary::DEAD_END), intersect_in_ref(-1)
+    {
+    }
+
+    network_diff::terminus_record::terminus_record(const lane::terminus *t) : type(binary::DEAD_END), intersect_in_ref(-1)
+    {
+        const lane::intersection_terminus *it = dynamic_cast<const lane::intersection_terminus*>(t);
+        const lane::lane_terminus         *lt = dynamic_cast<const lane::lane_terminus*>(t);
+        if(it)
+        {
+            type             = binary::INTERSECTION;
+            ref              = it->adjacent_intersection->id;
+            intersect_in_ref = it->intersect_in_ref;
+        }
+        else if(lt)
+        {
+            type = binary::LANE;
+            ref  = lt->adjacent_lane->id;
+        }
+    }
+
+    bool network_diff::terminus_record::operator==(const terminus_record &o) const
+    {
+        return type == o.type && ref == o.ref && intersect_in_ref == o.intersect_in_ref;
+    }
+
+    bool network_diff::membership_record::operator==(const membership_record &o) const
+    {
+        return divider == o.divider && road == o.road && interval[0] == o.interval[0] && interval[1] == o.interval[1] && lane_position == o.lane_position;
+    }
+
+    bool network_diff::adjacency_record::operator==(const adjacency_record &o) const
+    {
+        return divider == o.divider && neighbor == o.neighbor && neighbor_interval[0] == o.neighbor_interval[0] && neighbor_interval[1] == o.neighbor_interval[1];
+    }
+
+    network_diff::lane_record::lane_record() : speedlimit(0.0f)
+    {
+    }
+
+    static void adjacency_records(std::vector<network_diff::adjacency_record> &res, const lane::adjacency::intervals &adjs)
+    {
+        res.reserve(adjs.size());
+        typedef lane::adjacency::intervals::entry ae;
+        BOOST_FOREACH(const ae &adj, adjs)
+        {
+            network_diff::adjacency_record ar;
+            ar.divider              = adj.first;
+            ar.neighbor             = adj.second.empty() ? str() : adj.second.neighbor->id;
+            ar.neighbor_interval[0] = adj.second.neighbor_interval[0];
+            ar.neighbor_interval[1] = adj.second.neighbor_interval[1];
+            res.push_back(ar);
+        }
+    }
+
+    network_diff::lane_record::lane_record(const lane &l) : id(l.id), speedlimit(l.speedlimit), start(l.start), end(l.end)
+    {
+        memberships.reserve(l.road_memberships.size());
+        typedef lane::road_membership::intervals::entry rme;
+        BOOST_FOREACH(const rme &rm, l.road_memberships)
+        {
+            membership_record mr;
+            mr.divider       = rm.first;
+            mr.road          = rm.second.empty() ? str() : rm.second.parent_road->id;
+            mr.interval[0]   = rm.second.interval[0];
+            mr.interval[1]   = rm.second.interval[1];
+            mr.lane_position = rm.second.lane_position;
+            memberships.push_back(mr);
+        }
+
+        adjacency_records(left,  l.left);
+        adjacency_records(right, l.right);
+    }
+
+    bool network_diff::lane_record::operator==(const lane_record &o) const
+    {
+        return id == o.id && speedlimit == o.speedlimit && start == o.start && end == o.end &&
+            memberships == o.memberships && left == o.left && right == o.right;
+    }
+
+    bool network_diff::state_record::operator==(const state_record &o) const
+    {
+        return duration == o.duration && pairs == o.pairs;
+    }
+
+    network_diff::intersection_record::intersection_record()
+    {
+    }
+
+    network_diff::intersection_record::intersection_record(const intersection &is) : id(is.id)
+    {
+        incoming.reserve(is.incoming.size());
+        BOOST_FOREACH(const lane *l, is.incoming)
+        {
+            incoming.push_back(l->id);
+        }
+        outgoing.reserve(is.outgoing.size());
+        BOOST_FOREACH(const lane *l, is.outgoing)
+        {
+            outgoing.push_back(l->id);
+        }
+
+        states.resize(is.states.size());
+        for(size_t s = 0; s < is.states.size(); ++s)
+        {
+            states[s].duration = is.states[s].duration;
+            BOOST_FOREACH(const intersection::state::state_pair &sp, is.states[s].in_pair())
+            {
+                states[s].pairs.push_back(std::make_pair(sp.in_idx, sp.out_idx));
+            }
+            std::sort(states[s].pairs.begin(), states[s].pairs.end());
+        }
+    }
+
+    bool network_diff::intersection_record::operator==(const intersection_record &o) const
+    {
+        return id == o.id && incoming == o.incoming && outgoing == o.outgoing && states == o.states;
+    }
+
+    // Bitwise, through the binary layout of the arrays
+    static bool same_road(const road &a, const road &b)
+    {
+        if(a.name != b.name)
+            return false;
+
+        std::vector<float> fa, fb;
+        binary::road       ra, rb;
+        binary::write_road(ra, fa, a);
+        binary::write_road(rb, fb, b);
+        return fa == fb &&
+            ra.points.count       == rb.points.count &&
+            ra.normals.count      == rb.normals.count &&
+            ra.radii.count        == rb.radii.count &&
+            ra.arcs.count         == rb.arcs.count &&
+            ra.frames.count       == rb.frames.count &&
+            ra.seg_clengths.count == rb.seg_clengths.count &&
+            ra.arc_clengths.count == rb.arc_clengths.count;
+    }
+
+    template <class M>
+    static void removed_ids(std::vector<str> &res, const M &base, const M &variant)
+    {
+        typedef typename M::value_type value_type;
+        BOOST_FOREACH(const value_type &v, base)
+        {
+            if(variant.find(v.first) == variant.end())
+                res.push_back(v.first);
+        }
+    }
+
+    network_diff::network_diff()
+    {
+    }
+
+    network_diff::network_diff(const network &base, const network &variant)
+    {
+        PROFILE_SCOPE("hwm::network_diff");
+        removed_ids(removed_roads,         base.roads,         variant.roads);
+        removed_ids(removed_lanes,         base.lanes,         variant.lanes);
+        removed_ids(removed_intersections, base.intersections, variant.intersections);
+
+        // Compare on all threads, then gather what changed in map order
+        std::vector<const road*> vroads;
+        vroads.reserve(variant.roads.size());
+        BOOST_FOREACH(const road_pair &rp, variant.roads)
+        {
+            vroads.push_back(&(rp.second));
+        }
+        std::vector<char> road_changed(vroads.size(), 0);
+        const long        nroads = static_cast<long>(vroads.size());
+        #pragma omp parallel for schedule(dynamic, 64)
+        for(long i = 0; i < nroads; ++i)
+        {
+            const road_map::const_iterator b = base.roads.find(vroads[i]->id);
+            road_changed[i] = b == base.roads.end() || !same_road(b->second, *vroads[i]);
+        }
+        for(size_t i = 0; i < vroads.size(); ++i)
+            if(road_changed[i])
+                roads.push_back(*vroads[i]);
+
+        std::vector<const lane*> vlanes;
+        vlanes.reserve(variant.lanes.size());
+        BOOST_FOREACH(const lane_pair &lp, variant.lanes)
+        {
+            vlanes.push_back(&(lp.second));
+        }
+        std::vector<lane_record> lane_recs(vlanes.size());
+        std::vector<char>        lane_changed(vlanes.size(), 0);
+        const long               nlanes = static_cast<long>(vlanes.size());
+        #pragma omp parallel for schedule(dynamic, 64)
+        for(long i = 0; i < nlanes; ++i)
+        {
+            lane_recs[i] = lane_record(*vlanes[i]);
+            const lane_map::const_iterator b = base.lanes.find(vlanes[i]->id);
+            lane_changed[i] = b == base.lanes.end() || !(lane_record(b->second) == lane_recs[i]);
+        }
+        for(size_t i = 0; i < vlanes.size(); ++i)
+            if(lane_changed[i])
+                lanes.push_back(lane_recs[i]);
+
+        std::vector<const intersection*> vintersections;
+        vintersections.reserve(variant.intersections.size());
+        BOOST_FOREACH(const intersection_pair &ip, variant.intersections)
+        {
+            vintersections.push_back(&(ip.second));
+        }
+        std::vector<intersection_record> intersection_recs(vintersections.size());
+        std::vector<char>                intersection_changed(vintersections.size(), 0);
+        const long                       nintersections = static_cast<long>(vintersections.size());
+        #pragma omp parallel for schedule(dynamic, 64)
+        for(long i = 0; i < nintersections; ++i)
+        {
+            intersection_recs[i] = intersection_record(*vintersections[i]);
+            const intersection_map::const_iterator b = base.intersections.find(vintersections[i]->id);
+            intersection_changed[i] = b == base.intersections.end() || !(intersection_record(b->second) == intersection_recs[i]);
+        }
+        for(size_t i = 0; i < vintersections.size(); ++i)
+            if(intersection_changed[i])
+                intersections.push_back(intersection_recs[i]);
+
+        PROFILE_COUNT("removed", removed_roads.size() + removed_lanes.size() + removed_intersections.size());
+        PROFILE_COUNT("changed", roads.size() + lanes.size() + intersections.size());
+    }
+
+    bool network_diff::empty() const
+    {
+        return removed_roads.empty() && removed_lanes.empty() && removed_intersections.empty() &&
+            roads.empty() && lanes.empty() && intersections.empty();
+    }
+
+    template <class M>
+    static typename M::mapped_type &patch_find(M &m, const str &id, const char *what)
+    {
+        const typename M::iterator f = m.find(id);
+        if(f == m.end())
+            throw std::runtime_error(boost::str(boost::format("Patch refers to %s %s, which isn't in the network") % what % id));
+        return f->second;
+    }
+
+    static lane::terminus *make_terminus(network &n, const network_diff::terminus_record &tr)
+    {
+        switch(tr.type)
+        {
+        case binary::INTERSECTION:
+            return new lane::intersection_terminus(&(patch_find(n.intersections, tr.ref, "intersection")), tr.intersect_in_ref);
+        case binary::LANE:
+            return new lane::lane_terminus(&(patch_find(n.lanes, tr.ref, "lane")));
+        default:
+            return new lane::terminus();
+        }
+    }
+
+    static void apply_adjacencies(network &n, lane::adjacency::intervals &adjs, const std::vector<network_diff::adjacency_record> &ars)
+    {
+        adjs.clear();
+        BOOST_FOREACH(const network_diff::adjacency_record &ar, ars)
+        {
+            lane::adjacency adj;
+            adj.neighbor             = ar.neighbor.empty() ? 0 : &(patch_find(n.lanes, ar.neighbor, "lane"));
+            adj.neighbor_interval[0] = ar.neighbor_interval[0];
+            adj.neighbor_interval[1] = ar.neighbor_interval[1];
+            adjs.insert(ar.divider, adj);
+        }
+    }
+
+    template <class M>
+    static void remove_ids(M &m, std::set<str> &edited, const std::vector<str> &ids, const char *what)
+    {
+        BOOST_FOREACH(const str &id, ids)
+        {
+            if(!m.erase(id))
+                throw std::runtime_error(boost::str(boost::format("Patch removes %s %s, which isn't in the network") % what % id));
+            edited.erase(id);
+        }
+    }
+
+    void network_diff::apply(network &n) const
+    {
+        PROFILE_SCOPE("hwm::network_diff::apply");
+
+        // Everything a record can refer to exists before any is filled in
+        BOOST_FOREACH(const road &r, roads)
+        {
+            const road_map::iterator f = n.roads.find(r.id);
+            if(f == n.roads.end())
+                n.roads.insert(std::make_pair(r.id, r));
+            else
+                f->second = r;
+            n.touch_road(r.id);
+        }
+
+        BOOST_FOREACH(const lane_record &lr, lanes)
+        {
+            const lane_map::iterator f = n.lanes.find(lr.id);
+            if(f == n.lanes.end())
+            {
+                lane &l = n.lanes.insert(std::make_pair(lr.id, lane())).first->second;
+                l.id         = lr.id;
+                l.active     = true;
+                l.user_datum = 0;
+            }
+            n.touch_lane(lr.id);
+        }
+
+        BOOST_FOREACH(const intersection_record &ir, intersections)
+        {
+            if(n.intersections.find(ir.id) == n.intersections.end())
+                n.intersections.insert(std::make_pair(ir.id, intersection())).first->second.id = ir.id;
+            n.touch_intersection(ir.id);
+        }
+
+        BOOST_FOREACH(const lane_record &lr, lanes)
+        {
+            lane &l = n.lanes.find(lr.id)->second;
+            l.speedlimit = lr.speedlimit;
+
+            delete l.start;
+            l.start = 0;
+            delete l.end;
+            l.end   = 0;
+            l.start = make_terminus(n, lr.start);
+            l.end   = make_terminus(n, lr.end);
+
+            l.road_memberships.clear();
+            BOOST_FOREACH(const membership_record &mr, lr.memberships)
+            {
+                lane::road_membership rm;
+                rm.parent_road   = mr.road.empty() ? 0 : &(patch_find(n.roads, mr.road, "road"));
+                rm.interval[0]   = mr.interval[0];
+                rm.interval[1]   = mr.interval[1];
+                rm.lane_position = mr.lane_position;
+                l.road_memberships.insert(mr.divider, rm);
+            }
+
+            apply_adjacencies(n, l.left,  lr.left);
+            apply_adjacencies(n, l.right, lr.right);
+        }
+
+        BOOST_FOREACH(const intersection_record &ir, intersections)
+        {
+            intersection &is = n.intersections.find(ir.id)->second;
+
+            is.incoming.clear();
+            BOOST_FOREACH(const str &id, ir.incoming)
+            {
+                is.incoming.push_back(&(patch_find(n.lanes, id, "lane")));
+            }
+            is.outgoing.clear();
+            BOOST_FOREACH(const str &id, ir.outgoing)
+            {
+                is.outgoing.push_back(&(patch_find(n.lanes, id, "lane")));
+            }
+
+            is.states.clear();
+            is.fict_roads.clear();
+            is.fict_lanes.clear();
+            is.states.resize(ir.states.size());
+            for(size_t s = 0; s < ir.states.size(); ++s)
+            {
+                is.states[s].duration = ir.states[s].duration;
+                typedef std::pair<int, int> int_pair;
+                BOOST_FOREACH(const int_pair &p, ir.states[s].pairs)
+                {
+                    is.states[s].state_pairs.insert(intersection::state::state_pair(p.first, p.second));
+                }
+            }
+            if(is.current_state >= is.states.size())
+            {
+                is.current_state = 0;
+                is.state_time    = 0;
+            }
+        }
+
+        remove_ids(n.intersections, n.edits.intersections, removed_intersections, "intersection");
+        remove_ids(n.lanes,         n.edits.lanes,         removed_lanes,         "lane");
+        remove_ids(n.roads,         n.edits.roads,         removed_roads,         "road");
+
+        PROFILE_COUNT("removed", removed_roads.size() + removed_lanes.size() + removed_intersections.size());
+        PROFILE_COUNT("changed", roads.size() + lanes.size() + intersections.size());
+    }
+
+    static const size_t patch_record_size[patch::NSECTIONS] = {sizeof(char),
+                                                               sizeof(float),
+                                                               sizeof(uint32_t),
+                                                               sizeof(binary::road),
+                                                               sizeof(binary::membership),
+                                                               sizeof(binary::adjacency),
+                                                               sizeof(binary::lane),
+                                                               sizeof(binary::intersection),
+                                                               sizeof(binary::state),
+                                                               sizeof(binary::state_pair)};
+
+    static uint32_t patch_ref(binary::string_table &strings, const str &id)
+    {
+        return id.empty() ? binary::npos : strings.add(id);
+    }
+
+    static binary::terminus patch_terminus(binary::string_table &strings, const network_diff::terminus_record &tr)
+    {
+        binary::terminus bt;
+        bt.type             = tr.type;
+        bt.ref              = patch_ref(strings, tr.ref);
+        bt.intersect_in_ref = tr.intersect_in_ref;
+        return bt;
+    }
+
+    static binary::span patch_adjacencies(binary::string_table &strings, std::vector<binary::adjacency> &adjacencies, const std::vector<network_diff::adjacency_record> &ars)
+    {
+        binary::span res;
+        res.begin = adjacencies.size();
+        res.count = ars.size();
+        BOOST_FOREACH(const network_diff::adjacency_record &ar, ars)
+        {
+            binary::adjacency ba;
+            ba.divider              = ar.divider;
+            ba.neighbor             = patch_ref(strings, ar.neighbor);
+            ba.neighbor_interval[0] = ar.neighbor_interval[0];
+            ba.neighbor_interval[1] = ar.neighbor_interval[1];
+            adjacencies.push_back(ba);
+        }
+        return res;
+    }
+
+    static binary::span patch_ids(binary::string_table &strings, std::vector<uint32_t> &ids, const std::vector<str> &v)
+    {
+        binary::span res;
+        res.begin = ids.size();
+        res.count = v.size();
+        BOOST_FOREACH(const str &id, v)
+        {
+            ids.push_back(strings.add(id));
+        }
+        return res;
+    }
+
+    void network_diff::write(const char *filename) const
+    {
+        PROFILE_SCOPE("hwm::network_diff::write");
+        binary::string_table               strings;
+        std::vector<float>                 floats;
+        std::vector<uint32_t>              ids;
+        std::vector<binary::road>          broads;
+        std::vector<binary::membership>    memberships;
+        std::vector<binary::adjacency>     adjacencies;
+        std::vector<binary::lane>          blanes;
+        std::vector<binary::intersection>  bintersections;
+        std::vector<binary::state>         states;
+        std::vector<binary::state_pair>    state_pairs;
+
+        patch::header hdr;
+        std::memset(&hdr, 0, sizeof(hdr));
+        std::memcpy(hdr.magic, patch::magic, sizeof(patch::magic));
+        hdr.version    = patch::version;
+        hdr.byte_order = binary::byte_order;
+        hdr.removed[0] = removed_roads.size();
+        hdr.removed[1] = removed_lanes.size();
+        hdr.removed[2] = removed_intersections.size();
+
+        patch_ids(strings, ids, removed_roads);
+        patch_ids(strings, ids, removed_lanes);
+        patch_ids(strings, ids, removed_intersections);
+
+        broads.reserve(roads.size());
+        BOOST_FOREACH(const road &r, roads)
+        {
+            binary::road br;
+            br.id   = strings.add(r.id);
+            br.name = strings.add(r.name);
+            binary::write_road(br, floats, r);
+            broads.push_back(br);
+        }
+
+        blanes.reserve(lanes.size());
+        BOOST_FOREACH(const lane_record &lr, lanes)
+        {
+            binary::lane bl;
+            bl.id         = strings.add(lr.id);
+            bl.speedlimit = lr.speedlimit;
+            bl.start      = patch_terminus(strings, lr.start);
+            bl.end        = patch_terminus(strings, lr.end);
+
+            bl.memberships.begin = memberships.size();
+            bl.memberships.count = lr.memberships.size();
+            BOOST_FOREACH(const membership_record &mr, lr.memberships)
+            {
+                binary::membership bm;
+                bm.divider       = mr.divider;
+                bm.road          = patch_ref(strings, mr.road);
+                bm.interval[0]   = mr.interval[0];
+                bm.interval[1]   = mr.interval[1];
+                bm.lane_position = mr.lane_position;
+                memberships.push_back(bm);
+            }
+
+            bl.left  = patch_adjacencies(strings, adjacencies, lr.left);
+            bl.right = patch_adjacencies(strings, adjacencies, lr.right);
+            blanes.push_back(bl);
+        }
+
+        bintersections.reserve(intersections.size());
+        BOOST_FOREACH(const intersection_record &ir, intersections)
+        {
+            binary::intersection bi;
+            bi.id       = strings.add(ir.id);
+            bi.incoming = patch_ids(strings, ids, ir.incoming);
+            bi.outgoing = patch_ids(strings, ids, ir.outgoing);
+
+            bi.states.begin = states.size();
+            bi.states.count = ir.states.size();
+            BOOST_FOREACH(const state_record &sr, ir.states)
+            {
+                binary::state bs;
+                bs.duration    = sr.duration;
+                bs.pairs.begin = state_pairs.size();
+                bs.pairs.count = sr.pairs.size();
+                typedef std::pair<int, int> int_pair;
+                BOOST_FOREACH(const int_pair &p, sr.pairs)
+                {
+                    binary::state_pair bsp;
+                    bsp.in_idx  = p.first;
+                    bsp.out_idx = p.second;
+                    state_pairs.push_back(bsp);
+                }
+                states.push_back(bs);
+            }
+            bintersections.push_back(bi);
+        }
+
+        const size_t counts[patch::NSECTIONS] = {strings.chars.size(),
+                                                 floats.size(),
+                                                 ids.size(),
+                                                 broads.size(),
+                                                 memberships.size(),
+                                                 adjacencies.size(),
+                                                 blanes.size(),
+                                                 bintersections.size(),
+                                                 states.size(),
+                                                 state_pairs.size()};
+        uint64_t pos = binary::align8(sizeof(hdr));
+        for(int s = 0; s < patch::NSECTIONS; ++s)
+        {
+            hdr.sections[s].offset = pos;
+            hdr.sections[s].count  = counts[s];
+            pos = binary::align8(pos + counts[s]*patch_record_size[s]);
+        }
+
+        std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+        if(!out)
+            throw std::runtime_error(boost::str(boost::format("Can't open %s for writing") % filename));
+
+        out.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+        pos = sizeof(hdr);
+        binary::write_section(out, pos, hdr.sections[patch::STRINGS],       strings.chars);
+        binary::write_section(out, pos, hdr.sections[patch::FLOATS],        floats);
+        binary::write_section(out, pos, hdr.sections[patch::IDS],           ids);
+        binary::write_section(out, pos, hdr.sections[patch::ROADS],         broads);
+        binary::write_section(out, pos, hdr.sections[patch::MEMBERSHIPS],   memberships);
+        binary::write_section(out, pos, hdr.sections[patch::ADJACENCIES],   adjacencies);
+        binary::write_section(out, pos, hdr.sections[patch::LANES],         blanes);
+        binary::write_section(out, pos, hdr.sections[patch::INTERSECTIONS], bintersections);
+        binary::write_section(out, pos, hdr.sections[patch::STATES],        states);
+        binary::write_section(out, pos, hdr.sections[patch::STATE_PAIRS],   state_pairs);
+
+        if(!out)
+            throw std::runtime_error(boost::str(boost::format("Error writing patch %s") % filename));
+    }
+
+    // A patch file read whole into memory, with its header and section bounds checked
+    struct patch_file
+    {
+        patch_file(const char *filename)
+        {
+            std::ifstream in(filename, std::ios::binary);
+            if(!in)
+                throw std::runtime_error(boost::str(boost::format("Can't open patch %s") % filename));
+
+            in.seekg(0, std::ios::end);
+            const size_t bytes = in.tellg();
+            in.seekg(0, std::ios::beg);
+            if(bytes < sizeof(patch::header))
+                throw std::runtime_error(boost::str(boost::format("Patch %s is too short") % filename));
+
+            // uint64_t keeps the records aligned
+            data.resize((bytes + 7)/8);
+            in.read(reinterpret_cast<char*>(&(data[0])), bytes);
+            if(!in)
+                throw std::runtime_error(boost::str(boost::format("Error reading patch %s") % filename));
+            hdr = reinterpret_cast<const patch::header*>(&(data[0]));
+
+            const char *err = 0;
+            if(std::memcmp(hdr->magic, patch::magic, sizeof(patch::magic)) != 0)
+                err = "not a patch";
+            else if(hdr->byte_order != binary::byte_order)
+                err = "written with a different byte order";
+            else if(hdr->version != patch::version)
+                err = "unsupported version";
+            else
+            {
+                for(int s = 0; s < patch::NSECTIONS && !err; ++s)
+                {
+                    const binary::section &sec = hdr->sections[s];
+                    if(sec.offset % 8 || sec.offset > bytes || sec.count > (bytes - sec.offset)/patch_record_size[s])
+                        err = "section out of bounds";
+                }
+                if(!err && (count(patch::STRINGS) == 0 || records<char>(patch::STRINGS)[count(patch::STRINGS)-1] != 0))
+                    err = "bad string table";
+                if(!err && static_cast<uint64_t>(hdr->removed[0]) + hdr->removed[1] + hdr->removed[2] > count(patch::IDS))
+                    err = "more removals than ids";
+            }
+
+            if(err)
+                throw std::runtime_error(boost::str(boost::format("Patch %s: %s") % filename % err));
+        }
+
+        template <typename T>
+        const T *records(const patch::section_t s) const
+        {
+            return reinterpret_cast<const T*>(reinterpret_cast<const char*>(&(data[0])) + hdr->sections[s].offset);
+        }
+
+        size_t count(const patch::section_t s) const
+        {
+            return hdr->sections[s].count;
+        }
+
+        str string(const uint32_t s) const
+        {
+            if(s == binary::npos)
+                return str();
+            if(s >= count(patch::STRINGS))
+                throw std::runtime_error("Patch string out of bounds");
+            return str(records<char>(patch::STRINGS) + s);
+        }
+
+        void check_span(const binary::span &s, const patch::section_t sec) const
+        {
+            if(static_cast<uint64_t>(s.begin) + s.count > count(sec))
+                throw std::runtime_error("Patch span out of bounds");
+        }
+
+        void ids(std::vector<str> &res, const binary::span &s) const
+        {
+            check_span(s, patch::IDS);
+            const uint32_t *refs = records<uint32_t>(patch::IDS) + s.begin;
+            res.resize(s.count);
+            for(size_t i = 0; i < s.count; ++i)
+                res[i] = string(refs[i]);
+        }
+
+        network_diff::terminus_record terminus(const binary::terminus &bt) const
+        {
+            if(bt.type != binary::DEAD_END && bt.type != binary::INTERSECTION && bt.type != binary::LANE)
+                throw std::runtime_error("Bad terminus type in patch");
+
+            network_diff::terminus_record tr;
+            tr.type             = bt.type;
+            tr.ref              = string(bt.ref);
+            tr.intersect_in_ref = bt.intersect_in_ref;
+            return tr;
+        }
+
+        void adjacencies(std::vector<network_diff::adjacency_record> &res, const binary::span &s) const
+        {
+            check_span(s, patch::ADJACENCIES);
+            const binary::adjacency *badjs = records<binary::adjacency>(patch::ADJACENCIES) + s.begin;
+            res.resize(s.count);
+            for(size_t i = 0; i < s.count; ++i)
+            {
+                res[i].divider              = badjs[i].divider;
+                res[i].neighbor             = string(badjs[i].neighbor);
+                res[i].neighbor_interval[0] = badjs[i].neighbor_interval[0];
+                res[i].neighbor_interval[1] = badjs[i].neighbor_interval[1];
+            }
+        }
+
+        std::vector<uint64_t>  data;
+        const patch::header   *hdr;
+    };
+
+    void network_diff::read(const char *filename)
+    {
+        PROFILE_SCOPE("hwm::network_diff::read");
+        const patch_file f(filename);
+        *this = network_diff();
+
+        binary::span removed;
+        removed.begin = 0;
+        removed.count = f.hdr->removed[0];
+        f.ids(removed_roads, removed);
+        removed.begin += removed.count;
+        removed.count  = f.hdr->removed[1];
+        f.ids(removed_lanes, removed);
+        removed.begin += removed.count;
+        removed.count  = f.hdr->removed[2];
+        f.ids(removed_intersections, removed);
+
+        const binary::road *broads = f.records<binary::road>(patch::ROADS);
+        roads.resize(f.count(patch::ROADS));
+        for(size_t i = 0; i < roads.size(); ++i)
+        {
+            roads[i].id   = f.string(broads[i].id);
+            roads[i].name = f.string(broads[i].name);
+            binary::read_road(roads[i], broads[i], f.records<float>(patch::FLOATS), f.count(patch::FLOATS));
+        }
+
+        const binary::lane       *blanes       = f.records<binary::lane>(patch::LANES);
+        const binary::membership *bmemberships = f.records<binary::membership>(patch::MEMBERSHIPS);
+        lanes.resize(f.count(patch::LANES));
+        for(size_t i = 0; i < lanes.size(); ++i)
+        {
+            const binary::lane &bl = blanes[i];
+            lane_record        &lr = lanes[i];
+            lr.id         = f.string(bl.id);
+            lr.speedlimit = bl.speedlimit;
+            lr.start      = f.terminus(bl.start);
+            lr.end        = f.terminus(bl.end);
+
+            f.check_span(bl.memberships, patch::MEMBERSHIPS);
+            lr.memberships.resize(bl.memberships.count);
+            for(size_t m = 0; m < bl.memberships.count; ++m)
+            {
+                const binary::membership &bm = bmemberships[bl.memberships.begin + m];
+                lr.memberships[m].divider       = bm.divider;
+                lr.memberships[m].road          = f.string(bm.road);
+                lr.memberships[m].interval[0]   = bm.interval[0];
+                lr.memberships[m].interval[1]   = bm.interval[1];
+                lr.memberships[m].lane_position = bm.lane_position;
+            }
+
+            f.adjacencies(lr.left,  bl.left);
+            f.adjacencies(lr.right, bl.right);
+        }
+
+        const binary::intersection *bintersections = f.records<binary::intersection>(patch::INTERSECTIONS);
+        const binary::state        *bstates        = f.records<binary::state>(patch::STATES);
+        const binary::state_pair   *bstate_pairs   = f.records<binary::state_pair>(patch::STATE_PAIRS);
+        intersections.resize(f.count(patch::INTERSECTIONS));
+        for(size_t i = 0; i < intersections.size(); ++i)
+        {
+            const binary::intersection &bi = bintersections[i];
+            intersection_record        &ir = intersections[i];
+            ir.id = f.string(bi.id);
+            f.ids(ir.incoming, bi.incoming);
+            f.ids(ir.outgoing, bi.outgoing);
+
+            f.check_span(bi.states, patch::STATES);
+            ir.states.resize(bi.states.count);
+            for(size_t s = 0; s < bi.states.count; ++s)
+            {
+                const binary::state &bs = bstates[bi.states.begin + s];
+                ir.states[s].duration = bs.duration;
+
+                f.check_span(bs.pairs, patch::STATE_PAIRS);
+                ir.states[s].pairs.resize(bs.pairs.count);
+                for(size_t p = 0; p < bs.pairs.count; ++p)
+                    ir.states[s].pairs[p] = std::make_pair(bstate_pairs[bs.pairs.begin + p].in_idx, bstate_pairs[bs.pairs.begin + p].out_idx);
+            }
+        }
+    }
+}
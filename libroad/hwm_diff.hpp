@@ -0,0 +1,125 @@
+#ifndef _HWM_DIFF_HPP_
+#define _HWM_DIFF_HPP_
+
+#include "hwm_binary.hpp"
+
+namespace hwm
+{
+    // What turns one version of a network into another, object by object, matched by id.
+    // Added and changed objects are kept whole, with the references between objects held as ids, so a diff applies to
+    // any network that has what they refer to; normally the base it was made from.
+    struct network_diff
+    {
+        struct terminus_record
+        {
+            terminus_record();
+            terminus_record(const lane::terminus *t);
+
+            bool operator==(const terminus_record &o) const;
+
+            int type;             // A binary::terminus_t
+            str ref;              // Intersection or lane id
+            int intersect_in_ref;
+        };
+
+        struct membership_record
+        {
+            bool operator==(const membership_record &o) const;
+
+            float divider;
+            str   road;           // Empty in a gap
+            float interval[2];
+            float lane_position;
+        };
+
+        struct adjacency_record
+        {
+            bool operator==(const adjacency_record &o) const;
+
+            float divider;
+            str   neighbor;       // Empty in a gap
+            float neighbor_interval[2];
+        };
+
+        struct lane_record
+        {
+            lane_record();
+            lane_record(const lane &l);
+
+            bool operator==(const lane_record &o) const;
+
+            str                            id;
+            float                          speedlimit;
+            terminus_record                start;
+            terminus_record                end;
+            std::vector<membership_record> memberships;
+            std::vector<adjacency_record>  left;
+            std::vector<adjacency_record>  right;
+        };
+
+        struct state_record
+        {
+            bool operator==(const state_record &o) const;
+
+            float                             duration;
+            std::vector<std::pair<int, int> > pairs; // (in_idx, out_idx), sorted
+        };
+
+        struct intersection_record
+        {
+            intersection_record();
+            intersection_record(const intersection &is);
+
+            bool operator==(const intersection_record &o) const;
+
+            str                       id;
+            std::vector<str>          incoming;
+            std::vector<str>          outgoing;
+            std::vector<state_record> states;
+        };
+
+        network_diff();
+        // What turns base into variant
+        network_diff(const network &base, const network &variant);
+
+        bool empty() const;
+
+        // Changes n in place. Objects that stay keep their addresses; added and changed ones are recorded in n.edits.
+        // Intersections that change get new states without fictitious lanes, to be built by the caller
+        // (network::build_fictitious_lanes, or network_aux::update when nothing was removed).
+        void apply(network &n) const;
+
+        void write(const char *filename) const;
+        void read (const char *filename);
+
+        std::vector<str>                 removed_roads;
+        std::vector<str>                 removed_lanes;
+        std::vector<str>                 removed_intersections;
+        std::vector<road>                roads;
+        std::vector<lane_record>         lanes;
+        std::vector<intersection_record> intersections;
+    };
+
+    // Patch files hold a network_diff in the records of the binary network format (see hwm_binary.hpp), with ids
+    // (offsets in STRINGS) wherever those hold indices: terminus refs, membership roads, adjacency neighbors and the
+    // lane lists of intersections. IDS holds the removed road, lane and intersection ids, in that order, then the
+    // intersections' lane lists.
+    namespace patch
+    {
+        static const char     magic[8] = {'H', 'W', 'M', 'P', 'A', 'T', 'C', 'H'};
+        static const uint32_t version  = 1;
+
+        enum section_t {STRINGS, FLOATS, IDS, ROADS, MEMBERSHIPS, ADJACENCIES, LANES, INTERSECTIONS, STATES, STATE_PAIRS, NSECTIONS};
+
+        struct header
+        {
+            char            magic[8];
+            uint32_t        version;
+            uint32_t        byte_order;
+            uint32_t        removed[3]; // Removed roads, lanes and intersections at the start of IDS
+            uint32_t        pad;
+            binary::section sections[NSECTIONS];
+        };
+    }
+}
+#endif
@@ -1,4 +1,5 @@
 #include "hwm_draw.hpp"
+#include "profile.hpp"
 
 static inline tvmet::XprVector<tvmet::VectorConstReference<float, 3>, 3> cvec3f(const float *mem)
 {
@@ -99,13 +100,11 @@ namespace hwm
 
     void network_draw::initialize(const network *in_net, const float resolution)
     {
+        PROFILE_SCOPE("hwm::network_draw::initialize");
         net = in_net;
         std::vector<vertex> points;
         std::vector<vec3u>  lane_faces;
 
-        std::cout << "Generating network mesh with refinement " << resolution << "...";
-        std::cout.flush();
-
         BOOST_FOREACH(const lane_pair &l, net->lanes)
         {
             lane_vert_starts.push_back(points.size());
@@ -157,47 +156,42 @@ namespace hwm
             intersection_vert_loop_starts.push_back(intersection_vert_fan_starts.back() + 1);
             intersection_vert_loop_counts.push_back(intersection_vert_fan_counts.back() - 2);
 
-            BOOST_FOREACH(const intersection::state &st, i.second.states)
+            // Once per movement; states share the lanes, and draw them by id
+            BOOST_FOREACH(const lane_pair &lp, i.second.fict_lanes)
             {
-                BOOST_FOREACH(const intersection::state::state_pair &sp, st.in_pair())
-                {
-                    assert(sp.fict_lane);
-                    const lane &fict_lane = *(sp.fict_lane);
+                const lane &fict_lane = lp.second;
 
-                    lane_data_map::iterator it = lanes.find(fict_lane.id);
-                    assert(it == lanes.end());
+                lane_data_map::iterator it = lanes.find(fict_lane.id);
+                assert(it == lanes.end());
 
-                    lane_data fld;
-                    fld.vert_start = points.size();
-                    fld.face_start = lane_faces.size();
-                    fict_lane.make_mesh(points, lane_faces, net->lane_width, resolution);
-                    const float inv_len = 1.0f/fict_lane.length();
-                    for(size_t i = fld.vert_start; i < points.size(); ++i)
-                        points[i].tex_coord[0] *= inv_len;
+                lane_data fld;
+                fld.vert_start = points.size();
+                fld.face_start = lane_faces.size();
+                fict_lane.make_mesh(points, lane_faces, net->lane_width, resolution);
+                const float inv_len = 1.0f/fict_lane.length();
+                for(size_t i = fld.vert_start; i < points.size(); ++i)
+                    points[i].tex_coord[0] *= inv_len;
 
-                    fld.vert_count = points.size()     - fld.vert_start;
-                    fld.face_count = (lane_faces.size() - fld.face_start) * 3;
-                    fld.face_start *= sizeof(vec3u);
+                fld.vert_count = points.size()     - fld.vert_start;
+                fld.face_count = (lane_faces.size() - fld.face_start) * 3;
+                fld.face_start *= sizeof(vec3u);
 
-                    lanes.insert(it, std::make_pair(fict_lane.id, fld));
-                }
+                lanes.insert(it, std::make_pair(fict_lane.id, fld));
             }
         }
-        std::cout << "Done" << std::endl;
+        PROFILE_COUNT("vertex_bytes", points.size()*sizeof(vertex));
+        PROFILE_COUNT("index_bytes",  lane_faces.size()*sizeof(vec3i));
 
-        std::cout << "Sending " << points.size()*sizeof(vertex) << " bytes of vertex info to GPU...";
-        std::cout.flush();
-        glGenBuffers(1, &v_vbo);
-        glBindBuffer(GL_ARRAY_BUFFER, v_vbo);
-        glBufferData(GL_ARRAY_BUFFER, points.size()*sizeof(vertex), &(points[0]), GL_STATIC_DRAW);
-        std::cout << "Done" << std::endl;
-
-        std::cout << "Sending " << lane_faces.size()*sizeof(vec3i) << " bytes of index info to GPU...";
-        std::cout.flush();
-        glGenBuffers(1, &f_vbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, f_vbo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, lane_faces.size()*sizeof(vec3i), &(lane_faces[0]), GL_STATIC_DRAW);
-        std::cout << "Done" << std::endl;
+        {
+            PROFILE_SCOPE("upload");
+            glGenBuffers(1, &v_vbo);
+            glBindBuffer(GL_ARRAY_BUFFER, v_vbo);
+            glBufferData(GL_ARRAY_BUFFER, points.size()*sizeof(vertex), &(points[0]), GL_STATIC_DRAW);
+
+            glGenBuffers(1, &f_vbo);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, f_vbo);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, lane_faces.size()*sizeof(vec3i), &(lane_faces[0]), GL_STATIC_DRAW);
+        }
 
         assert(glGetError() == GL_NO_ERROR);
     }
@@ -410,13 +404,11 @@ namespace hwm
 
     void network_aux_draw::initialize(const network_aux *in_neta, const road_metrics &rm, const float resolution)
     {
+        PROFILE_SCOPE("hwm::network_aux_draw::initialize");
         neta = in_neta;
         std::vector<vertex> points;
         std::vector<vec3u>  lc_faces;
 
-        std::cout << "Generating network aux mesh with refinement " << resolution << "...";
-        std::cout.flush();
-
         BOOST_FOREACH(const strhash<network_aux::road_rev_map>::type::value_type &rrm_v, neta->rrm)
         {
             for(partition01<network_aux::road_rev_map::lane_cont>::const_iterator current = rrm_v.second.lane_map.begin();
@@ -442,7 +434,7 @@ namespace hwm
                     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
                     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
-                    std::cout << "Making new lane texture; res: " << lm.im_res << " scale: " << lm.scale << std::endl;
+                    PROFILE_COUNT("lane_textures", 1);
                     unsigned char *pix = new unsigned char[4*lm.im_res[0]*lm.im_res[1]];
                     lm.draw(pix);
                     for(size_t i = 0; i < lm.im_res[0]*lm.im_res[1]; ++i)
@@ -521,21 +513,19 @@ namespace hwm
 
             intersection_vert_fan_counts.push_back(points.size()-intersection_vert_fan_starts.back());
         }
-        std::cout << "Done" << std::endl;
-
-        std::cout << "Sending " << points.size()*sizeof(vertex) << " bytes of vertex info to GPU...";
-        std::cout.flush();
-        glGenBuffers(1, &v_vbo);
-        glBindBuffer(GL_ARRAY_BUFFER, v_vbo);
-        glBufferData(GL_ARRAY_BUFFER, points.size()*sizeof(vertex), &(points[0]), GL_STATIC_DRAW);
-        std::cout << "Done" << std::endl;
+        PROFILE_COUNT("vertex_bytes", points.size()*sizeof(vertex));
+        PROFILE_COUNT("index_bytes",  lc_faces.size()*sizeof(vec3i));
 
-        std::cout << "Sending " << lc_faces.size()*sizeof(vec3i) << " bytes of index info to GPU...";
-        std::cout.flush();
-        glGenBuffers(1, &f_vbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, f_vbo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, lc_faces.size()*sizeof(vec3i), &(lc_faces[0]), GL_STATIC_DRAW);
-        std::cout << "Done" << std::endl;
+        {
+            PROFILE_SCOPE("upload");
+            glGenBuffers(1, &v_vbo);
+            glBindBuffer(GL_ARRAY_BUFFER, v_vbo);
+            glBufferData(GL_ARRAY_BUFFER, points.size()*sizeof(vertex), &(points[0]), GL_STATIC_DRAW);
+
+            glGenBuffers(1, &f_vbo);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, f_vbo);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, lc_faces.size()*sizeof(vec3i), &(lc_faces[0]), GL_STATIC_DRAW);
+        }
 
         assert(glGetError() == GL_NO_ERROR);
     }
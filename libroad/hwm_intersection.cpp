@@ -1,4 +1,5 @@
 #include "hwm_network.hpp"
+#include <set>
 
 namespace hwm
 {
@@ -39,101 +40,6 @@ namespace hwm
         {
             sp.check(parent);
         }
-
-        bool first = fict_lanes.begin()->second.active;
-        BOOST_FOREACH(const lane_pair &lp, fict_lanes)
-        {
-            if(lp.second.active != first)
-                throw std::runtime_error("Fictious lanes in state have inconsitent active flag");
-        }
-    }
-
-    void intersection::state::translate(const vec3f &o)
-    {
-        BOOST_FOREACH(road_pair &frp, fict_roads)
-        {
-            frp.second.translate(o);
-        }
-    }
-
-    void intersection::state::build_fictitious_lanes(const intersection &parent)
-    {
-        intersection::state::state_pair_in::iterator current = in_pair().begin();
-        for(; current != in_pair().end(); ++current)
-        {
-            const intersection::state::state_pair &sp = *current;
-            lane *in  = parent.incoming[sp.in_idx];
-            lane *out = parent.outgoing[sp.out_idx];
-
-            const str road_id(boost::str(boost::format("%s_to_%s_fict_road") % in->id % out->id));
-
-            road_map::iterator new_road_itr(fict_roads.find(road_id));
-            assert(new_road_itr == fict_roads.end());
-
-            new_road_itr = fict_roads.insert(new_road_itr, std::make_pair(road_id, road()));
-
-            road &new_road = new_road_itr->second;
-            new_road.name  = road_id;
-            new_road.id    = road_id;
-
-            vec3f start_point;
-            vec3f start_tan;
-            vec3f end_point;
-            vec3f end_tan;
-            {
-                const mat4x4f start(in ->point_frame(1.0));
-                const mat4x4f end  (out->point_frame(0.0));
-                for(int i = 0; i < 3; ++i)
-                {
-                    start_point[i] = start(i, 3);
-                    start_tan[i]   = start(i, 0);
-                    end_point[i]   = end(i, 3);
-                    end_tan[i]     = -end(i, 0);
-                }
-            }
-
-            new_road.rep.initialize_from_polyline(0.0f, from_tan_pairs(start_point,
-                                                                       start_tan,
-                                                                       end_point,
-                                                                       end_tan,
-                                                                       2.0f));
-            new_road.check();
-
-            assert(!sp.fict_lane);
-            const str lane_id(boost::str(boost::format("%s_to_%s_fict_lane") % in->id % out->id));
-
-            lane_map::iterator new_lane_itr(fict_lanes.find(lane_id));
-            assert(new_lane_itr == fict_lanes.end());
-
-            new_lane_itr = fict_lanes.insert(new_lane_itr, std::make_pair(lane_id, lane()));
-            lane &new_lane = new_lane_itr->second;
-            new_lane.id = lane_id;
-
-            {
-                lane::road_membership rm;
-                rm.parent_road = &new_road;
-                rm.lane_position = 0.0f;
-                rm.interval[0] = 0.0f;
-                rm.interval[1] = 1.0f;
-                new_lane.road_memberships.insert(0.0, rm);
-            }
-
-            new_lane.start = new hwm::lane::lane_terminus(in);
-            new_lane.end   = new hwm::lane::lane_terminus(out);
-
-            if(new_road.rep.points_.size() > 2)
-            {
-                const float min_rad = *std::min_element(new_road.rep.radii_.begin(), new_road.rep.radii_.end());
-                const float curve_speedlimit = maximum_cornering_speed(min_rad, 9.81, tire_static_friction);
-                new_lane.speedlimit = std::min(curve_speedlimit, out->speedlimit);
-            }
-            else
-                new_lane.speedlimit = out->speedlimit;
-
-            new_lane.active     = false;
-
-            in_pair().replace(current, intersection::state::state_pair(sp.in_idx, sp.out_idx, &new_lane));
-        }
     }
 
     intersection::state::state_pair_in &intersection::state::in_pair()
@@ -156,19 +62,20 @@ namespace hwm
         return state_pairs.get<intersection::state::out>();
     }
 
+    // A lane shared with the next state goes off and on again as the state advances
     void intersection::state::activate()
     {
-        BOOST_FOREACH(lane_pair &l, fict_lanes)
+        BOOST_FOREACH(const intersection::state::state_pair &sp, in_pair())
         {
-            l.second.active = true;
+            sp.fict_lane->active = true;
         }
     }
 
     void intersection::state::deactivate()
     {
-        BOOST_FOREACH(lane_pair &l, fict_lanes)
+        BOOST_FOREACH(const intersection::state::state_pair &sp, in_pair())
         {
-            l.second.active = false;
+            sp.fict_lane->active = false;
         }
     }
 
@@ -208,13 +115,32 @@ namespace hwm
         {
             s.check(*this);
         }
+
+        if(states.empty())
+            return;
+        if(current_state >= states.size())
+            throw std::runtime_error("Intersection's current state out of range");
+
+        // Lanes are shared between states, so only the current state's lanes can be active, and all of them are
+        std::set<const lane*> current;
+        BOOST_FOREACH(const intersection::state::state_pair &sp, states[current_state].in_pair())
+        {
+            if(!sp.fict_lane->active)
+                throw std::runtime_error("Fictious lane in current state is inactive");
+            current.insert(sp.fict_lane);
+        }
+        BOOST_FOREACH(const lane_pair &lp, fict_lanes)
+        {
+            if(lp.second.active && !current.count(&(lp.second)))
+                throw std::runtime_error("Fictious lane outside current state is active");
+        }
     }
 
     void intersection::translate(const vec3f &o)
     {
-        BOOST_FOREACH(state &st, states)
+        BOOST_FOREACH(road_pair &frp, fict_roads)
         {
-            st.translate(o);
+            frp.second.translate(o);
         }
 
         BOOST_FOREACH(vec3f &pt, shape)
@@ -324,15 +250,115 @@ namespace hwm
         center /= shape.size();
     }
 
+    lane *intersection::build_fictitious_lane(const int in_idx, const int out_idx)
+    {
+        lane *in  = incoming[in_idx];
+        lane *out = outgoing[out_idx];
+
+        const str road_id(boost::str(boost::format("%s_to_%s_fict_road") % in->id % out->id));
+
+        road_map::iterator new_road_itr(fict_roads.find(road_id));
+        assert(new_road_itr == fict_roads.end());
+
+        new_road_itr = fict_roads.insert(new_road_itr, std::make_pair(road_id, road()));
+
+        road &new_road = new_road_itr->second;
+        new_road.name  = road_id;
+        new_road.id    = road_id;
+
+        vec3f start_point;
+        vec3f start_tan;
+        vec3f end_point;
+        vec3f end_tan;
+        {
+            const mat4x4f start(in ->point_frame(1.0));
+            const mat4x4f end  (out->point_frame(0.0));
+            for(int i = 0; i < 3; ++i)
+            {
+                start_point[i] = start(i, 3);
+                start_tan[i]   = start(i, 0);
+                end_point[i]   = end(i, 3);
+                end_tan[i]     = -end(i, 0);
+            }
+        }
+
+        new_road.rep.initialize_from_polyline(0.0f, from_tan_pairs(start_point,
+                                                                   start_tan,
+                                                                   end_point,
+                                                                   end_tan,
+                                                                   2.0f));
+        new_road.check();
+
+        const str lane_id(boost::str(boost::format("%s_to_%s_fict_lane") % in->id % out->id));
+
+        lane_map::iterator new_lane_itr(fict_lanes.find(lane_id));
+        assert(new_lane_itr == fict_lanes.end());
+
+        new_lane_itr = fict_lanes.insert(new_lane_itr, std::make_pair(lane_id, lane()));
+        lane &new_lane = new_lane_itr->second;
+        new_lane.id = lane_id;
+
+        {
+            lane::road_membership rm;
+            rm.parent_road = &new_road;
+            rm.lane_position = 0.0f;
+            rm.interval[0] = 0.0f;
+            rm.interval[1] = 1.0f;
+            new_lane.road_memberships.insert(0.0, rm);
+        }
+
+        new_lane.start = new hwm::lane::lane_terminus(in);
+        new_lane.end   = new hwm::lane::lane_terminus(out);
+
+        if(new_road.rep.points_.size() > 2)
+        {
+            const float min_rad = *std::min_element(new_road.rep.radii_.begin(), new_road.rep.radii_.end());
+            const float curve_speedlimit = maximum_cornering_speed(min_rad, 9.81, tire_static_friction);
+            new_lane.speedlimit = std::min(curve_speedlimit, out->speedlimit);
+        }
+        else
+            new_lane.speedlimit = out->speedlimit;
+
+        new_lane.active     = false;
+
+        return &new_lane;
+    }
+
     void intersection::build_fictitious_lanes()
     {
+        std::map<std::pair<int, int>, lane*> movements;
         BOOST_FOREACH(state &s, states)
         {
-            s.build_fictitious_lanes(*this);
+            state::state_pair_in &pairs = s.in_pair();
+            for(state::state_pair_in::iterator current = pairs.begin(); current != pairs.end(); ++current)
+            {
+                assert(!current->fict_lane);
+                lane *&fict = movements[std::make_pair(current->in_idx, current->out_idx)];
+                if(!fict)
+                    fict = build_fictitious_lane(current->in_idx, current->out_idx);
+                pairs.replace(current, state::state_pair(current->in_idx, current->out_idx, fict));
+            }
         }
         states[current_state].activate();
     }
 
+    void intersection::rebuild(const float lane_width)
+    {
+        shape.clear();
+        build_shape(lane_width);
+
+        fict_roads.clear();
+        fict_lanes.clear();
+        BOOST_FOREACH(state &s, states)
+        {
+            state::state_pair_in &pairs = s.in_pair();
+            for(state::state_pair_in::iterator current = pairs.begin(); current != pairs.end(); ++current)
+                pairs.replace(current, state::state_pair(current->in_idx, current->out_idx));
+        }
+        if(!states.empty())
+            build_fictitious_lanes();
+    }
+
     lane *intersection::downstream_lane(const int incoming_ref) const
     {
         assert(current_state < states.size());
@@ -1,4 +1,6 @@
 #include "hwm_network.hpp"
+#include "profile.hpp"
+#include <sstream>
 
 namespace hwm
 {
@@ -57,6 +59,7 @@ namespace hwm
         roads         = n.roads;
         lanes         = n.lanes;
         intersections = n.intersections;
+        edits         = n.edits;
 
         // Fill in pointers in lanes with other lanes
         BOOST_FOREACH(lane_pair &l, lanes)
@@ -117,71 +120,49 @@ namespace hwm
             current_lane.start->update_pointers(*this);
             current_lane.end->update_pointers(*this);
         }
-        // typedef strhash<intersection>::type::value_type ival;
-        // BOOST_FOREACH(ival &i, intersections)
-        // {
-        //     const str    &intersection_id      = i.first;
-        //     intersection &current_intersection = i.second;
-
-        //     const strhash<intersection>::type::const_iterator other = n.intersections.find(i.first);
-        //     assert(other != n.intersections.end());
-        //     assert(other->first == intersection_id);
-
-        //     const intersection &other_intersection = other->second;
-
-        //     {
-        //         std::vector<lane*>::iterator       my_inc     = current_intersection.incoming.begin();
-        //         std::vector<lane*>::const_iterator other_inc  =   other_intersection.incoming.begin();
-        //         for(; my_inc  != current_intersection.incoming.end() &&
-        //             other_inc !=   other_intersection.incoming.end();
-        //             ++my_inc, ++other_inc)
-        //         {
-        //             assert(*my_inc);
-        //             const strhash<lane>::type::iterator my_lane = lanes.find((*other_inc)->id);
-        //             assert(my_lane != lanes.end());
-        //             *my_inc = &(my_lane->second);
-        //         }
-        //     }
-
-        //     {
-        //         std::vector<lane*>::iterator       my_out     = current_intersection.outgoing.begin();
-        //         std::vector<lane*>::const_iterator other_out  =   other_intersection.outgoing.begin();
-        //         for(; my_out  != current_intersection.outgoing.end() &&
-        //             other_out !=   other_intersection.outgoing.end();
-        //             ++my_out, ++other_out)
-        //         {
-        //             assert(*my_out);
-        //             const strhash<lane>::type::iterator my_lane = lanes.find((*other_out)->id);
-        //             assert(my_lane != lanes.end());
-        //             *my_out = &(my_lane->second);
-        //         }
-
-        //         std::vector<intersection::state>::iterator       my_state    = current_intersection.states.begin();
-        //         std::vector<intersection::state>::const_iterator other_state =   other_intersection.states.begin();
-        //         for(;  my_state != current_intersection.states.end() &&
-        //             other_state !=   other_intersection.states.end();
-        //             ++my_state, ++other_state)
-        //         {
-        //             *my_state = *other_state;
-        //             std::vector<intersection::state::out_id>::iterator       my_out    =    my_state->in_states.begin();
-        //             std::vector<intersection::state::out_id>::const_iterator other_out = other_state->in_states.begin();
-        //             for(;  my_out !=    my_state->in_states.end() &&
-        //                 other_out != other_state->in_states.end();
-        //                 ++my_out, ++other_out)
-        //             {
-        //                 my_out->fict_lane = 0;
-        //             }
-        //             std::vector<intersection::state::in_id>::iterator       my_in    =    my_state->out_states.begin();
-        //             std::vector<intersection::state::in_id>::const_iterator other_in = other_state->out_states.begin();
-        //             for(;  my_in !=    my_state->out_states.end() &&
-        //                 other_in != other_state->out_states.end();
-        //                 ++my_in, ++other_in)
-        //             {
-        //                 my_in->fict_lane = 0;
-        //             }
-        //         }
-        //}
-        //}
+
+        // Intersections and their fictitious lanes still point into n
+        BOOST_FOREACH(intersection_pair &ip, intersections)
+        {
+            intersection &is = ip.second;
+            for(int incoming = 0; incoming < 2; ++incoming)
+            {
+                std::vector<lane*> &lv = incoming ? is.incoming : is.outgoing;
+                BOOST_FOREACH(lane *&l, lv)
+                {
+                    if(!l)
+                        continue;
+                    const lane_map::iterator my_lane = lanes.find(l->id);
+                    assert(my_lane != lanes.end());
+                    l = &(my_lane->second);
+                }
+            }
+
+            BOOST_FOREACH(lane_pair &fl, is.fict_lanes)
+            {
+                BOOST_FOREACH(lane::road_membership::intervals::entry &rm, fl.second.road_memberships)
+                {
+                    const road_map::iterator my_road = is.fict_roads.find(rm.second.parent_road->id);
+                    assert(my_road != is.fict_roads.end());
+                    rm.second.parent_road = &(my_road->second);
+                }
+                fl.second.start->update_pointers(*this);
+                fl.second.end->update_pointers(*this);
+            }
+
+            BOOST_FOREACH(intersection::state &st, is.states)
+            {
+                intersection::state::state_pair_in &pairs = st.in_pair();
+                for(intersection::state::state_pair_in::iterator current = pairs.begin(); current != pairs.end(); ++current)
+                {
+                    if(!current->fict_lane)
+                        continue;
+                    const lane_map::iterator my_lane = is.fict_lanes.find(current->fict_lane->id);
+                    assert(my_lane != is.fict_lanes.end());
+                    pairs.replace(current, intersection::state::state_pair(current->in_idx, current->out_idx, &(my_lane->second)));
+                }
+            }
+        }
     }
 
     network &network::operator=(const network &n)
@@ -221,6 +202,109 @@ namespace hwm
         }
     }
 
+    bool network_edits::empty() const
+    {
+        return roads.empty() && lanes.empty() && intersections.empty();
+    }
+
+    void network_edits::clear()
+    {
+        roads.clear();
+        lanes.clear();
+        intersections.clear();
+    }
+
+    void network::touch_road(const str &id)
+    {
+        edits.roads.insert(id);
+    }
+
+    void network::touch_lane(const str &id)
+    {
+        edits.lanes.insert(id);
+
+        const lane_map::const_iterator l = lanes.find(id);
+        if(l == lanes.end())
+            return;
+        BOOST_FOREACH(const lane::road_membership::intervals::entry &rme, l->second.road_memberships)
+        {
+            edits.roads.insert(rme.second.parent_road->id);
+        }
+    }
+
+    void network::touch_intersection(const str &id)
+    {
+        edits.intersections.insert(id);
+    }
+
+    bool network::set_road_points(const str &id, const std::vector<vec3f> &points, const float cull_prox)
+    {
+        const road_map::iterator r = roads.find(id);
+        if(r == roads.end())
+            throw std::runtime_error(boost::str(boost::format("No road %s to edit") % id));
+
+        const arc_road old(r->second.rep);
+        if(!r->second.rep.initialize_from_polyline(cull_prox, points))
+        {
+            r->second.rep = old;
+            return false;
+        }
+
+        touch_road(id);
+        return true;
+    }
+
+    bool network::move_road_point(const str &id, const size_t i, const vec3f &p, const float cull_prox)
+    {
+        const road_map::const_iterator r = roads.find(id);
+        if(r == roads.end())
+            throw std::runtime_error(boost::str(boost::format("No road %s to edit") % id));
+        if(i >= r->second.rep.points_.size())
+            throw std::runtime_error(boost::str(boost::format("Road %s has no point %d") % id % i));
+
+        std::vector<vec3f> points(r->second.rep.points_);
+        points[i] = p;
+        return set_road_points(id, points, cull_prox);
+    }
+
+    void network::set_lane_memberships(const str &id, const lane::road_membership::intervals &memberships)
+    {
+        const lane_map::iterator l = lanes.find(id);
+        if(l == lanes.end())
+            throw std::runtime_error(boost::str(boost::format("No lane %s to edit") % id));
+        BOOST_FOREACH(const lane::road_membership::intervals::entry &rme, memberships)
+        {
+            const road *parent = rme.second.parent_road;
+            if(!parent || roads.find(parent->id) == roads.end() || &(roads.find(parent->id)->second) != parent)
+                throw std::runtime_error(boost::str(boost::format("Lane %s can't be put on a road outside the network") % id));
+        }
+
+        // Before the change, so the roads it leaves are known; update() finds the ones it joins
+        touch_lane(id);
+        l->second.road_memberships = memberships;
+    }
+
+    void network::set_intersection_states(const str &id, const std::vector<intersection::state> &states)
+    {
+        const intersection_map::iterator is = intersections.find(id);
+        if(is == intersections.end())
+            throw std::runtime_error(boost::str(boost::format("No intersection %s to edit") % id));
+        BOOST_FOREACH(const intersection::state &s, states)
+        {
+            BOOST_FOREACH(const intersection::state::state_pair &sp, s.in_pair())
+            {
+                if(sp.in_idx < 0 || sp.in_idx >= static_cast<int>(is->second.incoming.size()) ||
+                   sp.out_idx < 0 || sp.out_idx >= static_cast<int>(is->second.outgoing.size()))
+                    throw std::runtime_error(boost::str(boost::format("Intersection %s has no movement from %d to %d") % id % sp.in_idx % sp.out_idx));
+            }
+        }
+
+        is->second.states        = states;
+        is->second.current_state = 0;
+        is->second.state_time    = 0.0f;
+        touch_intersection(id);
+    }
+
     void network::translate(const vec3f &o)
     {
         BOOST_FOREACH(road_pair &rp, roads)
@@ -242,12 +326,48 @@ namespace hwm
         }
     }
 
+    // Intersections only read the lanes around them, so they are built on all threads; failures are reported together
     void network::build_fictitious_lanes()
     {
+        PROFILE_SCOPE("hwm::network::build_fictitious_lanes");
+        std::vector<intersection*> is;
+        is.reserve(intersections.size());
         BOOST_FOREACH(intersection_pair &ip, intersections)
         {
-            ip.second.build_fictitious_lanes();
+            is.push_back(&(ip.second));
+        }
+
+        std::vector<str> errors(is.size());
+        #pragma omp parallel for schedule(dynamic, 16)
+        for(long i = 0; i < static_cast<long>(is.size()); ++i)
+        {
+            try
+            {
+                is[i]->build_fictitious_lanes();
+            }
+            catch(std::exception &e)
+            {
+                errors[i] = e.what();
+            }
+        }
+
+        size_t             failed = 0;
+        size_t             fict   = 0;
+        std::ostringstream report;
+        for(size_t i = 0; i < is.size(); ++i)
+        {
+            fict += is[i]->fict_lanes.size();
+            if(errors[i].empty())
+                continue;
+            if(failed < 16)
+                report << "\n    intersection " << is[i]->id << ": " << errors[i];
+            ++failed;
         }
+        PROFILE_COUNT("fictitious_lanes", fict);
+        if(failed > 16)
+            report << "\n    and " << (failed - 16) << " more";
+        if(failed)
+            throw std::runtime_error(boost::str(boost::format("Failed to build fictitious lanes for %d of %d intersections:%s") % failed % is.size() % report.str()));
     }
 
     void network::auto_scale_memberships()
@@ -296,10 +416,166 @@ namespace hwm
         return entry->second;
     }
 
-    network from_sumo(const str &name, const float gamma, const float lane_width, const sumo::network &snet)
+    simplify_report::simplify_report() : roads(0), features_before(0), features_after(0), max_deviation(0.0f)
+    {
+    }
+
+    void simplify_report::add(const size_t before, const size_t after, const float deviation)
+    {
+        ++roads;
+        features_before += before;
+        features_after  += after;
+        max_deviation    = std::max(max_deviation, deviation);
+    }
+
+    // An arc_road through n points has 2(n-2)+1 features
+    static inline size_t feature_count(const size_t points)
+    {
+        return points < 2 ? 0 : 2*(points-2)+1;
+    }
+
+    // Fits the arcs of every road to the polyline in its rep.points_ (first simplified to within simplify, if that
+    // is positive), on all threads. The roads must already be in their map, which must not change meanwhile. Roads
+    // that can't be fitted go into report and left_out; without a report, they are all reported in one exception.
+    static void fit_roads(const std::vector<road*> &roads, const float cull_prox, const float simplify, simplify_report *report,
+                          const char *caller, std::set<str> &left_out)
+    {
+        PROFILE_SCOPE("fit_roads");
+        PROFILE_COUNT("roads", roads.size());
+        std::vector<str>    errors(roads.size());
+        std::vector<size_t> before(roads.size());
+        std::vector<float>  deviation(roads.size(), 0.0f);
+        #pragma omp parallel for schedule(dynamic, 64)
+        for(long i = 0; i < static_cast<long>(roads.size()); ++i)
+        {
+            try
+            {
+                arc_road &rep = roads[i]->rep;
+                before[i]     = feature_count(rep.points_.size());
+                if(simplify > 0.0f)
+                    rep.points_ = simplify_polyline(rep.points_, simplify, &(deviation[i]));
+                if(!rep.initialize_from_polyline(cull_prox, rep.points_))
+                    errors[i] = "can't fit arcs";
+            }
+            catch(std::exception &e)
+            {
+                errors[i] = e.what();
+            }
+        }
+
+        if(report)
+        {
+            for(size_t i = 0; i < roads.size(); ++i)
+            {
+                if(errors[i].empty())
+                    report->add(before[i], feature_count(roads[i]->rep.points_.size()), deviation[i]);
+                else
+                {
+                    simplify_report::failure f;
+                    f.road   = roads[i]->id;
+                    f.reason = errors[i];
+                    report->failures.push_back(f);
+                    left_out.insert(roads[i]->id);
+                }
+            }
+            return;
+        }
+
+        size_t             failed = 0;
+        std::ostringstream failures;
+        for(size_t i = 0; i < roads.size(); ++i)
+        {
+            if(errors[i].empty())
+                continue;
+            if(failed < 16)
+                failures << "\n    road " << roads[i]->id << ": " << errors[i];
+            ++failed;
+        }
+        if(failed > 16)
+            failures << "\n    and " << (failed - 16) << " more";
+        if(failed)
+            throw std::runtime_error(boost::str(boost::format("Failed to initialize arc_road in %s for %d of %d roads:%s") % caller % failed % roads.size() % failures.str()));
+    }
+
+    // Removes the roads that couldn't be fitted, whose lanes have been left out, and the intersections that were
+    // only theirs
+    static void drop_failed(network &hnet, const std::set<str> &failed)
+    {
+        BOOST_FOREACH(const str &id, failed)
+        {
+            hnet.roads.erase(id);
+        }
+
+        std::vector<str> unused;
+        BOOST_FOREACH(const intersection_pair &ip, hnet.intersections)
+        {
+            if(ip.second.incoming.empty() && ip.second.outgoing.empty())
+                unused.push_back(ip.first);
+        }
+        BOOST_FOREACH(const str &id, unused)
+        {
+            hnet.intersections.erase(id);
+        }
+    }
+
+    simplify_report network::simplify_roads(const float tolerance)
+    {
+        PROFILE_SCOPE("hwm::network::simplify_roads");
+        std::vector<road*> rs;
+        rs.reserve(roads.size());
+        BOOST_FOREACH(road_pair &rp, roads)
+        {
+            rs.push_back(&(rp.second));
+        }
+
+        std::vector<size_t> before(rs.size());
+        std::vector<float>  deviation(rs.size(), 0.0f);
+        #pragma omp parallel for schedule(dynamic, 64)
+        for(long i = 0; i < static_cast<long>(rs.size()); ++i)
+        {
+            // A road that can't be fitted again keeps the fit it had
+            const arc_road old(rs[i]->rep);
+            before[i] = feature_count(old.points_.size());
+            if(!rs[i]->rep.refit(tolerance, 0.0f, &(deviation[i])))
+            {
+                rs[i]->rep   = old;
+                deviation[i] = 0.0f;
+            }
+        }
+
+        simplify_report report;
+        for(size_t i = 0; i < rs.size(); ++i)
+            report.add(before[i], feature_count(rs[i]->rep.points_.size()), deviation[i]);
+        return report;
+    }
+
+    // Adds states to is that between them hold every (in_idx, out_idx) pair, and returns how many. A state can take
+    // each lane once, so pairs that clash with ones already in a state go into the next.
+    static size_t add_states(intersection &is, std::vector<std::pair<int, int> > pairs)
+    {
+        typedef std::pair<int, int> io_pair;
+        size_t added = 0;
+        while(!pairs.empty())
+        {
+            is.states.push_back(intersection::state());
+            intersection::state &st = is.states.back();
+            ++added;
+
+            std::vector<io_pair> rest;
+            BOOST_FOREACH(const io_pair &p, pairs)
+            {
+                if(!st.state_pairs.insert(intersection::state::state_pair(p.first, p.second)).second)
+                    rest.push_back(p);
+            }
+            pairs.swap(rest);
+        }
+        return added;
+    }
+
+    network from_sumo(const str &name, const float gamma, const float lane_width, const sumo::network &snet, const float simplify, simplify_report *report)
     {
+        PROFILE_SCOPE("hwm::from_sumo");
         typedef strhash<sumo::node>::type::value_type      sumo_node_pair;
-        typedef strhash<sumo::edge_type>::type::value_type sumo_type_pair;
         typedef strhash<sumo::edge>::type::value_type      sumo_edge_pair;
 
         network hnet;
@@ -307,20 +583,18 @@ namespace hwm
         hnet.gamma      = gamma;
         hnet.lane_width = lane_width;
 
-        strhash<size_t>::type node_degree;
-        BOOST_FOREACH(const sumo_node_pair &np, snet.nodes)
-        {
-            node_degree.insert(std::make_pair(np.first, 0));
-        }
+        // Roads get their polylines here and are fitted together afterwards
+        std::vector<road*> fitted;
+        fitted.reserve(snet.edges.size());
 
         BOOST_FOREACH(const sumo_edge_pair &ep, snet.edges)
         {
             const sumo::edge &e = ep.second;
 
-            ++node_degree[e.from->id];
-            ++node_degree[e.to->id];
-
-            road &new_road = retrieve<road>(hnet.roads, e.id);
+            const size_t before   = hnet.roads.size();
+            road        &new_road = retrieve<road>(hnet.roads, e.id);
+            if(hnet.roads.size() != before)
+                fitted.push_back(&new_road);
             new_road.name = new_road.id;
 
             new_road.rep.points_.reserve(2 + e.shape.size());
@@ -336,22 +610,63 @@ namespace hwm
             new_road.rep.points_.push_back(vec3f(e.to->xy[0],
                                                  e.to->xy[1],
                                                  0.0f));
-            if(!new_road.rep.initialize_from_polyline(lane_width, new_road.rep.points_))
-                throw std::runtime_error("Failed to initialize arc_road in from_sumo");
         }
 
-        BOOST_FOREACH(const strhash<size_t>::type::value_type &ndeg, node_degree)
+        std::set<str> failed;
+        fit_roads(fitted, lane_width, simplify, report, "from_sumo", failed);
+
+        // Connections through roads that couldn't be fitted are left out with them
+        std::vector<const sumo::connection*> connections;
+        connections.reserve(snet.connections.size());
+        BOOST_FOREACH(const sumo::connection &c, snet.connections)
+        {
+            if(!failed.count(c.from->id) && !failed.count(c.to->id))
+                connections.push_back(&c);
+        }
+
+        strhash<size_t>::type node_degree;
+        BOOST_FOREACH(const sumo_node_pair &np, snet.nodes)
+        {
+            node_degree.insert(std::make_pair(np.first, 0));
+        }
+        BOOST_FOREACH(const sumo_edge_pair &ep, snet.edges)
+        {
+            if(failed.count(ep.first))
+                continue;
+            ++node_degree[ep.second.from->id];
+            ++node_degree[ep.second.to->id];
+        }
+
+        // A .net.xml says which junctions link lanes; without one, any node more than one edge meets is taken to be an intersection
+        if(snet.connections.empty())
         {
-            if(ndeg.second > 1)
-                retrieve<intersection>(hnet.intersections, ndeg.first);
+            BOOST_FOREACH(const strhash<size_t>::type::value_type &ndeg, node_degree)
+            {
+                if(ndeg.second > 1)
+                    retrieve<intersection>(hnet.intersections, ndeg.first);
+            }
+        }
+        else
+        {
+            BOOST_FOREACH(const sumo::connection *c, connections)
+            {
+                retrieve<intersection>(hnet.intersections, c->from->to->id);
+            }
         }
 
+        // Lanes of each edge by SUMO index, which counts from the right
+        strhash<std::vector<lane*> >::type edge_lanes;
+
         BOOST_FOREACH(const sumo_edge_pair &ep, snet.edges)
         {
+            if(failed.count(ep.first))
+                continue;
+
             const sumo::edge      &e           = ep.second;
             const sumo::edge_type &et          = *(e.type);
             road                  *parent_road = &retrieve<road>(hnet.roads, e.id);
-            std::vector<lane*>     newlanes(et.nolanes);
+            std::vector<lane*>    &newlanes    = edge_lanes[e.id];
+            newlanes.resize(et.nolanes);
 
             intersection *start_inters, *end_inters;
             {
@@ -361,6 +676,9 @@ namespace hwm
                 end_inters                            = (the_inters == hnet.intersections.end()) ? 0 : &(the_inters->second);
             }
 
+            // Centred on the shape, or all to its right
+            const float first_position = (e.spread == sumo::edge::center) ? -lane_width*(et.nolanes - 1)/2.0f : -lane_width*(et.nolanes - 0.5f);
+
             for(int lanect = 0; lanect < et.nolanes; ++lanect)
             {
                 lane &new_lane = retrieve<lane>(hnet.lanes, boost::str(boost::format("%s_%02d") % e.id % lanect));
@@ -371,26 +689,24 @@ namespace hwm
                 rm.parent_road = parent_road;
                 rm.interval[0] = 0.0f;
                 rm.interval[1] = 1.0f;
-                rm.lane_position = lanect;
+                rm.lane_position = first_position + lane_width*lanect;
                 new_lane.road_memberships.insert(0.0, rm);
 
-                // new_lane.start.inters = start_inters;
-                // if(start_inters)
-                // {
-                //     start_inters->outgoing.push_back(&new_lane);
-                //     new_lane.start.intersect_in_ref = start_inters->outgoing.size()-1;
-                // }
-                // else
-                //     new_lane.start.intersect_in_ref = -1;
+                if(start_inters)
+                {
+                    start_inters->outgoing.push_back(&new_lane);
+                    new_lane.start = new lane::intersection_terminus(start_inters, start_inters->outgoing.size()-1);
+                }
+                else
+                    new_lane.start = new lane::terminus();
 
-                // new_lane.end.inters = end_inters;
-                // if(end_inters)
-                // {
-                //     end_inters->incoming.push_back(&new_lane);
-                //     new_lane.end.intersect_in_ref = end_inters->incoming.size()-1;
-                // }
-                // else
-                //     new_lane.end.intersect_in_ref = -1;
+                if(end_inters)
+                {
+                    end_inters->incoming.push_back(&new_lane);
+                    new_lane.end = new lane::intersection_terminus(end_inters, end_inters->incoming.size()-1);
+                }
+                else
+                    new_lane.end = new lane::terminus();
             }
 
             for(int lanect = 0; lanect < et.nolanes; ++lanect)
@@ -401,7 +717,7 @@ namespace hwm
                     la.neighbor = newlanes[lanect-1];
                     la.neighbor_interval[0] = 0.0f;
                     la.neighbor_interval[1] = 1.0f;
-                    newlanes[lanect]->left.insert(0.0f, la);
+                    newlanes[lanect]->right.insert(0.0f, la);
                 }
                 if(lanect < et.nolanes - 1)
                 {
@@ -409,17 +725,93 @@ namespace hwm
                     la.neighbor = newlanes[lanect+1];
                     la.neighbor_interval[0] = 0.0f;
                     la.neighbor_interval[1] = 1.0f;
-                    newlanes[lanect]->right.insert(0.0f, la);
+                    newlanes[lanect]->left.insert(0.0f, la);
+                }
+            }
+        }
+
+        // Each connection is a state pair at its junction. Under a traffic light, every phase that lets some of them
+        // go gives states that share its duration; otherwise they are spread over as few states as they fit in.
+        typedef std::pair<int, int>                              io_pair;
+        typedef std::vector<const sumo::connection*>             connection_list;
+        typedef strhash<connection_list>::type::value_type       junction_pair;
+        const float                                              STATE_DURATION = 20;
+        strhash<connection_list>::type                           junction_connections;
+        BOOST_FOREACH(const sumo::connection *c, connections)
+        {
+            junction_connections[c->from->to->id].push_back(c);
+        }
+
+        BOOST_FOREACH(const junction_pair &jp, junction_connections)
+        {
+            intersection         &is = hnet.intersections[jp.first];
+            std::vector<io_pair>  pairs;
+            pairs.reserve(jp.second.size());
+            BOOST_FOREACH(const sumo::connection *c, jp.second)
+            {
+                const std::vector<lane*> &in_lanes  = edge_lanes[c->from->id];
+                const std::vector<lane*> &out_lanes = edge_lanes[c->to->id];
+                if(c->from_lane < 0 || c->from_lane >= static_cast<int>(in_lanes.size()) ||
+                   c->to_lane   < 0 || c->to_lane   >= static_cast<int>(out_lanes.size()))
+                    throw std::runtime_error(boost::str(boost::format("Connection from %s lane %d to %s lane %d refers to a lane that doesn't exist")
+                                                        % c->from->id % c->from_lane % c->to->id % c->to_lane));
+
+                const lane::intersection_terminus *in_it  = dynamic_cast<const lane::intersection_terminus*>(in_lanes[c->from_lane]->end);
+                const lane::intersection_terminus *out_it = dynamic_cast<const lane::intersection_terminus*>(out_lanes[c->to_lane]->start);
+                if(!in_it || !out_it || in_it->adjacent_intersection != &is || out_it->adjacent_intersection != &is)
+                    throw std::runtime_error(boost::str(boost::format("Connection from %s to %s doesn't pass through junction %s")
+                                                        % c->from->id % c->to->id % jp.first));
+                pairs.push_back(std::make_pair(in_it->intersect_in_ref, out_it->intersect_in_ref));
+            }
+
+            const sumo::tl_logic *tl = 0;
+            if(!jp.second.front()->tl.empty())
+            {
+                const strhash<sumo::tl_logic>::type::const_iterator found = snet.tl_logics.find(jp.second.front()->tl);
+                if(found != snet.tl_logics.end())
+                    tl = &(found->second);
+            }
+
+            const size_t first_state = is.states.size();
+            if(tl)
+            {
+                BOOST_FOREACH(const sumo::tl_logic::phase &ph, tl->phases)
+                {
+                    std::vector<io_pair> green;
+                    for(size_t i = 0; i < pairs.size(); ++i)
+                    {
+                        const int link = jp.second[i]->link_index;
+                        if(link >= 0 && link < static_cast<int>(ph.state.size()) && (ph.state[link] == 'G' || ph.state[link] == 'g'))
+                            green.push_back(pairs[i]);
+                    }
+                    if(ph.duration <= 0.0f)
+                        continue;
+
+                    const size_t added = add_states(is, green);
+                    for(size_t s = is.states.size() - added; s < is.states.size(); ++s)
+                        is.states[s].duration = ph.duration/added;
                 }
             }
+            if(is.states.size() == first_state)
+            {
+                add_states(is, pairs);
+                for(size_t s = first_state; s < is.states.size(); ++s)
+                    is.states[s].duration = STATE_DURATION;
+            }
         }
 
+        if(!failed.empty())
+            drop_failed(hnet, failed);
+
+        PROFILE_COUNT("roads",         hnet.roads.size());
+        PROFILE_COUNT("lanes",         hnet.lanes.size());
+        PROFILE_COUNT("intersections", hnet.intersections.size());
         return hnet;
     }
 
-    network from_osm(const str &name, const float gamma, const float lane_width, osm::network &snet)
+    network from_osm(const str &name, const float gamma, const float lane_width, osm::network &snet, const float simplify, simplify_report *report)
     {
-        typedef strhash<osm::node>::type::value_type      node_pair;
+        PROFILE_SCOPE("hwm::from_osm");
         typedef strhash<osm::edge_type>::type::value_type type_pair;
         typedef strhash<osm::edge>::type::value_type      edge_pair;
         network                                           hnet;
@@ -427,18 +819,16 @@ namespace hwm
         hnet.gamma      = gamma;
         hnet.lane_width = lane_width;
 
-        strhash<size_t>::type node_degree;
-        BOOST_FOREACH(const node_pair &np, snet.nodes)
-        {
-            node_degree.insert(std::make_pair(np.first, 0));
-        }
+        // Roads get their polylines here and are fitted together afterwards
+        std::vector<road*> fitted;
+        fitted.reserve(snet.edges.size());
 
         BOOST_FOREACH(const osm::edge& e, snet.edges)
         {
-            ++node_degree[e.shape[0]->id];
-            ++node_degree[e.shape.back()->id];
-
-            road &new_road = retrieve<road>(hnet.roads, e.id);
+            const size_t before   = hnet.roads.size();
+            road        &new_road = retrieve<road>(hnet.roads, e.id);
+            if(hnet.roads.size() != before)
+                fitted.push_back(&new_road);
             new_road.name = new_road.id;
 
             new_road.rep.points_.reserve(2 + e.shape.size());
@@ -457,10 +847,11 @@ namespace hwm
                 last = n;
             }
 
-            if(!new_road.rep.initialize_from_polyline(0.7f, new_road.rep.points_))
-                throw std::runtime_error("Failed to initialize arc_road in from_osm");
         }
 
+        std::set<str> failed;
+        fit_roads(fitted, 0.7f, simplify, report, "from_osm", failed);
+
         typedef strhash<hwm::lane>::type::value_type hwm_l_pair;
         BOOST_FOREACH(const hwm_l_pair& l, hnet.lanes)
         {
@@ -468,10 +859,10 @@ namespace hwm
             assert(l.second.length() > 0);
         }
 
-        BOOST_FOREACH(const strhash<osm::intersection>::type::value_type &isect,
+        BOOST_FOREACH(const osm::intersection_map::value_type &isect,
                       snet.intersections)
         {
-            retrieve<intersection>(hnet.intersections, isect.first);
+            retrieve<intersection>(hnet.intersections, osm::id_string(isect.first));
         }
 
         typedef std::pair<std::vector<lane*>, std::vector<lane*> > in_and_out;
@@ -479,6 +870,9 @@ namespace hwm
 
         BOOST_FOREACH(const osm::edge& e, snet.edges)
         {
+            if(failed.count(e.id))
+                continue;
+
             const osm::edge_type &et          = *(e.type);
             road                  *parent_road = &retrieve<road>(hnet.roads, e.id);
 
@@ -487,9 +881,9 @@ namespace hwm
 
             intersection *start_inters, *end_inters;
             {
-                intersection_map::iterator the_inters = hnet.intersections.find(e.from);
+                intersection_map::iterator the_inters = hnet.intersections.find(osm::id_string(e.from));
                 start_inters                          = (the_inters == hnet.intersections.end()) ? 0 : &(the_inters->second);
-                the_inters                            = hnet.intersections.find(e.to);
+                the_inters                            = hnet.intersections.find(osm::id_string(e.to));
                 end_inters                            = (the_inters == hnet.intersections.end()) ? 0 : &(the_inters->second);
             }
 
@@ -674,6 +1068,9 @@ namespace hwm
 
             BOOST_FOREACH(const osm::edge::lane& l, e.additional_lanes)
             {
+                if(failed.count(e.id) || failed.count(l.ramp_id))
+                    continue;
+
                 str id = boost::str(boost::format("%1%_%2%_%3%_%4%") % e.id % l.start_t % l.end_t % l.offset);
                 road                  *parent_road = &retrieve<road>(hnet.roads, e.id);
                 lane &new_lane = retrieve<lane>(hnet.lanes, id);
@@ -797,14 +1194,14 @@ namespace hwm
 
         //TODO Use geometric method to get minimal set of traffic states.
 
-        typedef std::pair<const str, osm::intersection> isect_pair;
+        typedef osm::intersection_map::value_type isect_pair;
         BOOST_FOREACH(const isect_pair& i_pair, snet.intersections)
         {
             const osm::intersection& osm_isect = i_pair.second;
 
-            assert(osm_isect.id_from_node != "");
+            assert(osm_isect.id_from_node != 0);
 
-            hwm::intersection& hwm_isect = hnet.intersections[osm_isect.id_from_node];
+            hwm::intersection& hwm_isect = hnet.intersections[osm::id_string(osm_isect.id_from_node)];
             if (hwm_isect.id == "")
                 assert(0);
 
@@ -979,6 +1376,12 @@ namespace hwm
             assert(i.second.id != "");
         }
 
+        if(!failed.empty())
+            drop_failed(hnet, failed);
+
+        PROFILE_COUNT("roads",         hnet.roads.size());
+        PROFILE_COUNT("lanes",         hnet.lanes.size());
+        PROFILE_COUNT("intersections", hnet.intersections.size());
         return hnet;
     }
 }
@@ -11,6 +11,7 @@
 #include "hwm_texture_gen.hpp"
 #include "rtree.hpp"
 #include "im_heightfield.hpp"
+#include <set>
 #if HAVE_CAIRO
 #include <cairo.h>
 #endif
@@ -49,6 +50,7 @@ namespace hwm
     {
         void xml_read (const vec3f &scale, xmlpp::TextReader &reader);
         void xml_write(xmlpp::Element *elt) const;
+        void xml_write(xml_writer &w) const;
         void check() const;
 
         void translate(const vec3f &o);
@@ -85,6 +87,7 @@ namespace hwm
             virtual terminus* clone() const;
             virtual void xml_read (network &n, const lane *parent, xmlpp::TextReader &reader, const str &name);
             virtual void xml_write(xmlpp::Element *elt, const str &name) const;
+            virtual void xml_write(xml_writer &w, const str &name) const;
             virtual void check(bool start, const lane *parent) const;
             virtual lane *incident(bool start) const;
             virtual bool network_boundary() const;
@@ -104,6 +107,7 @@ namespace hwm
             virtual intersection_terminus* clone() const;
             virtual void xml_read (network &n, const lane *parent, xmlpp::TextReader &reader, const str &name);
             virtual void xml_write(xmlpp::Element *elt, const str &name) const;
+            virtual void xml_write(xml_writer &w, const str &name) const;
             virtual void check(bool start, const lane *parent) const;
             virtual lane *incident(bool start) const;
             virtual bool network_boundary() const;
@@ -126,6 +130,7 @@ namespace hwm
             virtual lane_terminus* clone() const;
             virtual void xml_read (network &n, const lane *parent, xmlpp::TextReader &reader, const str &name);
             virtual void xml_write(xmlpp::Element *elt, const str &name) const;
+            virtual void xml_write(xml_writer &w, const str &name) const;
             virtual void check(bool start, const lane *parent) const;
             virtual lane *incident(bool start) const;
             virtual bool network_boundary() const;
@@ -137,6 +142,7 @@ namespace hwm
         {
             void xml_read (network &n, xmlpp::TextReader &reader);
             void xml_write(xmlpp::Element *elt) const;
+            void xml_write(xml_writer &w) const;
             void check() const;
             bool empty() const;
 
@@ -156,6 +162,7 @@ namespace hwm
         {
             void xml_read (network &n, xmlpp::TextReader &reader);
             void xml_write(xmlpp::Element *elt) const;
+            void xml_write(xml_writer &w) const;
             void check() const;
             bool empty() const;
 
@@ -166,6 +173,7 @@ namespace hwm
 
         void xml_read (network &n, xmlpp::TextReader &reader);
         void xml_write(xmlpp::Element *elt) const;
+        void xml_write(xml_writer &w) const;
         void check() const;
         void auto_scale_memberships();
 
@@ -265,11 +273,9 @@ namespace hwm
 
             void xml_read (xmlpp::TextReader &reader);
             void xml_write(const size_t id, xmlpp::Element *elt) const;
+            void xml_write(const size_t id, xml_writer &w) const;
             void check(const intersection &parent) const;
 
-            void translate(const vec3f &o);
-            void build_fictitious_lanes(const intersection &parent);
-
             state_pair_in        &in_pair();
             const state_pair_in  &in_pair() const;
             state_pair_out       &out_pair();
@@ -278,19 +284,22 @@ namespace hwm
             void activate();
             void deactivate();
 
-            float               duration;
-            state_pair_set      state_pairs;
-            strhash<road>::type fict_roads;
-            strhash<lane>::type fict_lanes;
+            float          duration;
+            state_pair_set state_pairs; // fict_lane points into the intersection's fict_lanes
         };
 
         void xml_read (network &n, xmlpp::TextReader &reader);
         void xml_write(xmlpp::Element *elt) const;
+        void xml_write(xml_writer &w) const;
         void check() const;
 
         void translate(const vec3f &o);
         void build_shape(float lane_width);
+        // One fictitious road and lane per (in_idx, out_idx) movement, shared by every state that allows it
         void build_fictitious_lanes();
+        lane *build_fictitious_lane(int in_idx, int out_idx);
+        // Throws away the shape and fictitious lanes and builds them again, for after the lanes have moved
+        void rebuild(float lane_width);
 
         lane *downstream_lane(int incoming_ref) const;
         lane *  upstream_lane(int outgoing_ref) const;
@@ -301,15 +310,17 @@ namespace hwm
         void lock();
         void unlock();
 
-        str                id;
-        std::vector<lane*> incoming;
-        std::vector<lane*> outgoing;
-        std::vector<state> states;
-        bool               locked;
-        size_t             current_state;
-        float              state_time;
-        std::vector<vec3f> shape;
-        vec3f              center;
+        str                 id;
+        std::vector<lane*>  incoming;
+        std::vector<lane*>  outgoing;
+        std::vector<state>  states;
+        strhash<road>::type fict_roads;
+        strhash<lane>::type fict_lanes;
+        bool                locked;
+        size_t              current_state;
+        float               state_time;
+        std::vector<vec3f>  shape;
+        vec3f               center;
     };
 
     typedef strhash<road>::type         road_map;
@@ -320,6 +331,38 @@ namespace hwm
     typedef lane_map::value_type         lane_pair;
     typedef intersection_map::value_type intersection_pair;
 
+    // What simplifying roads before fitting them did; features are counted as arc_road counts them
+    struct simplify_report
+    {
+        simplify_report();
+
+        void add(size_t before, size_t after, float deviation);
+
+        // A road whose arcs couldn't be fitted, and why
+        struct failure
+        {
+            str road;
+            str reason;
+        };
+
+        size_t               roads;
+        size_t               features_before;
+        size_t               features_after;
+        float                max_deviation;
+        std::vector<failure> failures;
+    };
+
+    // What has been edited in a network since network_aux::update last brought its derived data up to date
+    struct network_edits
+    {
+        bool empty() const;
+        void clear();
+
+        std::set<str> roads;         // Geometry or the lanes on them changed
+        std::set<str> lanes;         // Memberships, adjacency or termini changed
+        std::set<str> intersections; // States or incident lanes changed
+    };
+
     struct network
     {
         static const int SVG_ROADS=1, SVG_LANES=4, SVG_ARCS=8, SVG_CIRCLES=16;
@@ -345,12 +388,31 @@ namespace hwm
         void xml_read (xmlpp::TextReader &reader, const vec3f &scale=vec3f(1.0f,1.0f,1.0f));
         void xml_write(const char *filename) const;
         void xml_write(xmlpp::Element *elt)  const;
+        void xml_write(xml_writer &w)        const;
         void svg_write(const char *filename, const int flags) const;
 
         void check() const;
         void build_intersections();
         void build_fictitious_lanes();
         void auto_scale_memberships();
+        // Refits every road, on all threads, from its control polygon simplified to within tolerance
+        simplify_report simplify_roads(float tolerance);
+
+        // Edits that record what they change in edits. The touch_ functions record changes made directly;
+        // touch_lane has to come before a lane's memberships change, so that the roads it leaves are known.
+        void touch_road        (const str &id);
+        void touch_lane        (const str &id);
+        void touch_intersection(const str &id);
+        // Refit the road to new control points, culling those within cull_prox of each other; false, with the road
+        // as it was, if the fit fails. Pass the distance the road was fitted with to keep its existing points:
+        // from_sumo culls at lane_width, from_osm and the XML loader at 0.7.
+        bool set_road_points(const str &id, const std::vector<vec3f> &points, float cull_prox);
+        bool move_road_point(const str &id, size_t i, const vec3f &p, float cull_prox);
+        // Put the lane on other roads, or elsewhere across them; the memberships' roads must be in this network
+        void set_lane_memberships(const str &id, const lane::road_membership::intervals &memberships);
+        // Replace the intersection's states, which index its incoming and outgoing lanes, and start it at the first.
+        // The fictitious lanes are made for them when the intersection is rebuilt, as network_aux::update does.
+        void set_intersection_states(const str &id, const std::vector<intersection::state> &states);
 
         serial_state serial() const;
 
@@ -364,6 +426,7 @@ namespace hwm
         road_map         roads;
         lane_map         lanes;
         intersection_map intersections;
+        network_edits    edits;
     };
 
     struct network_aux
@@ -449,21 +512,86 @@ namespace hwm
             struct entry
             {
                 entry();
-                entry(road_rev_map::lane_cont *r, const aabb2d &rect);
+                entry(road_rev_map::lane_cont *r, const vec2f &interval, const aabb2d &rect);
 
                 road_rev_map::lane_cont *lc;
+                vec2f                    interval;
                 aabb2d                   rect;
             };
 
+            typedef std::pair<size_t, size_t> item_pair;
+
             road_spatial();
             ~road_spatial();
 
             void build(float lane_width, strhash<road_rev_map>::type &roads);
+            // Take a road's leaves out, and put them back once its lane map has been rebuilt
+            void remove_road(const str &id);
+            void add_road(float lane_width, const str &id, road_rev_map &rm);
+
+            std::vector<entry> query(const aabb2d &rect) const;
+
+            // Pairs of items on different roads whose lane bands overlap in the plane
+            std::vector<item_pair> overlapping(float lane_width, float resolution) const;
+
+            rtree2d                             *tree;
+            std::vector<entry>                   items;
+            strhash<std::vector<size_t> >::type  road_items;
+            std::vector<size_t>                  free_items; // Slots of items that remove_road emptied
+        };
+
+        // Leaves are single arc_road features (segment or arc) of a single lane
+        struct lane_spatial
+        {
+            // lane_interval holds the lane parameters at the ends of feature_interval
+            struct entry
+            {
+                entry();
+                entry(hwm::lane *l, const hwm::lane::road_membership *rm, size_t f, const vec2f &fi, const vec2f &li, const aabb2d &rect);
+
+                hwm::lane                        *lane;
+                const hwm::lane::road_membership *membership;
+                size_t                            feature;
+                vec2f                             feature_interval;
+                vec2f                             lane_interval;
+                aabb2d                            rect;
+            };
+
+            struct hit
+            {
+                bool operator<(const hit &o) const
+                {
+                    return distance < o.distance;
+                }
+
+                hwm::lane *lane;
+                float      t;
+                float      distance;
+                vec3f      point;
+            };
+
+            lane_spatial();
+            ~lane_spatial();
+
+            static void lane_entries(std::vector<entry> &res, hwm::lane *l, float lane_width);
+            static void feature_hits(std::vector<hit> &res, const entry &e, const vec2f &p0, const vec2f &p1);
+
+            void build(float lane_width, lane_map &lanes);
+            void remove_lane(const str &id);
+            void add_lane(float lane_width, hwm::lane *l);
 
             std::vector<entry> query(const aabb2d &rect) const;
 
-            rtree2d            *tree;
-            std::vector<entry>  items;
+            // Lane centerline crossings, and touches at segment ends or on arcs, nearest to p0 (or origin) first
+            std::vector<hit> query_segment(const vec2f &p0, const vec2f &p1) const;
+            std::vector<hit> query_ray(const vec2f &origin, const vec2f &dir) const;
+            void             query_segments(std::vector<std::vector<hit> > &res, const std::vector<vec2f> &p0s, const std::vector<vec2f> &p1s) const;
+
+            rtree2d                             *tree;
+            std::vector<entry>                   items;
+            aabb2d                               bounds;
+            strhash<std::vector<size_t> >::type  lane_items;
+            std::vector<size_t>                  free_items; // Slots of items that remove_lane emptied
         };
 
         network_aux(network &n);
@@ -476,17 +604,69 @@ namespace hwm
         void network_obj(const std::string &path, float resolution, const im_heightfield *ih=0) const;
 
         void build_spatial();
+        // Brings the lane maps, spatial indices and intersection geometry up to date with net.edits, and the shapes and
+        // fictitious lanes of the intersections they reach, redoing only what the edits touch; then clears the edits.
+        // Lanes and roads may be changed and added, but not removed.
+        void update();
 
         strhash<road_rev_map>::type           rrm;
         strhash<intersection_geometry>::type  intersection_geoms;
         network                              &net;
         road_spatial                          road_space;
+        lane_spatial                          lane_space;
     };
 
     network load_xml_network(const char *filename, const vec3f &scale=vec3f(1.0f, 1.0f, 1.0f));
+    // Reads the whole file (mapped, or inflated if gzipped) and parses its roads, lanes and intersections in chunks
+    // on all threads, then links intersections in parallel. Files it can't split safely go to load_xml_network.
+    network load_xml_network_parallel(const char *filename, const vec3f &scale=vec3f(1.0f, 1.0f, 1.0f));
+    // Loads only the roads whose points' bounds overlap region (in scaled coordinates), the lanes on them, the intersections
+    // those lanes meet with all of their lanes, and the roads those lanes lie on. A text pre-pass over the file picks them
+    // out, so only what is kept gets parsed; connections to anything left out become network-boundary termini.
+    network load_xml_network_region(const char *filename, const aabb2d &region, const vec3f &scale=vec3f(1.0f, 1.0f, 1.0f));
     void    write_xml_network(const network &n, const char *filename);
 
-    network from_sumo(const str &name, float gamma, float lane_width, const sumo::network &n);
-    network from_osm (const str &name, float gamma, float lane_width,       osm::network &n);
+    network load_binary_network(const char *filename);
+    void    write_binary_network(const network &n, const char *filename);
+
+    // With simplify > 0, each road's polyline is simplified to within that distance before its arcs are fitted.
+    // Given a report, roads that can't be fitted are listed in it and left out, with their lanes, the connections
+    // and states through them and any intersection left with no lanes; without one, they make the conversion throw.
+    // from_sumo lays lanes out the SUMO way for both readers: lane 0 is the rightmost, each lane's right neighbour
+    // is the one numbered below it, and lanes sit lane_width apart, centred on the shape or all to its right by spread.
+    // Every lane ends at an intersection or a plain terminus; files without connections (the three-file format)
+    // get an intersection, with no states, at each node more than one edge meets.
+    network from_sumo(const str &name, float gamma, float lane_width, const sumo::network &n, float simplify=0.0f, simplify_report *report=0);
+    network from_osm (const str &name, float gamma, float lane_width,       osm::network &n, float simplify=0.0f, simplify_report *report=0);
+
+    struct tiled_options
+    {
+        tiled_options();
+
+        size_t   memory_budget; // bytes for the spill buffers and for one tile's conversion
+        float    halo;          // how far past its tile a way may reach and still be converted with it, in tiles,
+                                // besides the ways of the roads the tile owns, which it always gets whole
+        float    simplify;      // passed on to from_osm
+        bf::path spill_dir;     // if empty, a fresh temporary directory that is removed afterwards
+    };
+
+    struct tiled_report
+    {
+        tiled_report();
+
+        size_t tiles;        // converted
+        int    depth;        // of the most split tile
+        size_t largest_tile; // estimated bytes to convert the biggest tile; over the budget only where splitting didn't help
+        size_t over_budget;  // tiles estimated over the budget, all of them ones that splitting didn't help
+    };
+
+    // Converts an OSM file (as osm::read_network reads it) to an HWM file without holding either network whole.
+    // The file is spilled to disk and cut into tiles, each converted like test/osm-import does it and written
+    // out as it is done; returns the number of tiles converted. Throws if the tiles don't agree on a road
+    // that crosses between them, or if a road can't be fitted, as leaving it out would leave its neighbours
+    // pointing at it, and before converting anything if a tile is still over the budget when splitting
+    // stops at the deepest level while it was still helping.
+    size_t tiled_from_osm(const char *osm_file, const char *hwm_file, const str &name, float gamma, float lane_width,
+                          const tiled_options &opt=tiled_options(), tiled_report *report=0);
 };
 #endif
@@ -1,4 +1,5 @@
 #include "hwm_network.hpp"
+#include "profile.hpp"
 
 namespace hwm
 {
@@ -94,6 +95,7 @@ namespace hwm
     network_aux::network_aux(network &n)
         : net(n)
     {
+        PROFILE_SCOPE("hwm::network_aux");
         BOOST_FOREACH(const road_pair &r, net.roads)
         {
             rrm[r.first] = road_rev_map(&(r.second));
@@ -114,7 +116,105 @@ namespace hwm
             intersection_geoms[i.first] = intersection_geometry(&(i.second), n.lane_width);
         }
 
-        build_spatial();
+        {
+            PROFILE_SCOPE("build_spatial");
+            build_spatial();
+        }
+    }
+
+    static void add_terminus_intersection(std::set<str> &res, const lane::terminus *t)
+    {
+        const lane::intersection_terminus *it = dynamic_cast<const lane::intersection_terminus*>(t);
+        if(it && it->adjacent_intersection)
+            res.insert(it->adjacent_intersection->id);
+    }
+
+    void network_aux::update()
+    {
+        PROFILE_SCOPE("hwm::network_aux::update");
+        network_edits &e(net.edits);
+
+        // Roads whose lane maps change: the edited ones, and those edited lanes are now on
+        std::set<str> roads(e.roads);
+        BOOST_FOREACH(const str &id, e.lanes)
+        {
+            const lane_map::iterator l = net.lanes.find(id);
+            if(l == net.lanes.end())
+                throw std::runtime_error(boost::str(boost::format("Edited lane %s isn't in the network") % id));
+            BOOST_FOREACH(const lane::road_membership::intervals::entry &rme, l->second.road_memberships)
+            {
+                roads.insert(rme.second.parent_road->id);
+            }
+        }
+
+        // Lanes whose geometry follows those roads
+        std::set<str> lanes(e.lanes);
+        BOOST_FOREACH(const str &id, roads)
+        {
+            const strhash<road_rev_map>::type::const_iterator rm = rrm.find(id);
+            if(rm == rrm.end())
+                continue;
+            for(partition01<road_rev_map::lane_cont>::const_iterator current = rm->second.lane_map.begin(); current != rm->second.lane_map.end(); ++current)
+            {
+                typedef road_rev_map::lane_cont::value_type lc_pair;
+                BOOST_FOREACH(const lc_pair &lcp, current->second)
+                {
+                    lanes.insert(lcp.second.lane->id);
+                }
+            }
+        }
+
+        std::set<str> intersections(e.intersections);
+        BOOST_FOREACH(const str &id, lanes)
+        {
+            const lane &l(net.lanes.find(id)->second);
+            add_terminus_intersection(intersections, l.start);
+            add_terminus_intersection(intersections, l.end);
+        }
+
+        // Every lane that was on these roads is in lanes, as is any lane edited onto them, so the maps are rebuilt from those
+        BOOST_FOREACH(const str &id, roads)
+        {
+            const road_map::iterator r = net.roads.find(id);
+            if(r == net.roads.end())
+                throw std::runtime_error(boost::str(boost::format("Edited road %s isn't in the network") % id));
+
+            road_space.remove_road(id);
+            rrm[id] = road_rev_map(&(r->second));
+        }
+
+        BOOST_FOREACH(const str &id, lanes)
+        {
+            lane &l(net.lanes.find(id)->second);
+            BOOST_FOREACH(lane::road_membership::intervals::entry &rme, l.road_memberships)
+            {
+                if(roads.count(rme.second.parent_road->id))
+                    rrm[rme.second.parent_road->id].add_lane(&l, &(rme.second));
+            }
+        }
+
+        BOOST_FOREACH(const str &id, roads)
+        {
+            road_space.add_road(net.lane_width, id, rrm[id]);
+        }
+
+        BOOST_FOREACH(const str &id, lanes)
+        {
+            lane_space.remove_lane(id);
+            lane_space.add_lane(net.lane_width, &(net.lanes.find(id)->second));
+        }
+
+        BOOST_FOREACH(const str &id, intersections)
+        {
+            intersection &is(net.intersections.find(id)->second);
+            is.rebuild(net.lane_width);
+            intersection_geoms[id] = intersection_geometry(&is, net.lane_width);
+        }
+
+        PROFILE_COUNT("roads", roads.size());
+        PROFILE_COUNT("lanes", lanes.size());
+        PROFILE_COUNT("intersections", intersections.size());
+        e.clear();
     }
 
     static void write_intersection_mtl(std::ostream      &o,
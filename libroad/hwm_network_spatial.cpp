@@ -5,13 +5,14 @@ namespace hwm
     void network_aux::build_spatial()
     {
         road_space.build(net.lane_width, rrm);
+        lane_space.build(net.lane_width, net.lanes);
     }
 
     network_aux::road_spatial::entry::entry() : lc(0)
     {
     }
 
-    network_aux::road_spatial::entry::entry(network_aux::road_rev_map::lane_cont *in_lc, const aabb2d &in_rect) : lc(in_lc), rect(in_rect)
+    network_aux::road_spatial::entry::entry(network_aux::road_rev_map::lane_cont *in_lc, const vec2f &in_interval, const aabb2d &in_rect) : lc(in_lc), interval(in_interval), rect(in_rect)
     {
     }
 
@@ -29,21 +30,82 @@ namespace hwm
     {
         if(tree)
             delete tree;
+        items.clear();
+        road_items.clear();
+        free_items.clear();
 
         std::vector<rtree2d::entry> leaves;
         typedef strhash<road_rev_map>::type::value_type rrm_pair;
         BOOST_FOREACH(rrm_pair &rp, roads)
         {
+            std::vector<size_t> &mine = road_items[rp.first];
             for(partition01<road_rev_map::lane_cont>::iterator current = rp.second.lane_map.begin(); current != rp.second.lane_map.end(); ++current)
             {
+                if(current->second.empty())
+                    continue;
+
                 const vec2f interval(rp.second.lane_map.containing_interval(current));
                 const aabb2d rect(current->second.planar_bounding_box(lane_width, interval));
+                mine.push_back(items.size());
                 leaves.push_back(rtree2d::entry(rect, items.size()));
-                items.push_back(entry(&(current->second), rect));
+                items.push_back(entry(&(current->second), interval, rect));
             }
         }
 
-        tree = rtree2d::hilbert_rtree(leaves);
+        tree = leaves.empty() ? 0 : rtree2d::hilbert_rtree(leaves);
+    }
+
+    void network_aux::road_spatial::remove_road(const str &id)
+    {
+        const strhash<std::vector<size_t> >::type::iterator ri = road_items.find(id);
+        if(ri == road_items.end())
+            return;
+
+        BOOST_FOREACH(const size_t i, ri->second)
+        {
+            tree->remove(rtree2d::entry(items[i].rect, i));
+            items[i] = entry();
+            free_items.push_back(i);
+        }
+        road_items.erase(ri);
+
+        if(tree && !tree->root)
+        {
+            delete tree;
+            tree = 0;
+        }
+    }
+
+    void network_aux::road_spatial::add_road(const float lane_width, const str &id, road_rev_map &rm)
+    {
+        std::vector<size_t> &mine = road_items[id];
+        assert(mine.empty());
+        for(partition01<road_rev_map::lane_cont>::iterator current = rm.lane_map.begin(); current != rm.lane_map.end(); ++current)
+        {
+            if(current->second.empty())
+                continue;
+
+            const vec2f  interval(rm.lane_map.containing_interval(current));
+            const aabb2d rect(current->second.planar_bounding_box(lane_width, interval));
+            size_t       i;
+            if(free_items.empty())
+            {
+                i = items.size();
+                items.push_back(entry());
+            }
+            else
+            {
+                i = free_items.back();
+                free_items.pop_back();
+            }
+            items[i] = entry(&(current->second), interval, rect);
+            mine.push_back(i);
+
+            if(!tree)
+                tree = new rtree2d();
+            rtree2d::entry leaf(rect, i);
+            tree->insert(leaf);
+        }
     }
 
     std::vector<network_aux::road_spatial::entry> network_aux::road_spatial::query(const aabb2d &rect) const
@@ -60,4 +122,438 @@ namespace hwm
 
         return res;
     }
+
+    static inline float cross2(const vec2f &a, const vec2f &b)
+    {
+        return a[0]*b[1] - a[1]*b[0];
+    }
+
+    // Outline of a lane_cont: low side forward, then high side backward; interior is a point in the middle of the band
+    static void band_polygon(std::vector<vec2f> &poly, vec2f &interior, const network_aux::road_spatial::entry &e, const float lane_width, const float resolution)
+    {
+        const network_aux::road_rev_map::lane_cont &lc(*e.lc);
+        const arc_road                             &ar(lc.begin()->second.membership->parent_road->rep);
+        const float                                 low_offset  = lc.begin()->first-lane_width/2;
+        const float                                 high_offset = boost::prior(lc.end())->first+lane_width/2;
+
+        std::vector<vertex> low;
+        std::vector<vertex> high;
+        ar.extract_line(low,  e.interval, low_offset,  resolution);
+        ar.extract_line(high, e.interval, high_offset, resolution);
+
+        const float mid = 0.5f*(e.interval[0] + e.interval[1]);
+        const vec3f center(ar.point(mid, 0.5f*(low_offset + high_offset)));
+        interior = vec2f(center[0], center[1]);
+
+        poly.clear();
+        poly.reserve(low.size() + high.size());
+        BOOST_FOREACH(const vertex &v, low)
+        {
+            poly.push_back(vec2f(v.position[0], v.position[1]));
+        }
+        BOOST_REVERSE_FOREACH(const vertex &v, high)
+        {
+            poly.push_back(vec2f(v.position[0], v.position[1]));
+        }
+    }
+
+    static bool point_in_polygon(const vec2f &pt, const std::vector<vec2f> &poly)
+    {
+        bool inside = false;
+        for(size_t i = 0, j = poly.size()-1; i < poly.size(); j = i++)
+        {
+            if((poly[i][1] > pt[1]) != (poly[j][1] > pt[1]) &&
+               pt[0] < poly[j][0] + (poly[i][0] - poly[j][0])*(pt[1] - poly[j][1])/(poly[i][1] - poly[j][1]))
+                inside = !inside;
+        }
+        return inside;
+    }
+
+    // Crossings within eps of an edge's ends are ignored, so bands that only share an end cap
+    // (consecutive roads) aren't reported
+    static bool polygons_overlap(const std::vector<vec2f> &a, const vec2f &a_interior, const std::vector<vec2f> &b, const vec2f &b_interior)
+    {
+        static const float eps = 1e-4f;
+        for(size_t i = 0, pi = a.size()-1; i < a.size(); pi = i++)
+        {
+            const vec2f r(a[i] - a[pi]);
+            for(size_t j = 0, pj = b.size()-1; j < b.size(); pj = j++)
+            {
+                const vec2f sv(b[j] - b[pj]);
+                const float denom = cross2(r, sv);
+                if(std::abs(denom) < 1e-12f)
+                    continue;
+
+                const vec2f diff(b[pj] - a[pi]);
+                const float s = cross2(diff, sv)/denom;
+                const float u = cross2(diff, r)/denom;
+                if(s > eps && s < 1.0f-eps && u > eps && u < 1.0f-eps)
+                    return true;
+            }
+        }
+
+        // No edges cross; one band may still contain the other
+        return point_in_polygon(a_interior, b) || point_in_polygon(b_interior, a);
+    }
+
+    std::vector<network_aux::road_spatial::item_pair> network_aux::road_spatial::overlapping(const float lane_width, const float resolution) const
+    {
+        std::vector<item_pair> res;
+        if(!tree)
+            return res;
+
+        std::vector<item_pair> candidates;
+        tree->self_join(candidates);
+
+        std::vector<std::vector<vec2f> > polys(items.size());
+        std::vector<vec2f>               interiors(items.size());
+        const long                       nitems = static_cast<long>(items.size());
+#pragma omp parallel for schedule(dynamic, 16)
+        for(long i = 0; i < nitems; ++i)
+            if(items[i].lc)
+                band_polygon(polys[i], interiors[i], items[i], lane_width, resolution);
+
+        std::vector<char> keep(candidates.size(), 0);
+        const long ncand = static_cast<long>(candidates.size());
+#pragma omp parallel for schedule(dynamic, 64)
+        for(long c = 0; c < ncand; ++c)
+        {
+            const size_t i = candidates[c].first;
+            const size_t j = candidates[c].second;
+            if(items[i].lc->begin()->second.membership->parent_road == items[j].lc->begin()->second.membership->parent_road)
+                continue;
+
+            keep[c] = polys[i].size() > 2 && polys[j].size() > 2 && polygons_overlap(polys[i], interiors[i], polys[j], interiors[j]);
+        }
+
+        for(size_t c = 0; c < candidates.size(); ++c)
+            if(keep[c])
+                res.push_back(candidates[c]);
+
+        return res;
+    }
+
+    network_aux::lane_spatial::entry::entry() : lane(0), membership(0), feature(0)
+    {
+    }
+
+    network_aux::lane_spatial::entry::entry(hwm::lane *l, const hwm::lane::road_membership *rm, const size_t f, const vec2f &fi, const vec2f &li, const aabb2d &r)
+        : lane(l), membership(rm), feature(f), feature_interval(fi), lane_interval(li), rect(r)
+    {
+    }
+
+    network_aux::lane_spatial::lane_spatial() : tree(0)
+    {
+    }
+
+    network_aux::lane_spatial::~lane_spatial()
+    {
+        if(tree)
+            delete tree;
+    }
+
+    void network_aux::lane_spatial::lane_entries(std::vector<entry> &res, hwm::lane *l, const float lane_width)
+    {
+        for(lane::road_membership::intervals::const_iterator rmi = l->road_memberships.begin(); rmi != l->road_memberships.end(); ++rmi)
+        {
+            const lane::road_membership &rm(rmi->second);
+            const arc_road              &ar(rm.parent_road->rep);
+            const vec2f                  lane_iv(l->road_memberships.containing_interval(rmi));
+            const float                  offset = rm.lane_position;
+            const float                  len    = ar.length(offset);
+            const float                  rspan  = rm.interval[1] - rm.interval[0];
+            if(len <= 0.0f || rspan == 0.0f)
+                continue;
+
+            const float  rlow  = std::min(rm.interval[0], rm.interval[1]);
+            const float  rhigh = std::max(rm.interval[0], rm.interval[1]);
+            float        start_local;
+            const size_t start_feature = ar.locate_scale(rlow,  offset, start_local);
+            float        end_local;
+            const size_t end_feature   = ar.locate_scale(rhigh, offset, end_local);
+
+            for(size_t f = start_feature; f <= end_feature; ++f)
+            {
+                const vec2f fi(f == start_feature ? start_local : 0.0f,
+                               f == end_feature   ? end_local   : 1.0f);
+                if(ar.feature_size(f, offset) <= 0.0f || fi[1] <= fi[0])
+                    continue;
+
+                aabb2d rect(ar.bound_feature2d(offset, fi, f));
+                for(int d = 0; d < 2; ++d)
+                {
+                    rect.bounds[0][d] -= lane_width/2;
+                    rect.bounds[1][d] += lane_width/2;
+                }
+
+                // road parameter -> membership-local -> lane parameter
+                float lt[2];
+                for(int e = 0; e < 2; ++e)
+                {
+                    const float rt    = ar.length_at_feature(f, fi[e], offset)/len;
+                    const float local = std::min(std::max((rt - rm.interval[0])/rspan, 0.0f), 1.0f);
+                    lt[e]             = lane_iv[0] + local*(lane_iv[1] - lane_iv[0]);
+                }
+
+                res.push_back(entry(l, &rm, f, fi, vec2f(lt[0], lt[1]), rect));
+            }
+        }
+    }
+
+    void network_aux::lane_spatial::build(const float lane_width, lane_map &lanes)
+    {
+        if(tree)
+            delete tree;
+        tree = 0;
+        items.clear();
+        lane_items.clear();
+        free_items.clear();
+        bounds = aabb2d();
+
+        BOOST_FOREACH(lane_pair &lp, lanes)
+        {
+            const size_t start = items.size();
+            lane_entries(items, &(lp.second), lane_width);
+            std::vector<size_t> &mine = lane_items[lp.first];
+            for(size_t i = start; i < items.size(); ++i)
+                mine.push_back(i);
+        }
+
+        std::vector<rtree2d::entry> leaves;
+        leaves.reserve(items.size());
+        for(size_t i = 0; i < items.size(); ++i)
+        {
+            leaves.push_back(rtree2d::entry(items[i].rect, i));
+            bounds = bounds.funion(items[i].rect);
+        }
+
+        if(!leaves.empty())
+            tree = rtree2d::hilbert_rtree(leaves);
+    }
+
+    void network_aux::lane_spatial::remove_lane(const str &id)
+    {
+        const strhash<std::vector<size_t> >::type::iterator li = lane_items.find(id);
+        if(li == lane_items.end())
+            return;
+
+        BOOST_FOREACH(const size_t i, li->second)
+        {
+            tree->remove(rtree2d::entry(items[i].rect, i));
+            items[i] = entry();
+            free_items.push_back(i);
+        }
+        lane_items.erase(li);
+
+        if(tree && !tree->root)
+        {
+            delete tree;
+            tree = 0;
+        }
+    }
+
+    // bounds only grows; it is just the clip box for query_ray
+    void network_aux::lane_spatial::add_lane(const float lane_width, hwm::lane *l)
+    {
+        std::vector<entry> fresh;
+        lane_entries(fresh, l, lane_width);
+
+        std::vector<size_t> &mine = lane_items[l->id];
+        assert(mine.empty());
+        BOOST_FOREACH(const entry &e, fresh)
+        {
+            size_t i;
+            if(free_items.empty())
+            {
+                i = items.size();
+                items.push_back(entry());
+            }
+            else
+            {
+                i = free_items.back();
+                free_items.pop_back();
+            }
+            items[i] = e;
+            mine.push_back(i);
+            bounds = bounds.funion(e.rect);
+
+            if(!tree)
+                tree = new rtree2d();
+            rtree2d::entry leaf(e.rect, i);
+            tree->insert(leaf);
+        }
+    }
+
+    std::vector<network_aux::lane_spatial::entry> network_aux::lane_spatial::query(const aabb2d &rect) const
+    {
+        std::vector<entry> res;
+        if(tree)
+        {
+            const std::vector<size_t> q_res(tree->query(rect));
+            BOOST_FOREACH(const size_t &i, q_res)
+            {
+                res.push_back(items[i]);
+            }
+        }
+
+        return res;
+    }
+
+    static inline vec2f feature_point(const arc_road &ar, const size_t f, const float local, const float offset, const float len)
+    {
+        const vec3f pt(ar.point(ar.length_at_feature(f, local, offset)/len, offset));
+        return vec2f(pt[0], pt[1]);
+    }
+
+    static void add_hit(std::vector<network_aux::lane_spatial::hit> &res, const network_aux::lane_spatial::entry &e,
+                        const float local, const float s, const float seg_len, const float offset, const float len)
+    {
+        const arc_road &ar(e.membership->parent_road->rep);
+        const float     fspan = e.feature_interval[1] - e.feature_interval[0];
+        const float     u     = fspan > 0.0f ? (local - e.feature_interval[0])/fspan : 0.0f;
+
+        network_aux::lane_spatial::hit h;
+        h.lane     = e.lane;
+        h.t        = e.lane_interval[0] + u*(e.lane_interval[1] - e.lane_interval[0]);
+        h.distance = s*seg_len;
+        h.point    = ar.point(ar.length_at_feature(e.feature, local, offset)/len, offset);
+        res.push_back(h);
+    }
+
+    // How near a segment may pass a feature and still touch it: a few float steps at the feature's coordinates,
+    // so segments that end on a lane or graze an arc still hit it after rounding
+    static inline float contact_slop(const vec2f &p0, const vec2f &p1)
+    {
+        const float mag = std::max(std::max(std::abs(p0[0]), std::abs(p0[1])), std::max(std::abs(p1[0]), std::abs(p1[1])));
+        return 1e-4f + 1e-6f*mag;
+    }
+
+    static inline float clamp01(const float x)
+    {
+        return std::min(std::max(x, 0.0f), 1.0f);
+    }
+
+    void network_aux::lane_spatial::feature_hits(std::vector<hit> &res, const entry &e, const vec2f &p0, const vec2f &p1)
+    {
+        const arc_road &ar(e.membership->parent_road->rep);
+        const float     offset  = e.membership->lane_position;
+        const float     len     = ar.length(offset);
+        const vec2f     r(p1 - p0);
+        const float     seg_len = std::sqrt(tvmet::dot(r, r));
+        const vec2f     q0(feature_point(ar, e.feature, e.feature_interval[0], offset, len));
+        const vec2f     q1(feature_point(ar, e.feature, e.feature_interval[1], offset, len));
+        const float     slop    = contact_slop(q0, q1);
+        const float     s_slop  = seg_len > 0.0f ? slop/seg_len : 0.0f;
+
+        if(!(e.feature & 1))
+        {
+            const vec2f sv(q1 - q0);
+            const float denom = cross2(r, sv);
+            if(std::abs(denom) < 1e-12f)
+                return;
+
+            const vec2f diff(q0 - p0);
+            const float s      = cross2(diff, sv)/denom;
+            const float u      = cross2(diff, r)/denom;
+            const float u_slop = slop/std::sqrt(tvmet::dot(sv, sv));
+            if(s >= -s_slop && s <= 1.0f + s_slop && u >= -u_slop && u <= 1.0f + u_slop)
+                add_hit(res, e, e.feature_interval[0] + clamp01(u)*(e.feature_interval[1] - e.feature_interval[0]), clamp01(s), seg_len, offset, len);
+        }
+        else
+        {
+            // The offset curve of an arc is a concentric arc; intersect with its circle in the plane
+            const mat4x4f &frame(ar.frames_[e.feature/2]);
+            const vec2f    c(frame(0, 3), frame(1, 3));
+            const vec2f    a(q0 - c);
+            const float    rad2  = tvmet::dot(a, a);
+            const float    rad   = std::sqrt(rad2);
+            const float    sweep = ar.arcs_[e.feature/2]*(e.feature_interval[1] - e.feature_interval[0]);
+            if(sweep <= 0.0f)
+                return;
+
+            const vec2f qm(feature_point(ar, e.feature, 0.5f*(e.feature_interval[0] + e.feature_interval[1]), offset, len));
+            const float orient = cross2(a, qm - c) < 0.0f ? -1.0f : 1.0f;
+
+            // From the point of the line nearest the centre, in double: far from the origin, or for long segments,
+            // the terms cancel down to the arc's size and a grazing line's hits would move along it by metres
+            const vec2f  pc(p0 - c);
+            const double qa = static_cast<double>(r[0])*r[0] + static_cast<double>(r[1])*r[1];
+            if(qa <= 0.0)
+                return;
+
+            const double sc    = -(static_cast<double>(r[0])*pc[0] + static_cast<double>(r[1])*pc[1])/qa;
+            const double nc[2] = {pc[0] + sc*r[0], pc[1] + sc*r[1]};
+            double       h2    = rad2 - (nc[0]*nc[0] + nc[1]*nc[1]);
+            // -h2 is about 2*rad times how far the line misses the circle
+            if(h2 < 0.0 && h2 >= -2.0*rad*slop)
+                h2 = 0.0;
+            if(h2 < 0.0)
+                return;
+
+            const double ds    = std::sqrt(h2/qa);
+            const float  ss[2] = {static_cast<float>(sc - ds), static_cast<float>(sc + ds)};
+            for(int i = 0; i < (h2 > 0.0 ? 2 : 1); ++i)
+            {
+                if(ss[i] < -s_slop || ss[i] > 1.0f + s_slop)
+                    continue;
+
+                const vec2f hc(pc + clamp01(ss[i])*r);
+                float       ang = orient*std::atan2(cross2(a, hc), tvmet::dot(a, hc));
+                if(ang < -slop/rad)
+                    ang += 2.0f*M_PI;
+                if(ang > sweep + slop/rad)
+                    continue;
+
+                const float frac = clamp01(ang/sweep);
+                add_hit(res, e, e.feature_interval[0] + frac*(e.feature_interval[1] - e.feature_interval[0]), clamp01(ss[i]), seg_len, offset, len);
+            }
+        }
+    }
+
+    std::vector<network_aux::lane_spatial::hit> network_aux::lane_spatial::query_segment(const vec2f &p0, const vec2f &p1) const
+    {
+        std::vector<hit> res;
+        if(!tree)
+            return res;
+
+        const float              fp0[2] = {p0[0], p0[1]};
+        const float              fp1[2] = {p1[0], p1[1]};
+        const std::vector<size_t> q_res(tree->query_segment(fp0, fp1));
+        BOOST_FOREACH(const size_t &i, q_res)
+        {
+            feature_hits(res, items[i], p0, p1);
+        }
+
+        std::sort(res.begin(), res.end());
+        return res;
+    }
+
+    std::vector<network_aux::lane_spatial::hit> network_aux::lane_spatial::query_ray(const vec2f &origin, const vec2f &dir) const
+    {
+        // Clip to the extent of the index so the exact tests work on a finite segment
+        float tmax = std::numeric_limits<float>::max();
+        for(int i = 0; i < 2; ++i)
+        {
+            if(dir[i] > 0.0f)
+                tmax = std::min(tmax, (bounds.bounds[1][i] - origin[i])/dir[i]);
+            else if(dir[i] < 0.0f)
+                tmax = std::min(tmax, (bounds.bounds[0][i] - origin[i])/dir[i]);
+        }
+
+        if(!tree || !(tmax > 0.0f) || tmax == std::numeric_limits<float>::max())
+            return std::vector<hit>();
+
+        return query_segment(origin, vec2f(origin + tmax*dir));
+    }
+
+    void network_aux::lane_spatial::query_segments(std::vector<std::vector<hit> > &res, const std::vector<vec2f> &p0s, const std::vector<vec2f> &p1s) const
+    {
+        assert(p0s.size() == p1s.size());
+        res.resize(p0s.size());
+
+        const long n = static_cast<long>(p0s.size());
+#pragma omp parallel for schedule(dynamic, 64)
+        for(long i = 0; i < n; ++i)
+            res[i] = query_segment(p0s[i], p1s[i]);
+    }
 }
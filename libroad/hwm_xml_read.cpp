@@ -1,5 +1,20 @@
 #include "hwm_network.hpp"
 #include "xml_util.hpp"
+#include "profile.hpp"
+#include "compression.hpp"
+#include <boost/scoped_ptr.hpp>
+#include <cstring>
+#include <set>
+#include <libxml/parser.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#if HAVE_MMAP
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 void polyline_road::xml_read(xmlpp::TextReader &reader, const vec3f &scale)
 {
@@ -14,26 +29,15 @@ void polyline_road::xml_read(xmlpp::TextReader &reader, const vec3f &scale)
         if(reader.get_node_type() == xmlpp::TextReader::Text ||
            reader.get_node_type() == xmlpp::TextReader::SignificantWhitespace)
         {
-            std::string                 res(reader.get_value());
-            typedef boost::tokenizer<boost::char_separator<char> > tokenizer;
-            boost::char_separator<char> linesep("\n");
-            tokenizer                   linetokens(res, linesep);
-
-            BOOST_FOREACH(const std::string &ltok, linetokens)
+            number_tokens tokens(text_value(reader));
+            vec3f         pos;
+            while(tokens.next(pos[0]))
             {
-                std::string trim_ltok(ltok);
-                boost::trim_left(trim_ltok);
-                if(!trim_ltok.empty())
-                {
-                    std::stringstream instr(trim_ltok);
+                if(!tokens.next(pos[1]) || !tokens.next(pos[2]))
+                    throw xml_error(reader, "Incomplete point!");
+                tokens.skip_line();
 
-                    vec3f pos;
-                    instr >> pos[0];
-                    instr >> pos[1];
-                    instr >> pos[2];
-
-                    points_.push_back(vec3f(pos*scale));
-                }
+                points_.push_back(vec3f(pos*scale));
             }
         }
     }
@@ -58,26 +62,15 @@ void arc_road::xml_read(xmlpp::TextReader &reader, const vec3f &scale)
         if(reader.get_node_type() == xmlpp::TextReader::Text ||
            reader.get_node_type() == xmlpp::TextReader::SignificantWhitespace)
         {
-            std::string                 res(reader.get_value());
-            typedef boost::tokenizer<boost::char_separator<char> > tokenizer;
-            boost::char_separator<char> linesep("\n");
-            tokenizer                   linetokens(res, linesep);
-
-            BOOST_FOREACH(const std::string &ltok, linetokens)
+            number_tokens tokens(text_value(reader));
+            vec3f         pos;
+            while(tokens.next(pos[0]))
             {
-                std::string trim_ltok(ltok);
-                boost::trim_left(trim_ltok);
-                if(!trim_ltok.empty())
-                {
-                    std::stringstream instr(trim_ltok);
+                if(!tokens.next(pos[1]) || !tokens.next(pos[2]))
+                    throw xml_error(reader, "Incomplete point!");
+                tokens.skip_line();
 
-                    vec3f pos;
-                    instr >> pos[0];
-                    instr >> pos[1];
-                    instr >> pos[2];
-
-                    points_.push_back(vec3f(pos*scale));
-                }
+                points_.push_back(vec3f(pos*scale));
             }
         }
     }
@@ -92,24 +85,13 @@ void arc_road::xml_read(xmlpp::TextReader &reader, const vec3f &scale)
         if(reader.get_node_type() == xmlpp::TextReader::Text ||
            reader.get_node_type() == xmlpp::TextReader::SignificantWhitespace)
         {
-            std::string                 res(reader.get_value());
-            typedef boost::tokenizer<boost::char_separator<char> > tokenizer;
-            boost::char_separator<char> linesep("\n");
-            tokenizer                   linetokens(res, linesep);
-
-            BOOST_FOREACH(const std::string &ltok, linetokens)
+            number_tokens tokens(text_value(reader));
+            float         rad;
+            while(tokens.next(rad))
             {
-                std::string trim_ltok(ltok);
-                boost::trim_left(trim_ltok);
-                if(!trim_ltok.empty())
-                {
-                    std::stringstream instr(trim_ltok);
+                tokens.skip_line();
 
-                    float rad;
-                    instr >> rad;
-
-                    radii_.push_back(rad*scale[0]);
-                }
+                radii_.push_back(rad*scale[0]);
             }
         }
     }
@@ -133,26 +115,15 @@ void arc_road::xml_read_as_poly(xmlpp::TextReader &reader, const vec3f &scale)
         if(reader.get_node_type() == xmlpp::TextReader::Text ||
            reader.get_node_type() == xmlpp::TextReader::SignificantWhitespace)
         {
-            std::string                 res(reader.get_value());
-            typedef boost::tokenizer<boost::char_separator<char> > tokenizer;
-            boost::char_separator<char> linesep("\n");
-            tokenizer                   linetokens(res, linesep);
-
-            BOOST_FOREACH(const std::string &ltok, linetokens)
+            number_tokens tokens(text_value(reader));
+            vec3f         pos;
+            while(tokens.next(pos[0]))
             {
-                std::string trim_ltok(ltok);
-                boost::trim_left(trim_ltok);
-                if(!trim_ltok.empty())
-                {
-                    std::stringstream instr(trim_ltok);
+                if(!tokens.next(pos[1]) || !tokens.next(pos[2]))
+                    throw xml_error(reader, "Incomplete point!");
+                tokens.skip_line();
 
-                    vec3f pos;
-                    instr >> pos[0];
-                    instr >> pos[1];
-                    instr >> pos[2];
-
-                    points_.push_back(vec3f(pos*scale));
-                }
+                points_.push_back(vec3f(pos*scale));
             }
         }
     }
@@ -207,15 +178,29 @@ void partition01<T>::xml_read(C &n, xmlpp::TextReader &reader, const str &tag)
 
 namespace hwm
 {
+    // What retrieve does with an id that isn't in the map yet. The streaming reader inserts it;
+    // threads reading chunks for the parallel loaders find every item entered before they start, and
+    // the maps they share must not change under them. The region loader enters only what it keeps,
+    // so references out of the region come back null.
+    enum unknown_ref_t {INSERT_UNKNOWN, THROW_UNKNOWN, NULL_UNKNOWN};
+    static unknown_ref_t unknown_refs = INSERT_UNKNOWN;
+    #pragma omp threadprivate(unknown_refs)
+
     template <class T>
     static inline T* retrieve(typename strhash<T>::type &m, const str &id)
     {
         typedef typename strhash<T>::type val;
         typename strhash<T>::type::iterator entry(m.find(id));
         if(entry == m.end())
-            m.insert(entry, std::make_pair(id, T()));
+        {
+            if(unknown_refs == THROW_UNKNOWN)
+                throw std::runtime_error(boost::str(boost::format("Reference to unknown item %s") % id));
+            else if(unknown_refs == NULL_UNKNOWN)
+                return 0;
+            entry = m.insert(entry, std::make_pair(id, T()));
+        }
 
-        return &(m[id]);
+        return &(entry->second);
     }
 
     void intersection::state::xml_read(xmlpp::TextReader &reader)
@@ -250,6 +235,8 @@ namespace hwm
         get_attribute(lane_position, reader, "lane_position");
 
         parent_road = retrieve<road>(n.roads, ref);
+        if(!parent_road)
+            throw xml_error(reader, boost::str(boost::format("Road %s wasn't loaded") % ref));
 
         read_to_close(reader, "road_membership");
     }
@@ -310,23 +297,10 @@ namespace hwm
         str ref;
         get_attribute(ref, reader, "ref");
 
+        // intersect_in_ref is filled in by link_intersections once the whole network is read
         adjacent_intersection = retrieve<intersection>(n.intersections, ref);
         intersect_in_ref = -1;
 
-        if(!adjacent_intersection->id.empty())
-        {
-            const std::vector<lane*> &cont(tag == "start" ? adjacent_intersection->outgoing : adjacent_intersection->incoming);
-            size_t pos = 0;
-            while(cont[pos] != parent)
-            {
-                if(pos >= cont.size())
-                    throw xml_error(reader, boost::str(boost::format("Lane %s reports that it is incident on intersection %s, but intersection does not") % parent->id % adjacent_intersection->id));
-
-                ++pos;
-            }
-            intersect_in_ref = pos;
-        }
-
         read_to_close(reader, tag);
     }
 
@@ -392,6 +366,15 @@ namespace hwm
 
         res->xml_read(n, parent, reader, tag);
 
+        // A connection out of a partially loaded network becomes its boundary
+        const lane::intersection_terminus *it = dynamic_cast<const lane::intersection_terminus*>(res);
+        const lane::lane_terminus         *lt = dynamic_cast<const lane::lane_terminus*>(res);
+        if((it && !it->adjacent_intersection) || (lt && !lt->adjacent_lane))
+        {
+            delete res;
+            res = new lane::terminus();
+        }
+
         return res;
     }
 
@@ -471,7 +454,7 @@ namespace hwm
             throw xml_error(reader, boost::str(boost::format("No adjacencies in lane %s!") % id));
     }
 
-    static inline void xml_incident_read(network &n, std::vector<lane*> &lv, xmlpp::TextReader &reader, bool incoming, const str &intersect_id)
+    static inline void xml_incident_read(network &n, std::vector<lane*> &lv, xmlpp::TextReader &reader)
     {
         assert(is_opening_element(reader, "lane_ref"));
 
@@ -486,16 +469,72 @@ namespace hwm
         assert(lv.size() > loc);
         lv[loc] = retrieve<lane>(n.lanes, ref);
 
-        if(!lv[loc]->id.empty())
+        read_to_close(reader, "lane_ref");
+    }
+
+    // Sets the intersect_in_ref of every intersection terminus and checks that lanes and intersections agree on it.
+    // Lanes and intersections that were referenced but never read (empty id) are left alone, as the readers always have.
+    // Each terminus is written only by the intersection it names, so this runs in parallel.
+    static void link_intersections(network &n)
+    {
+        std::vector<intersection*> inters;
+        inters.reserve(n.intersections.size());
+        BOOST_FOREACH(intersection_pair &ip, n.intersections)
         {
-            lane::intersection_terminus *term = dynamic_cast<lane::intersection_terminus*>(incoming ? lv[loc]->end : lv[loc]->start);
+            inters.push_back(&(ip.second));
+        }
+        std::vector<lane*> lanes;
+        lanes.reserve(n.lanes.size());
+        BOOST_FOREACH(lane_pair &lp, n.lanes)
+        {
+            lanes.push_back(&(lp.second));
+        }
+
+        std::vector<str> errors(std::max(inters.size(), lanes.size()));
+
+        #pragma omp parallel for schedule(dynamic, 64)
+        for(long i = 0; i < static_cast<long>(inters.size()); ++i)
+        {
+            intersection &is = *(inters[i]);
+            for(int incoming = 0; incoming < 2 && errors[i].empty(); ++incoming)
+            {
+                const std::vector<lane*> &lv = incoming ? is.incoming : is.outgoing;
+                for(size_t loc = 0; loc < lv.size(); ++loc)
+                {
+                    if(!lv[loc] || lv[loc]->id.empty())
+                        continue;
 
-            if(!term->adjacent_intersection || term->adjacent_intersection->id != intersect_id)
-                throw xml_error(reader, boost::str(boost::format("Intersection %s reports that it is incident on lane %s, but lane does not") % intersect_id % lv[loc]->id));
-            term->intersect_in_ref = loc;
+                    lane::intersection_terminus *term = dynamic_cast<lane::intersection_terminus*>(incoming ? lv[loc]->end : lv[loc]->start);
+                    if(!term || term->adjacent_intersection != &is)
+                    {
+                        errors[i] = boost::str(boost::format("Intersection %s reports that it is incident on lane %s, but lane does not") % is.id % lv[loc]->id);
+                        break;
+                    }
+                    term->intersect_in_ref = loc;
+                }
+            }
+        }
+        BOOST_FOREACH(const str &e, errors)
+        {
+            if(!e.empty())
+                throw std::runtime_error(e);
         }
 
-        read_to_close(reader, "lane_ref");
+        #pragma omp parallel for schedule(dynamic, 64)
+        for(long i = 0; i < static_cast<long>(lanes.size()); ++i)
+        {
+            for(int start = 0; start < 2; ++start)
+            {
+                const lane::intersection_terminus *term = dynamic_cast<const lane::intersection_terminus*>(start ? lanes[i]->start : lanes[i]->end);
+                if(term && term->adjacent_intersection && !term->adjacent_intersection->id.empty() && term->intersect_in_ref < 0)
+                    errors[i] = boost::str(boost::format("Lane %s reports that it is incident on intersection %s, but intersection does not") % lanes[i]->id % term->adjacent_intersection->id);
+            }
+        }
+        BOOST_FOREACH(const str &e, errors)
+        {
+            if(!e.empty())
+                throw std::runtime_error(e);
+        }
     }
 
     void intersection::xml_read(network &n, xmlpp::TextReader &reader)
@@ -520,7 +559,7 @@ namespace hwm
                     read_skip_comment(reader);
 
                     if(is_opening_element(reader, "lane_ref"))
-                        xml_incident_read(n, incoming, reader, true, id);
+                        xml_incident_read(n, incoming, reader);
                 }
             }
             else if(is_opening_element(reader, "outgoing"))
@@ -530,7 +569,7 @@ namespace hwm
                     read_skip_comment(reader);
 
                     if(is_opening_element(reader, "lane_ref"))
-                        xml_incident_read(n, outgoing, reader, false, id);
+                        xml_incident_read(n, outgoing, reader);
                 }
             }
         }
@@ -554,11 +593,8 @@ namespace hwm
         }
     }
 
-    network load_xml_network(const char *filename, const vec3f &scale)
+    static void xml_read_network_attributes(network &n, xmlpp::TextReader &reader)
     {
-        network n;
-        xmlpp::TextReader reader(filename);
-
         read_skip_comment(reader);
 
         if(!is_opening_element(reader, "network"))
@@ -579,6 +615,35 @@ namespace hwm
         if(n.gamma <= 0.0f ||
            n.gamma >= 1.0f)
             throw xml_error(reader, "Invalid gamma!");
+    }
+
+    // libxml2 stops at the end of the first member of a multi-member gzip file, so PARALLEL_GZIP files are inflated here
+    static bool inflate_parallel_gzip(std::string &res, const char *filename)
+    {
+        unsigned char header[pgzip::header_bytes];
+        size_t        member_bytes;
+        {
+            std::ifstream in(filename, std::ios::binary);
+            if(!in.read(reinterpret_cast<char*>(header), sizeof(header)) || !pgzip::member_header(header, member_bytes))
+                return false;
+        }
+
+        boost::iostreams::filtering_istream *in = decompressing_istream(filename);
+        res.assign(std::istreambuf_iterator<char>(*in), std::istreambuf_iterator<char>());
+        delete in;
+        return true;
+    }
+
+    // Streams the whole file into n
+    static void xml_read_network(network &n, const char *filename, const vec3f &scale)
+    {
+        std::string                                inflated;
+        const boost::scoped_ptr<xmlpp::TextReader> reader_ptr(inflate_parallel_gzip(inflated, filename) ?
+                                                               new xmlpp::TextReader(reinterpret_cast<const unsigned char*>(inflated.data()), inflated.size(), filename) :
+                                                               new xmlpp::TextReader(filename));
+        xmlpp::TextReader                         &reader = *reader_ptr;
+
+        xml_read_network_attributes(n, reader);
 
         bool have_roads         = false;
         bool have_lanes         = false;
@@ -606,6 +671,550 @@ namespace hwm
 
         reader.close();
 
+        link_intersections(n);
+    }
+
+    network load_xml_network(const char *filename, const vec3f &scale)
+    {
+        PROFILE_SCOPE("hwm::load_xml_network");
+        network n;
+        xml_read_network(n, filename, scale);
+
+        PROFILE_COUNT("roads",         n.roads.size());
+        PROFILE_COUNT("lanes",         n.lanes.size());
+        PROFILE_COUNT("intersections", n.intersections.size());
+        return n;
+    }
+
+    // The text of an XML file; mapped if it is plain, inflated into memory if it is gzipped
+    struct xml_text
+    {
+        xml_text(const char *filename) : begin(0), end(0), map_root(0), map_bytes(0)
+        {
+            unsigned char magic[2] = {0, 0};
+            {
+                std::ifstream in(filename, std::ios::binary);
+                if(!in)
+                    throw std::runtime_error(boost::str(boost::format("Can't open network %s") % filename));
+                in.read(reinterpret_cast<char*>(magic), sizeof(magic));
+            }
+
+#if HAVE_MMAP
+            if(magic[0] != 0x1f || magic[1] != 0x8b)
+            {
+                const int   fi = open(filename, O_RDONLY);
+                struct stat fs;
+                if(fi >= 0 && fstat(fi, &fs) == 0 && fs.st_size > 0)
+                {
+                    map_bytes = fs.st_size;
+                    map_root  = mmap(0, map_bytes, PROT_READ, MAP_SHARED, fi, 0);
+                    if(map_root == MAP_FAILED)
+                        map_root = 0;
+                }
+                if(fi >= 0)
+                    close(fi);
+                if(map_root)
+                {
+                    begin = static_cast<const char*>(map_root);
+                    end   = begin + map_bytes;
+                    return;
+                }
+            }
+#endif
+            boost::iostreams::filtering_istream *in = decompressing_istream(filename);
+            inflated.assign(std::istreambuf_iterator<char>(*in), std::istreambuf_iterator<char>());
+            delete in;
+            begin = inflated.data();
+            end   = begin + inflated.size();
+        }
+
+        ~xml_text()
+        {
+#if HAVE_MMAP
+            if(map_root)
+                munmap(map_root, map_bytes);
+#endif
+        }
+
+        const char  *begin;
+        const char  *end;
+        std::string  inflated;
+        void        *map_root;
+        size_t       map_bytes;
+    };
+
+    static inline const char *find_text(const char *begin, const char *end, const char *pat)
+    {
+        const char *res = std::search(begin, end, pat, pat + std::strlen(pat));
+        return res == end ? 0 : res;
+    }
+
+    // The next <name ...> start tag in [begin, end), skipping longer names with the same prefix
+    static const char *find_start_tag(const char *begin, const char *end, const char *name)
+    {
+        const std::string pat(boost::str(boost::format("<%s") % name));
+        while((begin = find_text(begin, end, pat.c_str())))
+        {
+            if(begin + pat.size() >= end)
+                return 0;
+            const char c = begin[pat.size()];
+            if(c == '>' || c == '/' || c == ' ' || c == '\t' || c == '\n' || c == '\r')
+                return begin;
+            begin += pat.size();
+        }
+        return 0;
+    }
+
+    // Where the items of one section (e.g. the <road>s in <roads>) lie in the file: items[i] starts at starts[i],
+    // and starts.back() is the section's closing tag
+    struct xml_section
+    {
+        std::vector<const char*> starts;
+        std::vector<str>         ids;
+    };
+
+    // Finds the section and its items' ids with a plain text scan.
+    // Returns false for anything the scan can't vouch for (comments, CDATA, ids with entities or in single quotes),
+    // in which case the file has to go through the streaming reader.
+    static bool scan_section(xml_section &sec, const char *begin, const char *end, const char *container, const char *item)
+    {
+        const char *open = find_start_tag(begin, end, container);
+        if(!open)
+            return true;
+
+        const char *open_end = static_cast<const char*>(std::memchr(open, '>', end - open));
+        if(!open_end)
+            return false;
+        if(open_end[-1] == '/')
+        {
+            sec.starts.push_back(open_end + 1);
+            return true;
+        }
+        ++open_end;
+
+        const std::string close_tag(boost::str(boost::format("</%s>") % container));
+        const char *close = find_text(open_end, end, close_tag.c_str());
+        if(!close || find_text(open_end, close, "<!--") || find_text(open_end, close, "<![CDATA["))
+            return false;
+
+        const char *pos = open_end;
+        while((pos = find_start_tag(pos, close, item)))
+        {
+            const char *tag_end = static_cast<const char*>(std::memchr(pos, '>', close - pos));
+            if(!tag_end)
+                return false;
+
+            const char *id = find_text(pos, tag_end, " id=\"");
+            if(!id)
+                return false;
+            id += 5;
+            const char *id_end = static_cast<const char*>(std::memchr(id, '"', tag_end - id));
+            if(!id_end || std::memchr(id, '&', id_end - id))
+                return false;
+
+            sec.starts.push_back(pos);
+            sec.ids.push_back(str(std::string(id, id_end)));
+            pos = tag_end;
+        }
+        sec.starts.push_back(close);
+        return true;
+    }
+
+    // Enters every item of the section (only those marked in keep, if it is given) with its id set
+    template <typename T>
+    static void enter_items(T &themap, const xml_section &sec, const char *item_name, const std::vector<char> *keep = 0)
+    {
+        for(size_t i = 0; i < sec.ids.size(); ++i)
+        {
+            if(keep && !(*keep)[i])
+                continue;
+
+            const str &id = sec.ids[i];
+            const typename T::iterator vp(themap.insert(themap.end(), std::make_pair(id, typename T::value_type::second_type())));
+            if(!vp->second.id.empty())
+                throw std::runtime_error(boost::str(boost::format("Duplicate %s id %s") % item_name % id));
+            vp->second.id = vp->first;
+        }
+    }
+
+    // Reads the items of one chunk into entries that are already in the map, ids and all
+    template <class closure, typename T>
+    static void read_chunk(closure &c, T &themap, xmlpp::TextReader &reader, const char *item_name, const str &container_name)
+    {
+        while(!is_closing_element(reader, container_name))
+        {
+            read_skip_comment(reader);
+
+            if(reader.get_node_type() == xmlpp::TextReader::Element)
+            {
+                if(!has_name(reader, item_name))
+                    throw xml_error(reader, boost::str(boost::format("Found stray %s in %s container search (expected %s)") % reader.get_name() % container_name % item_name));
+
+                const char                *id = attribute_value(reader, "id");
+                const typename T::iterator vp(id ? themap.find(str(id)) : themap.end());
+                if(vp == themap.end())
+                    throw xml_error(reader, boost::str(boost::format("%s %s wasn't found by the section scan") % item_name % (id ? id : "")));
+
+                vp->second.xml_read(c, reader);
+            }
+        }
+    }
+
+    // Some items of one section, parsed together as a document of their own; each piece is a run of consecutive items
+    struct xml_chunk
+    {
+        enum kind_t {ROADS, LANES, INTERSECTIONS};
+
+        typedef std::pair<const char*, const char*> piece;
+
+        kind_t             kind;
+        std::vector<piece> pieces;
+    };
+
+    static const char *section_names[3][2] = {{"roads", "road"}, {"lanes", "lane"}, {"intersections", "intersection"}};
+
+    // Cuts the items of a section (only those marked in keep, if it is given) into chunks of about chunk_bytes each, at item boundaries
+    static void split_section(std::vector<xml_chunk> &chunks, const xml_section &sec, const xml_chunk::kind_t kind, const size_t chunk_bytes,
+                              const std::vector<char> *keep = 0)
+    {
+        xml_chunk c;
+        c.kind       = kind;
+        size_t bytes = 0;
+        for(size_t i = 0; i + 1 < sec.starts.size(); ++i)
+        {
+            if(keep && !(*keep)[i])
+                continue;
+
+            if(!c.pieces.empty() && c.pieces.back().second == sec.starts[i])
+                c.pieces.back().second = sec.starts[i+1];
+            else
+                c.pieces.push_back(xml_chunk::piece(sec.starts[i], sec.starts[i+1]));
+
+            bytes += sec.starts[i+1] - sec.starts[i];
+            if(bytes >= chunk_bytes)
+            {
+                chunks.push_back(c);
+                c.pieces.clear();
+                bytes = 0;
+            }
+        }
+        if(!c.pieces.empty())
+            chunks.push_back(c);
+    }
+
+    static void read_xml_chunk(network &n, const vec3f &scale, const xml_chunk &c, const unknown_ref_t mode)
+    {
+        const char *container = section_names[c.kind][0];
+        const char *item      = section_names[c.kind][1];
+
+        size_t bytes = 64;
+        BOOST_FOREACH(const xml_chunk::piece &p, c.pieces)
+        {
+            bytes += p.second - p.first;
+        }
+
+        std::string doc;
+        doc.reserve(bytes);
+        doc += boost::str(boost::format("<%s>") % container);
+        BOOST_FOREACH(const xml_chunk::piece &p, c.pieces)
+        {
+            doc.append(p.first, p.second);
+        }
+        doc += boost::str(boost::format("</%s>") % container);
+
+        struct unknown_refs_guard
+        {
+            unknown_refs_guard(const unknown_ref_t mode) { unknown_refs = mode;           }
+            ~unknown_refs_guard()                        { unknown_refs = INSERT_UNKNOWN; }
+        } guard(mode);
+
+        xmlpp::TextReader reader(reinterpret_cast<const unsigned char*>(doc.data()), doc.size());
+        read_skip_comment(reader);
+
+        switch(c.kind)
+        {
+        case xml_chunk::ROADS:
+            read_chunk(scale, n.roads, reader, item, container);
+            break;
+        case xml_chunk::LANES:
+            read_chunk(n, n.lanes, reader, item, container);
+            break;
+        case xml_chunk::INTERSECTIONS:
+            read_chunk(n, n.intersections, reader, item, container);
+            break;
+        }
+
+        reader.close();
+    }
+
+    // The network element and its three sections, as found by the text scan
+    struct xml_layout
+    {
+        const char  *net_end;
+        xml_section  sections[3];
+    };
+
+    // Whether the whole file could be located by the text scan
+    static bool scan_layout(xml_layout &l, const xml_text &text)
+    {
+        const char *net_tag = find_start_tag(text.begin, text.end, "network");
+        l.net_end           = net_tag ? static_cast<const char*>(std::memchr(net_tag, '>', text.end - net_tag)) : 0;
+        bool splittable     = l.net_end != 0;
+        for(int k = 0; k < 3 && splittable; ++k)
+            splittable = scan_section(l.sections[k], l.net_end, text.end, section_names[k][0], section_names[k][1]);
+        return splittable;
+    }
+
+    // Reads the network element's attributes
+    static void read_layout_header(network &n, const xml_text &text, const xml_layout &l)
+    {
+        const std::string header(std::string(text.begin, l.net_end + 1) + "</network>");
+        xmlpp::TextReader reader(reinterpret_cast<const unsigned char*>(header.data()), header.size());
+        xml_read_network_attributes(n, reader);
+        reader.close();
+    }
+
+    // Reads the chunks on all threads. Items only reach each other through the maps, which are complete and
+    // no longer change, so roads, lanes and intersections can all be read at once.
+    static void read_xml_chunks(network &n, const vec3f &scale, const std::vector<xml_chunk> &chunks, const unknown_ref_t mode)
+    {
+        xmlInitParser();
+
+        std::vector<str> errors(chunks.size());
+        #pragma omp parallel for schedule(dynamic, 1)
+        for(long i = 0; i < static_cast<long>(chunks.size()); ++i)
+        {
+            try
+            {
+                read_xml_chunk(n, scale, chunks[i], mode);
+            }
+            catch(std::exception &e)
+            {
+                errors[i] = boost::str(boost::format("In %s: %s") % section_names[chunks[i].kind][0] % e.what());
+            }
+        }
+        BOOST_FOREACH(const str &e, errors)
+        {
+            if(!e.empty())
+                throw std::runtime_error(e);
+        }
+    }
+
+    // Several chunks per thread so that the dynamic schedule can even out road-heavy and lane-heavy pieces
+    static size_t chunk_size(const size_t total_bytes)
+    {
+#ifdef _OPENMP
+        const size_t nthreads = omp_get_max_threads();
+#else
+        const size_t nthreads = 1;
+#endif
+        return std::max(static_cast<size_t>(1 << 16), total_bytes/(8*nthreads));
+    }
+
+    network load_xml_network_parallel(const char *filename, const vec3f &scale)
+    {
+        PROFILE_SCOPE("hwm::load_xml_network_parallel");
+        const xml_text text(filename);
+
+        // Everything is located before anything is read, so a file that can't be split goes to the streaming reader untouched.
+        // Both ways fill the one network returned, so it isn't copied out.
+        network    n;
+        xml_layout l;
+        if(scan_layout(l, text))
+        {
+            read_layout_header(n, text, l);
+
+            enter_items(n.roads,         l.sections[xml_chunk::ROADS],         "road");
+            enter_items(n.lanes,         l.sections[xml_chunk::LANES],         "lane");
+            enter_items(n.intersections, l.sections[xml_chunk::INTERSECTIONS], "intersection");
+
+            const size_t chunk_bytes = chunk_size(text.end - text.begin);
+            std::vector<xml_chunk> chunks;
+            for(int k = 0; k < 3; ++k)
+                split_section(chunks, l.sections[k], static_cast<xml_chunk::kind_t>(k), chunk_bytes);
+
+            read_xml_chunks(n, scale, chunks, THROW_UNKNOWN);
+
+            link_intersections(n);
+        }
+        else
+            xml_read_network(n, filename, scale);
+
+        PROFILE_COUNT("roads",         n.roads.size());
+        PROFILE_COUNT("lanes",         n.lanes.size());
+        PROFILE_COUNT("intersections", n.intersections.size());
+        return n;
+    }
+
+    // The values of every attr="..." in [begin, end)
+    static void scan_refs(std::vector<str> &refs, const char *begin, const char *end, const char *attr)
+    {
+        const std::string pat(boost::str(boost::format(" %s=\"") % attr));
+        while((begin = find_text(begin, end, pat.c_str())))
+        {
+            begin += pat.size();
+            const char *ref_end = static_cast<const char*>(std::memchr(begin, '"', end - begin));
+            if(!ref_end)
+                break;
+            refs.push_back(str(std::string(begin, ref_end)));
+            begin = ref_end;
+        }
+    }
+
+    // The planar bounds of the points in a road's text. Both representations keep the road inside the hull of its points.
+    static aabb2d road_text_bounds(const char *begin, const char *end, const vec3f &scale)
+    {
+        aabb2d      res;
+        const char *open = find_text(begin, end, "<points>");
+        const char *close = open ? find_text(open, end, "</points>") : 0;
+        if(!close)
+            return res;
+
+        const std::string points(open + 8, close);
+        number_tokens     tokens(points.c_str());
+        vec3f             pos;
+        while(tokens.next(pos[0]))
+        {
+            if(!tokens.next(pos[1]) || !tokens.next(pos[2]))
+                throw std::runtime_error("Incomplete point!");
+            tokens.skip_line();
+            res.enclose_point(pos[0]*scale[0], pos[1]*scale[1]);
+        }
+        return res;
+    }
+
+    // Marks the items of sec whose text lists, under attr, any id in ids; the ids they list go to found, if it is given
+    static void mark_referring(std::vector<char> &marks, const xml_section &sec, const char *attr, const std::set<str> &ids,
+                               std::vector<std::vector<str> > *found = 0)
+    {
+        const long nitems = sec.ids.size();
+        marks.resize(nitems, 0);
+        if(found)
+            found->resize(nitems);
+
+        #pragma omp parallel for
+        for(long i = 0; i < nitems; ++i)
+        {
+            std::vector<str> refs;
+            scan_refs(refs, sec.starts[i], sec.starts[i+1], attr);
+            BOOST_FOREACH(const str &r, refs)
+            {
+                if(ids.count(r))
+                {
+                    marks[i] = 1;
+                    break;
+                }
+            }
+            if(marks[i] && found)
+                (*found)[i].swap(refs);
+        }
+    }
+
+    network load_xml_network_region(const char *filename, const aabb2d &region, const vec3f &scale)
+    {
+        PROFILE_SCOPE("hwm::load_xml_network_region");
+        const xml_text text(filename);
+
+        xml_layout l;
+        if(!scan_layout(l, text))
+            throw std::runtime_error(boost::str(boost::format("Can't index %s for a region load (it has comments or CDATA in its sections, or unusual ids)") % filename));
+
+        const xml_section &roads  = l.sections[xml_chunk::ROADS];
+        const xml_section &lanes  = l.sections[xml_chunk::LANES];
+        const xml_section &inters = l.sections[xml_chunk::INTERSECTIONS];
+
+        // Roads that overlap the region
+        std::vector<char> keep_roads(roads.ids.size(), 0);
+        std::vector<str>  errors(roads.ids.size());
+        #pragma omp parallel for
+        for(long i = 0; i < static_cast<long>(roads.ids.size()); ++i)
+        {
+            try
+            {
+                keep_roads[i] = road_text_bounds(roads.starts[i], roads.starts[i+1], scale).overlap(region);
+            }
+            catch(std::exception &e)
+            {
+                errors[i] = boost::str(boost::format("In road %s: %s") % roads.ids[i] % e.what());
+            }
+        }
+        BOOST_FOREACH(const str &e, errors)
+        {
+            if(!e.empty())
+                throw std::runtime_error(e);
+        }
+
+        std::set<str> ids;
+        for(size_t i = 0; i < roads.ids.size(); ++i)
+            if(keep_roads[i])
+                ids.insert(roads.ids[i]);
+
+        // Lanes on them, and the intersections those lanes meet
+        std::vector<char> keep_lanes;
+        mark_referring(keep_lanes, lanes, "parent_road_ref", ids);
+
+        ids.clear();
+        for(size_t i = 0; i < lanes.ids.size(); ++i)
+            if(keep_lanes[i])
+                ids.insert(lanes.ids[i]);
+
+        std::vector<char>              keep_inters;
+        std::vector<std::vector<str> > inter_lanes;
+        mark_referring(keep_inters, inters, "ref", ids, &inter_lanes);
+
+        // Every lane of a kept intersection comes along, so that its states stay whole,
+        // and so does every road any kept lane lies on
+        BOOST_FOREACH(const std::vector<str> &il, inter_lanes)
+        {
+            ids.insert(il.begin(), il.end());
+        }
+        std::vector<std::vector<str> > lane_roads(lanes.ids.size());
+        #pragma omp parallel for
+        for(long i = 0; i < static_cast<long>(lanes.ids.size()); ++i)
+        {
+            if(keep_lanes[i] || ids.count(lanes.ids[i]))
+            {
+                keep_lanes[i] = 1;
+                scan_refs(lane_roads[i], lanes.starts[i], lanes.starts[i+1], "parent_road_ref");
+            }
+        }
+
+        ids.clear();
+        BOOST_FOREACH(const std::vector<str> &lr, lane_roads)
+        {
+            ids.insert(lr.begin(), lr.end());
+        }
+        for(size_t i = 0; i < roads.ids.size(); ++i)
+            if(ids.count(roads.ids[i]))
+                keep_roads[i] = 1;
+
+        network n;
+        read_layout_header(n, text, l);
+
+        enter_items(n.roads,         roads,  "road",         &keep_roads);
+        enter_items(n.lanes,         lanes,  "lane",         &keep_lanes);
+        enter_items(n.intersections, inters, "intersection", &keep_inters);
+
+        size_t kept_bytes = 0;
+        const std::vector<char> *keeps[3] = {&keep_roads, &keep_lanes, &keep_inters};
+        for(int k = 0; k < 3; ++k)
+            for(size_t i = 0; i < keeps[k]->size(); ++i)
+                if((*keeps[k])[i])
+                    kept_bytes += l.sections[k].starts[i+1] - l.sections[k].starts[i];
+
+        const size_t chunk_bytes = chunk_size(kept_bytes);
+        std::vector<xml_chunk> chunks;
+        for(int k = 0; k < 3; ++k)
+            split_section(chunks, l.sections[k], static_cast<xml_chunk::kind_t>(k), chunk_bytes, keeps[k]);
+
+        // References out of the region come back null and turn into network boundaries
+        read_xml_chunks(n, scale, chunks, NULL_UNKNOWN);
+
+        link_intersections(n);
+
+        PROFILE_COUNT("roads",         n.roads.size());
+        PROFILE_COUNT("lanes",         n.lanes.size());
+        PROFILE_COUNT("intersections", n.intersections.size());
         return n;
     }
 }
@@ -631,25 +1240,13 @@ static obj_record xml_read_object(xmlpp::TextReader &reader)
                 if(reader.get_node_type() == xmlpp::TextReader::Text ||
                    reader.get_node_type() == xmlpp::TextReader::SignificantWhitespace)
                 {
-                    std::string                 res(reader.get_value());
-                    typedef boost::tokenizer<boost::char_separator<char> > tokenizer;
-                    boost::char_separator<char> linesep("\n");
-                    tokenizer                   linetokens(res, linesep);
-
-                    BOOST_FOREACH(const std::string &ltok, linetokens)
+                    number_tokens tokens(text_value(reader));
+                    float         val;
+                    while(tokens.next(val))
                     {
-                        std::string trim_ltok(ltok);
-                        boost::trim_left(trim_ltok);
-                        if(!trim_ltok.empty())
-                        {
-                            std::stringstream instr(trim_ltok);
-                            while(!instr.eof())
-                            {
-                                if(matrix_pos > 16)
-                                    throw xml_error(reader, "Too many elements in matrix!");
-                                instr >> obj.matrix.data()[matrix_pos++];
-                            }
-                        }
+                        if(matrix_pos >= 16)
+                            throw xml_error(reader, "Too many elements in matrix!");
+                        obj.matrix.data()[matrix_pos++] = val;
                     }
                 }
             }
@@ -663,25 +1260,15 @@ static obj_record xml_read_object(xmlpp::TextReader &reader)
                 if(reader.get_node_type() == xmlpp::TextReader::Text ||
                    reader.get_node_type() == xmlpp::TextReader::SignificantWhitespace)
                 {
-                    std::string                 res(reader.get_value());
-                    typedef boost::tokenizer<boost::char_separator<char> > tokenizer;
-                    boost::char_separator<char> linesep("\n");
-                    tokenizer                   linetokens(res, linesep);
-
-                    BOOST_FOREACH(const std::string &ltok, linetokens)
+                    number_tokens tokens(text_value(reader));
+                    vec3f         pos;
+                    while(tokens.next(pos[0]))
                     {
-                        std::string trim_ltok(ltok);
-                        boost::trim_left(trim_ltok);
-                        if(!trim_ltok.empty())
-                        {
-                            std::stringstream instr(trim_ltok);
-                            vec3f pos;
-                            instr >> pos[0];
-                            instr >> pos[1];
-                            instr >> pos[2];
-
-                            obj.box.enclose_point(pos[0], pos[1], pos[2]);
-                        }
+                        if(!tokens.next(pos[1]) || !tokens.next(pos[2]))
+                            throw xml_error(reader, "Incomplete bounding box point!");
+                        tokens.skip_line();
+
+                        obj.box.enclose_point(pos[0], pos[1], pos[2]);
                     }
                 }
             }
@@ -695,7 +1282,12 @@ std::vector<obj_record> xml_read_scene(const std::string &filename)
 {
     std::vector<obj_record> res;
 
-    xmlpp::TextReader reader(filename);
+    // Scenes are written with compressing_ostream too, so PARALLEL_GZIP ones are inflated as networks are
+    std::string                                inflated;
+    const boost::scoped_ptr<xmlpp::TextReader> reader_ptr(hwm::inflate_parallel_gzip(inflated, filename.c_str()) ?
+                                                          new xmlpp::TextReader(reinterpret_cast<const unsigned char*>(inflated.data()), inflated.size(), filename) :
+                                                          new xmlpp::TextReader(filename));
+    xmlpp::TextReader                         &reader = *reader_ptr;
     read_skip_comment(reader);
 
     if(!is_opening_element(reader, "scene"))
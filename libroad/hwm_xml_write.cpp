@@ -1,5 +1,6 @@
 #include "hwm_network.hpp"
 #include "xml_util.hpp"
+#include "profile.hpp"
 
 void polyline_road::xml_write(xmlpp::Element *elt) const
 {
@@ -41,6 +42,31 @@ void arc_road::xml_write(xmlpp::Element *elt) const
     }
 }
 
+void arc_road::xml_write(xml_writer &w) const
+{
+    w.start("arc_line_rep");
+    w.start("points");
+    BOOST_FOREACH(const vec3f &pt, points_)
+    {
+        w.text(pt[0]);
+        w.text(" ");
+        w.text(pt[1]);
+        w.text(" ");
+        w.text(pt[2]);
+        w.text(" 0.0\n");
+    }
+    w.end();
+
+    w.start("radii");
+    BOOST_FOREACH(float pt, radii_)
+    {
+        w.text(pt);
+        w.text("\n");
+    }
+    w.end();
+    w.end();
+}
+
 void arc_road::svg_arc_arcs(const str &id, xmlpp::Element *parent) const
 {
     if(points_.size() <= 2)
@@ -99,6 +125,31 @@ void partition01<T>::xml_write(xmlpp::Element *elt, const str &name) const
     }
 }
 
+template <class T>
+void partition01<T>::xml_write(xml_writer &w, const str &name) const
+{
+    w.start(name.c_str());
+    w.start("interval");
+
+    typename partition01<T>::const_iterator pit = begin();
+    if(!empty())
+    {
+        w.start("base");
+        pit->second.xml_write(w);
+        w.end();
+        for(++pit; pit != end(); ++pit)
+        {
+            w.start("divider");
+            w.attribute("value", pit->first);
+            pit->second.xml_write(w);
+            w.end();
+        }
+    }
+
+    w.end();
+    w.end();
+}
+
 namespace hwm
 {
     template <class T>
@@ -113,6 +164,20 @@ namespace hwm
         }
     }
 
+    template <class T>
+    static inline void xml_write_map(const T &v, xml_writer &w, const char *name)
+    {
+        w.start(name);
+
+        typedef typename T::value_type val;
+        BOOST_FOREACH(const val &item, v)
+        {
+            item.second.xml_write(w);
+        }
+
+        w.end();
+    }
+
     void road::xml_write(xmlpp::Element *elt) const
     {
         xmlpp::Element *road_elt = elt->add_child("road");
@@ -121,12 +186,29 @@ namespace hwm
         rep.xml_write(road_elt);
     }
 
+    void road::xml_write(xml_writer &w) const
+    {
+        w.start("road");
+        w.attribute("id",   id);
+        w.attribute("name", name);
+        rep.xml_write(w);
+        w.end();
+    }
+
     void lane::terminus::xml_write(xmlpp::Element *elt, const str &name) const
     {
         xmlpp::Element *term_elt = elt->add_child(name);
         term_elt->add_child("dead_end");
     }
 
+    void lane::terminus::xml_write(xml_writer &w, const str &name) const
+    {
+        w.start(name.c_str());
+        w.start("dead_end");
+        w.end();
+        w.end();
+    }
+
     void lane::intersection_terminus::xml_write(xmlpp::Element *elt, const str &name) const
     {
         xmlpp::Element *term_elt = elt->add_child(name);
@@ -134,6 +216,15 @@ namespace hwm
         iref->set_attribute("ref", adjacent_intersection->id);
     }
 
+    void lane::intersection_terminus::xml_write(xml_writer &w, const str &name) const
+    {
+        w.start(name.c_str());
+        w.start("intersection_ref");
+        w.attribute("ref", adjacent_intersection->id);
+        w.end();
+        w.end();
+    }
+
     void lane::lane_terminus::xml_write(xmlpp::Element *elt, const str &name) const
     {
         xmlpp::Element *term_elt = elt->add_child(name);
@@ -141,6 +232,15 @@ namespace hwm
         iref->set_attribute("ref", adjacent_lane->id);
     }
 
+    void lane::lane_terminus::xml_write(xml_writer &w, const str &name) const
+    {
+        w.start(name.c_str());
+        w.start("lane_ref");
+        w.attribute("ref", adjacent_lane->id);
+        w.end();
+        w.end();
+    }
+
     void lane::road_membership::xml_write(xmlpp::Element *elt) const
     {
         xmlpp::Element *rm_elt = elt->add_child("road_membership");
@@ -153,6 +253,19 @@ namespace hwm
         }
     }
 
+    void lane::road_membership::xml_write(xml_writer &w) const
+    {
+        w.start("road_membership");
+        if(!empty())
+        {
+            w.attribute("parent_road_ref", parent_road->id);
+            w.attribute("interval_start",  interval[0]);
+            w.attribute("interval_end",    interval[1]);
+            w.attribute("lane_position",   lane_position);
+        }
+        w.end();
+    }
+
     void lane::adjacency::xml_write(xmlpp::Element *elt) const
     {
         xmlpp::Element *la_elt = elt->add_child("lane_adjacency");
@@ -164,6 +277,18 @@ namespace hwm
         }
     }
 
+    void lane::adjacency::xml_write(xml_writer &w) const
+    {
+        w.start("lane_adjacency");
+        if(!empty())
+        {
+            w.attribute("lane_ref",       neighbor->id);
+            w.attribute("interval_start", neighbor_interval[0]);
+            w.attribute("interval_end",   neighbor_interval[1]);
+        }
+        w.end();
+    }
+
     void lane::xml_write(xmlpp::Element *elt) const
     {
         xmlpp::Element *lane_elt = elt->add_child("lane");
@@ -177,6 +302,21 @@ namespace hwm
         right.xml_write(adj_elt, "right");
     }
 
+    void lane::xml_write(xml_writer &w) const
+    {
+        w.start("lane");
+        w.attribute("id", id);
+        w.attribute("speedlimit", speedlimit);
+        start->xml_write(w, "start");
+        end->xml_write(w, "end");
+        road_memberships.xml_write(w, "road_intervals");
+        w.start("adjacency_intervals");
+        left. xml_write(w, "left");
+        right.xml_write(w, "right");
+        w.end();
+        w.end();
+    }
+
     template <class T>
     static inline void xml_write_vector(const std::vector<T> &v, xmlpp::Element *elt, const str &name)
     {
@@ -210,6 +350,23 @@ namespace hwm
         }
     }
 
+    void intersection::state::xml_write(const size_t id, xml_writer &w) const
+    {
+        w.start("state");
+        w.attribute("id", id);
+        w.attribute("duration", duration);
+
+        BOOST_FOREACH(const state_pair &sp, in_pair())
+        {
+            w.start("lane_pair");
+            w.attribute("in_id",  sp.in_idx);
+            w.attribute("out_id", sp.out_idx);
+            w.end();
+        }
+
+        w.end();
+    }
+
     void intersection::xml_write(xmlpp::Element *elt) const
     {
         xmlpp::Element *intersection_elt = elt->add_child("intersection");
@@ -221,15 +378,44 @@ namespace hwm
         xml_write_vector(states, intersection_elt, "states");
     }
 
-    void network::xml_write(const char *filename) const
+    void intersection::xml_write(xml_writer &w) const
     {
-        xmlpp::Document out;
+        w.start("intersection");
+        w.attribute("id", id);
+
+        w.start("incident");
+        const std::vector<lane*> *incident[2]  = {&incoming, &outgoing};
+        const char               *inc_names[2] = {"incoming", "outgoing"};
+        for(int i = 0; i < 2; ++i)
+        {
+            w.start(inc_names[i]);
+            for(size_t count = 0; count < incident[i]->size(); ++count)
+            {
+                w.start("lane_ref");
+                w.attribute("ref", (*incident[i])[count]->id);
+                w.attribute("local_id", count);
+                w.end();
+            }
+            w.end();
+        }
+        w.end();
+
+        w.start("states");
+        for(size_t count = 0; count < states.size(); ++count)
+            states[count].xml_write(count, w);
+        w.end();
 
-        xmlpp::Element *root(out.create_root_node("network"));
-        xml_write(root);
+        w.end();
+    }
 
+    void network::xml_write(const char *filename) const
+    {
+        PROFILE_SCOPE("hwm::network::xml_write");
         std::ostream *out_stream = compressing_ostream(filename);
-        out.write_to_stream_formatted(*out_stream, "utf-8");
+        {
+            xml_writer w(*out_stream);
+            xml_write(w);
+        }
         delete out_stream;
     }
 
@@ -244,6 +430,19 @@ namespace hwm
         xml_write_map(intersections, elt, "intersections");
     }
 
+    void network::xml_write(xml_writer &w) const
+    {
+        w.start("network");
+        w.attribute("name",       name);
+        w.attribute("version",    "1.3");
+        w.attribute("gamma",      gamma);
+        w.attribute("lane_width", lane_width);
+        xml_write_map(roads,         w, "roads");
+        xml_write_map(lanes,         w, "lanes");
+        xml_write_map(intersections, w, "intersections");
+        w.end();
+    }
+
     void network::svg_write(const char *filename, const int flags) const
     {
         xmlpp::Document out;
@@ -436,20 +635,17 @@ namespace hwm
 
             BOOST_FOREACH(const intersection_pair &ip, intersections)
             {
-                BOOST_FOREACH(const intersection::state &s, ip.second.states)
+                BOOST_FOREACH(const lane_pair &lp, ip.second.fict_lanes)
                 {
-                    BOOST_FOREACH(const lane_pair &lp, s.fict_lanes)
                     {
-                        {
-                            xmlpp::Element *path = arcgroup->add_child("path");
-                            path->set_attribute("d", lp.second.svg_arc_path(lane_width).stringify()+"Z");
-                            path->set_attribute("id", boost::str(boost::format("id%s_arc") % lp.first));
-                        }
-                        {
-                            xmlpp::Element *path = polygroup->add_child("path");
-                            path->set_attribute("d", lp.second.svg_poly_path(lane_width).stringify()+"Z");
-                            path->set_attribute("id", boost::str(boost::format("id%s_poly") % lp.first));
-                        }
+                        xmlpp::Element *path = arcgroup->add_child("path");
+                        path->set_attribute("d", lp.second.svg_arc_path(lane_width).stringify()+"Z");
+                        path->set_attribute("id", boost::str(boost::format("id%s_arc") % lp.first));
+                    }
+                    {
+                        xmlpp::Element *path = polygroup->add_child("path");
+                        path->set_attribute("d", lp.second.svg_poly_path(lane_width).stringify()+"Z");
+                        path->set_attribute("id", boost::str(boost::format("id%s_poly") % lp.first));
                     }
                 }
             }
@@ -78,10 +78,11 @@ namespace std
         template <>
         struct hash<const str>
         {
+            // By contents; hash<const char*> would hash the pointer
             size_t operator()(const Glib::ustring &str) const
             {
-                hash<const char*> h;
-                return h(str.c_str());
+                hash<std::string> h;
+                return h(str.raw());
             }
         };
     }
@@ -186,28 +187,30 @@ inline V transform(const M &mat, const V &v)
     return sub<0, 3>::vector(vec4f(mat*vec4f(v[0], v[1], v[2], 1.0)));
 }
 
-#ifdef _MSC_VER
-inline boost::iostreams::filtering_ostream *compressing_ostream(const str &filename)
-{
-    boost::iostreams::filtering_ostream *out_stream = new boost::iostreams::filtering_ostream();
-    str zip_name;
-    zip_name = filename;
-    out_stream->push(boost::iostreams::file_descriptor_sink(zip_name.raw()));
-    return out_stream;
-}
-#else
-inline boost::iostreams::filtering_ostream *compressing_ostream(const str &filename)
+// How compressing_ostream encodes its output.
+// PARALLEL_GZIP cuts the stream into block_size pieces that are deflated independently on 'threads' threads
+// (0 for all of them) and written as consecutive gzip members, which gzip, zlib and pigz read as a single stream.
+struct compression
 {
-    boost::iostreams::filtering_ostream *out_stream = new boost::iostreams::filtering_ostream();
-    out_stream->push(boost::iostreams::gzip_compressor(boost::iostreams::gzip_params(9)));
-    str zip_name;
-    if(filename.substr(static_cast<int>(filename.size())-1, static_cast<int>(filename.size())-1) == str("z"))
-        zip_name = filename;
-    else
-        zip_name = boost::str(boost::format("%s.gz") % filename);
-    out_stream->push(boost::iostreams::file_descriptor_sink(zip_name.raw()));
-    return out_stream;
-}
-#endif
+    enum codec_t {NONE, GZIP, PARALLEL_GZIP};
+
+    compression(const codec_t c = PARALLEL_GZIP, const int l = 6, const int t = 0, const size_t bs = 1 << 20)
+        : codec(c), level(l), threads(t), block_size(bs)
+    {}
+
+    codec_t codec;
+    int     level;
+    int     threads;
+    size_t  block_size;
+};
+
+// What compressing_ostream uses when it isn't given a compression; change it to affect every writer
+compression &default_compression();
+
+// Gzipped codecs get '.gz' appended to filename unless it already ends in 'z'
+boost::iostreams::filtering_ostream *compressing_ostream(const str &filename, const compression &c = default_compression());
+
+// Reads plain, gzip, and PARALLEL_GZIP files; the members of the latter are inflated in parallel
+boost::iostreams::filtering_istream *decompressing_istream(const str &filename);
 
 #endif
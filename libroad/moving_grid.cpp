@@ -0,0 +1,454 @@
+#include "moving_grid.hpp"
+#include "hilbert.hpp"
+#include <stdexcept>
+
+const moving_grid::idx_t moving_grid::npos = static_cast<moving_grid::idx_t>(-1);
+
+moving_grid::moving_grid() : mode(WORLD), levels(0), nitems(0)
+{
+    origin[0]       = origin[1]       = 0.0f;
+    cell_dim[0]     = cell_dim[1]     = 1.0f;
+    inv_cell_dim[0] = inv_cell_dim[1] = 1.0f;
+    ncells[0]       = ncells[1]       = 1;
+    head.resize(1, npos);
+}
+
+moving_grid::moving_grid(const aabb2d &bounds, const float cell_size, const size_t capacity) : mode(WORLD), levels(0), nitems(0)
+{
+    if(!(cell_size > 0.0f))
+        throw std::runtime_error("moving_grid: cell size must be positive");
+
+    const float  extent = std::max(bounds.bounds[1][0] - bounds.bounds[0][0],
+                                   bounds.bounds[1][1] - bounds.bounds[0][1]);
+    const size_t side   = std::max(static_cast<size_t>(std::ceil(extent/cell_size)), static_cast<size_t>(1));
+    while((1ULL << levels) < side)
+        ++levels;
+    if(levels > 15)
+        throw std::runtime_error(boost::str(boost::format("moving_grid: %u cells per side is too many; use a larger cell size") % side));
+
+    origin[0]       = bounds.bounds[0][0];
+    origin[1]       = bounds.bounds[0][1];
+    cell_dim[0]     = cell_dim[1]     = cell_size;
+    inv_cell_dim[0] = inv_cell_dim[1] = 1.0f/cell_size;
+    ncells[0]       = ncells[1]       = 1ULL << levels;
+
+    head.resize(ncells[0]*ncells[1], npos);
+    resize(capacity);
+}
+
+moving_grid::moving_grid(const size_t nlanes, const size_t cells_per_lane, const size_t capacity) : mode(LANE), levels(0), nitems(0)
+{
+    if(nlanes == 0 || cells_per_lane == 0)
+        throw std::runtime_error("moving_grid: lane mode needs at least one lane and one cell per lane");
+
+    origin[0]       = 0.0f;
+    origin[1]       = 0.0f;
+    cell_dim[0]     = 1.0f/cells_per_lane;
+    cell_dim[1]     = 1.0f;
+    inv_cell_dim[0] = cells_per_lane;
+    inv_cell_dim[1] = 1.0f;
+    ncells[0]       = cells_per_lane;
+    ncells[1]       = nlanes;
+
+    head.resize(ncells[0]*ncells[1], npos);
+    resize(capacity);
+}
+
+void moving_grid::resize(const size_t capacity)
+{
+    const size_t old = xs.size();
+    if(capacity <= old)
+        return;
+
+    slot_of.resize(capacity, npos);
+    xs.resize(capacity);
+    ys.resize(capacity);
+    items.resize(capacity, npos);
+    keys.resize(capacity);
+    next.resize(capacity, npos);
+    prev.resize(capacity, npos);
+
+    perm.resize(capacity);
+    tmp_x.resize(capacity);
+    tmp_y.resize(capacity);
+    tmp_items.resize(capacity);
+    tmp_keys.resize(capacity);
+
+    free_slots.reserve(capacity);
+    std::vector<idx_t> new_free;
+    for(size_t s = capacity; s > old; --s)
+        new_free.push_back(s - 1);
+    free_slots.insert(free_slots.begin(), new_free.begin(), new_free.end());
+}
+
+void moving_grid::clear()
+{
+    std::fill(head.begin(),    head.end(),    npos);
+    std::fill(slot_of.begin(), slot_of.end(), npos);
+    std::fill(items.begin(),   items.end(),   npos);
+
+    free_slots.clear();
+    for(size_t s = xs.size(); s > 0; --s)
+        free_slots.push_back(s - 1);
+    nitems = 0;
+}
+
+size_t moving_grid::size() const
+{
+    return nitems;
+}
+
+bool moving_grid::contains(const idx_t item) const
+{
+    return item < slot_of.size() && slot_of[item] != npos;
+}
+
+void moving_grid::cell_coords(size_t &cx, size_t &cy, const float x, const float y) const
+{
+    const float fx = (x - origin[0])*inv_cell_dim[0];
+    const float fy = (y - origin[1])*inv_cell_dim[1];
+    // Clamped while still floats; converting one beyond size_t's range is undefined
+    cx = !(fx > 0.0f) ? 0 : std::min(static_cast<size_t>(std::min(fx, static_cast<float>(ncells[0] - 1))), ncells[0] - 1);
+    cy = !(fy > 0.0f) ? 0 : std::min(static_cast<size_t>(std::min(fy, static_cast<float>(ncells[1] - 1))), ncells[1] - 1);
+}
+
+size_t moving_grid::cell_key(const size_t cx, const size_t cy) const
+{
+    if(mode == WORLD)
+        return hilbert::encode2(cx, cy, levels);
+    return cy*ncells[0] + cx;
+}
+
+size_t moving_grid::cell(const float x, const float y) const
+{
+    size_t cx, cy;
+    cell_coords(cx, cy, x, y);
+    return cell_key(cx, cy);
+}
+
+void moving_grid::link(const idx_t slot, const size_t key)
+{
+    keys[slot] = key;
+    prev[slot] = npos;
+    next[slot] = head[key];
+    if(head[key] != npos)
+        prev[head[key]] = slot;
+    head[key] = slot;
+}
+
+void moving_grid::unlink(const idx_t slot)
+{
+    if(prev[slot] != npos)
+        next[prev[slot]] = next[slot];
+    else
+        head[keys[slot]] = next[slot];
+
+    if(next[slot] != npos)
+        prev[next[slot]] = prev[slot];
+}
+
+void moving_grid::insert(const idx_t item, const float x, const float y)
+{
+    if(item >= slot_of.size())
+        resize(std::max(item + 1, 2*slot_of.size()));
+
+    if(slot_of[item] != npos)
+    {
+        update(item, x, y);
+        return;
+    }
+
+    const idx_t slot = free_slots.back();
+    free_slots.pop_back();
+
+    xs[slot]      = x;
+    ys[slot]      = y;
+    items[slot]   = item;
+    slot_of[item] = slot;
+    link(slot, cell(x, y));
+    ++nitems;
+}
+
+void moving_grid::update(const idx_t item, const float x, const float y)
+{
+    if(!contains(item))
+    {
+        insert(item, x, y);
+        return;
+    }
+
+    const idx_t slot = slot_of[item];
+    xs[slot]         = x;
+    ys[slot]         = y;
+
+    const size_t key = cell(x, y);
+    if(key != keys[slot])
+    {
+        unlink(slot);
+        link(slot, key);
+    }
+}
+
+void moving_grid::remove(const idx_t item)
+{
+    if(!contains(item))
+        return;
+
+    const idx_t slot = slot_of[item];
+    unlink(slot);
+    items[slot]   = npos;
+    slot_of[item] = npos;
+    free_slots.push_back(slot);
+    --nitems;
+}
+
+void moving_grid::insert_lane(const idx_t item, const size_t lane, const float t)
+{
+    insert(item, t, static_cast<float>(lane));
+}
+
+void moving_grid::update_lane(const idx_t item, const size_t lane, const float t)
+{
+    update(item, t, static_cast<float>(lane));
+}
+
+void moving_grid::rebuild(const float *x, const float *y, const size_t n)
+{
+    resize(n);
+
+    const long cap = static_cast<long>(xs.size());
+#pragma omp parallel for
+    for(long s = 0; s < cap; ++s)
+    {
+        if(s < static_cast<long>(n))
+        {
+            xs[s]      = x[s];
+            ys[s]      = y[s];
+            items[s]   = s;
+            slot_of[s] = s;
+        }
+        else
+        {
+            items[s]   = npos;
+            slot_of[s] = npos;
+        }
+    }
+    nitems = n;
+
+    rebuild();
+}
+
+void moving_grid::rebuild()
+{
+    const long cap = static_cast<long>(xs.size());
+
+#pragma omp parallel for
+    for(long s = 0; s < cap; ++s)
+        if(items[s] != npos)
+            keys[s] = cell(xs[s], ys[s]);
+
+    // Stable counting sort of the live slots by cell key
+    counts.assign(head.size() + 1, 0);
+    for(long s = 0; s < cap; ++s)
+        if(items[s] != npos)
+            ++counts[keys[s] + 1];
+    for(size_t k = 1; k < counts.size(); ++k)
+        counts[k] += counts[k - 1];
+    for(long s = 0; s < cap; ++s)
+        if(items[s] != npos)
+            perm[counts[keys[s]]++] = s;
+
+    const long live = static_cast<long>(nitems);
+#pragma omp parallel for
+    for(long j = 0; j < live; ++j)
+    {
+        const idx_t s = perm[j];
+        tmp_x[j]      = xs[s];
+        tmp_y[j]      = ys[s];
+        tmp_items[j]  = items[s];
+        tmp_keys[j]   = keys[s];
+    }
+    xs.swap(tmp_x);
+    ys.swap(tmp_y);
+    items.swap(tmp_items);
+    keys.swap(tmp_keys);
+
+    const long nheads = static_cast<long>(head.size());
+#pragma omp parallel for
+    for(long k = 0; k < nheads; ++k)
+        head[k] = npos;
+
+#pragma omp parallel for
+    for(long j = 0; j < cap; ++j)
+    {
+        if(j < live)
+        {
+            slot_of[items[j]] = j;
+            prev[j]           = (j > 0        && keys[j - 1] == keys[j]) ? j - 1 : npos;
+            next[j]           = (j + 1 < live && keys[j + 1] == keys[j]) ? j + 1 : npos;
+            if(prev[j] == npos)
+                head[keys[j]] = j;
+        }
+        else
+            items[j] = npos;
+    }
+
+    free_slots.clear();
+    for(long s = cap; s > live; --s)
+        free_slots.push_back(s - 1);
+}
+
+size_t moving_grid::scan_cell(std::vector<idx_t> &res, const size_t key, const aabb2d &rect) const
+{
+    size_t count = 0;
+    for(idx_t s = head[key]; s != npos; s = next[s])
+    {
+        if(xs[s] >= rect.bounds[0][0] && xs[s] <= rect.bounds[1][0] &&
+           ys[s] >= rect.bounds[0][1] && ys[s] <= rect.bounds[1][1])
+        {
+            res.push_back(items[s]);
+            ++count;
+        }
+    }
+    return count;
+}
+
+size_t moving_grid::query(std::vector<idx_t> &res, const aabb2d &rect) const
+{
+    res.clear();
+
+    size_t low[2], high[2];
+    cell_coords(low[0],  low[1],  rect.bounds[0][0], rect.bounds[0][1]);
+    cell_coords(high[0], high[1], rect.bounds[1][0], rect.bounds[1][1]);
+
+    for(size_t cy = low[1]; cy <= high[1]; ++cy)
+        for(size_t cx = low[0]; cx <= high[0]; ++cx)
+            scan_cell(res, cell_key(cx, cy), rect);
+
+    return res.size();
+}
+
+size_t moving_grid::query_radius(std::vector<idx_t> &res, const float x, const float y, const float r) const
+{
+    res.clear();
+
+    size_t low[2], high[2];
+    cell_coords(low[0],  low[1],  x - r, y - r);
+    cell_coords(high[0], high[1], x + r, y + r);
+
+    const float r2 = r*r;
+    for(size_t cy = low[1]; cy <= high[1]; ++cy)
+        for(size_t cx = low[0]; cx <= high[0]; ++cx)
+            for(idx_t s = head[cell_key(cx, cy)]; s != npos; s = next[s])
+            {
+                const float dx = xs[s] - x;
+                const float dy = ys[s] - y;
+                if(dx*dx + dy*dy <= r2)
+                    res.push_back(items[s]);
+            }
+
+    return res.size();
+}
+
+static inline void knn_consider(std::vector<moving_grid::dist_item> &res, const size_t k, const float d2, const moving_grid::idx_t item)
+{
+    if(res.size() < k)
+    {
+        res.push_back(std::make_pair(d2, item));
+        std::push_heap(res.begin(), res.end());
+    }
+    else if(d2 < res.front().first)
+    {
+        std::pop_heap(res.begin(), res.end());
+        res.back() = std::make_pair(d2, item);
+        std::push_heap(res.begin(), res.end());
+    }
+}
+
+size_t moving_grid::query_knn(std::vector<dist_item> &res, const float x, const float y, const size_t k) const
+{
+    res.clear();
+    if(k == 0 || nitems == 0)
+        return 0;
+
+    size_t c[2];
+    cell_coords(c[0], c[1], x, y);
+
+    // Expanding rings of cells around c; lane mode only searches along the lane
+    const float step = mode == LANE ? cell_dim[0] : std::min(cell_dim[0], cell_dim[1]);
+    for(size_t r = 0; ; ++r)
+    {
+        const size_t ry      = mode == LANE ? 0 : r;
+        const long   xlow    = std::max(static_cast<long>(c[0]) - static_cast<long>(r),  0L);
+        const long   xhigh   = std::min(static_cast<long>(c[0]  + r),  static_cast<long>(ncells[0]) - 1);
+        const long   ylow    = std::max(static_cast<long>(c[1]) - static_cast<long>(ry), 0L);
+        const long   yhigh   = std::min(static_cast<long>(c[1]  + ry), static_cast<long>(ncells[1]) - 1);
+
+        for(long cy = ylow; cy <= yhigh; ++cy)
+        {
+            const bool full_row = mode == LANE || static_cast<size_t>(std::abs(cy - static_cast<long>(c[1]))) == r;
+            for(long cx = xlow; cx <= xhigh; ++cx)
+            {
+                if(!full_row && static_cast<size_t>(std::abs(cx - static_cast<long>(c[0]))) != r)
+                    continue;
+                if(mode == LANE && r > 0 && static_cast<size_t>(std::abs(cx - static_cast<long>(c[0]))) != r)
+                    continue;
+
+                for(idx_t s = head[cell_key(cx, cy)]; s != npos; s = next[s])
+                {
+                    const float dx = xs[s] - x;
+                    const float dy = ys[s] - y;
+                    knn_consider(res, k, dx*dx + dy*dy, items[s]);
+                }
+            }
+        }
+
+        const bool covered = xlow == 0 && xhigh == static_cast<long>(ncells[0]) - 1 &&
+            (mode == LANE || (ylow == 0 && yhigh == static_cast<long>(ncells[1]) - 1));
+        if(covered)
+            break;
+
+        // Anything in ring r+1 is at least r cells away
+        const float bound = r*step;
+        if(res.size() == k && res.front().first <= bound*bound)
+            break;
+    }
+
+    std::sort_heap(res.begin(), res.end());
+    BOOST_FOREACH(dist_item &di, res)
+    {
+        di.first = std::sqrt(di.first);
+    }
+
+    return res.size();
+}
+
+size_t moving_grid::query_lane(std::vector<idx_t> &res, const size_t lane, const intervalf &range) const
+{
+    const float fl = static_cast<float>(lane);
+    return query(res, aabb2d(std::min(range[0], range[1]), std::max(range[0], range[1]), fl, fl));
+}
+
+size_t moving_grid::query_lane_knn(std::vector<dist_item> &res, const size_t lane, const float t, const size_t k) const
+{
+    return query_knn(res, t, static_cast<float>(lane), k);
+}
+
+bool moving_grid::check() const
+{
+    size_t count = 0;
+    for(size_t k = 0; k < head.size(); ++k)
+    {
+        idx_t last = npos;
+        for(idx_t s = head[k]; s != npos; s = next[s])
+        {
+            if(keys[s] != k || prev[s] != last || items[s] == npos || slot_of[items[s]] != s)
+                return false;
+            if(cell(xs[s], ys[s]) != k)
+                return false;
+            last = s;
+            ++count;
+        }
+    }
+    return count == nitems && free_slots.size() + nitems == xs.size();
+}
@@ -0,0 +1,86 @@
+#ifndef _MOVING_GRID_HPP_
+#define _MOVING_GRID_HPP_
+
+#include "libroad_common.hpp"
+#include "rtree.hpp"
+
+// Spatial index for points that move every step (i.e. vehicles).
+// Items are dense integer handles in [0, capacity).
+// The grid is uniform, with cells numbered along a Hilbert curve; each cell is a
+// doubly-linked list of storage slots, so update() is O(1).
+// rebuild() recomputes every cell in parallel and renumbers the slots so that each
+// cell's items (and neighboring cells) are contiguous in memory.
+// In lane mode, positions are (t, lane index) and there is one row of cells per lane.
+// Queries fill caller-provided vectors and don't allocate once those have capacity.
+struct moving_grid
+{
+    typedef size_t idx_t;
+    typedef std::pair<float, idx_t> dist_item;
+
+    enum mode_t {WORLD, LANE};
+
+    static const idx_t npos;
+
+    moving_grid();
+    moving_grid(const aabb2d &bounds, float cell_size, size_t capacity);
+    moving_grid(size_t nlanes, size_t cells_per_lane, size_t capacity);
+
+    void   resize(size_t capacity);
+    void   clear();
+    size_t size() const;
+    bool   contains(idx_t item) const;
+
+    void insert(idx_t item, float x, float y);
+    void update(idx_t item, float x, float y);
+    void remove(idx_t item);
+
+    // Batch rebuild; the first form replaces the contents with items [0, n)
+    void rebuild(const float *x, const float *y, size_t n);
+    void rebuild();
+
+    size_t query       (std::vector<idx_t>     &res, const aabb2d &rect) const;
+    size_t query_radius(std::vector<idx_t>     &res, float x, float y, float r) const;
+    size_t query_knn   (std::vector<dist_item> &res, float x, float y, size_t k) const;
+
+    void   insert_lane   (idx_t item, size_t lane, float t);
+    void   update_lane   (idx_t item, size_t lane, float t);
+    size_t query_lane    (std::vector<idx_t>     &res, size_t lane, const intervalf &range) const;
+    size_t query_lane_knn(std::vector<dist_item> &res, size_t lane, float t, size_t k) const;
+
+    void   cell_coords(size_t &cx, size_t &cy, float x, float y) const;
+    size_t cell_key   (size_t cx, size_t cy) const;
+    size_t cell       (float x, float y) const;
+    size_t scan_cell  (std::vector<idx_t> &res, size_t key, const aabb2d &rect) const;
+    void   link       (idx_t slot, size_t key);
+    void   unlink     (idx_t slot);
+    bool   check      () const;
+
+    mode_t mode;
+    float  origin[2];
+    float  cell_dim[2];
+    float  inv_cell_dim[2];
+    size_t ncells[2];
+    size_t levels;
+    size_t nitems;
+
+    std::vector<idx_t>  head;
+    std::vector<idx_t>  slot_of;
+    std::vector<idx_t>  free_slots;
+
+    // per-slot storage
+    std::vector<float>  xs;
+    std::vector<float>  ys;
+    std::vector<idx_t>  items;
+    std::vector<size_t> keys;
+    std::vector<idx_t>  next;
+    std::vector<idx_t>  prev;
+
+    // rebuild scratch
+    std::vector<idx_t>  perm;
+    std::vector<size_t> counts;
+    std::vector<float>  tmp_x;
+    std::vector<float>  tmp_y;
+    std::vector<idx_t>  tmp_items;
+    std::vector<size_t> tmp_keys;
+};
+#endif
@@ -41,7 +41,7 @@ namespace osm
         glPointSize(5);
         glColor3f(1,0,0);
         glBegin(GL_POINTS);
-        BOOST_FOREACH(strhash<intersection>::type::value_type& i, intersections)
+        BOOST_FOREACH(intersection_map::value_type& i, intersections)
         {
             glVertex3fv(nodes[i.second.id_from_node].xy.data());
         }
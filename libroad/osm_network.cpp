@@ -1,9 +1,12 @@
 #include "osm_network.hpp"
 #include "arc_road.hpp"
+#include "rtree.hpp"
+#include "profile.hpp"
 #include <vector>
 #include <sstream>
 #include <limits>
 #include <algorithm>
+#include <cstring>
 
 static const double moar_fudge   = 0.5; //0.6666666;
 static const double scale        = 157253.2964 * moar_fudge;
@@ -16,30 +19,395 @@ namespace osm
     //Instantiate static
     size_t network::new_edges_id = 0;
 
-    typedef std::pair<const str, edge>         edge_pair;
-    typedef std::pair<const str, node>         node_pair;
-    typedef std::pair<const str, intersection> intr_pair;
+    typedef std::pair<const str, edge>     edge_pair;
+    typedef std::pair<const node_id, intersection> intr_pair;
+    typedef std::pair<node_id, vec2d>      id_xy;
 
-    node *network::add_node(const vec3f &v, const bool is_overpass)
+    static inline bool id_less(const id_xy &a, const id_xy &b)
     {
-        str id;
-        strhash<node>::type::iterator res;
-        do
+        return a.first < b.first;
+    }
+
+    str id_string(const node_id id)
+    {
+        return boost::str(boost::format("%d") % id);
+    }
+
+    highway_kind highway_kind_of(const str &highway_class)
+    {
+        static const char *names[OTHER_HIGHWAY] = {"motorway", "motorway_link", "primary", "primary_link", "secondary",
+                                                   "secondary_link", "residential", "service", "urban"};
+        const std::string &raw = highway_class.raw();
+        for(int k = 0; k < OTHER_HIGHWAY; ++k)
+            if(raw == names[k])
+                return static_cast<highway_kind>(k);
+        return OTHER_HIGHWAY;
+    }
+
+    // Speeds in mph, converted to m/s
+    static const edge_type highway_types[N_HIGHWAY_KINDS] = {{"motorway",       3, 65.0*MIPH_TO_MEPS, 0, true},
+                                                            {"motorway_link",  1, 30.0*MIPH_TO_MEPS, 0, true},
+                                                            {"primary",        1, 50.0*MIPH_TO_MEPS, 0, false},
+                                                            {"primary_link",   1, 30.0*MIPH_TO_MEPS, 0, true},
+                                                            {"secondary",      1, 40.0*MIPH_TO_MEPS, 0, false},
+                                                            {"secondary_link", 1, 30.0*MIPH_TO_MEPS, 0, true},
+                                                            {"residential",    1, 30.0*MIPH_TO_MEPS, 0, false},
+                                                            {"service",        1, 25.0*MIPH_TO_MEPS, 0, false},
+                                                            {"urban",          2, 30.0*MIPH_TO_MEPS, 0, false},
+                                                            {"other",          1, 25.0*MIPH_TO_MEPS, 0, false}};
+
+    const edge_type &highway_type(const highway_kind k)
+    {
+        assert(k >= 0 && k < N_HIGHWAY_KINDS);
+        return highway_types[k];
+    }
+
+    // Swaps without copying the shapes and strings, for compacting the edge list
+    static void swap_edges(edge &a, edge &b)
+    {
+        a.id.swap(b.id);
+        std::swap(a.from, b.from);
+        std::swap(a.to, b.to);
+        std::swap(a.type, b.type);
+        a.shape.swap(b.shape);
+        std::swap(a.spread, b.spread);
+        a.highway_class.swap(b.highway_class);
+        std::swap(a.kind, b.kind);
+        a.overpass_nodes.swap(b.overpass_nodes);
+        a.additional_lanes.swap(b.additional_lanes);
+    }
+
+    // Drops the edges marked dead, keeping the order of the others
+    static void compact_edges(std::vector<edge> &edges, const std::vector<char> &dead)
+    {
+        size_t kept = 0;
+        for(size_t j = 0; j < edges.size(); ++j)
         {
-            id = boost::str(boost::format("%d") % rand());
-            res = nodes.find(id);
+            if(dead[j])
+                continue;
+            if(kept != j)
+                swap_edges(edges[kept], edges[j]);
+            ++kept;
         }
-        while(res != nodes.end());
+        edges.resize(kept);
+    }
 
-        res                     = nodes.insert(res, std::make_pair(id, node()));
-        res->second.id          = id;
-        res->second.xy          = v;
-        res->second.is_overpass = is_overpass;
+    node_store::node_store() : made_base(-1)
+    {}
+
+    size_t node_store::slot(const node_id id) const
+    {
+        if(!made_slots.empty() && id <= made_base && static_cast<uint64_t>(made_base - id) < made_slots.size())
+            return made_slots[made_base - id];
+
+        const std::vector<node_id>::const_iterator it = std::lower_bound(ids.begin(), ids.end(), id);
+        if(it == ids.end() || *it != id)
+            return records.size();
+        return id_slots[it - ids.begin()];
+    }
+
+    node *node_store::find(const node_id id)
+    {
+        const size_t s = slot(id);
+        return s == records.size() ? 0 : &(records[s]);
+    }
+
+    const node *node_store::find(const node_id id) const
+    {
+        const size_t s = slot(id);
+        return s == records.size() ? 0 : &(records[s]);
+    }
+
+    node &node_store::operator[](const node_id id)
+    {
+        const size_t s = slot(id);
+        if(s != records.size())
+            return records[s];
+
+        const std::vector<node_id>::iterator it = std::lower_bound(ids.begin(), ids.end(), id);
+        id_slots.insert(id_slots.begin() + (it - ids.begin()), records.size());
+        ids.insert(it, id);
+        records.push_back(node());
+        records.back().id     = id;
+        records.back().lonlat = vec2d(0.0, 0.0);
+        records.back().xy     = vec3f(0.0f, 0.0f, 0.0f);
+        degrees.push_back(0);
+        return records.back();
+    }
+
+    node *node_store::add(const vec3f &xy, const node_id origin)
+    {
+        if(made_slots.empty())
+            made_base = std::min(static_cast<node_id>(0), ids.empty() ? static_cast<node_id>(0) : ids.front()) - 1;
+
+        const node_id id = made_base - static_cast<node_id>(made_slots.size());
+        made_slots.push_back(records.size());
+        made_from.push_back(origin);
+        records.push_back(node());
+        records.back().id     = id;
+        records.back().lonlat = vec2d(0.0, 0.0);
+        records.back().xy     = xy;
+        degrees.push_back(0);
+        return &(records.back());
+    }
 
-        return &(res->second);
+    node_id node_store::origin(const node_id id) const
+    {
+        if(made_slots.empty() || id > made_base || static_cast<uint64_t>(made_base - id) >= made_slots.size())
+            return 0;
+        return made_from[made_base - id];
+    }
+
+    void node_store::assign(const std::vector<id_xy> &sorted)
+    {
+        clear();
+        ids.reserve(sorted.size());
+        id_slots.reserve(sorted.size());
+        degrees.resize(sorted.size(), 0);
+        BOOST_FOREACH(const id_xy &p, sorted)
+        {
+            id_slots.push_back(records.size());
+            ids.push_back(p.first);
+            records.push_back(node());
+            records.back().id     = p.first;
+            records.back().lonlat = p.second;
+            records.back().xy     = vec3f(0.0f, 0.0f, 0.0f);
+        }
+    }
+
+    void node_store::clear()
+    {
+        records.clear();
+        ids.clear();
+        id_slots.clear();
+        made_base = -1;
+        made_slots.clear();
+        made_from.clear();
+        degrees.clear();
+        stray_degrees.clear();
+        incidence_begin.clear();
+        incidence.clear();
+    }
+
+    int &node_store::degree(const node_id id)
+    {
+        const size_t s = slot(id);
+        return s == records.size() ? stray_degrees[id] : degrees[s];
+    }
+
+    int node_store::degree(const node_id id) const
+    {
+        const size_t s = slot(id);
+        if(s != records.size())
+            return degrees[s];
+        const std::map<node_id, int>::const_iterator stray = stray_degrees.find(id);
+        return stray == stray_degrees.end() ? 0 : stray->second;
+    }
+
+    void node_store::reset_degrees()
+    {
+        std::fill(degrees.begin(), degrees.end(), 0);
+        stray_degrees.clear();
+    }
+
+    void node_store::index_edges(std::vector<edge> &edges)
+    {
+        // Count, prefix-sum, then fill; rows keep the order the edges come in
+        std::vector<size_t> edge_slots;
+        incidence_begin.assign(records.size() + 1, 0);
+        BOOST_FOREACH(const edge &e, edges)
+        {
+            BOOST_FOREACH(const node *n, e.shape)
+            {
+                const size_t s = slot(n->id);
+                edge_slots.push_back(s);
+                if(s != records.size())
+                    ++incidence_begin[s + 1];
+            }
+        }
+        for(size_t s = 0; s < records.size(); ++s)
+            incidence_begin[s + 1] += incidence_begin[s];
+
+        incidence.resize(incidence_begin.back());
+        std::vector<size_t> fill(incidence_begin.begin(), incidence_begin.end() - 1);
+        std::vector<size_t>::const_iterator current = edge_slots.begin();
+        BOOST_FOREACH(edge &e, edges)
+        {
+            for(size_t i = 0; i < e.shape.size(); ++i, ++current)
+                if(*current != records.size())
+                    incidence[fill[*current]++] = &e;
+        }
+    }
+
+    edge *const *node_store::edges_begin(const node_id id) const
+    {
+        const size_t s = slot(id);
+        if(s == records.size() || s + 1 >= incidence_begin.size() || incidence.empty())
+            return 0;
+        return &(incidence[0]) + incidence_begin[s];
     }
 
-    bool network::out_of_bounds(const vec3f &pt) const
+    edge *const *node_store::edges_end(const node_id id) const
+    {
+        const size_t s = slot(id);
+        if(s == records.size() || s + 1 >= incidence_begin.size() || incidence.empty())
+            return 0;
+        return &(incidence[0]) + incidence_begin[s + 1];
+    }
+
+    size_t node_store::edge_count(const node_id id) const
+    {
+        return edges_end(id) - edges_begin(id);
+    }
+
+    void node_store::replace_edge(const node_id id, const edge *from, edge *to)
+    {
+        edge *const *b = edges_begin(id);
+        edge *const *e = edges_end(id);
+        edge *const *it = std::find(b, e, from);
+        if(it != e)
+            incidence[it - &(incidence[0])] = to;
+    }
+
+    void build_network(network &n, std::vector<raw_node> &nodes, std::vector<raw_way> &ways)
+    {
+        // Only nodes that some highway goes through are kept
+        std::vector<node_id> used;
+        BOOST_FOREACH(const raw_way &w, ways)
+        {
+            used.insert(used.end(), w.refs.begin(), w.refs.end());
+        }
+        std::sort(used.begin(), used.end());
+        used.erase(std::unique(used.begin(), used.end()), used.end());
+
+        // A node given twice keeps its last position
+        std::vector<id_xy> kept;
+        BOOST_FOREACH(const raw_node &rn, nodes)
+        {
+            if(std::binary_search(used.begin(), used.end(), rn.id))
+                kept.push_back(id_xy(rn.id, rn.lonlat));
+        }
+        std::vector<raw_node>().swap(nodes);
+        std::vector<node_id>().swap(used);
+
+        std::stable_sort(kept.begin(), kept.end(), id_less);
+        std::vector<id_xy>::iterator out = kept.begin();
+        for(std::vector<id_xy>::iterator it = kept.begin(); it != kept.end(); ++it)
+        {
+            if(out != kept.begin() && (out - 1)->first == it->first)
+                *(out - 1) = *it;
+            else
+                *out++ = *it;
+        }
+        kept.erase(out, kept.end());
+        n.nodes.assign(kept);
+        std::vector<id_xy>().swap(kept);
+
+        BOOST_FOREACH(const raw_way &w, ways)
+        {
+            edge &e = n.edge_hash[w.id];
+            e.id            = w.id;
+            e.highway_class = w.highway_class;
+            e.kind          = highway_kind_of(e.highway_class);
+            BOOST_FOREACH(const node_id ref, w.refs)
+            {
+                node *current_node = &(n.nodes[ref]);
+
+                e.shape.push_back(current_node);
+
+                // The last node is the "to" node, the first the "from" node
+                if(e.shape.size() == 1)
+                    e.from = current_node->id;
+                e.to = current_node->id;
+            }
+        }
+        std::vector<raw_way>().swap(ways);
+
+        n.degrees_stale   = true;
+        n.incidence_stale = true;
+    }
+
+    raw_collector::raw_collector(network &n) : net(n)
+    {}
+
+    void raw_collector::bounds(const double minlon, const double minlat, const double maxlon, const double maxlat)
+    {
+        net.center[0] = (maxlon - minlon)/2.0 + minlon;
+        net.center[1] = (maxlat - minlat)/2.0 + minlat;
+
+        net.topleft[0] = minlon;
+        net.topleft[1] = maxlat;
+        net.bottomright[0] = maxlon;
+        net.bottomright[1] = minlat;
+    }
+
+    void raw_collector::node(raw_node &n)
+    {
+        nodes.push_back(n);
+    }
+
+    void raw_collector::way(raw_way &w)
+    {
+        ways.push_back(raw_way());
+        ways.back().id = w.id;
+        ways.back().highway_class.swap(w.highway_class);
+        ways.back().refs.swap(w.refs);
+    }
+
+    void read_network(const char *osm_file, reader_sink &sink)
+    {
+        const size_t len = std::strlen(osm_file);
+        if(len >= 4 && std::strcmp(osm_file + len - 4, ".pbf") == 0)
+            read_pbf_network(osm_file, sink);
+        else
+            read_xml_network(osm_file, sink);
+    }
+
+    network load_xml_network(const char *osm_file)
+    {
+        PROFILE_SCOPE("osm::load_xml_network");
+        network       n;
+        raw_collector raw(n);
+        read_xml_network(osm_file, raw);
+        build_network(n, raw.nodes, raw.ways);
+        PROFILE_COUNT("nodes", n.nodes.size());
+        PROFILE_COUNT("edges", n.edge_hash.size());
+        return n;
+    }
+
+    network load_pbf_network(const char *osm_file)
+    {
+        PROFILE_SCOPE("osm::load_pbf_network");
+        network       n;
+        raw_collector raw(n);
+        read_pbf_network(osm_file, raw);
+        build_network(n, raw.nodes, raw.ways);
+        PROFILE_COUNT("nodes", n.nodes.size());
+        PROFILE_COUNT("edges", n.edge_hash.size());
+        return n;
+    }
+
+    network load_network(const char *osm_file)
+    {
+        PROFILE_SCOPE("osm::load_network");
+        network       n;
+        raw_collector raw(n);
+        read_network(osm_file, raw);
+        build_network(n, raw.nodes, raw.ways);
+        PROFILE_COUNT("nodes", n.nodes.size());
+        PROFILE_COUNT("edges", n.edge_hash.size());
+        return n;
+    }
+
+    node *network::add_node(const vec3f &v, const bool is_overpass)
+    {
+        node *res        = nodes.add(v);
+        res->is_overpass = is_overpass;
+
+        return res;
+    }
+
+    bool network::out_of_bounds(const vec2d &pt) const
     {
         return !((pt[0] >= topleft[0] && pt[0] <= bottomright[0])
                  &&
@@ -48,44 +416,84 @@ namespace osm
 
     void network::clip_roads_to_bounds()
     {
-        //Remove any node that's outside the bounding box.
-        size_t j = 0;
-        while (j < edges.size())
+        //Remove any node that's outside the bounding box, and edges left with less than two.
+        std::vector<char> dead(edges.size(), 0);
+        for(size_t j = 0; j < edges.size(); ++j)
         {
-            edge&  e = edges[j];
-            size_t i = 0;
-            while (i < e.shape.size())
-                if (out_of_bounds(e.shape[i]->xy))
-                    e.shape.erase(e.shape.begin() + i);
-                else
-                    i++;
-
-            // e.shape.erase(e.shape.begin(), e.shape.begin() + new_start);
-            // e.shape.erase(e.shape.begin() + new_end, e.shape.end());
-            e.to   = e.shape.back()->id;
-            e.from = e.shape[0]->id;
+            edge             &e   = edges[j];
+            shape_t::iterator out = e.shape.begin();
+            for(shape_t::iterator in = e.shape.begin(); in != e.shape.end(); ++in)
+                if (!out_of_bounds((*in)->lonlat))
+                    *out++ = *in;
+            e.shape.erase(out, e.shape.end());
 
             if (e.shape.size() < 2)
-                edges.erase(edges.begin() + j);
-            else
-                j++;
+            {
+                dead[j] = 1;
+                continue;
+            }
+
+            e.to   = e.shape.back()->id;
+            e.from = e.shape[0]->id;
         }
+        compact_edges(edges, dead);
+
+        degrees_stale   = true;
+        incidence_stale = true;
     }
 
     void network::populate_edges_from_hash()
     {
+        edges.reserve(edges.size() + edge_hash.size());
         BOOST_FOREACH(strhash<edge>::type::value_type& hash, edge_hash)
         {
             edges.push_back(hash.second);
         }
+
+        degrees_stale   = true;
+        incidence_stale = true;
     }
 
-    void network::remove_duplicate_nodes()
+    void network::clean_up(const float lane_width, const projection::kind *proj)
     {
-        BOOST_FOREACH(edge& e, edges)
+        PROFILE_SCOPE("osm::network::clean_up");
+        { PROFILE_SCOPE("populate_edges_from_hash");     populate_edges_from_hash(); }
+        { PROFILE_SCOPE("remove_duplicate_nodes");       remove_duplicate_nodes(); }
+        { PROFILE_SCOPE("clip_roads_to_bounds");         clip_roads_to_bounds(); }
+        { PROFILE_SCOPE("compute_edge_types");           compute_edge_types(); }
+        { PROFILE_SCOPE("compute_node_degrees");         compute_node_degrees(); }
+        if(proj)
         {
-            e.remove_duplicate_nodes();
+            PROFILE_SCOPE("project");
+            project(*proj);
         }
+        else
+        {
+            PROFILE_SCOPE("scale_and_translate");
+            scale_and_translate();
+        }
+        { PROFILE_SCOPE("split_into_road_segments");     split_into_road_segments(); }
+        { PROFILE_SCOPE("remove_highway_intersections"); remove_highway_intersections(); }
+        { PROFILE_SCOPE("compute_node_heights");         compute_node_heights(); }
+        { PROFILE_SCOPE("join_logical_roads");           join_logical_roads(); }
+        { PROFILE_SCOPE("create_ramps");                 create_ramps(lane_width); }
+        { PROFILE_SCOPE("remove_small_roads");           remove_small_roads(50); }
+        { PROFILE_SCOPE("join_logical_roads");           join_logical_roads(); }
+        { PROFILE_SCOPE("create_intersections");         create_intersections(lane_width); }
+        PROFILE_COUNT("nodes",         nodes.size());
+        PROFILE_COUNT("edges",         edges.size());
+        PROFILE_COUNT("intersections", intersections.size());
+    }
+
+    void network::remove_duplicate_nodes()
+    {
+        const long count = static_cast<long>(edges.size());
+        #pragma omp parallel for schedule(dynamic, 256)
+        for(long i = 0; i < count; ++i)
+            edges[i].remove_duplicate_nodes();
+
+        degrees_stale   = true;
+        incidence_stale = true;
     }
 
     void network::edges_check()
@@ -98,10 +506,10 @@ namespace osm
 
     void network::node_degrees_and_edges_agree()
     {
-        strhash<int>::type node_degree_check;
-        BOOST_FOREACH(const osm::node_pair &np, nodes)
+        std::map<node_id, int> node_degree_check;
+        BOOST_FOREACH(const osm::node &n, nodes)
         {
-            node_degree_check.insert(std::pair<str,int>(np.first, 0));
+            node_degree_check.insert(std::make_pair(n.id, 0));
         }
 
         BOOST_FOREACH(osm::edge &e, edges)
@@ -112,16 +520,16 @@ namespace osm
             }
         }
 
-        typedef std::pair<const str, int> n_d;
+        typedef std::pair<const node_id, int> n_d;
         BOOST_FOREACH(n_d& nodepair, node_degree_check)
         {
-            assert(node_degrees[nodepair.first] == nodepair.second);
+            assert(nodes.degree(nodepair.first) == nodepair.second);
         }
 
         //Check intersections
         BOOST_FOREACH(intr_pair& ip, intersections)
         {
-            assert(node_degrees[ip.first] > 1);
+            assert(nodes.degree(ip.first) > 1);
         }
 
         BOOST_FOREACH(const edge& ep, edges)
@@ -183,12 +591,13 @@ namespace osm
                 //Update degree count for all nodes
                 BOOST_FOREACH(node* n, e.shape)
                 {
-                    node_degrees[n->id]--;
+                    nodes.degree(n->id)--;
                 }
 
                 //TODO join roads that this edge connected..
-                std::swap(edges[i], edges.back());
+                swap_edges(edges[i], edges.back());
                 edges.pop_back();
+                incidence_stale = true;
             }
             else
                 ++i;
@@ -198,24 +607,22 @@ namespace osm
     void network::create_grid(int w, int h, double dw, double dh)
     {
         std::vector<std::vector< node*> > node_grid (w, std::vector<node*>(h));
+        std::vector<std::vector< str> >   node_names(w, std::vector<str>(h));
 
         for(int i = 0; i < w; i++)
         {
             for(int j = 0; j < h; j++)
             {
-                std::stringstream node_id;
-                node_id << "node " << i << "_" << j;
-                node* n = retrieve<node>(nodes, str(node_id.str()));
-                n->id = str(node_id.str());
-                n->xy[0] = i*dw;
-                n->xy[1] = j*dh;
-                n->xy[2] = 0.0;
+                std::stringstream node_name;
+                node_name << "node " << i << "_" << j;
+                node_names[i][j] = str(node_name.str());
+                node* n = nodes.add(vec3f(i*dw, j*dh, 0.0));
 
                 node_grid[i][j] = n;
 
                 if (j != 0) //create vertical edge
                 {
-                    str   e_id = n->id+"to"+node_grid[i][j-1]->id;
+                    str   e_id = node_names[i][j]+"to"+node_names[i][j-1];
                     edge* e    = NULL;
                     for(int k=0; k < static_cast<int>(edges.size()); k++)
                         if (edges[k].id == e_id)
@@ -232,13 +639,14 @@ namespace osm
                     e->from = n->id;
                     e->to = node_grid[i][j-1]->id;
                     e->highway_class = "urban";
-                    e->shape.push_back(&nodes[e->from]);
-                    e->shape.push_back(&nodes[e->to]);
+                    e->kind = URBAN;
+                    e->shape.push_back(n);
+                    e->shape.push_back(node_grid[i][j-1]);
                 }
 
                 if (i != 0)
                 {
-                    str   e_id = n->id+"to"+node_grid[i-1][j]->id;
+                    str   e_id = node_names[i][j]+"to"+node_names[i-1][j];
                     edge* e    = NULL;
                     for(int k=0; k < static_cast<int>(edges.size()); k++)
                         if (edges[k].id == e_id)
@@ -255,64 +663,58 @@ namespace osm
                     e->from          = n->id;
                     e->to            = node_grid[i-1][j]->id;
                     e->highway_class = "urban";
-                    e->shape.push_back(&nodes[e->from]);
-                    e->shape.push_back(&nodes[e->to]);
+                    e->kind          = URBAN;
+                    e->shape.push_back(n);
+                    e->shape.push_back(node_grid[i-1][j]);
                 }
             }
         }
+
+        degrees_stale   = true;
+        incidence_stale = true;
     }
 
     void network::compute_node_degrees()
     {
-        node_degrees.erase(node_degrees.begin(), node_degrees.end());
-        assert(node_degrees.size() == 0);
-        BOOST_FOREACH(osm::node_pair &np, nodes)
-        {
-            np.second.edges_including.erase(np.second.edges_including.begin(), np.second.edges_including.end());
-        }
-
-        BOOST_FOREACH(const osm::node_pair &np, nodes)
-        {
-            node_degrees.insert(std::pair<str,int>(np.first, 0));
-        }
+        nodes.reset_degrees();
 
         BOOST_FOREACH(osm::edge &e, edges)
         {
             BOOST_FOREACH(osm::node *n, e.shape)
             {
-                //Check if this edge has already been recorded (edge has node multiple times
-                node_degrees[n->id]++;
-                n->edges_including.push_back(&e);
+                //An edge that has a node multiple times counts each time
+                nodes.degree(n->id)++;
             }
         }
+
+        nodes.index_edges(edges);
+        degrees_stale   = false;
+        incidence_stale = false;
     }
 
     void network::edges_including_rebuild()
     {
-        BOOST_FOREACH(osm::node_pair &np, nodes)
-        {
-            np.second.edges_including.erase(np.second.edges_including.begin(), np.second.edges_including.end());
-            assert(np.second.edges_including.size() == 0);
-        }
+        nodes.index_edges(edges);
+        incidence_stale = false;
+    }
 
-        BOOST_FOREACH(osm::edge &e, edges)
-        {
-            BOOST_FOREACH(node* n, e.shape)
-            {
-                n->edges_including.push_back(&e);
-            }
-        }
+    void network::update_index()
+    {
+        if(degrees_stale)
+            compute_node_degrees();
+        else if(incidence_stale)
+            edges_including_rebuild();
     }
 
 
     void network::create_ramps(const float lane_width)
     {
-        edges_including_rebuild();
+        update_index();
 
         BOOST_FOREACH(osm::edge &e, edges)
         {
             //For each ramp..
-            if (e.highway_class == "motorway_link")
+            if (e.kind == MOTORWAY_LINK)
             {
                 for (int b = 0; b < 2; b++)
                 {
@@ -330,13 +732,13 @@ namespace osm
                         node*      highway_node         = n->ramp_merging_point;
                         bool       highway_intersection = false;
                         osm::edge* highway              = NULL;
-                        BOOST_FOREACH(osm::edge *e, highway_node->edges_including)
+                        for(edge *const *inc = nodes.edges_begin(highway_node->id); inc != nodes.edges_end(highway_node->id); ++inc)
                         {
-                            highway_intersection = (e->highway_class == "motorway");
+                            highway_intersection = ((*inc)->kind == MOTORWAY);
 
                             if (highway_intersection)
                             {
-                                highway = e;
+                                highway = *inc;
                                 break;
                             }
                         }
@@ -397,16 +799,16 @@ namespace osm
                             if (i == 0)
                             {
                                 vec3f tan(col(highway_shape.frame(t, offset, false), 0));
-                                e.shape.insert(e.shape.begin() + 1, new node);
-                                e.shape[i + 1]->id = str(boost::lexical_cast<std::string>(rand()));
-                                e.shape[i + 1]->xy = len*tan + pt;
+                                e.shape.insert(e.shape.begin() + 1, nodes.add(vec3f(len*tan + pt)));
+                                nodes.degree(e.shape[1]->id)++;
+                                incidence_stale = true;
                             }
                             else if (i + 1 == e.shape.size())
                             {
                                 vec3f tan(col(highway_shape.frame(t, offset, true), 0));
-                                e.shape.insert(e.shape.begin() + i, new node);
-                                e.shape[i]->id = str(boost::lexical_cast<std::string>(rand()));
-                                e.shape[i]->xy = len*tan + pt;
+                                e.shape.insert(e.shape.begin() + i, nodes.add(vec3f(len*tan + pt)));
+                                nodes.degree(e.shape[i]->id)++;
+                                incidence_stale = true;
                             }
                             else
                             {
@@ -450,12 +852,14 @@ namespace osm
 
     void network::remove_highway_intersections()
     {
-        edges_including_rebuild();
-        compute_node_degrees();
+        update_index();
+
+        //Highways get their own copy of every node they share, looked up by the original's id
+        std::map<node_id, node*> highway_nodes;
 
         BOOST_FOREACH(osm::edge &e, edges)
         {
-            if (e.highway_class == "motorway")
+            if (e.kind == MOTORWAY)
             {
                 for(size_t i = 0; i < e.shape.size(); i++)
                 {
@@ -463,19 +867,21 @@ namespace osm
                     node*& n         = e.shape[i];
 
                     //Found an intersection
-                    if (node_degrees[n->id] > 2)
+                    if (nodes.degree(n->id) > 2)
                     {
                         //Removing node from highway
-                        node_degrees[n->id]--;
+                        nodes.degree(n->id)--;
 
-                        node* old    = n;
-                        str   new_id = old->id + "_HWY";
-                        n            = retrieve<node>(nodes, new_id);
+                        node*  old = n;
+                        node*& hwy = highway_nodes[old->id];
+                        if (!hwy)
+                            hwy = nodes.add(old->xy, old->id);
+                        n = hwy;
 
                         //If there is a ramp at this intersection, store the connecting node
-                        BOOST_FOREACH(edge* e, old->edges_including)
+                        for(edge *const *inc = nodes.edges_begin(old->id); inc != nodes.edges_end(old->id); ++inc)
                         {
-                            if (e->highway_class == "motorway_link")
+                            if ((*inc)->kind == MOTORWAY_LINK)
                             {
                                 old->ramp_merging_point = n;
                                 ramp_node = true;
@@ -487,20 +893,7 @@ namespace osm
                             old->is_overpass = true;
 
                         n->xy = old->xy;
-                        //TODO edges_including..
-                        n->id = new_id;
-                        n->edges_including.push_back(&e);
-                        if (find(old->edges_including.begin(),
-                                 old->edges_including.end(),
-                                 &e) != old->edges_including.end())
-                            old->edges_including.erase(find(old->edges_including.begin(),
-                                                            old->edges_including.end(),
-                                                            &e));
-
-
-                        if (node_degrees.find(n->id) == node_degrees.end())
-                            node_degrees[n->id] = 0;
-                        node_degrees[n->id]++;
+                        nodes.degree(n->id)++;
 
                         //If node is at the end of the road
                         if (i + 1 == e.shape.size())
@@ -512,25 +905,15 @@ namespace osm
                     else if (n->ramp_merging_point != NULL || n->is_overpass == true)
                     {
                         //Removing node from highway
-                        node_degrees[n->id]--;
+                        nodes.degree(n->id)--;
 
-                        node* old    = n;
-                        str   new_id = old->id + "_HWY";
-                        n            = retrieve<node>(nodes, new_id);
+                        node*  old = n;
+                        node*& hwy = highway_nodes[old->id];
+                        if (!hwy)
+                            hwy = nodes.add(old->xy, old->id);
+                        n = hwy;
                         n->xy = old->xy;
-                        n->id = new_id;
-                        n->edges_including.push_back(&e);
-                        if (find(old->edges_including.begin(),
-                                 old->edges_including.end(),
-                                 &e) != old->edges_including.end())
-                            old->edges_including.erase(find(old->edges_including.begin(),
-                                                            old->edges_including.end(),
-                                                            &e));
-
-
-                        if (node_degrees.find(n->id) == node_degrees.end())
-                            node_degrees[n->id] = 0;
-                        node_degrees[n->id]++;
+                        nodes.degree(n->id)++;
 
                         //If node is at the end of the road
                         if (i + 1 == e.shape.size())
@@ -542,6 +925,82 @@ namespace osm
                 }
             }
         }
+
+        //The highways now go through their own nodes
+        edges_including_rebuild();
+    }
+
+    // Pairs of edge segments that intersect in the plane without sharing a node;
+    // these are where roads pass over or under each other rather than meet.
+    void network::find_crossings(std::vector<crossing> &res) const
+    {
+        std::vector<std::pair<size_t, size_t> > segs;
+        std::vector<rtree2d::entry>              leaves;
+        for(size_t e = 0; e < edges.size(); ++e)
+        {
+            const shape_t &shape = edges[e].shape;
+            for(size_t i = 0; i + 1 < shape.size(); ++i)
+            {
+                const vec3f &p0 = shape[i]->xy;
+                const vec3f &p1 = shape[i+1]->xy;
+                leaves.push_back(rtree2d::entry(aabb2d(std::min(p0[0], p1[0]), std::max(p0[0], p1[0]),
+                                                       std::min(p0[1], p1[1]), std::max(p0[1], p1[1])),
+                                                segs.size()));
+                segs.push_back(std::make_pair(e, i));
+            }
+        }
+
+        if(leaves.empty())
+            return;
+
+        rtree2d                                  *tree = rtree2d::hilbert_rtree(leaves);
+        std::vector<std::pair<size_t, size_t> >   candidates;
+        tree->self_join(candidates);
+        delete tree;
+
+        std::vector<crossing> found(candidates.size());
+        std::vector<char>     keep(candidates.size(), 0);
+        const long            ncand = static_cast<long>(candidates.size());
+#pragma omp parallel for schedule(dynamic, 256)
+        for(long c = 0; c < ncand; ++c)
+        {
+            const std::pair<size_t, size_t> &sa = segs[candidates[c].first];
+            const std::pair<size_t, size_t> &sb = segs[candidates[c].second];
+            const node *a0 = edges[sa.first].shape[sa.second];
+            const node *a1 = edges[sa.first].shape[sa.second+1];
+            const node *b0 = edges[sb.first].shape[sb.second];
+            const node *b1 = edges[sb.first].shape[sb.second+1];
+            if(a0 == b0 || a0 == b1 || a1 == b0 || a1 == b1 ||
+               a0->id == b0->id || a0->id == b1->id || a1->id == b0->id || a1->id == b1->id)
+                continue;
+
+            const double rx    = a1->xy[0] - a0->xy[0];
+            const double ry    = a1->xy[1] - a0->xy[1];
+            const double sx    = b1->xy[0] - b0->xy[0];
+            const double sy    = b1->xy[1] - b0->xy[1];
+            const double denom = rx*sy - ry*sx;
+            if(denom == 0.0)
+                continue;
+
+            const double dx = b0->xy[0] - a0->xy[0];
+            const double dy = b0->xy[1] - a0->xy[1];
+            const double s  = (dx*sy - dy*sx)/denom;
+            const double u  = (dx*ry - dy*rx)/denom;
+            if(s < 0.0 || s > 1.0 || u < 0.0 || u > 1.0)
+                continue;
+
+            crossing &x  = found[c];
+            x.edge       = sa.first;
+            x.seg        = sa.second;
+            x.other_edge = sb.first;
+            x.other_seg  = sb.second;
+            x.point      = vec3f(a0->xy + static_cast<float>(s)*(a1->xy - a0->xy));
+            keep[c]      = 1;
+        }
+
+        for(size_t c = 0; c < found.size(); ++c)
+            if(keep[c])
+                res.push_back(found[c]);
     }
 
     typedef std::pair<vec2f, vec2f> pair_of_isects;
@@ -576,71 +1035,19 @@ namespace osm
 
     void network::compute_node_heights()
     {
-        float overpass_height = 5;
+        const float overpass_height = 5;
 
-        BOOST_FOREACH(osm::edge& e, edges)
-        {
-            std::vector<node*> new_shape;
-            for(int i = 0; i < static_cast<int>(e.shape.size()); i++)
-            {
-                osm::node* n = e.shape[i];
-                //Find node that's part of overpass.
-                if (n->is_overpass)
-                {
-                    //TODO What if road ends before ramp radius is reached? Could continue to traverse connecting roads, but that could produce odd effects.
-
-                    n->xy[2] += overpass_height;
-
-                    //         vec2f n_2d(n->xy[0], n->xy[1]);
-
-                    //         //Walk back until
-                    //         //  1) another overpass is found, or
-                    //         //  2) until a line segment intersects with a circle centered at point i
-                    //         float overpass_radius = 60;
-                    //         float len_thus_far = 0;
-                    //         int last_index = -1;
-                    //         for(int j = i - 1; j >= 0; j--)
-                    //         {
-                    //             osm::node* j_node = e.shape[j];
-
-                    //             vec3f j_3d(j_node->xy[0], j_node->xy[1], 0);
-                    //             vec3f jp1_3d(e.shape[j + 1]->xy[0], e.shape[j + 1]->xy[1], 0);
-
-                    //             if (j_node->is_overpass)
-                    //                 break;
-
-                    //             float dist = norm2(j_3d - jp1_3d);
-                    //             if (len_thus_far + dist > overpass_radius)
-                    //             {
-                    //                 float param = (overpass_radius - len_thus_far) / dist;
-                    //                 vec3f new_point(param*(j_3d - jp1_3d) + jp1_3d);
-                    //                 osm::node ramp_start;
-                    //                 ramp_start.id = n->id + "_opassramp";
-                    //                 ramp_start.xy = vec3f(new_point);
-                    //                 ramp_start.edges_including.push_back(&e);
-                    //                 node_degrees[ramp_start.id] = 1;
-                    //                 strhash<node>::type::iterator pos = nodes.insert(std::make_pair(ramp_start.id, ramp_start)).first;
-                    //                 new_shape.push_back(&(pos->second));
-                    //                 break;
-                    //             }
-                    //             else
-                    //             {
-                    //                 len_thus_far += dist;
-                    //                 new_shape[j]->xy[2] = (len_thus_far / overpass_radius) / overpass_height;
-                    //             }
-                    //         }
-                    //         new_shape.push_back(n);
-                    //     }
-                    //     else
-                    //         new_shape.push_back(n);
-                }
+        //Overpass nodes are raised once for every time an edge goes through them, which is their degree
+        if(degrees_stale)
+            compute_node_degrees();
 
-                // e.shape.clear();
-                // for (int i = 0; i < new_shape.size(); i++)
-                // {
-                //     e.shape.push_back(new_shape[i]);
-                // }
-            }
+        const long count = static_cast<long>(nodes.size());
+        #pragma omp parallel for schedule(static)
+        for(long i = 0; i < count; ++i)
+        {
+            osm::node &n = nodes.records[i];
+            if (n.is_overpass)
+                n.xy[2] += overpass_height*nodes.degree_at(i);
         }
     }
 
@@ -650,14 +1057,14 @@ namespace osm
         BOOST_FOREACH(const osm::intr_pair &ip, intersections)
         {
             assert(ip.first == ip.second.id_from_node);
-            assert(node_degrees[ip.first] > 1);
+            assert(nodes.degree(ip.first) > 1);
         }
 
         //Check that intersections don't occur in the middle of roads.
         BOOST_FOREACH(const osm::edge &e, edges)
         {
             for (int i = 1; i < static_cast<int>(e.shape.size()) - 1; i++)
-                assert(node_degrees[e.shape[i]->id] == 1);
+                assert(nodes.degree(e.shape[i]->id) == 1);
         }
     }
 
@@ -676,33 +1083,23 @@ namespace osm
 
     void network::create_intersections(float lane_width)
     {
-        compute_node_degrees();
+        update_index();
 
         BOOST_FOREACH(osm::edge &e, edges)
         {
             assert(e.to == e.shape.back()->id);
             assert(e.from == e.shape[0]->id);
-            if (node_degrees[e.to] > 2)
+            if (nodes.degree(e.to) > 2)
             {
-                if (e.highway_class == "motorway")
-                {
-                    std::cout << e.id << " is an intersection to " << e.to << std::endl;
-                    std::cout << node_degrees[e.to] << std::endl;
-                }
                 intersection* curr;
-                curr = retrieve<intersection>(intersections, e.to);
+                curr = &intersections[e.to];
                 curr->edges_ending_here.push_back(&e);
                 curr->id_from_node = e.to;
             }
-            if (node_degrees[e.from] > 2)
+            if (nodes.degree(e.from) > 2)
             {
-                if (e.highway_class == "motorway")
-                {
-                    std::cout << e.id << " is an intersection from " << e.from << std::endl;
-                    std::cout << node_degrees[e.from] << std::endl;
-                }
                 intersection* curr;
-                curr = retrieve<intersection>(intersections, e.from);
+                curr = &intersections[e.from];
                 curr->edges_starting_here.push_back(&e);
                 curr->id_from_node = e.from;
             }
@@ -713,7 +1110,8 @@ namespace osm
         BOOST_FOREACH(const osm::intr_pair &ip, intersections)
         {
             const intersection&  i = ip.second;
-            const node          &intersection_node(nodes[i.id_from_node]);
+            const node          *intersection_node = nodes.find(i.id_from_node);
+            const float          intersection_z    = intersection_node ? intersection_node->xy[2] : 0.0f;
 
             std::map<edge*, create_intersections::Edge_Offset*> edges_to_offsets;
             std::vector<create_intersections::Edge_Offset> edge_offsets;
@@ -859,7 +1257,7 @@ namespace osm
 
                 //Update node degree count.
                 for (int i = 1; i <= new_start; i++)
-                    node_degrees[e.shape[i]->id]--;
+                    nodes.degree(e.shape[i]->id)--;
 
                 //Modify geometry to make room for intersection.
                 vec3f start_seg(e.shape[new_start + 1]->xy - e.shape[new_start]->xy);
@@ -872,7 +1270,7 @@ namespace osm
                 e.shape[new_start]->id    = e.shape[0]->id;
                 e.shape[new_start]->xy[0] = e.shape[new_start + 1]->xy[0] - start_seg[0];
                 e.shape[new_start]->xy[1] = e.shape[new_start + 1]->xy[1] - start_seg[1];
-                e.shape[new_start]->xy[2] = intersection_node.xy[2];
+                e.shape[new_start]->xy[2] = intersection_z;
 
                 assert(!isnan(e.shape[new_start]->xy[0]));
                 assert(!isnan(e.shape[new_start]->xy[1]));
@@ -904,7 +1302,7 @@ namespace osm
                 //Update node degree count
                 //Don't change count for the last node, as we use its id.
                 for (int i = new_end; i < static_cast<int>(e.shape.size()) - 1; i++)
-                    node_degrees[e.shape[i]->id]--;
+                    nodes.degree(e.shape[i]->id)--;
 
                 vec3f end_seg = e.shape[new_end]->xy;
 
@@ -918,7 +1316,7 @@ namespace osm
                 e.shape[new_end]->id     = e.shape[e.shape.size() - 1]->id;
                 e.shape[new_end]->xy[0]  = e.shape[new_end - 1]->xy[0] + end_seg[0];
                 e.shape[new_end]->xy[1]  = e.shape[new_end - 1]->xy[1] + end_seg[1];
-                e.shape[new_end]->xy[2]  = intersection_node.xy[2];
+                e.shape[new_end]->xy[2]  = intersection_z;
 
                 assert(!isnan(e.shape[new_end]->xy[0]));
                 assert(!isnan(e.shape[new_end]->xy[1]));
@@ -928,22 +1326,56 @@ namespace osm
                     e.shape.erase(e.shape.begin() + new_end + 1, e.shape.end());
             }
         }
+
+        incidence_stale = true;
     }
 
     void network::scale_and_translate()
     {
-        bool first = true;
-        vec2d bias;
+        const vec2d bias(center*scale);
 
-        BOOST_FOREACH(osm::node_pair &np, nodes)
+        const long count = static_cast<long>(nodes.size());
+        #pragma omp parallel for schedule(static)
+        for(long i = 0; i < count; ++i)
         {
-            if (first)
-                bias = center*scale;
-            np.second.xy[0] = np.second.xy[0]*scale - bias[0];
-            np.second.xy[1] = np.second.xy[1]*scale - bias[1];
+            osm::node &n = nodes.records[i];
+            n.xy[0] = static_cast<float>(n.lonlat[0]*scale - bias[0]);
+            n.xy[1] = static_cast<float>(n.lonlat[1]*scale - bias[1]);
+            n.xy[2] = 0.0f;
         }
     }
 
+    projection::local_frame network::project(const projection::kind k)
+    {
+        const size_t        count = nodes.size();
+        std::vector<double> x(count);
+        std::vector<double> y(count);
+        std::vector<float>  fx(count);
+        std::vector<float>  fy(count);
+        for(size_t i = 0; i < count; ++i)
+        {
+            x[i] = nodes.records[i].lonlat[0];
+            y[i] = nodes.records[i].lonlat[1];
+        }
+
+        const projection::projector proj(k, center[0], center[1]);
+        double                      origin[2];
+        proj.forward(center[0], center[1], origin[0], origin[1]);
+        if(count)
+            proj.forward(&(x[0]), &(y[0]), &(x[0]), &(y[0]), count);
+
+        const projection::local_frame res(projection::to_local(count ? &(x[0]) : 0, count ? &(y[0]) : 0, count, origin,
+                                                                count ? &(fx[0]) : 0, count ? &(fy[0]) : 0));
+        for(size_t i = 0; i < count; ++i)
+        {
+            nodes.records[i].xy[0] = fx[i];
+            nodes.records[i].xy[1] = fy[i];
+            nodes.records[i].xy[2] = 0.0f;
+        }
+        frame = res;
+        return res;
+    }
+
     void network::join(osm::edge* a, osm::edge* b)
     {
         //Adds b to a
@@ -959,8 +1391,7 @@ namespace osm
         //Add all of b's nodes except the first one.
         for (int i = 1; i < static_cast<int>(b->shape.size()); i++)
         {
-            b->shape[i]->edges_including.erase(find(b->shape[i]->edges_including.begin(), b->shape[i]->edges_including.end(), b));
-            b->shape[i]->edges_including.push_back(a);
+            nodes.replace_edge(b->shape[i]->id, b, a);
             a->shape.push_back(b->shape[i]);
         }
 
@@ -972,19 +1403,19 @@ namespace osm
     void edge::remove_duplicate_nodes()
     {
         std::vector<node*> new_node_list;
-        str last_id = shape[0]->id;
-        vec3f last_vec = shape[0]->xy;
+        node_id last_id = shape[0]->id;
+        vec2d last_vec = shape[0]->lonlat;
         new_node_list.push_back(shape[0]);
         for(size_t i = 1; i < shape.size(); i++)
         {
             if ((shape[i]->id != last_id)
-                && ((shape[i]->xy[0] != last_vec[0])
+                && ((shape[i]->lonlat[0] != last_vec[0])
                     ||
-                    (shape[i]->xy[1] != last_vec[1])))
+                    (shape[i]->lonlat[1] != last_vec[1])))
             {
                 new_node_list.push_back(shape[i]);
                 last_id = shape[i]->id;
-                last_vec = shape[i]->xy;
+                last_vec = shape[i]->lonlat;
             }
         }
         shape.clear();
@@ -1000,47 +1431,48 @@ namespace osm
 
     void network::join_logical_roads()
     {
-        compute_node_degrees();
-        edges_including_rebuild();
+        update_index();
+#ifndef NDEBUG
         node_degrees_and_edges_agree();
-        std::vector<str> edges_to_delete;
+#endif
+        std::vector<char> joined(edges.size(), 0);
 
-        BOOST_FOREACH(osm::node_pair &np, nodes)
+        BOOST_FOREACH(const osm::node &np, nodes)
         {
-            if (node_degrees[np.first] == 2)
+            if (nodes.degree(np.id) == 2)
             {
-                assert(np.second.edges_including.size() < 3);
-                if(np.second.edges_including.size() == 2)
+                assert(nodes.edge_count(np.id) < 3);
+                if(nodes.edge_count(np.id) == 2)
                 {
-                    edge* e = np.second.edges_including[0];
-                    edge* o = np.second.edges_including[1];
+                    edge* e = nodes.edges_begin(np.id)[0];
+                    edge* o = nodes.edges_begin(np.id)[1];
 
                     if (o == e)
                         continue;
 
-                    if ((nodes[o->to].id == nodes[e->from].id) && (o->to == np.first))
+                    if ((o->to == e->from) && (o->to == np.id))
                     {
                         std::swap(o, e);
                     }
 
-                    if ((nodes[e->to].id == nodes[o->from].id) && (e->to == np.first))
+                    if ((e->to == o->from) && (e->to == np.id))
                     {
-                        node_degrees[e->to]--;
+                        nodes.degree(e->to)--;
 
                         int e_size = e->shape.size();
                         int o_size = o->shape.size();
                         join(e, o);
                         assert(static_cast<int>(e->shape.size()) == e_size + o_size - 1);
 
-                        edges_to_delete.push_back(o->id);
+                        joined[o - &(edges[0])] = 1;
                         // std::vector<edge*>::iterator ei_it = find(np.second.edges_including.begin(), np.second.edges_including.end(), o);
 
                         // assert(np.second.edges_including.end() != ei_it);
                         // np.second.edges_including.erase(ei_it);
                     }
-                    else if ((nodes[e->to].id == nodes[o->to].id) && (e->to == np.first))
+                    else if ((e->to == o->to) && (e->to == np.id))
                     {
-                        node_degrees[e->to]--;
+                        nodes.degree(e->to)--;
 
                         int e_size = e->shape.size();
                         int o_size = o->shape.size();
@@ -1052,14 +1484,14 @@ namespace osm
                         // std::vector<edge>::iterator j_it = find(edges.begin(), edges.end(), *o);
                         // assert(j_it != edges.end());
                         // edges.erase(j_it);
-                        edges_to_delete.push_back(o->id);
+                        joined[o - &(edges[0])] = 1;
                         // std::vector<edge*>::iterator ei_it = find(np.second.edges_including.begin(), np.second.edges_including.end(), o);
                         // assert(np.second.edges_including.end() != ei_it);
                         // np.second.edges_including.erase(ei_it);
                     }
-                    else if ((nodes[e->from].id == nodes[o->from].id) && (e->from == np.first))
+                    else if ((e->from == o->from) && (e->from == np.id))
                     {
-                        node_degrees[e->from]--;
+                        nodes.degree(e->from)--;
 
                         int e_size = e->shape.size();
                         int o_size = o->shape.size();
@@ -1071,7 +1503,7 @@ namespace osm
                         // std::vector<edge>::iterator j_it = find(edges.begin(), edges.end(), *o);
                         // assert(j_it != edges.end());
                         // edges.erase(j_it);
-                        edges_to_delete.push_back(o->id);
+                        joined[o - &(edges[0])] = 1;
 
                         // std::vector<edge*>::iterator ei_it = find(np.second.edges_including.begin(), np.second.edges_including.end(), o);
                         // assert(np.second.edges_including.end() != ei_it);
@@ -1081,17 +1513,8 @@ namespace osm
             }
         }
 
-        for(size_t i = 0; i < edges_to_delete.size(); i++)
-        {
-            for(size_t j = 0; j < edges.size(); j++)
-            {
-                if (edges[j].id == edges_to_delete[i])
-                {
-                    edges.erase(edges.begin() + j);
-                    break;
-                }
-            }
-        }
+        compact_edges(edges, joined);
+        incidence_stale = true;
     }
 
     void network::display_used_node_heights()
@@ -1106,184 +1529,108 @@ namespace osm
         }
     }
 
-    edge network::copy_no_shape(const edge& e)
+    // A copy of e without its shape or ends, named by number
+    static edge copy_no_shape_as(const edge& e, const size_t number)
     {
         edge to_return;
         to_return.type = e.type;
 
         //Initialized to values that must be changed.
-        to_return.from = "-1";
-        to_return.to   = "-1";
+        to_return.from = 0;
+        to_return.to   = 0;
 
-        std::stringstream sout;
-        sout << network::new_edges_id;
-        to_return.id = str(sout.str());
-        network::new_edges_id++;
+        to_return.id = boost::lexical_cast<std::string>(number);
 
         to_return.highway_class = e.highway_class;
+        to_return.kind          = e.kind;
 
         return to_return;
     }
 
+    edge network::copy_no_shape(const edge& e)
+    {
+        return copy_no_shape_as(e, network::new_edges_id++);
+    }
+
     void network::split_into_road_segments()
     {
-        //Locate all split points.
-        //        std::map<str, std::vector<str> > road_split_points;
-        std::map<str, std::vector<int> > road_split_points;
-        BOOST_FOREACH(edge &ep, edges)
+        if(degrees_stale)
+            compute_node_degrees();
+
+        //Locate all split points, by edge index: interior nodes that other edges go through too.
+        const long                     old_count = static_cast<long>(edges.size());
+        const node_store              &store     = nodes;
+        std::vector<std::vector<int> > road_split_points(old_count);
+        #pragma omp parallel for schedule(dynamic, 256)
+        for(long ei = 0; ei < old_count; ei++)
         {
+            const edge &ep = edges[ei];
             //Check nodes for split points, but skip the first and last
             for (int i = 1; i < static_cast<int>(ep.shape.size()) - 1; i++)
             {
-                if (node_degrees[ep.shape[i]->id] > 1)
-                {
-                    road_split_points[ep.id].push_back(i);
-                }
+                if (store.degree(ep.shape[i]->id) > 1)
+                    road_split_points[ei].push_back(i);
             }
         }
 
-        //Split each edge at its split points.
-        std::vector<edge> new_edges;
-        BOOST_FOREACH(edge &_edge, edges)
+        //Each split point starts a new edge. They go after the old edges, in order of edge and then of split point,
+        //and are numbered in that order, so the result doesn't depend on the number of threads.
+        std::vector<size_t> first_new(old_count + 1, old_count);
+        for(long ei = 0; ei < old_count; ei++)
         {
-            int node_index        = 0;
-            int _edge_ending_node = 0;
+            first_new[ei + 1] = first_new[ei] + road_split_points[ei].size();
 
-            //Find first splitter.
-            bool _first = true;
-            BOOST_FOREACH(int split_index, road_split_points[_edge.id])
+            //Increase the node degree as the road is being split.
+            BOOST_FOREACH(int split_index, road_split_points[ei])
             {
-                if (!_first)
-                {
-                    new_edges.push_back(copy_no_shape(_edge));
-                    new_edges.back().from = _edge.shape[node_index]->id;
-                    new_edges.back().shape.push_back(&nodes[_edge.shape[node_index]->id]);
-                }
-
-                //Increase the node degree as the road is being split.
-                node_degrees[_edge.shape[split_index]->id]++;
-
-                //Add each node to new edge up to, and including, the next splitter
-                //Set the first node of the new edge
-
-                while (node_index != split_index)
-                {
-                    node_index++;
-                    if (!_first)
-                    {
-                        //Add nodes to new road
-                        new_edges.back().shape.push_back(&nodes[_edge.shape[node_index]->id]);
-                        new_edges.back().to = _edge.shape[node_index]->id;
-                    }
-                }
-
-                if (!_first)
-                    assert(new_edges.back().shape.size() > 1);
-
-                //Node index is at the index of the split point.
-                if (_first)
-                {
-                    //Update the node this road goes up to.
-                    _edge.to          = _edge.shape[node_index]->id;
-                    _edge_ending_node = node_index;
-                    _first            = false;
-                }
+                nodes.degree(edges[ei].shape[split_index]->id)++;
             }
+        }
 
-            if (road_split_points[_edge.id].size() > 0)
-            {
-                //Now node_index is on the final splitter.
-                //Add that splitter and all remaining nodes to a new edge.
-                new_edges.push_back(copy_no_shape(_edge));
-                new_edges.back().from = _edge.shape[node_index]->id;
+        const size_t base_number = network::new_edges_id;
+        network::new_edges_id += first_new[old_count] - old_count;
+        edges.resize(first_new[old_count]);
 
-                for (;node_index < static_cast<int>(_edge.shape.size()); node_index++)
-                {
-                    new_edges.back().shape.push_back(_edge.shape[node_index]);
-                    new_edges.back().to = _edge.shape[node_index]->id;
-                }
+        #pragma omp parallel for schedule(dynamic, 256)
+        for(long ei = 0; ei < old_count; ei++)
+        {
+            const std::vector<int> &splits = road_split_points[ei];
+            if (splits.empty())
+                continue;
 
-                assert((--new_edges.end())->shape.size() > 1);
-                //Remove the deleted nodes from the original edge
-                _edge.shape.erase(_edge.shape.begin()+ _edge_ending_node + 1, _edge.shape.end());
+            edge &_edge = edges[ei];
+            for (size_t k = 0; k < splits.size(); k++)
+            {
+                //From this split point up to, and including, the next one or the end
+                const size_t slot  = first_new[ei] + k;
+                const int    start = splits[k];
+                const int    end   = k + 1 < splits.size() ? splits[k + 1] : static_cast<int>(_edge.shape.size()) - 1;
+
+                edge &new_edge = edges[slot];
+                new_edge       = copy_no_shape_as(_edge, base_number + slot - old_count);
+                new_edge.shape.assign(_edge.shape.begin() + start, _edge.shape.begin() + end + 1);
+                new_edge.from  = new_edge.shape.front()->id;
+                new_edge.to    = new_edge.shape.back()->id;
+                assert(new_edge.shape.size() > 1);
             }
-            assert(_edge.shape.size() > 1);
 
+            //The original edge keeps up to the first split point
+            _edge.shape.erase(_edge.shape.begin() + splits[0] + 1, _edge.shape.end());
+            _edge.to = _edge.shape.back()->id;
+            assert(_edge.shape.size() > 1);
         }
 
-        //Add all created edges
-        BOOST_FOREACH(edge& e, new_edges)
-        {
-            edges.push_back(e);
-        }
+        incidence_stale = true;
     }
 
     void network::compute_edge_types()
     {
-        // this is a goofy way to do this, we should use a hash or something
-        BOOST_FOREACH(edge &e, edges)
+        const long count = static_cast<long>(edges.size());
+        #pragma omp parallel for schedule(dynamic, 256)
+        for(long i = 0; i < count; ++i)
         {
-            edge_type* e_type = retrieve<edge_type>(types, e.id);
-            e.type            = e_type;
-            e_type->speed     = 25;
-            e_type->nolanes   = 1;
-            e_type->oneway    = 0;
-            if(e.highway_class == "motorway")
-            {
-                e_type->speed   = 65;
-                e_type->nolanes = 3;
-                e_type->oneway  = 1;
-            }
-            else if(e.highway_class == "motorway_link")
-            {
-                e_type->speed   = 30;
-                e_type->nolanes = 1;
-                e_type->oneway  = 1;
-            }
-            else if(e.highway_class == "residential")
-            {
-                e_type->speed   = 30;
-                e_type->nolanes = 1;
-                e_type->oneway  = 0;
-            }
-            else if(e.highway_class == "primary")
-            {
-                e_type->nolanes = 1;
-                e_type->oneway  = 0;
-                e_type->speed   = 50;
-            }
-            else if(e.highway_class == "secondary")
-            {
-                e_type->speed   = 40;
-                e_type->nolanes = 1;
-                e_type->oneway  = 0;
-            }
-            else if(e.highway_class == "service")
-            {
-                e_type->speed   = 25;
-                e_type->nolanes = 1;
-                e_type->oneway  = 0;
-            }
-            else if(e.highway_class == "primary_link")
-            {
-                e_type->speed   = 30;
-                e_type->nolanes = 1;
-                e_type->oneway  = 1;
-            }
-            else if(e.highway_class == "secondary_link")
-            {
-                e_type->speed   = 30;
-                e_type->nolanes = 1;
-                e_type->oneway  = 1;
-            }
-            else if(e.highway_class == "urban")
-            {
-                //Classes added for grid
-                e_type->speed   = 30;
-                e_type->nolanes = 2;
-                e_type->oneway  = 0;
-            }
-            e_type->speed *= MIPH_TO_MEPS;
+            edges[i].kind = highway_kind_of(edges[i].highway_class);
+            edges[i].type = &highway_type(edges[i].kind);
         }
 
         BOOST_FOREACH(osm::edge &e, edges)
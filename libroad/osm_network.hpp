@@ -2,23 +2,91 @@
 #define _OSM_NETWORK_HPP_
 
 #include "libroad_common.hpp"
+#include "projection.hpp"
 #include <vector>
+#include <deque>
+#include <stdint.h>
 
 namespace osm
 {
     struct edge;
 
+    // OSM ids of nodes read from a file; nodes the passes make up get ids below all of those
+    typedef int64_t node_id;
+
     struct node
     {
-        node(){ is_overpass = false; ramp_merging_point = NULL;}
+        node(){ id = 0; is_overpass = false; ramp_merging_point = NULL;}
 
-        str                id;
+        node_id            id;
+        vec2d              lonlat; // As read, in degrees; project() or scale_and_translate() sets xy from it
         vec3f              xy;
-        std::vector<edge*> edges_including; //Currently not maintained
         bool               is_overpass;
         node*              ramp_merging_point;
     };
 
+    str id_string(node_id id);
+
+    // The nodes of a network, keyed by id.
+    // Records live in a deque so that the node pointers edge shapes hold stay put as nodes are added.
+    // Ids from the file are found by binary search in a sorted array; made-up ids count down from
+    // made_base and index a dense table. Degrees and the edges through each node are kept per slot,
+    // the edges in compressed rows that index_edges() rebuilds.
+    struct node_store
+    {
+        typedef std::deque<node>::iterator       iterator;
+        typedef std::deque<node>::const_iterator const_iterator;
+
+        node_store();
+
+        iterator       begin()       { return records.begin(); }
+        iterator       end()         { return records.end();   }
+        const_iterator begin() const { return records.begin(); }
+        const_iterator end()   const { return records.end();   }
+        size_t         size()  const { return records.size();  }
+        bool           empty() const { return records.empty(); }
+
+        node       *find(node_id id);
+        const node *find(node_id id) const;
+        // Adds a node with this id if there isn't one
+        node       &operator[](node_id id);
+        // A new node with a made-up id; origin is the node it stands in for, if any
+        node       *add(const vec3f &xy, node_id origin=0);
+        // The origin given when a made-up node was added, 0 for nodes from the file
+        node_id     origin(node_id id) const;
+        // Replaces the contents with these (id, lon/lat) pairs, which must be sorted by id and unique
+        void        assign(const std::vector<std::pair<node_id, vec2d> > &sorted);
+        void        clear();
+
+        // Ids that aren't in the store (copies made by the passes) have their degree kept on the side
+        int  &degree(node_id id);
+        int   degree(node_id id) const;
+        // The degree of the node in records[slot]
+        int   degree_at(size_t slot) const { return degrees[slot]; }
+        void  reset_degrees();
+
+        void          index_edges(std::vector<edge> &edges);
+        edge *const  *edges_begin(node_id id) const;
+        edge *const  *edges_end(node_id id) const;
+        size_t        edge_count(node_id id) const;
+        // Points the first entry for from in id's row at to instead
+        void          replace_edge(node_id id, const edge *from, edge *to);
+
+        std::deque<node>          records;
+        std::vector<node_id>      ids;
+        std::vector<size_t>       id_slots;
+        node_id                   made_base;
+        std::vector<size_t>       made_slots;
+        std::vector<node_id>      made_from;
+        std::vector<int>          degrees;
+        std::map<node_id, int>    stray_degrees;
+        std::vector<size_t>       incidence_begin;
+        std::vector<edge*>        incidence;
+
+    private:
+        size_t slot(node_id id) const;
+    };
+
     struct edge_type
     {
         str    id;
@@ -28,25 +96,47 @@ namespace osm
         bool   oneway;
     };
 
+    // The highway classes the passes tell apart; any other class is OTHER_HIGHWAY
+    enum highway_kind
+    {
+        MOTORWAY,
+        MOTORWAY_LINK,
+        PRIMARY,
+        PRIMARY_LINK,
+        SECONDARY,
+        SECONDARY_LINK,
+        RESIDENTIAL,
+        SERVICE,
+        URBAN,
+        OTHER_HIGHWAY,
+        N_HIGHWAY_KINDS
+    };
+
+    highway_kind      highway_kind_of(const str &highway_class);
+    // One edge_type per kind, shared by every edge (and network) of that kind
+    const edge_type  &highway_type(highway_kind k);
+
     struct shape_t : public std::vector<node*>
     {
     };
 
     struct edge
     {
+        edge() : from(0), to(0), type(0), kind(OTHER_HIGHWAY) {}
         ~edge(){}
 
         bool operator==(const edge& e) {return id == e.id;}
 
         typedef enum {center, right} SPREAD;
 
-        str        id;
-        str        from;
-        str        to;
-        edge_type* type;
-        shape_t    shape;
-        SPREAD     spread;
-        str        highway_class;
+        str              id;
+        node_id          from;
+        node_id          to;
+        const edge_type* type;
+        shape_t          shape;
+        SPREAD           spread;
+        str              highway_class;
+        highway_kind     kind;
 
         struct lane
         {
@@ -62,35 +152,53 @@ namespace osm
         std::vector<node*> overpass_nodes;
         std::vector<lane>  additional_lanes;
 
+        // Compares lon/lat, so it goes before projection
         void remove_duplicate_nodes();
         void reverse();
         float length() const;
     };
 
+    // Segment shape[seg] -> shape[seg+1] of edges[edge] crosses the corresponding segment of edges[other_edge]
+    struct crossing
+    {
+        size_t edge;
+        size_t seg;
+        size_t other_edge;
+        size_t other_seg;
+        vec3f  point;
+    };
+
     struct intersection
     {
         std::vector<edge*> edges_ending_here;
         std::vector<edge*> edges_starting_here;
-        str                id_from_node;
+        node_id            id_from_node;
     };
 
+    typedef std::map<node_id, intersection> intersection_map;
+
     struct network
     {
-        network()
+        network() : degrees_stale(true), incidence_stale(true)
         {}
 
-        strhash<node>::type              nodes;
-        strhash<edge_type>::type         types;
+        node_store                       nodes;
         strhash<edge>::type              edge_hash;
-        strhash<intersection>::type      intersections;
+        intersection_map                 intersections;
         strhash<edge>::type              road_segs;
-        strhash<int>::type               node_degrees;
-        strhash<std::vector<str> >::type node_connections;
         std::vector<edge>                edges;
 
         vec2d center;
         vec2d topleft;
         vec2d bottomright;
+        // Set by project()
+        projection::local_frame frame;
+
+        // Whether nodes' degrees or edge rows are out of date; passes keep degrees up as they go where they can
+        // and bring either up to date only when they need it and it is stale
+        bool degrees_stale;
+        bool incidence_stale;
+        void update_index();
 
         node *add_node(const vec3f &v, const bool is_overpass);
 
@@ -101,17 +209,30 @@ namespace osm
         void display_used_node_heights();
         void list_edges();
 
+        // The passes osm-import runs, in order, up to create_intersections. Stages that work per edge or per node run on all
+        // threads; those that change topology merge their results in a fixed order, so the result doesn't depend on the
+        // number of threads. Each stage is a profile phase. If proj is given, it replaces scale_and_translate and frame
+        // says how it went.
+        void clean_up(float lane_width, const projection::kind *proj=0);
+
         void remove_duplicate_nodes();
         void edges_including_rebuild();
-        bool out_of_bounds(const vec3f &) const;
+        // Whether a lon/lat is outside the file's bounds
+        bool out_of_bounds(const vec2d &) const;
         void clip_roads_to_bounds();
         void create_ramps(const float lane_width);
         void populate_edges_from_hash();
         void populate_edge_hash_from_edges();
         void remove_small_roads(double min_len);
         void remove_highway_intersections();
+        // Where edges cross in the plane without sharing a node, so one passes over the other; the candidate
+        // segment pairs come from a self-join of an rtree over every segment, not from testing all pairs
+        void find_crossings(std::vector<crossing> &res) const;
         void create_grid(int, int, double, double);
         void scale_and_translate();
+        // Like scale_and_translate, but with a real projection about center; nodes end up in metres from center's projection.
+        // Lon/lat stay in double up to here, so positions are only rounded to float once they are local.
+        projection::local_frame project(projection::kind k);
         void compute_node_heights();
         void check_edge(const edge &e) const;
         void check_node(const node &n) const;
@@ -129,7 +250,57 @@ namespace osm
         static size_t new_edges_id;
     };
 
+    // Nodes and highway ways as a reader finds them, before it is known which nodes the highways need
+    struct raw_node
+    {
+        node_id id;
+        vec2d   lonlat;
+    };
+
+    struct raw_way
+    {
+        str                  id;
+        str                  highway_class;
+        std::vector<node_id> refs;
+    };
+
+    // Enters the nodes some way uses and builds an edge for every way; both vectors are emptied
+    void build_network(network &n, std::vector<raw_node> &nodes, std::vector<raw_way> &ways);
+
+    // Takes what a reader finds, in file order; only ways with a highway tag are passed on
+    struct reader_sink
+    {
+        virtual ~reader_sink() {}
+
+        virtual void bounds(double minlon, double minlat, double maxlon, double maxlat) = 0;
+        // The sink may take the contents of these
+        virtual void node(raw_node &n) = 0;
+        virtual void way (raw_way  &w) = 0;
+    };
+
+    // Keeps everything in memory for build_network
+    struct raw_collector : public reader_sink
+    {
+        raw_collector(network &n);
+
+        void bounds(double minlon, double minlat, double maxlon, double maxlat);
+        void node(raw_node &n);
+        void way (raw_way  &w);
+
+        network               &net;
+        std::vector<raw_node>  nodes;
+        std::vector<raw_way>   ways;
+    };
+
+    void read_xml_network(const char *osm_file, reader_sink &sink);
+    // Reads an OSM PBF file (OSMHeader and OSMData blobs, zlib-compressed or raw); batches of blobs are inflated and decoded in parallel
+    void read_pbf_network(const char *osm_file, reader_sink &sink);
+    // Picks the reader by extension: .pbf files go to read_pbf_network, everything else to read_xml_network
+    void read_network(const char *osm_file, reader_sink &sink);
+
     network load_xml_network(const char *osm_file);
+    network load_pbf_network(const char *osm_file);
+    network load_network(const char *osm_file);
 }
 
 inline std::ostream &operator<<(std::ostream &o, const osm::edge::SPREAD &t)
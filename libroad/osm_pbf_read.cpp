@@ -0,0 +1,522 @@
+#include "osm_network.hpp"
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+#include <zlib.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// OSM PBF, as described at http://wiki.openstreetmap.org/wiki/PBF_Format: a sequence of
+// (4-byte big-endian BlobHeader length, BlobHeader, Blob), each Blob holding an OSMHeader or OSMData block.
+// Only the protobuf messages and fields needed for nodes, highway ways and the bounding box are decoded.
+namespace osm
+{
+    namespace pbf
+    {
+        struct bad_pbf : public std::runtime_error
+        {
+            bad_pbf(const std::string &what) : std::runtime_error(what)
+            {}
+        };
+
+        // A protobuf message in [p, end), read field by field
+        struct message
+        {
+            message(const unsigned char *b, const unsigned char *e) : p(b), end(e)
+            {}
+
+            bool next(uint32_t &field, int &wire)
+            {
+                if(p >= end)
+                    return false;
+                const uint64_t key = varint();
+                field = static_cast<uint32_t>(key >> 3);
+                wire  = static_cast<int>(key & 7);
+                return true;
+            }
+
+            uint64_t varint()
+            {
+                uint64_t res = 0;
+                for(int shift = 0; shift < 64; shift += 7)
+                {
+                    if(p >= end)
+                        throw bad_pbf("Truncated varint");
+                    const unsigned char b = *p++;
+                    res |= static_cast<uint64_t>(b & 0x7f) << shift;
+                    if(!(b & 0x80))
+                        return res;
+                }
+                throw bad_pbf("Overlong varint");
+            }
+
+            int64_t svarint()
+            {
+                const uint64_t v = varint();
+                return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+            }
+
+            // The length-delimited field that starts here
+            message sub()
+            {
+                const uint64_t len = varint();
+                if(len > static_cast<uint64_t>(end - p))
+                    throw bad_pbf("Truncated field");
+                const message res(p, p + len);
+                p += len;
+                return res;
+            }
+
+            std::string bytes()
+            {
+                const message m(sub());
+                return std::string(reinterpret_cast<const char*>(m.p), m.end - m.p);
+            }
+
+            void skip(const int wire)
+            {
+                switch(wire)
+                {
+                case 0:
+                    varint();
+                    break;
+                case 1:
+                    advance(8);
+                    break;
+                case 2:
+                    sub();
+                    break;
+                case 5:
+                    advance(4);
+                    break;
+                default:
+                    throw bad_pbf(boost::str(boost::format("Unknown wire type %d") % wire));
+                }
+            }
+
+            void advance(const size_t n)
+            {
+                if(n > static_cast<size_t>(end - p))
+                    throw bad_pbf("Truncated field");
+                p += n;
+            }
+
+            const unsigned char *p;
+            const unsigned char *end;
+        };
+
+        // A packed repeated field of (possibly zigzag) varints; plain varint fields hold one value
+        static void read_packed(std::vector<int64_t> &res, message &m, const int wire, const bool zigzag)
+        {
+            if(wire == 2)
+            {
+                message packed(m.sub());
+                while(packed.p < packed.end)
+                    res.push_back(zigzag ? packed.svarint() : static_cast<int64_t>(packed.varint()));
+            }
+            else if(wire == 0)
+                res.push_back(zigzag ? m.svarint() : static_cast<int64_t>(m.varint()));
+            else
+                m.skip(wire);
+        }
+
+        static std::string decimal(int64_t v)
+        {
+            char        buf[24];
+            char       *p   = buf + sizeof(buf);
+            const bool  neg = v < 0;
+            uint64_t    u   = neg ? -static_cast<uint64_t>(v) : static_cast<uint64_t>(v);
+            do
+            {
+                *--p = '0' + u % 10;
+                u   /= 10;
+            }
+            while(u);
+            if(neg)
+                *--p = '-';
+            return std::string(p, buf + sizeof(buf) - p);
+        }
+
+        // One fileblock: its type and the (still compressed) Blob message
+        struct blob
+        {
+            std::string type;
+            std::string data;
+        };
+
+        // What one fileblock contributes to the network
+        struct block
+        {
+            block() : has_bbox(false)
+            {}
+
+            std::vector<raw_node> nodes;
+            std::vector<raw_way>  ways;
+            bool                  has_bbox;
+            double                bbox[4]; // left, right, top, bottom
+        };
+
+        static bool read_blob(blob &b, FILE *fp)
+        {
+            unsigned char len_bytes[4];
+            const size_t  got = std::fread(len_bytes, 1, 4, fp);
+            if(got == 0)
+                return false;
+            if(got != 4)
+                throw bad_pbf("Truncated BlobHeader length");
+
+            const uint32_t header_len = (len_bytes[0] << 24) | (len_bytes[1] << 16) | (len_bytes[2] << 8) | len_bytes[3];
+            if(header_len > 64*1024)
+                throw bad_pbf("BlobHeader too large");
+            std::vector<unsigned char> header(header_len);
+            if(header_len && std::fread(&(header[0]), 1, header_len, fp) != header_len)
+                throw bad_pbf("Truncated BlobHeader");
+
+            b.type.clear();
+            int64_t  datasize = -1;
+            message  m(header.empty() ? 0 : &(header[0]), header.empty() ? 0 : &(header[0]) + header_len);
+            uint32_t field;
+            int      wire;
+            while(m.next(field, wire))
+            {
+                if(field == 1 && wire == 2)
+                    b.type = m.bytes();
+                else if(field == 3 && wire == 0)
+                    datasize = static_cast<int64_t>(m.varint());
+                else
+                    m.skip(wire);
+            }
+            if(datasize < 0 || datasize > 64*1024*1024)
+                throw bad_pbf("Bad Blob size");
+
+            b.data.resize(datasize);
+            if(datasize && std::fread(&(b.data[0]), 1, datasize, fp) != static_cast<size_t>(datasize))
+                throw bad_pbf("Truncated Blob");
+            return true;
+        }
+
+        // The uncompressed contents of a Blob message
+        static void inflate_blob(std::string &res, const std::string &data)
+        {
+            const unsigned char *base = reinterpret_cast<const unsigned char*>(data.data());
+            message              m(base, base + data.size());
+            uint32_t             field;
+            int                  wire;
+            int64_t              raw_size = -1;
+            std::string          zdata;
+            bool                 have_raw = false;
+            while(m.next(field, wire))
+            {
+                if(field == 1 && wire == 2)
+                {
+                    res      = m.bytes();
+                    have_raw = true;
+                }
+                else if(field == 2 && wire == 0)
+                    raw_size = static_cast<int64_t>(m.varint());
+                else if(field == 3 && wire == 2)
+                    zdata = m.bytes();
+                else if(field >= 4 && field <= 7)
+                    throw bad_pbf("Unsupported Blob compression (only raw and zlib are read)");
+                else
+                    m.skip(wire);
+            }
+            if(have_raw)
+                return;
+            if(raw_size < 0 || raw_size > 64*1024*1024)
+                throw bad_pbf("Bad Blob raw_size");
+
+            res.resize(raw_size);
+            uLongf dest_len = raw_size;
+            if(raw_size && (uncompress(reinterpret_cast<Bytef*>(&(res[0])), &dest_len,
+                                       reinterpret_cast<const Bytef*>(zdata.data()), zdata.size()) != Z_OK ||
+                            dest_len != static_cast<uLongf>(raw_size)))
+                throw bad_pbf("Corrupt zlib Blob");
+        }
+
+        static void decode_header(block &res, message m)
+        {
+            uint32_t field;
+            int      wire;
+            while(m.next(field, wire))
+            {
+                if(field == 1 && wire == 2)
+                {
+                    message bbox(m.sub());
+                    while(bbox.next(field, wire))
+                    {
+                        if(field >= 1 && field <= 4 && wire == 0)
+                            res.bbox[field-1] = 1e-9*bbox.svarint();
+                        else
+                            bbox.skip(wire);
+                    }
+                    res.has_bbox = true;
+                }
+                else if(field == 4 && wire == 2)
+                {
+                    const std::string feature(m.bytes());
+                    if(feature != "OsmSchema-V0.6" && feature != "DenseNodes")
+                        throw bad_pbf(boost::str(boost::format("Unsupported required feature %s") % feature));
+                }
+                else
+                    m.skip(wire);
+            }
+        }
+
+        struct coords
+        {
+            coords() : granularity(100), lat_offset(0), lon_offset(0)
+            {}
+
+            vec2d operator()(const int64_t lat, const int64_t lon) const
+            {
+                return vec2d(1e-9*(lon_offset + granularity*lon),
+                             1e-9*(lat_offset + granularity*lat));
+            }
+
+            int64_t granularity;
+            int64_t lat_offset;
+            int64_t lon_offset;
+        };
+
+        static void decode_node(block &res, message m, const coords &c)
+        {
+            int64_t  id = 0, lat = 0, lon = 0;
+            uint32_t field;
+            int      wire;
+            while(m.next(field, wire))
+            {
+                if(field == 1 && wire == 0)
+                    id = m.svarint();
+                else if(field == 8 && wire == 0)
+                    lat = m.svarint();
+                else if(field == 9 && wire == 0)
+                    lon = m.svarint();
+                else
+                    m.skip(wire);
+            }
+            res.nodes.push_back(raw_node());
+            res.nodes.back().id = id;
+            res.nodes.back().lonlat = c(lat, lon);
+        }
+
+        static void decode_dense(block &res, message m, const coords &c)
+        {
+            std::vector<int64_t> ids, lats, lons;
+            uint32_t             field;
+            int                  wire;
+            while(m.next(field, wire))
+            {
+                if(field == 1)
+                    read_packed(ids, m, wire, true);
+                else if(field == 8)
+                    read_packed(lats, m, wire, true);
+                else if(field == 9)
+                    read_packed(lons, m, wire, true);
+                else
+                    m.skip(wire);
+            }
+            if(lats.size() != ids.size() || lons.size() != ids.size())
+                throw bad_pbf("DenseNodes with mismatched id, lat and lon counts");
+
+            // All three are delta coded
+            int64_t id = 0, lat = 0, lon = 0;
+            res.nodes.reserve(res.nodes.size() + ids.size());
+            for(size_t i = 0; i < ids.size(); ++i)
+            {
+                id  += ids[i];
+                lat += lats[i];
+                lon += lons[i];
+                res.nodes.push_back(raw_node());
+                res.nodes.back().id = id;
+                res.nodes.back().lonlat = c(lat, lon);
+            }
+        }
+
+        static void decode_way(block &res, message m, const std::vector<std::pair<const char*, size_t> > &strings, const int64_t highway_key)
+        {
+            int64_t              id = 0;
+            std::vector<int64_t> keys, vals;
+            message              refs(0, 0);
+            uint32_t             field;
+            int                  wire;
+            while(m.next(field, wire))
+            {
+                if(field == 1 && wire == 0)
+                    id = static_cast<int64_t>(m.varint());
+                else if(field == 2)
+                    read_packed(keys, m, wire, false);
+                else if(field == 3)
+                    read_packed(vals, m, wire, false);
+                else if(field == 8 && wire == 2)
+                    refs = m.sub();
+                else
+                    m.skip(wire);
+            }
+
+            size_t k = 0;
+            while(k < keys.size() && keys[k] != highway_key)
+                ++k;
+            if(highway_key < 0 || k == keys.size())
+                return;
+            if(k >= vals.size() || vals[k] < 0 || static_cast<size_t>(vals[k]) >= strings.size())
+                throw bad_pbf("Way tag value out of the string table");
+
+            res.ways.push_back(raw_way());
+            raw_way &w = res.ways.back();
+            w.id            = decimal(id);
+            w.highway_class = std::string(strings[vals[k]].first, strings[vals[k]].second);
+
+            int64_t ref = 0;
+            while(refs.p < refs.end)
+            {
+                ref += refs.svarint();
+                w.refs.push_back(ref);
+            }
+        }
+
+        static void decode_data(block &res, message m)
+        {
+            std::vector<std::pair<const char*, size_t> > strings;
+            std::vector<message>                         groups;
+            coords                                       c;
+            uint32_t                                     field;
+            int                                          wire;
+            while(m.next(field, wire))
+            {
+                if(field == 1 && wire == 2)
+                {
+                    message table(m.sub());
+                    while(table.next(field, wire))
+                    {
+                        if(field == 1 && wire == 2)
+                        {
+                            const message s(table.sub());
+                            strings.push_back(std::make_pair(reinterpret_cast<const char*>(s.p), static_cast<size_t>(s.end - s.p)));
+                        }
+                        else
+                            table.skip(wire);
+                    }
+                }
+                else if(field == 2 && wire == 2)
+                    groups.push_back(m.sub());
+                else if(field == 17 && wire == 0)
+                    c.granularity = static_cast<int64_t>(m.varint());
+                else if(field == 19 && wire == 0)
+                    c.lat_offset = static_cast<int64_t>(m.varint());
+                else if(field == 20 && wire == 0)
+                    c.lon_offset = static_cast<int64_t>(m.varint());
+                else
+                    m.skip(wire);
+            }
+
+            int64_t highway_key = -1;
+            for(size_t i = 0; i < strings.size() && highway_key < 0; ++i)
+                if(strings[i].second == 7 && std::memcmp(strings[i].first, "highway", 7) == 0)
+                    highway_key = i;
+
+            BOOST_FOREACH(message &g, groups)
+            {
+                while(g.next(field, wire))
+                {
+                    if(field == 1 && wire == 2)
+                        decode_node(res, g.sub(), c);
+                    else if(field == 2 && wire == 2)
+                        decode_dense(res, g.sub(), c);
+                    else if(field == 3 && wire == 2)
+                        decode_way(res, g.sub(), strings, highway_key);
+                    else
+                        g.skip(wire);
+                }
+            }
+        }
+
+        static void decode_blob(block &res, const blob &b)
+        {
+            std::string contents;
+            inflate_blob(contents, b.data);
+
+            const unsigned char *base = reinterpret_cast<const unsigned char*>(contents.data());
+            const message        m(base, base + contents.size());
+            if(b.type == "OSMHeader")
+                decode_header(res, m);
+            else if(b.type == "OSMData")
+                decode_data(res, m);
+        }
+    }
+
+    void read_pbf_network(const char *osm_file, reader_sink &sink)
+    {
+        FILE *fp = std::fopen(osm_file, "rb");
+        if(!fp)
+            throw std::runtime_error(boost::str(boost::format("Can't open %s") % osm_file));
+
+#ifdef _OPENMP
+        const size_t batch = 4*omp_get_max_threads();
+#else
+        const size_t batch = 1;
+#endif
+
+        size_t blob_no = 0;
+        try
+        {
+            // Blobs are read in batches and decoded on all threads; their results go to the sink in file order
+            std::vector<pbf::blob> blobs;
+            bool                   more = true;
+            while(more)
+            {
+                blobs.clear();
+                while(blobs.size() < batch && more)
+                {
+                    blobs.push_back(pbf::blob());
+                    more = pbf::read_blob(blobs.back(), fp);
+                    if(!more)
+                        blobs.pop_back();
+                }
+
+                std::vector<pbf::block> blocks(blobs.size());
+                std::vector<str>        errors(blobs.size());
+                #pragma omp parallel for schedule(dynamic, 1)
+                for(long i = 0; i < static_cast<long>(blobs.size()); ++i)
+                {
+                    try
+                    {
+                        pbf::decode_blob(blocks[i], blobs[i]);
+                    }
+                    catch(std::exception &e)
+                    {
+                        errors[i] = boost::str(boost::format("In fileblock %d: %s") % (blob_no + i) % e.what());
+                    }
+                }
+                BOOST_FOREACH(const str &e, errors)
+                {
+                    if(!e.empty())
+                        throw std::runtime_error(e);
+                }
+
+                BOOST_FOREACH(pbf::block &b, blocks)
+                {
+                    if(b.has_bbox)
+                        sink.bounds(b.bbox[0], b.bbox[3], b.bbox[1], b.bbox[2]);
+                    BOOST_FOREACH(raw_node &no, b.nodes)
+                    {
+                        sink.node(no);
+                    }
+                    BOOST_FOREACH(raw_way &w, b.ways)
+                    {
+                        sink.way(w);
+                    }
+                }
+                blob_no += blobs.size();
+            }
+        }
+        catch(...)
+        {
+            std::fclose(fp);
+            throw;
+        }
+        std::fclose(fp);
+    }
+}
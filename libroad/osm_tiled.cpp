@@ -0,0 +1,1431 @@
+#include "hwm_network.hpp"
+#include "osm_network.hpp"
+#include "xml_writer.hpp"
+#include "hilbert.hpp"
+#include <set>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <stdint.h>
+
+// Conversion of OSM files too big to hold at once.
+// The file is read once, into spill files of nodes, ways and way-node references. Those are
+// partitioned by node id to give every reference its coordinates, and then by way to put every
+// way into each tile that its reach, grown by the halo, touches. Tiles are the leaves of a
+// quadtree, split until the references each would convert fit the budget, and are converted one
+// at a time, in Hilbert order, with the passes the in-memory import uses. What each tile owns is
+// written out as XML fragments that are stitched together at the end. A tile owns the nodes that
+// fall in it (without the halo), the intersections at those nodes and the roads that start or end
+// at them.
+//
+// Names have to agree between tiles, so nodes keep their OSM ids (highway copies of a node are
+// named after it) and roads are named after their end nodes and what they go through. A tile has to
+// see all of any road it owns for that, so a way's reach is the bounds of the chain of ways that
+// join_logical_roads will make one road of, which are found from the node degrees before tiling,
+// and of every chain that ends at a node on it, so that the degrees at the ends of a chain come
+// out right wherever it is converted. Chains are found by walking files, indexed by way number,
+// of the ways each way joins. A road between two tiles is written by the first to get to it, which
+// leaves the other a note in a file of its own.
+// Passes that change degrees later (remove_small_roads) can still make tiles disagree, so every
+// reference between tiles, and every lane's claim on the intersections at its ends, is spilled
+// with what is written, by hash, and checked a bucket at a time when stitching; anything left
+// unmatched, or written twice, fails the conversion.
+
+namespace hwm
+{
+    namespace tiled
+    {
+        struct node_rec
+        {
+            osm::node_id id;
+            double       lon;
+            double       lat;
+        };
+
+        struct ref_rec
+        {
+            osm::node_id ref;
+            uint64_t     way;
+            uint32_t     pos;
+            uint32_t     count; // of references in the way
+        };
+
+        struct coord_rec
+        {
+            uint64_t     way;
+            uint32_t     pos;
+            osm::node_id ref;
+            double       lon;
+            double       lat;
+        };
+
+        static inline bool node_less(const node_rec &a, const node_rec &b)
+        {
+            return a.id < b.id;
+        }
+
+        static inline bool coord_less(const coord_rec &a, const coord_rec &b)
+        {
+            return a.way < b.way || (a.way == b.way && a.pos < b.pos);
+        }
+
+        static inline bool ref_less(const ref_rec &a, const ref_rec &b)
+        {
+            return a.ref < b.ref;
+        }
+
+        static inline bool way_end(const ref_rec &r)
+        {
+            return r.pos == 0 || r.pos + 1 == r.count;
+        }
+
+        static const uint64_t no_way = ~static_cast<uint64_t>(0);
+
+        // Two ways joined at a node, filed under the first
+        struct join_rec
+        {
+            uint64_t way;
+            uint64_t other;
+        };
+
+        static inline bool join_less(const join_rec &a, const join_rec &b)
+        {
+            return a.way < b.way;
+        }
+
+        // The ways a way is joined to at its ends, or no_way
+        struct link_rec
+        {
+            uint64_t way[2];
+        };
+
+        struct rect
+        {
+            rect()
+            {
+                b[0] = b[1] = DBL_MAX;
+                b[2] = b[3] = -DBL_MAX;
+            }
+
+            void add(const double lon, const double lat)
+            {
+                b[0] = std::min(b[0], lon);
+                b[1] = std::min(b[1], lat);
+                b[2] = std::max(b[2], lon);
+                b[3] = std::max(b[3], lat);
+            }
+
+            void add(const rect &o)
+            {
+                if(o.b[0] > o.b[2])
+                    return;
+                add(o.b[0], o.b[1]);
+                add(o.b[2], o.b[3]);
+            }
+
+            bool contains(const rect &o) const
+            {
+                return b[0] <= o.b[0] && b[1] <= o.b[1] && o.b[2] <= b[2] && o.b[3] <= b[3];
+            }
+
+            bool outside(const double box[4]) const
+            {
+                return b[2] < box[0] || b[0] > box[2] || b[3] < box[1] || b[1] > box[3];
+            }
+
+            double b[4]; // minlon, minlat, maxlon, maxlat
+        };
+
+        // A way's bounds, or its reach, and its references; refs is 0 for ways with none inside the bounds
+        struct box_rec
+        {
+            rect     box;
+            uint32_t refs;
+        };
+
+        // The bounds of the chain a way is in; joined is 0 for ways in none, and until the chain is walked
+        struct chain_rec
+        {
+            rect     box;
+            uint32_t joined;
+        };
+
+        struct reach_rec
+        {
+            uint64_t way;
+            rect     box;
+        };
+
+        template <typename T>
+        static inline void put(std::ostream &o, const T &t)
+        {
+            o.write(reinterpret_cast<const char*>(&t), sizeof(T));
+        }
+
+        template <typename T>
+        static inline bool get(std::istream &i, T &t)
+        {
+            return i.read(reinterpret_cast<char*>(&t), sizeof(T)).gcount() == static_cast<std::streamsize>(sizeof(T));
+        }
+
+        static inline void put_string(std::ostream &o, const str &s)
+        {
+            put(o, static_cast<uint32_t>(s.raw().size()));
+            o.write(s.raw().data(), s.raw().size());
+        }
+
+        static inline bool get_string(std::istream &i, str &s)
+        {
+            uint32_t len;
+            if(!get(i, len))
+                return false;
+            std::string buf(len, '\0');
+            if(len)
+                i.read(&(buf[0]), len);
+            s = buf;
+            return true;
+        }
+
+        static void open_out(std::ofstream &o, const bf::path &p, const bool append=false)
+        {
+            o.open(p.string().c_str(), std::ios::binary | (append ? std::ios::app : std::ios::trunc));
+            if(!o)
+                throw std::runtime_error(boost::str(boost::format("Can't write spill file %s") % p.string()));
+        }
+
+        static void open_in(std::ifstream &i, const bf::path &p)
+        {
+            i.open(p.string().c_str(), std::ios::binary);
+            if(!i)
+                throw std::runtime_error(boost::str(boost::format("Can't read spill file %s") % p.string()));
+        }
+
+        // Buffered appends to many files, flushed when they hold more than limit bytes; files are only open while
+        // being flushed, so there is no limit on how many there are
+        struct spill_buckets
+        {
+            spill_buckets(const bf::path &d, const char *pre, const size_t n, const size_t budget)
+                : dir(d), prefix(pre), buffers(n), buffered(0), limit(std::max(budget, static_cast<size_t>(1) << 16))
+            {
+            }
+
+            bf::path path(const size_t i) const
+            {
+                return dir / boost::str(boost::format("%s.%d") % prefix % i);
+            }
+
+            std::string &operator[](const size_t i)
+            {
+                return buffers[i];
+            }
+
+            size_t size() const
+            {
+                return buffers.size();
+            }
+
+            // Call after appending to a buffer
+            void added(const size_t bytes)
+            {
+                buffered += bytes;
+                if(buffered > limit)
+                    flush();
+            }
+
+            void flush()
+            {
+                for(size_t i = 0; i < buffers.size(); ++i)
+                    flush(i);
+                buffered = 0;
+            }
+
+            // One file, before reading it back
+            void flush(const size_t i)
+            {
+                if(buffers[i].empty())
+                    return;
+                std::ofstream o;
+                open_out(o, path(i), true);
+                o.write(buffers[i].data(), buffers[i].size());
+                buffered -= std::min(buffered, buffers[i].size());
+                std::string().swap(buffers[i]);
+            }
+
+            bf::path                 dir;
+            std::string              prefix;
+            std::vector<std::string> buffers;
+            size_t                   buffered;
+            size_t                   limit;
+        };
+
+        template <typename T>
+        static inline void append(std::string &s, const T &t)
+        {
+            s.append(reinterpret_cast<const char*>(&t), sizeof(T));
+        }
+
+        static inline void append_string(std::string &s, const str &v)
+        {
+            append(s, static_cast<uint32_t>(v.raw().size()));
+            s.append(v.raw());
+        }
+
+        // First pass: everything the reader finds goes straight to disk
+        struct spill_sink : public osm::reader_sink
+        {
+            spill_sink(const bf::path &dir) : nodes(0), ways(0), refs(0), has_bounds(false)
+            {
+                open_out(node_out, dir / "nodes");
+                open_out(way_out,  dir / "ways");
+                open_out(ref_out,  dir / "refs");
+                extent[0] = extent[1] = DBL_MAX;
+                extent[2] = extent[3] = -DBL_MAX;
+            }
+
+            void bounds(const double minlon, const double minlat, const double maxlon, const double maxlat)
+            {
+                box[0]     = minlon;
+                box[1]     = minlat;
+                box[2]     = maxlon;
+                box[3]     = maxlat;
+                has_bounds = true;
+            }
+
+            void node(osm::raw_node &n)
+            {
+                node_rec r;
+                r.id  = n.id;
+                r.lon = n.lonlat[0];
+                r.lat = n.lonlat[1];
+                put(node_out, r);
+                extent[0] = std::min(extent[0], r.lon);
+                extent[1] = std::min(extent[1], r.lat);
+                extent[2] = std::max(extent[2], r.lon);
+                extent[3] = std::max(extent[3], r.lat);
+                ++nodes;
+            }
+
+            void way(osm::raw_way &w)
+            {
+                put_string(way_out, w.id);
+                put_string(way_out, w.highway_class);
+                put(way_out, static_cast<uint32_t>(w.refs.size()));
+                for(size_t i = 0; i < w.refs.size(); ++i)
+                {
+                    ref_rec r;
+                    r.ref   = w.refs[i];
+                    r.way   = ways;
+                    r.pos   = i;
+                    r.count = w.refs.size();
+                    put(ref_out, r);
+                }
+                refs += w.refs.size();
+                ++ways;
+            }
+
+            void close()
+            {
+                node_out.close();
+                way_out.close();
+                ref_out.close();
+                if(!node_out || !way_out || !ref_out)
+                    throw std::runtime_error("Failed writing spill files");
+            }
+
+            std::ofstream node_out;
+            std::ofstream way_out;
+            std::ofstream ref_out;
+            size_t        nodes;
+            size_t        ways;
+            size_t        refs;
+            bool          has_bounds;
+            double        box[4];    // minlon, minlat, maxlon, maxlat
+            double        extent[4]; // the same, over the nodes read
+        };
+
+        // Ways that join_logical_roads will make one road of. They meet at nodes that two ways end at and nothing else
+        // goes through, so a way is joined to at most one other at each end and a chain is a path or a loop. Chains are
+        // walked a way at a time through files indexed by way number: links, boxes, and chains, which gets the bounds of
+        // every joined way's chain.
+        struct chains
+        {
+            chains(const bf::path &dir)
+            {
+                open_in(links, dir / "links");
+                open_in(boxes, dir / "boxes");
+                const bf::path cp(dir / "chains");
+                bounds.open(cp.string().c_str(), std::ios::binary | std::ios::in | std::ios::out);
+                if(!bounds)
+                    throw std::runtime_error(boost::str(boost::format("Can't write spill file %s") % cp.string()));
+            }
+
+            link_rec link(const uint64_t w)
+            {
+                link_rec rec;
+                links.seekg(w*sizeof(link_rec));
+                if(!get(links, rec))
+                    throw std::runtime_error("Failed reading spill files");
+                return rec;
+            }
+
+            chain_rec chain(const uint64_t w)
+            {
+                chain_rec rec;
+                bounds.seekg(w*sizeof(chain_rec));
+                if(!get(bounds, rec))
+                    throw std::runtime_error("Failed reading spill files");
+                return rec;
+            }
+
+            // Goes along the chain from start, which is an end of it or anywhere on a loop, adding up the bounds of its
+            // ways or, with write, giving them box; returns the last way
+            uint64_t walk(const uint64_t start, rect &box, const bool write)
+            {
+                uint64_t prev = no_way;
+                uint64_t w    = start;
+                for(;;)
+                {
+                    if(write)
+                    {
+                        chain_rec rec;
+                        rec.box    = box;
+                        rec.joined = 1;
+                        bounds.seekp(w*sizeof(chain_rec));
+                        put(bounds, rec);
+                    }
+                    else
+                    {
+                        box_rec rec;
+                        boxes.seekg(w*sizeof(box_rec));
+                        if(!get(boxes, rec))
+                            throw std::runtime_error("Failed reading spill files");
+                        if(rec.refs)
+                            box.add(rec.box);
+                    }
+
+                    const link_rec l    = link(w);
+                    const uint64_t next = l.way[0] == prev ? l.way[1] : l.way[0];
+                    if(next == no_way || next == start)
+                        return w;
+                    prev = w;
+                    w    = next;
+                }
+            }
+
+            // Paths first, each from its lower end; the joined ways left over are on loops
+            void resolve(const uint64_t ways)
+            {
+                for(int pass = 0; pass < 2; ++pass)
+                {
+                    const bool loops = pass == 1;
+                    for(uint64_t w = 0; w < ways; ++w)
+                    {
+                        const link_rec l      = link(w);
+                        const int      joined = (l.way[0] != no_way) + (l.way[1] != no_way);
+                        if(joined != (loops ? 2 : 1) || (loops && chain(w).joined))
+                            continue;
+
+                        rect           box;
+                        const uint64_t last = walk(w, box, false);
+                        if(!loops && last < w)
+                            continue;
+                        walk(w, box, true);
+                    }
+                }
+                if(!bounds.flush())
+                    throw std::runtime_error("Failed writing spill files");
+            }
+
+            // The bounds of w's chain, given w's own
+            rect reach(const uint64_t w, const rect &own)
+            {
+                const chain_rec rec = chain(w);
+                return rec.joined ? rec.box : own;
+            }
+
+            void close()
+            {
+                links.close();
+                boxes.close();
+                bounds.close();
+            }
+
+            std::ifstream links;
+            std::ifstream boxes;
+            std::fstream  bounds;
+        };
+
+        // What converting a reference takes, roughly, and how far tiles are split to get there
+        static const size_t bytes_per_ref  = 512;
+        static const int    max_tile_depth = 12;
+
+        // Tiles, split in four until what each would convert fits the budget, or splitting stops making them smaller
+        // (as for a tile that one long road fills); leaves are numbered in Hilbert order
+        struct quadtree
+        {
+            struct cell
+            {
+                double box[4];
+                int    depth;
+                size_t parent;
+                size_t child; // first of four (lower left, lower right, upper left, upper right), or 0 for leaves
+                size_t refs;  // measured
+            };
+
+            quadtree(const double b[4]) : cells(1)
+            {
+                std::copy(b, b + 4, cells[0].box);
+                cells[0].depth  = 0;
+                cells[0].parent = 0;
+                cells[0].child  = 0;
+                cells[0].refs   = 0;
+                number_leaves();
+            }
+
+            bool splittable(const size_t leaf) const
+            {
+                const cell &k = cells[leaves[leaf]];
+                return k.depth < max_tile_depth && (k.depth == 0 || k.refs < cells[k.parent].refs);
+            }
+
+            void split(const size_t leaf)
+            {
+                const size_t c      = leaves[leaf];
+                const cell   parent = cells[c];
+                const double mid[2] = {0.5*(parent.box[0] + parent.box[2]), 0.5*(parent.box[1] + parent.box[3])};
+                cells[c].child = cells.size();
+                for(int q = 0; q < 4; ++q)
+                {
+                    cell k;
+                    k.box[0] = q & 1 ? mid[0]        : parent.box[0];
+                    k.box[1] = q & 2 ? mid[1]        : parent.box[1];
+                    k.box[2] = q & 1 ? parent.box[2] : mid[0];
+                    k.box[3] = q & 2 ? parent.box[3] : mid[1];
+                    k.depth  = parent.depth + 1;
+                    k.parent = c;
+                    k.child  = 0;
+                    k.refs   = 0;
+                    cells.push_back(k);
+                }
+            }
+
+            void number_leaves()
+            {
+                const double *root = cells[0].box;
+                std::vector<std::pair<size_t, size_t> > order;
+                for(size_t c = 0; c < cells.size(); ++c)
+                {
+                    if(cells[c].child)
+                        continue;
+                    const double *b = cells[c].box;
+                    const double  x = root[2] > root[0] ? (0.5*(b[0] + b[2]) - root[0])/(root[2] - root[0]) : 0.5;
+                    const double  y = root[3] > root[1] ? (0.5*(b[1] + b[3]) - root[1])/(root[3] - root[1]) : 0.5;
+                    order.push_back(std::make_pair(hilbert::order(x, y), c));
+                }
+                std::sort(order.begin(), order.end());
+
+                leaves.resize(order.size());
+                leaf_of.assign(cells.size(), 0);
+                for(size_t i = 0; i < order.size(); ++i)
+                {
+                    leaves[i]                = order[i].second;
+                    leaf_of[order[i].second] = i;
+                }
+            }
+
+            // Points outside the root go to the nearest leaf
+            size_t leaf_at(const double lon, const double lat) const
+            {
+                size_t c = 0;
+                while(cells[c].child)
+                {
+                    const cell &k = cells[c];
+                    c = k.child + (lon >= 0.5*(k.box[0] + k.box[2])) + 2*(lat >= 0.5*(k.box[1] + k.box[3]));
+                }
+                return leaf_of[c];
+            }
+
+            // The leaves box comes within halo, in sizes of the leaf, of; a child grown so lies inside its parent grown so
+            void touching(const rect &box, const float halo, std::vector<size_t> &res, const size_t c=0) const
+            {
+                const cell   &k = cells[c];
+                const double  w = halo*(k.box[2] - k.box[0]);
+                const double  h = halo*(k.box[3] - k.box[1]);
+                const double  grown[4] = {k.box[0] - w, k.box[1] - h, k.box[2] + w, k.box[3] + h};
+                if(box.outside(grown))
+                    return;
+                if(!k.child)
+                {
+                    res.push_back(leaf_of[c]);
+                    return;
+                }
+                for(int q = 0; q < 4; ++q)
+                    touching(box, halo, res, k.child + q);
+            }
+
+            const cell &leaf(const size_t i) const
+            {
+                return cells[leaves[i]];
+            }
+
+            std::vector<cell>   cells;
+            std::vector<size_t> leaves;
+            std::vector<size_t> leaf_of; // by cell
+        };
+
+        static inline uint64_t fnv(uint64_t h, const void *p, const size_t len)
+        {
+            const unsigned char *c = static_cast<const unsigned char*>(p);
+            for(size_t i = 0; i < len; ++i)
+            {
+                h ^= c[i];
+                h *= 1099511628211ULL;
+            }
+            return h;
+        }
+
+        static const uint64_t fnv_basis = 14695981039346656037ULL;
+
+        // The file node a node is or stands in for; 0 for nodes made up from nothing
+        static inline osm::node_id file_node(const osm::network &onet, const osm::node_id id)
+        {
+            const osm::node_id o = onet.nodes.origin(id);
+            return o ? o : (onet.nodes.find(id) && id > 0 ? id : 0);
+        }
+
+        static str node_name(const osm::network &onet, const osm::node_id id)
+        {
+            const osm::node_id o = onet.nodes.origin(id);
+            if(o)
+                return osm::id_string(o) + "_hwy";
+            return osm::id_string(id);
+        }
+
+        // Names every edge after its ends and the file nodes it goes through, so that tiles that see the same road name it alike
+        static void stable_names(osm::network &onet)
+        {
+            std::map<str, str> renamed;
+            std::set<str>      taken;
+            BOOST_FOREACH(osm::edge &e, onet.edges)
+            {
+                uint64_t h = fnv_basis;
+                BOOST_FOREACH(const osm::node *n, e.shape)
+                {
+                    const osm::node_id f = file_node(onet, n->id);
+                    h = fnv(h, &f, sizeof(f));
+                }
+                h = fnv(h, e.highway_class.raw().data(), e.highway_class.raw().size());
+
+                str name(boost::str(boost::format("%s_%s_%08x") % node_name(onet, e.from) % node_name(onet, e.to) % static_cast<unsigned int>(h & 0xffffffff)));
+                for(int dup = 2; taken.count(name); ++dup)
+                    name = boost::str(boost::format("%s_%s_%08x_%d") % node_name(onet, e.from) % node_name(onet, e.to) % static_cast<unsigned int>(h & 0xffffffff) % dup);
+                taken.insert(name);
+                renamed[e.id] = name;
+                e.id          = name;
+            }
+
+            BOOST_FOREACH(osm::edge &e, onet.edges)
+            {
+                BOOST_FOREACH(osm::edge::lane &l, e.additional_lanes)
+                {
+                    const std::map<str, str>::const_iterator r = renamed.find(l.ramp_id);
+                    if(r != renamed.end())
+                        l.ramp_id = r->second;
+                }
+            }
+        }
+
+        struct fragments
+        {
+            fragments(const bf::path &dir)
+            {
+                open_out(road_out,  dir / "roads.xml");
+                open_out(lane_out,  dir / "lanes.xml");
+                open_out(isect_out, dir / "intersections.xml");
+            }
+
+            std::ofstream road_out;
+            std::ofstream lane_out;
+            std::ofstream isect_out;
+        };
+
+        // What the tiles have written, and what they refer to, keyed by kind and id and spilled to buckets by key
+        struct references
+        {
+            references(const bf::path &dir, const size_t n, const size_t budget) : parts(dir, "references", n, budget)
+            {
+            }
+
+            static uint64_t key(const char kind, const str &id)
+            {
+                return fnv(fnv(fnv_basis, &kind, 1), id.raw().data(), id.raw().size());
+            }
+
+            void note(const uint64_t k, const bool referring, const str &what)
+            {
+                std::string &buf    = parts[k % parts.size()];
+                const size_t before = buf.size();
+                append(buf, k);
+                append(buf, static_cast<uint8_t>(referring));
+                append_string(buf, what);
+                parts.added(buf.size() - before);
+            }
+
+            void wrote(const char kind, const str &id)
+            {
+                note(key(kind, id), false, id);
+            }
+
+            void refer(const char kind, const str &id, const str &from)
+            {
+                note(key(kind, id), true, from + " refers to " + id);
+            }
+
+            // A lane, what it refers to, and the intersections it claims to end at, which have to claim it back
+            void wrote(const lane &l)
+            {
+                wrote('l', l.id);
+                const str from("Lane " + l.id);
+                BOOST_FOREACH(const lane::road_membership::intervals::entry &rm, l.road_memberships)
+                {
+                    refer('r', rm.second.parent_road->id, from);
+                }
+                const lane::adjacency::intervals *sides[2] = {&(l.left), &(l.right)};
+                for(int s = 0; s < 2; ++s)
+                {
+                    BOOST_FOREACH(const lane::adjacency::intervals::entry &adj, *sides[s])
+                    {
+                        if(adj.second.neighbor)
+                            refer('l', adj.second.neighbor->id, from);
+                    }
+                }
+                const lane::terminus *ends[2] = {l.start, l.end};
+                for(int e = 0; e < 2; ++e)
+                {
+                    if(const lane::intersection_terminus *it = dynamic_cast<const lane::intersection_terminus*>(ends[e]))
+                    {
+                        const str claim(incidence(l.id, e == 1, it->adjacent_intersection->id));
+                        wrote('c', claim);
+                        refer('C', claim, from);
+                    }
+                    else if(const lane::lane_terminus *lt = dynamic_cast<const lane::lane_terminus*>(ends[e]))
+                        refer('l', lt->adjacent_lane->id, from);
+                }
+            }
+
+            void wrote(const intersection &is)
+            {
+                wrote('i', is.id);
+                const str from("Intersection " + is.id);
+                for(int into = 0; into < 2; ++into)
+                {
+                    BOOST_FOREACH(const lane *l, into ? is.incoming : is.outgoing)
+                    {
+                        const str claim(incidence(l->id, into == 1, is.id));
+                        wrote('C', claim);
+                        refer('c', claim, from);
+                    }
+                }
+            }
+
+            static str incidence(const str &lane, const bool into, const str &isect)
+            {
+                return lane + (into ? " into " : " out of ") + isect;
+            }
+
+            // A bucket at a time
+            void check()
+            {
+                parts.flush();
+                size_t pending = 0;
+                str    example;
+                for(size_t b = 0; b < parts.size(); ++b)
+                {
+                    if(!bf::exists(parts.path(b)))
+                        continue;
+
+                    typedef std::pair<uint64_t, str> entry;
+                    std::vector<entry> written;
+                    std::vector<entry> referred;
+                    {
+                        std::ifstream in;
+                        open_in(in, parts.path(b));
+                        uint64_t k;
+                        uint8_t  referring;
+                        str      what;
+                        while(get(in, k) && get(in, referring) && get_string(in, what))
+                            (referring ? referred : written).push_back(std::make_pair(k, what));
+                    }
+                    bf::remove(parts.path(b));
+
+                    std::sort(written.begin(), written.end());
+                    for(size_t i = 1; i < written.size(); ++i)
+                    {
+                        if(written[i].first == written[i - 1].first)
+                            throw std::runtime_error(boost::str(boost::format("Tiles disagree: %s was written twice") % written[i].second));
+                    }
+                    BOOST_FOREACH(const entry &r, referred)
+                    {
+                        const std::vector<entry>::const_iterator w = std::lower_bound(written.begin(), written.end(), entry(r.first, str()));
+                        if(w != written.end() && w->first == r.first)
+                            continue;
+                        if(!pending++)
+                            example = r.second;
+                    }
+                }
+                if(pending)
+                    throw std::runtime_error(boost::str(boost::format("Tiles disagree: %d references were never written, e.g. %s")
+                                                        % pending % example));
+            }
+
+            spill_buckets parts;
+        };
+
+        // Converts one tile and writes out what it owns
+        static void convert_tile(const bf::path &tile_file, const size_t tile, const quadtree &tree, const double bounds[4],
+                                 const str &name, const float gamma, const float lane_width, const float simplify,
+                                 xml_writer &roads, xml_writer &lanes, xml_writer &intersections,
+                                 references &refs, spill_buckets &written)
+        {
+            osm::network       onet;
+            osm::raw_collector raw(onet);
+            raw.bounds(bounds[0], bounds[1], bounds[2], bounds[3]);
+
+            std::vector<osm::node_id> owned;
+            {
+                std::ifstream in;
+                open_in(in, tile_file);
+                osm::raw_way w;
+                while(get_string(in, w.id))
+                {
+                    uint32_t count;
+                    get_string(in, w.highway_class);
+                    get(in, count);
+                    w.refs.resize(count);
+                    for(uint32_t i = 0; i < count; ++i)
+                    {
+                        node_rec r;
+                        get(in, r);
+                        w.refs[i] = r.id;
+
+                        osm::raw_node no;
+                        no.id     = r.id;
+                        no.lonlat = vec2d(r.lon, r.lat);
+                        raw.node(no);
+                        if(tree.leaf_at(r.lon, r.lat) == tile)
+                            owned.push_back(r.id);
+                    }
+                    raw.way(w);
+                }
+            }
+            std::sort(owned.begin(), owned.end());
+            owned.erase(std::unique(owned.begin(), owned.end()), owned.end());
+
+            // Roads that tiles before this one wrote, to nodes it owns
+            std::set<uint64_t> written_before;
+            written.flush(tile);
+            if(bf::exists(written.path(tile)))
+            {
+                std::ifstream in;
+                open_in(in, written.path(tile));
+                uint64_t k;
+                while(get(in, k))
+                    written_before.insert(k);
+                in.close();
+                bf::remove(written.path(tile));
+            }
+
+            build_network(onet, raw.nodes, raw.ways);
+            onet.clean_up(lane_width);
+            stable_names(onet);
+            onet.populate_edge_hash_from_edges();
+
+            network hnet(from_osm(name, gamma, lane_width, onet, simplify));
+            hnet.build_intersections();
+            hnet.build_fictitious_lanes();
+            hnet.auto_scale_memberships();
+
+            BOOST_FOREACH(const osm::intersection_map::value_type &isect, onet.intersections)
+            {
+                hnet.intersections[osm::id_string(isect.first)].id = node_name(onet, isect.first);
+            }
+
+            std::map<const road*, std::vector<const lane*> > road_lanes;
+            BOOST_FOREACH(const lane_pair &lp, hnet.lanes)
+            {
+                if(!lp.second.road_memberships.empty())
+                    road_lanes[lp.second.road_memberships.begin()->second.parent_road].push_back(&(lp.second));
+            }
+
+            BOOST_FOREACH(const osm::edge &e, onet.edges)
+            {
+                if(!std::binary_search(owned.begin(), owned.end(), file_node(onet, e.from)) &&
+                   !std::binary_search(owned.begin(), owned.end(), file_node(onet, e.to)))
+                    continue;
+
+                // A road between two tiles is written by whichever gets to it first, which tells the other
+                const uint64_t k = references::key('r', e.id);
+                if(written_before.count(k))
+                    continue;
+                const osm::node_id ends[2] = {file_node(onet, e.from), file_node(onet, e.to)};
+                for(int end = 0; end < 2; ++end)
+                {
+                    const osm::node *n     = ends[end] ? onet.nodes.find(ends[end]) : 0;
+                    const size_t     owner = n ? tree.leaf_at(n->lonlat[0], n->lonlat[1]) : tile;
+                    if(owner > tile)
+                    {
+                        append(written[owner], k);
+                        written.added(sizeof(k));
+                    }
+                }
+                refs.wrote('r', e.id);
+
+                const road &r = hnet.roads[e.id];
+                r.xml_write(roads);
+                BOOST_FOREACH(const lane *l, road_lanes[&r])
+                {
+                    refs.wrote(*l);
+                    l->xml_write(lanes);
+                }
+            }
+
+            BOOST_FOREACH(const osm::intersection_map::value_type &isect, onet.intersections)
+            {
+                if(std::binary_search(owned.begin(), owned.end(), file_node(onet, isect.first)))
+                {
+                    const intersection &is = hnet.intersections[osm::id_string(isect.first)];
+                    refs.wrote(is);
+                    is.xml_write(intersections);
+                }
+            }
+        }
+    }
+
+    tiled_options::tiled_options() : memory_budget(static_cast<size_t>(1) << 30), halo(0.25f), simplify(0.0f)
+    {
+    }
+
+    tiled_report::tiled_report() : tiles(0), depth(0), largest_tile(0), over_budget(0)
+    {
+    }
+
+    size_t tiled_from_osm(const char *osm_file, const char *hwm_file, const str &name, const float gamma, const float lane_width,
+                          const tiled_options &opt, tiled_report *report)
+    {
+        using namespace tiled;
+
+        const bool     own_dir = opt.spill_dir.empty();
+        const bf::path dir(own_dir ? bf::temp_directory_path() / bf::unique_path("libroad-tiles-%%%%-%%%%-%%%%") : opt.spill_dir);
+        bf::create_directories(dir);
+
+        size_t tiles_done = 0;
+        try
+        {
+            const size_t budget = std::max(opt.memory_budget, static_cast<size_t>(1) << 16);
+
+            spill_sink first(dir);
+            osm::read_network(osm_file, first);
+            first.close();
+
+            double bounds[4];
+            if(first.has_bounds)
+                std::copy(first.box, first.box + 4, bounds);
+            else
+                std::copy(first.extent, first.extent + 4, bounds);
+
+            // Give every reference its node's coordinates, a bucket of node ids at a time;
+            // the results go to buckets of way numbers. References to nodes the file doesn't have are dropped.
+            // Nodes that two ways end at and nothing else goes through join the ways; at the others, every way
+            // through them is noted as a junction.
+            const size_t id_buckets  = std::max(static_cast<size_t>(1), (first.nodes*sizeof(node_rec) + first.refs*sizeof(ref_rec))/(budget/2) + 1);
+            const size_t way_buckets = std::max(static_cast<size_t>(1), first.refs*sizeof(coord_rec)/(budget/2) + 1);
+            const size_t way_span    = first.ways/way_buckets + 1;
+            {
+                spill_buckets node_parts(dir, "nodes", id_buckets, budget/4);
+                spill_buckets ref_parts (dir, "refs",  id_buckets, budget/4);
+                {
+                    std::ifstream in;
+                    open_in(in, dir / "nodes");
+                    node_rec r;
+                    while(get(in, r))
+                    {
+                        const size_t b = static_cast<uint64_t>(r.id) % id_buckets;
+                        append(node_parts[b], r);
+                        node_parts.added(sizeof(r));
+                    }
+                }
+                {
+                    std::ifstream in;
+                    open_in(in, dir / "refs");
+                    ref_rec r;
+                    while(get(in, r))
+                    {
+                        const size_t b = static_cast<uint64_t>(r.ref) % id_buckets;
+                        append(ref_parts[b], r);
+                        ref_parts.added(sizeof(r));
+                    }
+                }
+                node_parts.flush();
+                ref_parts.flush();
+                bf::remove(dir / "nodes");
+                bf::remove(dir / "refs");
+
+                spill_buckets coord_parts(dir, "coords", way_buckets, budget/8);
+                spill_buckets link_parts (dir, "links",  way_buckets, budget/8);
+                std::ofstream junctions;
+                open_out(junctions, dir / "junctions");
+                for(size_t b = 0; b < id_buckets; ++b)
+                {
+                    std::vector<node_rec> nodes;
+                    if(bf::exists(node_parts.path(b)))
+                    {
+                        std::ifstream in;
+                        open_in(in, node_parts.path(b));
+                        node_rec r;
+                        while(get(in, r))
+                            nodes.push_back(r);
+                    }
+                    // A node given twice keeps its last position
+                    std::stable_sort(nodes.begin(), nodes.end(), node_less);
+
+                    std::vector<ref_rec> refs;
+                    if(bf::exists(ref_parts.path(b)))
+                    {
+                        std::ifstream in;
+                        open_in(in, ref_parts.path(b));
+                        ref_rec r;
+                        while(get(in, r))
+                            refs.push_back(r);
+                    }
+                    std::sort(refs.begin(), refs.end(), ref_less);
+
+                    std::vector<ref_rec>::const_iterator current = refs.begin();
+                    while(current != refs.end())
+                    {
+                        std::vector<ref_rec>::const_iterator next = current;
+                        while(next != refs.end() && next->ref == current->ref)
+                            ++next;
+
+                        node_rec key;
+                        key.id = current->ref;
+                        std::vector<node_rec>::const_iterator n = std::upper_bound(nodes.begin(), nodes.end(), key, node_less);
+                        if(n == nodes.begin() || (n - 1)->id != current->ref)
+                        {
+                            current = next;
+                            continue;
+                        }
+                        --n;
+
+                        for(std::vector<ref_rec>::const_iterator r = current; r != next; ++r)
+                        {
+                            coord_rec c;
+                            c.way = r->way;
+                            c.pos = r->pos;
+                            c.ref = r->ref;
+                            c.lon = n->lon;
+                            c.lat = n->lat;
+                            append(coord_parts[r->way/way_span], c);
+                            coord_parts.added(sizeof(c));
+                        }
+
+                        const std::vector<ref_rec>::const_iterator other = current + 1;
+                        if(next - current == 2 && current->way != other->way && way_end(*current) && way_end(*other))
+                        {
+                            join_rec j;
+                            j.way   = current->way;
+                            j.other = other->way;
+                            append(link_parts[j.way/way_span], j);
+                            std::swap(j.way, j.other);
+                            append(link_parts[j.way/way_span], j);
+                            link_parts.added(2*sizeof(j));
+                        }
+                        else if(next - current > 1)
+                        {
+                            put(junctions, static_cast<uint32_t>(next - current));
+                            for(std::vector<ref_rec>::const_iterator r = current; r != next; ++r)
+                                put(junctions, r->way);
+                        }
+                        current = next;
+                    }
+                    bf::remove(node_parts.path(b));
+                    bf::remove(ref_parts.path(b));
+                }
+                coord_parts.flush();
+                link_parts.flush();
+                junctions.close();
+                if(!junctions)
+                    throw std::runtime_error("Failed writing spill files");
+            }
+
+            // Every way's bounds and links, in order, and a place for its chain's bounds
+            {
+                std::ofstream out;
+                std::ofstream links;
+                std::ofstream chained;
+                open_out(out,     dir / "boxes");
+                open_out(links,   dir / "links");
+                open_out(chained, dir / "chains");
+                uint64_t seq = 0;
+                for(size_t b = 0; b < way_buckets; ++b)
+                {
+                    std::vector<coord_rec> coords;
+                    const bf::path         cp(dir / boost::str(boost::format("coords.%d") % b));
+                    if(bf::exists(cp))
+                    {
+                        std::ifstream in;
+                        open_in(in, cp);
+                        coord_rec c;
+                        while(get(in, c))
+                            coords.push_back(c);
+                    }
+                    std::sort(coords.begin(), coords.end(), coord_less);
+
+                    std::vector<join_rec> joined;
+                    const bf::path        lp(dir / boost::str(boost::format("links.%d") % b));
+                    if(bf::exists(lp))
+                    {
+                        std::ifstream in;
+                        open_in(in, lp);
+                        join_rec j;
+                        while(get(in, j))
+                            joined.push_back(j);
+                        in.close();
+                        bf::remove(lp);
+                    }
+                    std::sort(joined.begin(), joined.end(), join_less);
+
+                    std::vector<coord_rec>::const_iterator current = coords.begin();
+                    std::vector<join_rec>::const_iterator  join    = joined.begin();
+                    const uint64_t                         last    = std::min(static_cast<uint64_t>((b + 1)*way_span), static_cast<uint64_t>(first.ways));
+                    for(; seq < last; ++seq)
+                    {
+                        box_rec rec;
+                        rec.refs = 0;
+                        for(; current != coords.end() && current->way == seq; ++current)
+                        {
+                            rec.box.add(current->lon, current->lat);
+                            ++rec.refs;
+                        }
+                        if(rec.refs && rec.box.outside(bounds))
+                            rec.refs = 0;
+                        put(out, rec);
+
+                        // One at each end, at most
+                        link_rec l;
+                        l.way[0] = l.way[1] = no_way;
+                        for(int end = 0; join != joined.end() && join->way == seq; ++join, ++end)
+                        {
+                            if(end < 2)
+                                l.way[end] = join->other;
+                        }
+                        put(links, l);
+
+                        chain_rec c;
+                        c.joined = 0;
+                        put(chained, c);
+                    }
+                }
+                out.close();
+                links.close();
+                chained.close();
+                if(!out || !links || !chained)
+                    throw std::runtime_error("Failed writing spill files");
+            }
+
+            chains joins(dir);
+            joins.resolve(first.ways);
+
+            // Each way at a junction reaches as far as every chain through it
+            {
+                spill_buckets reach_parts(dir, "reach", way_buckets, budget/4);
+                std::ifstream junctions;
+                std::ifstream boxes;
+                open_in(junctions, dir / "junctions");
+                open_in(boxes,     dir / "boxes");
+                std::vector<uint64_t> ways;
+                std::vector<rect>     own;
+                uint32_t              count;
+                while(get(junctions, count))
+                {
+                    ways.resize(count);
+                    own.assign(count, rect());
+                    rect reach;
+                    for(uint32_t i = 0; i < count; ++i)
+                    {
+                        get(junctions, ways[i]);
+                        box_rec rec;
+                        boxes.seekg(ways[i]*sizeof(box_rec));
+                        if(!get(boxes, rec))
+                            throw std::runtime_error("Failed reading spill files");
+                        if(!rec.refs)
+                            continue;
+                        own[i] = joins.reach(ways[i], rec.box);
+                        reach.add(own[i]);
+                    }
+                    for(uint32_t i = 0; i < count; ++i)
+                    {
+                        if(own[i].contains(reach))
+                            continue;
+                        reach_rec r;
+                        r.way = ways[i];
+                        r.box = reach;
+                        append(reach_parts[ways[i]/way_span], r);
+                        reach_parts.added(sizeof(r));
+                    }
+                }
+                reach_parts.flush();
+            }
+            bf::remove(dir / "junctions");
+
+            // Every way's reach, in order
+            {
+                std::ifstream boxes;
+                std::ofstream out;
+                open_in(boxes, dir / "boxes");
+                open_out(out, dir / "reach");
+                uint64_t seq = 0;
+                for(size_t b = 0; b < way_buckets; ++b)
+                {
+                    std::map<uint64_t, rect> reached;
+                    const bf::path             rp(dir / boost::str(boost::format("reach.%d") % b));
+                    if(bf::exists(rp))
+                    {
+                        std::ifstream in;
+                        open_in(in, rp);
+                        reach_rec r;
+                        while(get(in, r))
+                            reached[r.way].add(r.box);
+                        bf::remove(rp);
+                    }
+
+                    const uint64_t last = std::min(static_cast<uint64_t>((b + 1)*way_span), static_cast<uint64_t>(first.ways));
+                    for(; seq < last; ++seq)
+                    {
+                        box_rec rec;
+                        get(boxes, rec);
+                        if(rec.refs)
+                        {
+                            rec.box = joins.reach(seq, rec.box);
+                            const std::map<uint64_t, rect>::const_iterator r = reached.find(seq);
+                            if(r != reached.end())
+                                rec.box.add(r->second);
+                        }
+                        put(out, rec);
+                    }
+                }
+                out.close();
+                if(!out)
+                    throw std::runtime_error("Failed writing spill files");
+            }
+            joins.close();
+            bf::remove(dir / "boxes");
+            bf::remove(dir / "links");
+            bf::remove(dir / "chains");
+
+            // Split tiles until what each would convert, measured, fits the budget
+            quadtree            tree(bounds);
+            std::vector<size_t> touched;
+            std::vector<size_t> tile_refs;
+            for(;;)
+            {
+                tile_refs.assign(tree.leaves.size(), 0);
+                std::ifstream in;
+                open_in(in, dir / "reach");
+                box_rec rec;
+                while(get(in, rec))
+                {
+                    if(!rec.refs)
+                        continue;
+                    touched.clear();
+                    tree.touching(rec.box, opt.halo, touched);
+                    BOOST_FOREACH(const size_t t, touched)
+                    {
+                        tile_refs[t] += rec.refs;
+                    }
+                }
+
+                std::vector<size_t> full;
+                for(size_t t = 0; t < tile_refs.size(); ++t)
+                {
+                    tree.cells[tree.leaves[t]].refs = tile_refs[t];
+                    if(tile_refs[t]*bytes_per_ref > budget && tree.splittable(t))
+                        full.push_back(t);
+                }
+                if(full.empty())
+                    break;
+                BOOST_FOREACH(const size_t t, full)
+                {
+                    tree.split(t);
+                }
+                tree.number_leaves();
+            }
+            const size_t ntiles = tree.leaves.size();
+
+            // Tiles over the budget that splitting stopped helping are let through; ones it was cut off from aren't
+            size_t over_budget = 0;
+            for(size_t t = 0; t < ntiles; ++t)
+            {
+                if(tile_refs[t]*bytes_per_ref <= budget)
+                    continue;
+                ++over_budget;
+                const quadtree::cell &k = tree.leaf(t);
+                if(k.depth >= max_tile_depth && k.refs < tree.cells[k.parent].refs)
+                    throw std::runtime_error(boost::str(boost::format("Tile %d (%f, %f to %f, %f) is split as far as it goes and still needs about %d bytes, over the budget of %d")
+                                                        % t % k.box[0] % k.box[1] % k.box[2] % k.box[3] % (tile_refs[t]*bytes_per_ref) % budget));
+            }
+
+            // Put whole ways into every tile they reach
+            {
+                spill_buckets tile_parts(dir, "tile", ntiles, budget/2);
+                std::ifstream ways;
+                std::ifstream reach;
+                open_in(ways,  dir / "ways");
+                open_in(reach, dir / "reach");
+                uint64_t seq = 0;
+                for(size_t b = 0; b < way_buckets; ++b)
+                {
+                    std::vector<coord_rec> coords;
+                    const bf::path         cp(dir / boost::str(boost::format("coords.%d") % b));
+                    if(bf::exists(cp))
+                    {
+                        std::ifstream in;
+                        open_in(in, cp);
+                        coord_rec c;
+                        while(get(in, c))
+                            coords.push_back(c);
+                        bf::remove(cp);
+                    }
+                    std::sort(coords.begin(), coords.end(), coord_less);
+
+                    std::vector<coord_rec>::const_iterator current = coords.begin();
+                    const uint64_t                         last    = std::min(static_cast<uint64_t>((b + 1)*way_span), static_cast<uint64_t>(first.ways));
+                    for(; seq < last; ++seq)
+                    {
+                        str      id, highway_class;
+                        uint32_t count;
+                        box_rec  reached;
+                        get_string(ways, id);
+                        get_string(ways, highway_class);
+                        get(ways, count);
+                        get(reach, reached);
+
+                        std::vector<coord_rec>::const_iterator start = current;
+                        while(current != coords.end() && current->way == seq)
+                            ++current;
+                        if(!reached.refs)
+                            continue;
+
+                        touched.clear();
+                        tree.touching(reached.box, opt.halo, touched);
+                        BOOST_FOREACH(const size_t t, touched)
+                        {
+                            std::string &buf    = tile_parts[t];
+                            const size_t before = buf.size();
+                            append_string(buf, id);
+                            append_string(buf, highway_class);
+                            append(buf, static_cast<uint32_t>(current - start));
+                            for(std::vector<coord_rec>::const_iterator n = start; n != current; ++n)
+                            {
+                                node_rec rec;
+                                rec.id  = n->ref;
+                                rec.lon = n->lon;
+                                rec.lat = n->lat;
+                                append(buf, rec);
+                            }
+                            tile_parts.added(buf.size() - before);
+                        }
+                    }
+                }
+                tile_parts.flush();
+                ways.close();
+                bf::remove(dir / "ways");
+                reach.close();
+                bf::remove(dir / "reach");
+            }
+
+            if(report)
+            {
+                report->depth        = 0;
+                report->largest_tile = 0;
+                report->over_budget  = over_budget;
+                for(size_t t = 0; t < ntiles; ++t)
+                {
+                    report->depth        = std::max(report->depth, tree.leaf(t).depth);
+                    report->largest_tile = std::max(report->largest_tile, tile_refs[t]*bytes_per_ref);
+                }
+            }
+
+            {
+                fragments  frag(dir);
+                xml_writer roads        (frag.road_out,  2);
+                xml_writer lanes        (frag.lane_out,  2);
+                xml_writer intersections(frag.isect_out, 2);
+                references    refs(dir, ntiles, budget/8);
+                spill_buckets written(dir, "written", ntiles, budget/8);
+                for(size_t tile = 0; tile < ntiles; ++tile)
+                {
+                    const bf::path tp(dir / boost::str(boost::format("tile.%d") % tile));
+                    if(!bf::exists(tp))
+                        continue;
+
+                    try
+                    {
+                        convert_tile(tp, tile, tree, bounds, name, gamma, lane_width, opt.simplify, roads, lanes, intersections, refs, written);
+                    }
+                    catch(std::exception &e)
+                    {
+                        const double *b = tree.leaf(tile).box;
+                        throw std::runtime_error(boost::str(boost::format("In tile %d (%f, %f to %f, %f): %s") % tile % b[0] % b[1] % b[2] % b[3] % e.what()));
+                    }
+                    bf::remove(tp);
+                    ++tiles_done;
+                }
+                roads.finish();
+                lanes.finish();
+                intersections.finish();
+                refs.check();
+            }
+
+            std::ostream *out_stream = compressing_ostream(hwm_file);
+            {
+                xml_writer w(*out_stream);
+                w.start("network");
+                w.attribute("name",       name);
+                w.attribute("version",    "1.3");
+                w.attribute("gamma",      gamma);
+                w.attribute("lane_width", lane_width);
+
+                const char *parts[3][2] = {{"roads", "roads.xml"}, {"lanes", "lanes.xml"}, {"intersections", "intersections.xml"}};
+                for(int p = 0; p < 3; ++p)
+                {
+                    std::ifstream in;
+                    open_in(in, dir / parts[p][1]);
+                    w.start(parts[p][0]);
+                    w.copy(in);
+                    w.end();
+                }
+                w.end();
+            }
+            delete out_stream;
+        }
+        catch(...)
+        {
+            if(own_dir)
+                bf::remove_all(dir);
+            throw;
+        }
+
+        if(own_dir)
+            bf::remove_all(dir);
+        else
+        {
+            bf::remove(dir / "roads.xml");
+            bf::remove(dir / "lanes.xml");
+            bf::remove(dir / "intersections.xml");
+        }
+
+        if(report)
+            report->tiles = tiles_done;
+        return tiles_done;
+    }
+}
@@ -1,151 +1,81 @@
 #include "osm_network.hpp"
 #include "xml_util.hpp"
-
-//TODO
-#include <iostream>
+#include <cstring>
 
 namespace osm
 {
-    static inline void xml_read(network &n, node &no, xmlpp::TextReader &reader)
-    {
-        get_attribute(no.id,    reader, "id");
-        get_attribute(no.xy[0], reader, "lon");
-        get_attribute(no.xy[1], reader, "lat");
-        no.xy[2] = 0.0f;
-    }
-
-    static inline void xml_read(network &n, edge &e, xmlpp::TextReader &reader)
+    static inline void xml_read_bounds(reader_sink &sink, xmlpp::TextReader &reader)
     {
-        bool first_node = true;
-        bool is_road = false;
-        do
-        {
-            read_skip_comment(reader);
-
-            if (reader.get_node_type() == xmlpp::TextReader::Element)
-            {
-                if (reader.get_name() == "nd")
-                {
-                    str n_id;
-                    node* current_node;
-                    get_attribute(n_id, reader, "ref");
-                    current_node = retrieve<node>(n.nodes, n_id);
-
-                    e.shape.push_back(current_node);
-                    current_node->edges_including.push_back(&e);
-
-                    //Set the "to node" -- which is expected to be the last node --
-                    //every time.  On the final iteration, the last node will be kept.
-                    e.to = current_node->id;
-
-                    //Save the first node as the "from" node
-                    if (first_node)
-                    {
-                        first_node = false;
-                        e.from = current_node->id;
-                    }
-                }
-
-                if (reader.get_name() == "tag")
-                {
-                    str k, v;
-                    get_attribute(k, reader, "k");
+        double minlat, minlon, maxlat, maxlon;
+        get_attribute(minlat, reader, "minlat");
+        get_attribute(minlon, reader, "minlon");
+        get_attribute(maxlat, reader, "maxlat");
+        get_attribute(maxlon, reader, "maxlon");
 
-                    if (k== "highway"){
-                        is_road = true;
-                        get_attribute(v, reader, "v");
-                        e.highway_class = v;
-                    }
-                }
-            }
-        }
-        while(!is_closing_element(reader, "way"));
-
-        if (!is_road)
-            n.edge_hash.erase(e.id);
+        sink.bounds(minlon, minlat, maxlon, maxlat);
     }
 
-    static inline void xml_read_nodes(network &n, xmlpp::TextReader &reader)
+    static inline void xml_read(raw_node &no, xmlpp::TextReader &reader)
     {
-        read_skip_comment(reader);
-        read_map_no_container(n, n.nodes, reader, "node");
+        get_attribute(no.id, reader, "id");
+        get_attribute(no.lonlat[0], reader, "lon");
+        get_attribute(no.lonlat[1], reader, "lat");
     }
 
-    static inline void xml_read_edges(network &n, xmlpp::TextReader &reader)
+    // Reads the way's node refs into refs (reused from way to way) and returns its highway class, empty if it has none
+    static inline str xml_read_way(std::vector<node_id> &refs, xmlpp::TextReader &reader)
     {
-        read_skip_comment(reader);
-        read_map_no_container(n, n.edge_hash, reader, "way");
-    }
+        refs.clear();
+        str highway_class;
+        if(xmlTextReaderIsEmptyElement(raw_reader(reader)) == 1)
+            return highway_class;
 
-    static inline void xml_read_center(network &n, const char* filename)
-    {
-        xmlpp::TextReader reader(filename);
-        do
+        while(reader.read() && !(reader.get_node_type() == xmlpp::TextReader::EndElement && has_name(reader, "way")))
         {
-            try
-            {
-                read_skip_comment(reader);
-            }
-            catch(xml_eof &e)
+            if(reader.get_node_type() != xmlpp::TextReader::Element)
+                continue;
+
+            if(has_name(reader, "nd"))
             {
-                break;
+                refs.push_back(0);
+                get_attribute(refs.back(), reader, "ref");
             }
-            if (reader.get_node_type() == xmlpp::TextReader::Element)
+            else if(has_name(reader, "tag"))
             {
-                if (reader.get_name() == "bounds")
-                {
-                    float minlat, minlon, maxlat, maxlon;
-                    get_attribute(minlat, reader, "minlat");
-                    get_attribute(minlon, reader, "minlon");
-                    get_attribute(maxlat, reader, "maxlat");
-                    get_attribute(maxlon, reader, "maxlon");
-
-                    n.center[0] = (maxlon - minlon)/2.0 + minlon;
-                    n.center[1] = (maxlat - minlat)/2.0 + minlat;
-
-                    n.topleft[0] = minlon;
-                    n.topleft[1] = maxlat;
-                    n.bottomright[0] = maxlon;
-                    n.bottomright[1] = minlat;
-                    std::cout << "Got " << minlat << " " << minlon << " " << maxlat
-                              << " " << maxlon << std::endl;
-                    std::cout << n.center[0] << " " << n.center[1] << std::endl;
-                }
+                const char *k = attribute_value(reader, "k");
+                if(k && std::strcmp(k, "highway") == 0)
+                    get_attribute(highway_class, reader, "v");
             }
-        }while(1);
-    }
-
-    static inline void xml_read_nodes(network &n, const char *filename)
-    {
-        std::cout << "xml_read_nodes1\n";
-        xmlpp::TextReader reader(filename);
-
-        xml_read_nodes(n, reader);
-
-        reader.close();
+        }
+        return highway_class;
     }
 
-    static inline void xml_read_edges(network &n, const char *filename)
+    void read_xml_network(const char *osm_file, reader_sink &sink)
     {
-        std::cout << "xml_read_edges\n";
-
-        xmlpp::TextReader reader(filename);
-        read_skip_comment(reader);
-        xml_read_edges(n, reader);
+        // One pass over the file: bounds, every node, and the ways that are highways
+        xmlpp::TextReader reader(osm_file);
+        raw_node          no;
+        raw_way           w;
+        while(reader.read())
+        {
+            if(reader.get_node_type() != xmlpp::TextReader::Element)
+                continue;
 
+            if(has_name(reader, "node"))
+            {
+                xml_read(no, reader);
+                sink.node(no);
+            }
+            else if(has_name(reader, "way"))
+            {
+                get_attribute(w.id, reader, "id");
+                w.highway_class = xml_read_way(w.refs, reader);
+                if(!w.highway_class.empty())
+                    sink.way(w);
+            }
+            else if(has_name(reader, "bounds"))
+                xml_read_bounds(sink, reader);
+        }
         reader.close();
     }
-
-    network load_xml_network(const char *osm_file)
-    {
-        network n;
-        std::cout << "load_xml_network\n";
-
-        xml_read_center(n, osm_file);
-
-        xml_read_nodes(n, osm_file);
-        xml_read_edges(n, osm_file);
-
-        return n;
-    }
 }
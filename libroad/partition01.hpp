@@ -2,6 +2,7 @@
 #define _PARTITION01_HPP_
 
 #include "libroad_common.hpp"
+#include "xml_writer.hpp"
 
 template <class T>
 struct partition01 : public std::map<float, T>
@@ -20,6 +21,7 @@ struct partition01 : public std::map<float, T>
     template <class C>
     void xml_read (C &n, xmlpp::TextReader &reader, const str &name);
     void xml_write(xmlpp::Element *elt, const str &name) const;
+    void xml_write(xml_writer &w, const str &name) const;
 
     iterator insert(float x, const T &val)
     {
@@ -0,0 +1,206 @@
+#include "profile.hpp"
+#include <ctime>
+#ifndef _MSC_VER
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace profile
+{
+    struct recorder
+    {
+        recorder() : epoch(now())
+        {}
+
+        std::vector<phase>                           done;
+        std::vector<int>                             open;
+        std::vector<std::pair<std::string, double> > counters; // Bumped with no phase open
+        double                                       epoch;
+    };
+
+    static recorder &rec()
+    {
+        static recorder r;
+        return r;
+    }
+
+    bool enabled()
+    {
+#ifdef LIBROAD_PROFILE
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    double now()
+    {
+#ifdef _MSC_VER
+        return static_cast<double>(std::clock())/CLOCKS_PER_SEC;
+#else
+        timeval tv;
+        gettimeofday(&tv, 0);
+        return tv.tv_sec + tv.tv_usec*1e-6;
+#endif
+    }
+
+    long rss_kb()
+    {
+#if defined(__linux__)
+        std::ifstream statm("/proc/self/statm");
+        long          pages    = 0;
+        long          resident = 0;
+        if(!(statm >> pages >> resident))
+            return 0;
+        return resident*(sysconf(_SC_PAGESIZE)/1024);
+#else
+        return 0;
+#endif
+    }
+
+    long peak_rss_kb()
+    {
+#ifdef _MSC_VER
+        return 0;
+#else
+        rusage ru;
+        if(getrusage(RUSAGE_SELF, &ru) != 0)
+            return 0;
+#ifdef __APPLE__
+        return ru.ru_maxrss/1024;
+#else
+        return ru.ru_maxrss;
+#endif
+#endif
+    }
+
+    static void open_phase(recorder &r, const char *name, const double start)
+    {
+        phase p;
+        p.name        = name;
+        p.parent      = r.open.empty() ? -1 : r.open.back();
+        p.depth       = static_cast<int>(r.open.size());
+        p.start       = start - r.epoch;
+        p.seconds     = 0.0;
+        p.rss_kb      = 0;
+        p.peak_rss_kb = 0;
+        r.open.push_back(static_cast<int>(r.done.size()));
+        r.done.push_back(p);
+    }
+
+    static void close_phase(recorder &r, const double end)
+    {
+        if(r.open.empty())
+            return;
+        phase &p = r.done[r.open.back()];
+        r.open.pop_back();
+        p.seconds     = end - r.epoch - p.start;
+        p.rss_kb      = rss_kb();
+        p.peak_rss_kb = peak_rss_kb();
+    }
+
+    void begin(const char *name)
+    {
+        recorder &r = rec();
+        open_phase(r, name, now());
+    }
+
+    void end()
+    {
+        recorder &r = rec();
+        close_phase(r, now());
+    }
+
+    void add(const char *name, const double seconds)
+    {
+        recorder    &r = rec();
+        const double t = now();
+        open_phase(r, name, t - seconds);
+        close_phase(r, t);
+    }
+
+    void count(const char *name, const double n)
+    {
+        #pragma omp critical(profile_count)
+        {
+            recorder                                     &r = rec();
+            std::vector<std::pair<std::string, double> > &c = r.open.empty() ? r.counters : r.done[r.open.back()].counters;
+
+            std::vector<std::pair<std::string, double> >::iterator it = c.begin();
+            while(it != c.end() && it->first != name)
+                ++it;
+            if(it == c.end())
+                c.push_back(std::make_pair(std::string(name), n));
+            else
+                it->second += n;
+        }
+    }
+
+    const std::vector<phase> &phases()
+    {
+        return rec().done;
+    }
+
+    void reset()
+    {
+        rec() = recorder();
+    }
+
+    static void write_json_string(std::ostream &o, const std::string &s)
+    {
+        o << '"';
+        BOOST_FOREACH(const char c, s)
+        {
+            if(c == '"' || c == '\\')
+                o << '\\' << c;
+            else if(static_cast<unsigned char>(c) < 0x20)
+                o << boost::format("\\u%04x") % static_cast<int>(c);
+            else
+                o << c;
+        }
+        o << '"';
+    }
+
+    static void write_json_counters(std::ostream &o, const std::vector<std::pair<std::string, double> > &c)
+    {
+        o << '{';
+        for(size_t i = 0; i < c.size(); ++i)
+        {
+            if(i)
+                o << ", ";
+            write_json_string(o, c[i].first);
+            o << ": " << boost::format("%.17g") % c[i].second;
+        }
+        o << '}';
+    }
+
+    void write_json(std::ostream &o)
+    {
+        const recorder &r = rec();
+        o << "{\n  \"enabled\": " << (enabled() ? "true" : "false") << ",\n";
+        o << "  \"peak_rss_kb\": " << peak_rss_kb() << ",\n";
+        o << "  \"counters\": ";
+        write_json_counters(o, r.counters);
+        o << ",\n  \"phases\": [";
+        for(size_t i = 0; i < r.done.size(); ++i)
+        {
+            const phase &p = r.done[i];
+            o << (i ? ",\n" : "\n") << "    {\"name\": ";
+            write_json_string(o, p.name);
+            o << boost::format(", \"parent\": %d, \"depth\": %d, \"start\": %.6f, \"seconds\": %.6f, \"rss_kb\": %ld, \"peak_rss_kb\": %ld, \"counters\": ")
+                % p.parent % p.depth % p.start % p.seconds % p.rss_kb % p.peak_rss_kb;
+            write_json_counters(o, p.counters);
+            o << '}';
+        }
+        o << "\n  ]\n}\n";
+    }
+
+    void write_json(const char *filename)
+    {
+        std::ofstream out(filename);
+        if(!out)
+            throw std::runtime_error(boost::str(boost::format("Can't open %s for the profile report") % filename));
+        write_json(out);
+    }
+}
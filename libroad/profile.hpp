@@ -0,0 +1,71 @@
+#ifndef _PROFILE_HPP_
+#define _PROFILE_HPP_
+
+#include "libroad_common.hpp"
+
+// Where the time and memory of imports and loads go: nested phases with wall time and resident set size, and
+// counters that belong to the innermost open phase. The library marks its phases with the PROFILE_ macros below,
+// which only do anything in a build configured with --enable-profile (LIBROAD_PROFILE); otherwise they expand to
+// nothing. Phases are opened and closed outside parallel regions; counters may be bumped anywhere.
+namespace profile
+{
+    struct phase
+    {
+        std::string                                   name;
+        int                                           parent;      // Index into phases(), -1 at the top
+        int                                           depth;
+        double                                        start;       // Seconds since the last reset()
+        double                                        seconds;
+        long                                          rss_kb;      // Resident set size when it ended
+        long                                          peak_rss_kb; // The process's peak up to when it ended
+        std::vector<std::pair<std::string, double> >  counters;
+    };
+
+    // Whether the library was built with its phases marked
+    bool enabled();
+
+    void begin(const char *name);
+    void end();
+    // A phase timed elsewhere, as a child of the open phase that ends now
+    void add(const char *name, double seconds);
+    void count(const char *name, double n);
+
+    // Phases in the order they began
+    const std::vector<phase> &phases();
+    void                      reset();
+
+    double now();
+    long   rss_kb();
+    long   peak_rss_kb();
+
+    void write_json(std::ostream &o);
+    void write_json(const char *filename);
+
+    struct scope
+    {
+        scope(const char *name)
+        {
+            begin(name);
+        }
+
+        ~scope()
+        {
+            end();
+        }
+    };
+}
+
+#define PROFILE_JOIN_(a, b) a##b
+#define PROFILE_JOIN(a, b)  PROFILE_JOIN_(a, b)
+
+#ifdef LIBROAD_PROFILE
+#define PROFILE_SCOPE(name)        profile::scope PROFILE_JOIN(profile_scope_, __LINE__)(name)
+#define PROFILE_COUNT(name, n)     profile::count((name), static_cast<double>(n))
+#define PROFILE_ADD(name, seconds) profile::add((name), (seconds))
+#else
+#define PROFILE_SCOPE(name)        ((void)0)
+#define PROFILE_COUNT(name, n)     ((void)0)
+#define PROFILE_ADD(name, seconds) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,213 @@
+#include "projection.hpp"
+#include <cmath>
+#include <stdexcept>
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+namespace projection
+{
+    static const double deg          = M_PI/180.0;
+    static const double wgs84_a      = 6378137.0;
+    static const double wgs84_f      = 1.0/298.257223563;
+    static const double mean_radius  = 6371008.8;
+    static const double utm_k0       = 0.9996;
+    static const size_t block_points = 4096;
+
+    kind kind_from_string(const str &name)
+    {
+        if(name == "equirectangular")
+            return EQUIRECTANGULAR;
+        if(name == "web_mercator")
+            return WEB_MERCATOR;
+        if(name == "utm")
+            return UTM;
+        throw std::runtime_error(boost::str(boost::format("Unknown projection %s") % name));
+    }
+
+    const char *kind_name(const kind k)
+    {
+        switch(k)
+        {
+        case EQUIRECTANGULAR:
+            return "equirectangular";
+        case WEB_MERCATOR:
+            return "web_mercator";
+        default:
+            return "utm";
+        }
+    }
+
+    static inline double atanh_(const double x)
+    {
+        return 0.5*std::log((1.0 + x)/(1.0 - x));
+    }
+
+    // Transverse Mercator series coefficients, from the flattening
+    struct krueger
+    {
+        krueger()
+        {
+            const double n  = wgs84_f/(2.0 - wgs84_f);
+            const double n2 = n*n;
+            const double n3 = n2*n;
+            A        = wgs84_a/(1.0 + n)*(1.0 + n2/4.0 + n2*n2/64.0);
+            alpha[0] = n/2.0 - 2.0*n2/3.0 + 5.0*n3/16.0;
+            alpha[1] = 13.0*n2/48.0 - 3.0*n3/5.0;
+            alpha[2] = 61.0*n3/240.0;
+            e2n      = 2.0*std::sqrt(n)/(1.0 + n);
+        }
+
+        double A;
+        double alpha[3];
+        double e2n;
+    };
+
+    static const krueger tm;
+
+    static void equirectangular(const double *lon, const double *lat, double *x, double *y, const size_t n, const double lon0, const double lat0)
+    {
+        const double sx = mean_radius*std::cos(lat0*deg)*deg;
+        const double sy = mean_radius*deg;
+        size_t       i  = 0;
+#ifdef __AVX__
+        const __m256d vsx   = _mm256_set1_pd(sx);
+        const __m256d vsy   = _mm256_set1_pd(sy);
+        const __m256d vlon0 = _mm256_set1_pd(lon0);
+        const __m256d vlat0 = _mm256_set1_pd(lat0);
+        for(; i + 4 <= n; i += 4)
+        {
+            const __m256d vx = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(lon + i), vlon0), vsx);
+            const __m256d vy = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(lat + i), vlat0), vsy);
+            _mm256_storeu_pd(x + i, vx);
+            _mm256_storeu_pd(y + i, vy);
+        }
+#endif
+        for(; i < n; ++i)
+        {
+            const double px = (lon[i] - lon0)*sx;
+            const double py = (lat[i] - lat0)*sy;
+            x[i] = px;
+            y[i] = py;
+        }
+    }
+
+    static void web_mercator(const double *lon, const double *lat, double *x, double *y, const size_t n)
+    {
+        // Bound by the log and tan, which only vectorize where the compiler has vector versions of them
+        const double sx = wgs84_a*deg;
+        for(size_t i = 0; i < n; ++i)
+        {
+            const double phi = lat[i]*deg;
+            x[i] = lon[i]*sx;
+            y[i] = wgs84_a*std::log(std::tan(M_PI/4.0 + phi/2.0));
+        }
+    }
+
+    static void utm(const double *lon, const double *lat, double *x, double *y, const size_t n, const int zone, const bool north)
+    {
+        const double lambda0   = (zone*6.0 - 183.0)*deg;
+        const double northing0 = north ? 0.0 : 10000000.0;
+        for(size_t i = 0; i < n; ++i)
+        {
+            const double phi    = lat[i]*deg;
+            const double lambda = lon[i]*deg - lambda0;
+            const double s      = std::sin(phi);
+            const double t      = std::sinh(atanh_(s) - tm.e2n*atanh_(tm.e2n*s));
+            const double xi     = std::atan2(t, std::cos(lambda));
+            const double eta    = atanh_(std::sin(lambda)/std::sqrt(1.0 + t*t));
+
+            double e = eta;
+            double m = xi;
+            for(int j = 0; j < 3; ++j)
+            {
+                const double k = 2.0*(j + 1);
+                e += tm.alpha[j]*std::cos(k*xi)*std::sinh(k*eta);
+                m += tm.alpha[j]*std::sin(k*xi)*std::cosh(k*eta);
+            }
+            x[i] = 500000.0 + utm_k0*tm.A*e;
+            y[i] = northing0 + utm_k0*tm.A*m;
+        }
+    }
+
+    projector::projector(const kind k, const double lo, const double la) : type(k), lon0(lo), lat0(la), zone(0), north(la >= 0.0)
+    {
+        if(type == UTM)
+        {
+            zone = static_cast<int>(std::floor((lo + 180.0)/6.0)) + 1;
+            zone = std::max(1, std::min(60, zone));
+        }
+    }
+
+    void projector::forward(const double *lon, const double *lat, double *x, double *y, const size_t n) const
+    {
+        const long blocks = static_cast<long>((n + block_points - 1)/block_points);
+        #pragma omp parallel for schedule(static) if(blocks > 1)
+        for(long b = 0; b < blocks; ++b)
+        {
+            const size_t start = b*block_points;
+            const size_t count = std::min(block_points, n - start);
+            switch(type)
+            {
+            case EQUIRECTANGULAR:
+                equirectangular(lon + start, lat + start, x + start, y + start, count, lon0, lat0);
+                break;
+            case WEB_MERCATOR:
+                web_mercator(lon + start, lat + start, x + start, y + start, count);
+                break;
+            case UTM:
+                utm(lon + start, lat + start, x + start, y + start, count, zone, north);
+                break;
+            }
+        }
+    }
+
+    void projector::forward(const double lon, const double lat, double &x, double &y) const
+    {
+        forward(&lon, &lat, &x, &y, 1);
+    }
+
+    local_frame::local_frame() : max_error(0.0), max_extent(0.0)
+    {
+        origin[0] = origin[1] = 0.0;
+    }
+
+    local_frame to_local(const double *x, const double *y, const size_t n, const double origin[2], float *fx, float *fy)
+    {
+        const long          blocks = static_cast<long>((n + block_points - 1)/block_points);
+        std::vector<double> error (blocks, 0.0);
+        std::vector<double> extent(blocks, 0.0);
+        #pragma omp parallel for schedule(static) if(blocks > 1)
+        for(long b = 0; b < blocks; ++b)
+        {
+            const size_t start = b*block_points;
+            const size_t end   = std::min(start + block_points, n);
+            double       err2  = 0.0;
+            double       ext2  = 0.0;
+            for(size_t i = start; i < end; ++i)
+            {
+                const double lx = x[i] - origin[0];
+                const double ly = y[i] - origin[1];
+                fx[i] = static_cast<float>(lx);
+                fy[i] = static_cast<float>(ly);
+
+                const double dx = fx[i] - lx;
+                const double dy = fy[i] - ly;
+                err2 = std::max(err2, dx*dx + dy*dy);
+                ext2 = std::max(ext2, lx*lx + ly*ly);
+            }
+            error[b]  = std::sqrt(err2);
+            extent[b] = std::sqrt(ext2);
+        }
+
+        local_frame res;
+        res.origin[0] = origin[0];
+        res.origin[1] = origin[1];
+        for(long b = 0; b < blocks; ++b)
+        {
+            res.max_error  = std::max(res.max_error,  error[b]);
+            res.max_extent = std::max(res.max_extent, extent[b]);
+        }
+        return res;
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef _PROJECTION_HPP_
+#define _PROJECTION_HPP_
+
+#include "libroad_common.hpp"
+
+// Batch map projections from longitude/latitude (degrees, WGS84) to metres.
+// Points are given as separate arrays of doubles (structure of arrays), so that the loops vectorize; the simple
+// projections have an AVX path when the compiler targets it. Large batches are split over threads.
+namespace projection
+{
+    enum kind
+    {
+        EQUIRECTANGULAR, // x scaled by the cosine of the reference latitude; fine for city-sized areas
+        WEB_MERCATOR,    // EPSG:3857; conformal, but scale grows as 1/cos(latitude)
+        UTM              // transverse Mercator in the zone of the reference point, Krueger series to third order
+    };
+
+    kind        kind_from_string(const str &name);
+    const char *kind_name(kind k);
+
+    struct projector
+    {
+        // lon0 and lat0 are the reference point: the origin for EQUIRECTANGULAR, and what picks the zone for UTM
+        projector(kind k, double lon0, double lat0);
+
+        // x and y may alias lon and lat
+        void forward(const double *lon, const double *lat, double *x, double *y, size_t n) const;
+        void forward(double lon, double lat, double &x, double &y) const;
+
+        kind   type;
+        double lon0;
+        double lat0;
+        int    zone;  // UTM only
+        bool   north; // UTM only
+    };
+
+    // Where a local frame is and how much was lost putting points into it
+    struct local_frame
+    {
+        local_frame();
+
+        double origin[2];
+        double max_error;  // furthest any point is from its double position once rounded to float, in metres
+        double max_extent; // furthest any point is from the origin, in metres
+    };
+
+    // Writes x - origin and y - origin to fx and fy as floats, and reports the rounding error
+    local_frame to_local(const double *x, const double *y, size_t n, const double origin[2], float *fx, float *fy);
+}
+#endif
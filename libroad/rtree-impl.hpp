@@ -66,6 +66,35 @@ bool rtree<REAL_T, D, MIN, MAX>::aabb::overlap(const typename rtree<REAL_T, D, M
     return true;
 }
 
+// Slab test: does origin + t*dir for t in [tmin, tmax] touch the box?
+template <typename REAL_T, int D, int MIN, int MAX>
+bool rtree<REAL_T, D, MIN, MAX>::aabb::ray_overlap(const real_t origin[DIMENSION], const real_t dir[DIMENSION], real_t tmin, real_t tmax) const
+{
+    for(int i = 0; i < DIMENSION; ++i)
+    {
+        if(dir[i] == 0)
+        {
+            if(origin[i] < bounds[0][i] || origin[i] > bounds[1][i])
+                return false;
+            continue;
+        }
+
+        const real_t inv = 1/dir[i];
+        real_t       t0  = (bounds[0][i] - origin[i])*inv;
+        real_t       t1  = (bounds[1][i] - origin[i])*inv;
+        if(t0 > t1)
+            std::swap(t0, t1);
+
+        if(t0 > tmin)
+            tmin = t0;
+        if(t1 < tmax)
+            tmax = t1;
+        if(tmin > tmax)
+            return false;
+    }
+    return true;
+}
+
 template <typename REAL_T, int D, int MIN, int MAX>
 void rtree<REAL_T, D, MIN, MAX>::aabb::center(real_t c[DIMENSION]) const
 {
@@ -527,6 +556,151 @@ typename rtree<REAL_T, D, MIN, MAX>::query_result_gen rtree<REAL_T, D, MIN, MAX>
     return query_result_gen(root, rect);
 }
 
+template <typename REAL_T, int D, int MIN, int MAX>
+std::vector<typename rtree<REAL_T, D, MIN, MAX>::idx_t> rtree<REAL_T, D, MIN, MAX>::query_ray(const real_t origin[D], const real_t dir[D], const real_t tmax) const
+{
+    std::vector<idx_t> res;
+    if(!root)
+        return res;
+
+    std::vector<const node*> stack;
+    stack.push_back(root);
+    while(!stack.empty())
+    {
+        const node *current = stack.back();
+        stack.pop_back();
+
+        if(current->leafp())
+        {
+            for(int i = 0; i < current->nchildren; ++i)
+                if(current->children[i].rect.ray_overlap(origin, dir, 0, tmax))
+                    res.push_back(current->children[i].as_item());
+        }
+        else
+        {
+            for(int i = 0; i < current->nchildren; ++i)
+                if(current->children[i].rect.ray_overlap(origin, dir, 0, tmax))
+                    stack.push_back(current->children[i].as_node());
+        }
+    }
+
+    return res;
+}
+
+template <typename REAL_T, int D, int MIN, int MAX>
+inline void rtree<REAL_T, D, MIN, MAX>::add_pair(std::vector<idx_pair> &res, const idx_t a, const idx_t b, const bool unordered)
+{
+    if(unordered && b < a)
+        res.push_back(std::make_pair(b, a));
+    else
+        res.push_back(std::make_pair(a, b));
+}
+
+// Synchronized traversal; with self set, a and b are the same node and each
+// pair of its children is visited once, skipping (i, i) at the leaves.
+// Self-joins report pairs unordered, as (low, high).
+template <typename REAL_T, int D, int MIN, int MAX>
+void rtree<REAL_T, D, MIN, MAX>::join_nodes(std::vector<idx_pair> &res, const node *a, const node *b, const bool self, const bool unordered)
+{
+    for(int i = 0; i < a->nchildren; ++i)
+        for(int j = self ? i : 0; j < b->nchildren; ++j)
+        {
+            const entry &ea = a->children[i];
+            const entry &eb = b->children[j];
+            if(!ea.rect.overlap(eb.rect))
+                continue;
+
+            if(a->leafp() && b->leafp())
+            {
+                if(!(self && i == j))
+                    add_pair(res, ea.as_item(), eb.as_item(), unordered);
+            }
+            else if(a->leafp())
+                join_entry(res, ea, eb.as_node(), false, unordered);
+            else if(b->leafp())
+                join_entry(res, eb, ea.as_node(), true, unordered);
+            else
+                join_nodes(res, ea.as_node(), eb.as_node(), self && i == j, unordered);
+        }
+}
+
+template <typename REAL_T, int D, int MIN, int MAX>
+void rtree<REAL_T, D, MIN, MAX>::join_entry(std::vector<idx_pair> &res, const entry &e, const node *n, const bool swapped, const bool unordered)
+{
+    for(int i = 0; i < n->nchildren; ++i)
+    {
+        const entry &c = n->children[i];
+        if(!e.rect.overlap(c.rect))
+            continue;
+
+        if(!n->leafp())
+            join_entry(res, e, c.as_node(), swapped, unordered);
+        else if(swapped)
+            add_pair(res, c.as_item(), e.as_item(), unordered);
+        else
+            add_pair(res, e.as_item(), c.as_item(), unordered);
+    }
+}
+
+// Splits the work into pairs of root children and runs those in parallel;
+// per-pair results are concatenated in order, so the output doesn't depend on the thread count.
+template <typename REAL_T, int D, int MIN, int MAX>
+void rtree<REAL_T, D, MIN, MAX>::join_roots(std::vector<idx_pair> &res, const node *a, const node *b, const bool self)
+{
+    if(a->leafp() || b->leafp())
+    {
+        join_nodes(res, a, b, self, self);
+        return;
+    }
+
+    std::vector<std::pair<int, int> > tasks;
+    for(int i = 0; i < a->nchildren; ++i)
+        for(int j = self ? i : 0; j < b->nchildren; ++j)
+            if(a->children[i].rect.overlap(b->children[j].rect))
+                tasks.push_back(std::make_pair(i, j));
+
+    std::vector<std::vector<idx_pair> > task_res(tasks.size());
+    const long ntasks = static_cast<long>(tasks.size());
+#pragma omp parallel for schedule(dynamic, 1)
+    for(long t = 0; t < ntasks; ++t)
+    {
+        const int i = tasks[t].first;
+        const int j = tasks[t].second;
+        join_nodes(task_res[t], a->children[i].as_node(), b->children[j].as_node(), self && i == j, self);
+    }
+
+    size_t total = res.size();
+    for(size_t t = 0; t < task_res.size(); ++t)
+        total += task_res[t].size();
+    res.reserve(total);
+    for(size_t t = 0; t < task_res.size(); ++t)
+        res.insert(res.end(), task_res[t].begin(), task_res[t].end());
+}
+
+template <typename REAL_T, int D, int MIN, int MAX>
+void rtree<REAL_T, D, MIN, MAX>::join(std::vector<idx_pair> &res, const rtree &o) const
+{
+    if(root && o.root)
+        join_roots(res, root, o.root, false);
+}
+
+template <typename REAL_T, int D, int MIN, int MAX>
+void rtree<REAL_T, D, MIN, MAX>::self_join(std::vector<idx_pair> &res) const
+{
+    if(root)
+        join_roots(res, root, root, true);
+}
+
+template <typename REAL_T, int D, int MIN, int MAX>
+std::vector<typename rtree<REAL_T, D, MIN, MAX>::idx_t> rtree<REAL_T, D, MIN, MAX>::query_segment(const real_t p0[D], const real_t p1[D]) const
+{
+    real_t dir[D];
+    for(int i = 0; i < D; ++i)
+        dir[i] = p1[i] - p0[i];
+
+    return query_ray(p0, dir, 1);
+}
+
 template <typename REAL_T, int D, int MIN, int MAX>
 void rtree<REAL_T, D, MIN, MAX>::insert(typename rtree<REAL_T, D, MIN, MAX>::entry &e, bool leaf)
 {
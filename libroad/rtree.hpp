@@ -16,6 +16,7 @@ struct rtree
 
     typedef REAL_T real_t;
     typedef size_t idx_t;
+    typedef std::pair<idx_t, idx_t> idx_pair;
     enum { DIMENSION = D };
     enum { m = MIN };
     enum { M = MAX };
@@ -31,6 +32,7 @@ struct rtree
         real_t area() const;
         aabb   funion(const aabb &o) const;
         bool   overlap(const aabb &o) const;
+        bool   ray_overlap(const real_t origin[DIMENSION], const real_t dir[DIMENSION], real_t tmin, real_t tmax) const;
         void   center(real_t c[DIMENSION]) const;
         void   enclose_point(real_t x, real_t y);
         void   enclose_point(real_t x, real_t y, real_t z);
@@ -112,6 +114,10 @@ struct rtree
     size_t             count_nodes(bool do_leaf) const;
     std::vector<idx_t> query(const aabb &rect) const;
     query_result_gen   make_query_gen(const aabb &rect) const;
+    std::vector<idx_t> query_ray(const real_t origin[D], const real_t dir[D], real_t tmax) const;
+    std::vector<idx_t> query_segment(const real_t p0[D], const real_t p1[D]) const;
+    void               join(std::vector<idx_pair> &res, const rtree &o) const;
+    void               self_join(std::vector<idx_pair> &res) const;
     void               insert(entry &e, bool leafp=true);
     node              *choose_node(const entry &e, const int e_height) const;
     void               adjust_tree(node *l, node *pair);
@@ -122,6 +128,11 @@ struct rtree
 
     void dump(const char *filename) const;
 
+    static void add_pair  (std::vector<idx_pair> &res, idx_t a, idx_t b, bool unordered);
+    static void join_nodes(std::vector<idx_pair> &res, const node *a, const node *b, bool self, bool unordered);
+    static void join_entry(std::vector<idx_pair> &res, const entry &e, const node *n, bool swapped, bool unordered);
+    static void join_roots(std::vector<idx_pair> &res, const node *a, const node *b, bool self);
+
     static void quad_split(node *out_n1, node *out_n2, entry in_e[M+1], int &nentries);
     static std::pair<int, int> quad_pick_seeds(const entry in_e[M+1], const int nentries);
     static int quad_pick_next(const aabb &r1, const aabb &r2, const entry in_e[M+1], const int nentries);
@@ -29,4 +29,51 @@ namespace sumo
         }
         return true;
     }
+
+    projection::local_frame network::recentre()
+    {
+        std::vector<double> x;
+        std::vector<double> y;
+        typedef strhash<node>::type::value_type node_pair;
+        typedef strhash<edge>::type::value_type edge_pair;
+        BOOST_FOREACH(const node_pair &np, nodes)
+        {
+            x.push_back(np.second.xy[0]);
+            y.push_back(np.second.xy[1]);
+        }
+        BOOST_FOREACH(const edge_pair &ep, edges)
+        {
+            BOOST_FOREACH(const vec2d &v, ep.second.shape)
+            {
+                x.push_back(v[0]);
+                y.push_back(v[1]);
+            }
+        }
+
+        double origin[2] = {0.0, 0.0};
+        if(!x.empty())
+        {
+            origin[0] = (*std::min_element(x.begin(), x.end()) + *std::max_element(x.begin(), x.end()))/2.0;
+            origin[1] = (*std::min_element(y.begin(), y.end()) + *std::max_element(y.begin(), y.end()))/2.0;
+        }
+
+        std::vector<float>            fx(x.size());
+        std::vector<float>            fy(y.size());
+        const projection::local_frame res(projection::to_local(x.empty() ? 0 : &(x[0]), y.empty() ? 0 : &(y[0]), x.size(), origin,
+                                                                fx.empty() ? 0 : &(fx[0]), fy.empty() ? 0 : &(fy[0])));
+
+        const vec2d shift(origin[0], origin[1]);
+        BOOST_FOREACH(node_pair &np, nodes)
+        {
+            np.second.xy -= shift;
+        }
+        BOOST_FOREACH(edge_pair &ep, edges)
+        {
+            BOOST_FOREACH(vec2d &v, ep.second.shape)
+            {
+                v -= shift;
+            }
+        }
+        return res;
+    }
 }
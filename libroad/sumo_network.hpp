@@ -2,6 +2,7 @@
 #define _SUMO_NETWORK_HPP_
 
 #include "libroad_common.hpp"
+#include "projection.hpp"
 
 namespace sumo
 {
@@ -38,6 +39,30 @@ namespace sumo
         SPREAD     spread;
     };
 
+    // A lane-to-lane link through a junction, from a .net.xml <connection>
+    struct connection
+    {
+        edge *from;
+        edge *to;
+        int   from_lane;  // SUMO lane index: 0 is the rightmost
+        int   to_lane;
+        str   tl;         // The tlLogic controlling it, if any
+        int   link_index; // Its position in tl's phase states, -1 if none
+    };
+
+    // A traffic light program; each phase's state has a character per link_index, 'G' or 'g' where it may go
+    struct tl_logic
+    {
+        struct phase
+        {
+            float       duration;
+            std::string state;
+        };
+
+        str                id;
+        std::vector<phase> phases;
+    };
+
     struct network
     {
         network() : anon_node_count(0), anon_edge_type_count(0)
@@ -48,6 +73,13 @@ namespace sumo
         strhash<edge_type>::type types;
         size_t                   anon_edge_type_count;
         strhash<edge>::type      edges;
+        // Only a .net.xml has these
+        std::vector<connection>  connections;
+        strhash<tl_logic>::type  tl_logics;
+
+        // Moves nodes and shapes (in double) so that their bounds are centred on the origin, where from_sumo's floats
+        // are precise; the frame reports the shift and what rounding to float will lose
+        projection::local_frame recentre();
 
         bool check_edge(const edge &e) const;
         bool check_node(const node &n) const;
@@ -57,6 +89,10 @@ namespace sumo
     network load_xml_network(const char *node_file,
                              const char *edge_type_file,
                              const char *edge_file);
+
+    // A single SUMO .net.xml (as netconvert writes them), read in one pass. Internal edges and junctions are dropped;
+    // each edge's shape is the middle of its lanes' shapes, without the ends, and its spread is center.
+    network load_net_xml(const char *net_file);
 }
 
 inline std::ostream &operator<<(std::ostream &o, const sumo::node::TYPES &t)
@@ -1,24 +1,33 @@
 #include "sumo_network.hpp"
 #include "xml_util.hpp"
+#include "profile.hpp"
+#include <cstring>
 
 namespace sumo
 {
-    static inline void read_shape(edge::shape_t &shape, const std::string &s)
+    // "x,y x,y ..."; coordinates past the second of each point are skipped
+    static inline void read_shape(edge::shape_t &shape, const char *s)
     {
-        typedef boost::tokenizer<boost::char_separator<char> > tokenizer;
-        boost::char_separator<char> sep(" ");
-        tokenizer                   tokens(s, sep);
+        size_t points = 1;
+        for(const char *c = s; *c; ++c)
+            points += *c == ' ';
+        shape.reserve(shape.size() + points);
 
-        BOOST_FOREACH(const std::string &vs, tokens)
+        while(*s)
         {
-            boost::char_separator<char> csep(",");
-            tokenizer                   vtokens(vs, csep);
-            tokenizer::iterator         tok        = vtokens.begin();
-
-            double x = boost::lexical_cast<double>(*tok);
-            ++tok;
-            double y = boost::lexical_cast<double>(*tok);
+            while(*s == ' ')
+                ++s;
+            if(!*s)
+                break;
+
+            double x, y;
+            s = parse_number(x, s);
+            if(!s || *s != ',' || !(s = parse_number(y, s + 1)))
+                throw boost::bad_lexical_cast();
             shape.push_back(vec2d(x, y));
+
+            while(*s && *s != ' ')
+                ++s;
         }
     }
 
@@ -65,7 +74,6 @@ namespace sumo
         get_attribute(no.id,    reader, "id");
         get_attribute(no.xy[0], reader, "x");
         get_attribute(no.xy[1], reader, "y");
-        no.xy[2] = 0.0f;
 
         try
         {
@@ -143,15 +151,9 @@ namespace sumo
             e.spread = edge::right;
         }
 
-        str shape_str;
-        try
-        {
-            get_attribute(shape_str, reader, "shape");
-            read_shape(e.shape, shape_str);
-        }
-        catch(missing_attribute &mi)
-        {
-        }
+        const char *shape = attribute_value(reader, "shape");
+        if(shape)
+            read_shape(e.shape, shape);
 
         return true;
     }
@@ -214,6 +216,7 @@ namespace sumo
                              const char *edge_file)
     {
         network n;
+        PROFILE_SCOPE("sumo::load_xml_network");
 
         if(!(xml_read_nodes(n, node_file) &&
              xml_read_types(n, edge_type_file) &&
@@ -222,4 +225,217 @@ namespace sumo
 
         return n;
     }
+
+    // netconvert writes many kinds of junction; all but the signals give way by priority of some sort
+    static inline node::TYPES junction_type(const char *type)
+    {
+        if(!type)
+            return node::unknown;
+        if(std::strncmp(type, "traffic_light", 13) == 0)
+            return node::traffic_light;
+        if(std::strcmp(type, "dead_end") == 0)
+            return node::unknown;
+        return node::priority;
+    }
+
+    // The middle of an edge's lanes, without the ends, which stop short of the junctions
+    static inline void lane_centre(edge::shape_t &shape, const std::vector<edge::shape_t> &lanes)
+    {
+        bool same = true;
+        BOOST_FOREACH(const edge::shape_t &l, lanes)
+        {
+            same = same && l.size() == lanes.front().size();
+        }
+
+        if(!same)
+        {
+            const edge::shape_t &mid = lanes[lanes.size()/2];
+            if(mid.size() > 2)
+                shape.assign(mid.begin() + 1, mid.end() - 1);
+            return;
+        }
+
+        const size_t points = lanes.front().size();
+        for(size_t i = 1; i + 1 < points; ++i)
+        {
+            vec2d sum(0.0, 0.0);
+            BOOST_FOREACH(const edge::shape_t &l, lanes)
+            {
+                sum += l[i];
+            }
+            shape.push_back(vec2d(sum/static_cast<double>(lanes.size())));
+        }
+    }
+
+    static inline bool is_empty_element(const xmlpp::TextReader &reader)
+    {
+        return xmlTextReaderIsEmptyElement(raw_reader(reader)) == 1;
+    }
+
+    static void net_read_edge(network &n, xmlpp::TextReader &reader)
+    {
+        const char *function = attribute_value(reader, "function");
+        if(function && std::strcmp(function, "normal") != 0)
+        {
+            if(!is_empty_element(reader))
+                read_to_close(reader, "edge");
+            return;
+        }
+
+        str id;
+        str from_id;
+        str to_id;
+        get_attribute(id,      reader, "id");
+        get_attribute(from_id, reader, "from");
+        get_attribute(to_id,   reader, "to");
+        int priority = -1;
+        if(const char *p = attribute_value(reader, "priority"))
+            parse_value(priority, p);
+
+        std::vector<edge::shape_t> lanes;
+        double                     speed = 0.0;
+        if(!is_empty_element(reader))
+        {
+            do
+            {
+                read_skip_comment(reader);
+                if(is_opening_element(reader, "lane"))
+                {
+                    int    index;
+                    double lane_speed;
+                    get_attribute(index,      reader, "index");
+                    get_attribute(lane_speed, reader, "speed");
+                    if(index < 0)
+                        throw xml_error(reader, boost::str(boost::format("Bad lane index %d in edge %s") % index % id));
+                    if(index >= static_cast<int>(lanes.size()))
+                        lanes.resize(index + 1);
+                    speed = std::max(speed, lane_speed);
+
+                    if(const char *shape = attribute_value(reader, "shape"))
+                        read_shape(lanes[index], shape);
+                }
+            }
+            while(!is_closing_element(reader, "edge"));
+        }
+        if(lanes.empty())
+            throw xml_error(reader, boost::str(boost::format("Edge %s has no lanes") % id));
+
+        edge &e = n.edges[id];
+        e.id       = id;
+        e.from     = retrieve<node>(n.nodes, from_id);
+        e.to       = retrieve<node>(n.nodes, to_id);
+        e.from->id = from_id;
+        e.to->id   = to_id;
+        e.type     = anon_edge_type(n, priority, static_cast<int>(lanes.size()), speed);
+        e.spread   = edge::center;
+        e.shape.clear();
+        lane_centre(e.shape, lanes);
+    }
+
+    static void net_read_junction(network &n, xmlpp::TextReader &reader)
+    {
+        const char       *type     = attribute_value(reader, "type");
+        const bool        internal = type && std::strcmp(type, "internal") == 0;
+        const node::TYPES jt       = junction_type(type);
+
+        if(!internal)
+        {
+            str id;
+            get_attribute(id, reader, "id");
+            node &no = *retrieve<node>(n.nodes, id);
+            no.id   = id;
+            no.type = jt;
+            get_attribute(no.xy[0], reader, "x");
+            get_attribute(no.xy[1], reader, "y");
+        }
+
+        if(!is_empty_element(reader))
+            read_to_close(reader, "junction");
+    }
+
+    static void net_read_connection(network &n, xmlpp::TextReader &reader)
+    {
+        str from_id;
+        str to_id;
+        get_attribute(from_id, reader, "from");
+        get_attribute(to_id,   reader, "to");
+
+        // Links between internal lanes are in here too; their edges weren't kept
+        const strhash<edge>::type::iterator from = n.edges.find(from_id);
+        const strhash<edge>::type::iterator to   = n.edges.find(to_id);
+        if(from != n.edges.end() && to != n.edges.end())
+        {
+            connection c;
+            c.from = &(from->second);
+            c.to   = &(to->second);
+            get_attribute(c.from_lane, reader, "fromLane");
+            get_attribute(c.to_lane,   reader, "toLane");
+            c.link_index = -1;
+            const char *tl = attribute_value(reader, "tl");
+            if(tl && *tl)
+            {
+                c.tl = tl;
+                get_attribute(c.link_index, reader, "linkIndex");
+            }
+            n.connections.push_back(c);
+        }
+
+        if(!is_empty_element(reader))
+            read_to_close(reader, "connection");
+    }
+
+    static void net_read_tl_logic(network &n, xmlpp::TextReader &reader)
+    {
+        str id;
+        get_attribute(id, reader, "id");
+
+        // Only the first program for each light is kept
+        const bool first = n.tl_logics.find(id) == n.tl_logics.end();
+        tl_logic  &tl    = n.tl_logics[id];
+        tl.id = id;
+
+        if(!is_empty_element(reader))
+        {
+            do
+            {
+                read_skip_comment(reader);
+                if(first && is_opening_element(reader, "phase"))
+                {
+                    tl_logic::phase ph;
+                    get_attribute(ph.duration, reader, "duration");
+                    get_attribute(ph.state,    reader, "state");
+                    tl.phases.push_back(ph);
+                }
+            }
+            while(!is_closing_element(reader, "tlLogic"));
+        }
+    }
+
+    network load_net_xml(const char *net_file)
+    {
+        network n;
+        PROFILE_SCOPE("sumo::load_net_xml");
+
+        xmlpp::TextReader reader(net_file);
+        while(reader.read())
+        {
+            if(reader.get_node_type() != xmlpp::TextReader::Element)
+                continue;
+
+            if(has_name(reader, "edge"))
+                net_read_edge(n, reader);
+            else if(has_name(reader, "junction"))
+                net_read_junction(n, reader);
+            else if(has_name(reader, "connection"))
+                net_read_connection(n, reader);
+            else if(has_name(reader, "tlLogic"))
+                net_read_tl_logic(n, reader);
+        }
+        reader.close();
+
+        PROFILE_COUNT("edges",       n.edges.size());
+        PROFILE_COUNT("nodes",       n.nodes.size());
+        PROFILE_COUNT("connections", n.connections.size());
+        return n;
+    }
 }
@@ -0,0 +1,221 @@
+#include "xml_util.hpp"
+#include <cerrno>
+#include <cfloat>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdint.h>
+
+static const double pow10_tab[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,
+                                   1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+                                   1e20, 1e21, 1e22};
+
+static inline bool is_digit(const char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// Splits a decimal number into sign, up to 19 significant digits and a power of ten.
+// Returns the character after the number, 0 if there isn't one; exact is false if digits were dropped.
+static const char *scan_decimal(const char *s, bool &neg, uint64_t &digits, int &exp10, bool &exact)
+{
+    neg = *s == '-';
+    if(*s == '-' || *s == '+')
+        ++s;
+
+    digits = 0;
+    exp10  = 0;
+    exact  = true;
+
+    int  nd  = 0;
+    bool any = false;
+    for(; is_digit(*s); ++s)
+    {
+        any = true;
+        if(nd < 19)
+        {
+            if(digits || *s != '0')
+            {
+                digits = digits*10 + (*s - '0');
+                ++nd;
+            }
+        }
+        else
+        {
+            ++exp10;
+            exact = exact && *s == '0';
+        }
+    }
+    if(*s == '.')
+    {
+        ++s;
+        for(; is_digit(*s); ++s)
+        {
+            any = true;
+            if(nd < 19)
+            {
+                if(digits || *s != '0')
+                {
+                    digits = digits*10 + (*s - '0');
+                    ++nd;
+                }
+                --exp10;
+            }
+            else
+                exact = exact && *s == '0';
+        }
+    }
+    if(!any)
+        return 0;
+
+    if(*s == 'e' || *s == 'E')
+    {
+        const char *e    = s + 1;
+        const bool  eneg = *e == '-';
+        if(*e == '-' || *e == '+')
+            ++e;
+        if(is_digit(*e))
+        {
+            int ev = 0;
+            for(; is_digit(*e); ++e)
+                if(ev < 100000)
+                    ev = ev*10 + (*e - '0');
+            exp10 += eneg ? -ev : ev;
+            s      = e;
+        }
+    }
+    return s;
+}
+
+// Exactly rounded digits*10^exp10, when that is a single correctly rounded operation
+static inline bool fast_decimal(double &res, const uint64_t digits, const int exp10)
+{
+    if(digits > (static_cast<uint64_t>(1) << 53) || exp10 < -22 || exp10 > 22)
+        return false;
+    res = exp10 < 0 ? digits/pow10_tab[-exp10] : digits*pow10_tab[exp10];
+    return true;
+}
+
+// Whether the double d falls exactly halfway between two floats, where rounding it again could go the wrong way
+static inline bool float_midpoint(const double d)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &d, sizeof(bits));
+    return (bits & 0x1fffffff) == 0x10000000;
+}
+
+template <typename F>
+static const char *strto(F &res, const char *s);
+
+template <>
+const char *strto(double &res, const char *s)
+{
+    char *end;
+    errno = 0;
+    res   = std::strtod(s, &end);
+    return end == s || errno == ERANGE ? 0 : end;
+}
+
+template <>
+const char *strto(float &res, const char *s)
+{
+    char *end;
+    errno = 0;
+    res   = std::strtof(s, &end);
+    return end == s || errno == ERANGE ? 0 : end;
+}
+
+const char *parse_number(double &res, const char *s)
+{
+    bool        neg;
+    uint64_t    digits;
+    int         exp10;
+    bool        exact;
+    const char *end = scan_decimal(s, neg, digits, exp10, exact);
+    if(!end)
+        return (*s == '-' || *s == '+' || *s == 'i' || *s == 'I' || *s == 'n' || *s == 'N') ? strto(res, s) : 0;
+
+    double d;
+    if(!exact || !fast_decimal(d, digits, exp10))
+        return strto(res, s);
+
+    res = neg ? -d : d;
+    return end;
+}
+
+const char *parse_number(float &res, const char *s)
+{
+    bool        neg;
+    uint64_t    digits;
+    int         exp10;
+    bool        exact;
+    const char *end = scan_decimal(s, neg, digits, exp10, exact);
+    if(!end)
+        return (*s == '-' || *s == '+' || *s == 'i' || *s == 'I' || *s == 'n' || *s == 'N') ? strto(res, s) : 0;
+
+    double d;
+    if(!exact || !fast_decimal(d, digits, exp10) ||
+       (d != 0.0 && (d < FLT_MIN || d > FLT_MAX || float_midpoint(d))))
+        return strto(res, s);
+
+    const float f = static_cast<float>(d);
+    res = neg ? -f : f;
+    return end;
+}
+
+template <typename T>
+static const char *parse_integer(T &res, const char *s)
+{
+    const bool neg = *s == '-';
+    if(neg && std::numeric_limits<T>::min() == 0)
+        return 0;
+    if(*s == '-' || *s == '+')
+        ++s;
+    if(!is_digit(*s))
+        return 0;
+
+    const unsigned long long limit = neg ? static_cast<unsigned long long>(-(std::numeric_limits<T>::min() + 1)) + 1 :
+                                           static_cast<unsigned long long>(std::numeric_limits<T>::max());
+    unsigned long long v = 0;
+    for(; is_digit(*s); ++s)
+    {
+        const unsigned d = *s - '0';
+        if(v > (limit - d)/10)
+            return 0;
+        v = v*10 + d;
+    }
+
+    res = neg ? static_cast<T>(-static_cast<long long>(v - 1) - 1) : static_cast<T>(v);
+    return s;
+}
+
+const char *parse_number(int &res, const char *s)
+{
+    return parse_integer(res, s);
+}
+
+const char *parse_number(long &res, const char *s)
+{
+    return parse_integer(res, s);
+}
+
+const char *parse_number(long long &res, const char *s)
+{
+    return parse_integer(res, s);
+}
+
+const char *parse_number(unsigned int &res, const char *s)
+{
+    return parse_integer(res, s);
+}
+
+const char *parse_number(unsigned long &res, const char *s)
+{
+    return parse_integer(res, s);
+}
+
+const char *parse_number(unsigned long long &res, const char *s)
+{
+    return parse_integer(res, s);
+}
@@ -5,6 +5,110 @@
 #include <boost/lexical_cast.hpp>
 #include <libxml++/libxml++.h>
 #include <libxml++/parsers/textreader.h>
+#include <libxml/xmlreader.h>
+
+// from_chars-style parsing straight out of a NUL-terminated buffer (such as libxml2's):
+// reads the number that s starts with into res and returns the character after it, or 0 if s doesn't start with one.
+// Floats are rounded exactly as strtod/strtof would; nothing is allocated.
+const char *parse_number(float              &res, const char *s);
+const char *parse_number(double             &res, const char *s);
+const char *parse_number(int                &res, const char *s);
+const char *parse_number(long               &res, const char *s);
+const char *parse_number(long long          &res, const char *s);
+const char *parse_number(unsigned int       &res, const char *s);
+const char *parse_number(unsigned long      &res, const char *s);
+const char *parse_number(unsigned long long &res, const char *s);
+
+// Whole-string conversions; like boost::lexical_cast, they throw bad_lexical_cast on anything but a bare number
+template <typename T>
+inline void parse_value(T &res, const char *s)
+{
+    res = boost::lexical_cast<T>(s);
+}
+
+#define PARSE_VALUE(T)                                  \
+    inline void parse_value(T &res, const char *s)      \
+    {                                                   \
+        const char *end = parse_number(res, s);         \
+        if(!end || *end)                                \
+            throw boost::bad_lexical_cast();            \
+    }
+
+PARSE_VALUE(float)
+PARSE_VALUE(double)
+PARSE_VALUE(int)
+PARSE_VALUE(long)
+PARSE_VALUE(long long)
+PARSE_VALUE(unsigned int)
+PARSE_VALUE(unsigned long)
+PARSE_VALUE(unsigned long long)
+#undef PARSE_VALUE
+
+// Numbers separated by whitespace (and sep, if given), read in place
+struct number_tokens
+{
+    number_tokens(const char *s, const char sep = ' ') : pos(s), extra_sep(sep)
+    {}
+
+    bool is_sep(const char c) const
+    {
+        return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == extra_sep;
+    }
+
+    // Reads the next number into res; false once the buffer is used up
+    template <typename T>
+    bool next(T &res)
+    {
+        while(is_sep(*pos))
+            ++pos;
+        if(!*pos)
+            return false;
+
+        const char *end = parse_number(res, pos);
+        if(!end || (*end && !is_sep(*end)))
+            throw boost::bad_lexical_cast();
+        pos = end;
+        return true;
+    }
+
+    void skip_line()
+    {
+        while(*pos && *pos != '\n')
+            ++pos;
+    }
+
+    const char *pos;
+    const char  extra_sep;
+};
+
+inline xmlTextReaderPtr raw_reader(const xmlpp::TextReader &reader)
+{
+    return const_cast<xmlpp::TextReader&>(reader).cobj();
+}
+
+// The current node's value in libxml2's own buffer; valid until the reader moves
+inline const char *text_value(const xmlpp::TextReader &reader)
+{
+    const xmlChar *v = xmlTextReaderConstValue(raw_reader(reader));
+    return v ? reinterpret_cast<const char*>(v) : "";
+}
+
+// The value of the current element's attribute name in libxml2's own buffer, or 0 if there isn't one.
+// Valid until the reader moves or the next call.
+inline const char *attribute_value(const xmlpp::TextReader &reader, const char *name)
+{
+    const xmlTextReaderPtr r = raw_reader(reader);
+    if(xmlTextReaderMoveToAttribute(r, reinterpret_cast<const xmlChar*>(name)) != 1)
+        return 0;
+    const xmlChar *v = xmlTextReaderConstValue(r);
+    xmlTextReaderMoveToElement(r);
+    return reinterpret_cast<const char*>(v);
+}
+
+inline bool has_name(const xmlpp::TextReader &reader, const char *name)
+{
+    return xmlStrEqual(xmlTextReaderConstName(raw_reader(reader)), reinterpret_cast<const xmlChar*>(name));
+}
 
 inline int xml_line(const xmlpp::Node *n)
 {
@@ -71,35 +175,37 @@ struct missing_attribute : std::exception
 template <typename T>
 inline void get_attribute(T &res, xmlpp::TextReader &reader, const str &eltname)
 {
-    str val(reader.get_attribute(eltname));
+    const char *val = attribute_value(reader, eltname.c_str());
 
-    if(val.empty())
+    if(!val || !*val)
         throw missing_attribute(reader, eltname);
 
-    res = boost::lexical_cast<T>(val);
+    parse_value(res, val);
 }
 
 template <>
 inline void get_attribute(str &res, xmlpp::TextReader &reader, const str &eltname)
 {
-    res = reader.get_attribute(eltname);
+    const char *val = attribute_value(reader, eltname.c_str());
 
-    if(res.empty())
+    if(!val || !*val)
         throw missing_attribute(reader, eltname);
+
+    res = val;
 }
 
 inline bool is_opening_element(const xmlpp::TextReader &reader, const str &name)
 {
 
     return (reader.get_node_type() == xmlpp::TextReader::Element
-            && reader.get_name() == name);
+            && has_name(reader, name.c_str()));
 }
 
 inline bool is_closing_element(const xmlpp::TextReader &reader, const str &name)
 {
     return ((reader.get_node_type() == xmlpp::TextReader::EndElement ||
-             reader.is_empty_element()) &&
-            reader.get_name() == name);
+             xmlTextReaderIsEmptyElement(raw_reader(reader)) == 1) &&
+            has_name(reader, name.c_str()));
 }
 
 struct xml_eof_opening : public std::exception
@@ -178,7 +284,7 @@ inline void read_map_no_container(closure &c, T &themap, xmlpp::TextReader &read
 
         if(reader.get_node_type() == xmlpp::TextReader::Element)
         {
-            if(reader.get_name() == item_name)
+            if(has_name(reader, item_name.c_str()))
             {
                 const str id(reader.get_attribute("id"));
 
@@ -202,7 +308,7 @@ inline void read_map(closure &c, T &themap, xmlpp::TextReader &reader, const str
 
         if(reader.get_node_type() == xmlpp::TextReader::Element)
         {
-            if(reader.get_name() != item_name)
+            if(!has_name(reader, item_name.c_str()))
                 throw xml_error(reader, boost::str(boost::format("Found stray %s in %s container search (expected %s)") % reader.get_name() % container_name % item_name));
 
             const str id(reader.get_attribute("id"));
@@ -226,7 +332,7 @@ inline void sumo_read_map(closure &c, T &themap, xmlpp::TextReader &reader, cons
 
         if(reader.get_node_type() == xmlpp::TextReader::Element)
         {
-            if(reader.get_name() != item_name)
+            if(!has_name(reader, item_name.c_str()))
                 throw xml_error(reader, boost::str(boost::format("Found stray %s in %s container search (expected %s)") % reader.get_name() % container_name % item_name));
 
             const str id(reader.get_attribute("id"));
@@ -0,0 +1,298 @@
+#include "xml_writer.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+static const double pow10_tab[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,
+                                   1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+                                   1e20, 1e21, 1e22};
+
+// 10^k for any k; exact for |k| <= 22
+static inline double pow10d(const int k)
+{
+    if(k >= 0)
+        return k <= 22 ? pow10_tab[k] : std::pow(10.0, k);
+    return k >= -22 ? 1.0/pow10_tab[-k] : std::pow(10.0, k);
+}
+
+// digits*10^scale, rounded once
+static inline double scale10(const double digits, const int scale)
+{
+    if(scale >= 0)
+        return scale <= 22 ? digits*pow10_tab[scale] : digits*std::pow(10.0, scale);
+    return scale >= -22 ? digits/pow10_tab[-scale] : digits*std::pow(10.0, scale);
+}
+
+size_t format_float(char *buf, float v)
+{
+    if(!xisfinite(v))
+        return std::sprintf(buf, "%g", v);
+
+    char *p = buf;
+    if(std::signbit(v))
+    {
+        *p++ = '-';
+        v    = -v;
+    }
+    if(v == 0.0f)
+    {
+        *p++ = '0';
+        return p - buf;
+    }
+
+    // e is the decimal exponent of the leading digit
+    const double dv = v;
+    int          e  = static_cast<int>(std::floor(std::log10(dv)));
+    if(dv >= pow10d(e+1))
+        ++e;
+    else if(dv < pow10d(e))
+        --e;
+
+    // Fewest digits that round-trip; float never needs more than 9. A carry into the next power of ten
+    // only bumps the exponent for the digit count it happened at.
+    const int          lead   = e;
+    unsigned long long digits = 0;
+    int                nd;
+    for(nd = 1; nd <= 9; ++nd)
+    {
+        e      = lead;
+        digits = static_cast<unsigned long long>(std::floor(scale10(dv, nd-1-e) + 0.5));
+        if(digits >= static_cast<unsigned long long>(pow10_tab[nd]))
+        {
+            // rounded up to the next power of ten
+            digits /= 10;
+            ++e;
+        }
+        if(static_cast<float>(scale10(static_cast<double>(digits), e-nd+1)) == v)
+            break;
+    }
+    if(nd > 9)
+        nd = 9;
+
+    char ds[10];
+    for(int i = nd-1; i >= 0; --i)
+    {
+        ds[i]   = '0' + digits % 10;
+        digits /= 10;
+    }
+    while(nd > 1 && ds[nd-1] == '0')
+        --nd;
+
+    if(e >= 0 && e < 9)
+    {
+        for(int i = 0; i <= e; ++i)
+            *p++ = i < nd ? ds[i] : '0';
+        if(nd > e+1)
+        {
+            *p++ = '.';
+            for(int i = e+1; i < nd; ++i)
+                *p++ = ds[i];
+        }
+    }
+    else if(e < 0 && e >= -5)
+    {
+        *p++ = '0';
+        *p++ = '.';
+        for(int i = -1; i > e; --i)
+            *p++ = '0';
+        for(int i = 0; i < nd; ++i)
+            *p++ = ds[i];
+    }
+    else
+    {
+        *p++ = ds[0];
+        if(nd > 1)
+        {
+            *p++ = '.';
+            for(int i = 1; i < nd; ++i)
+                *p++ = ds[i];
+        }
+        p += std::sprintf(p, "e%d", e);
+    }
+
+    return p - buf;
+}
+
+xml_writer::xml_writer(std::ostream &o) : out(o), base(0), in_tag(false)
+{
+    out << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n";
+}
+
+xml_writer::xml_writer(std::ostream &o, const size_t depth) : out(o), base(depth), in_tag(false)
+{
+    // Stand-ins for the enclosing elements; they only set the indentation
+    level l;
+    l.children  = true;
+    l.formatted = true;
+    open.resize(depth, l);
+}
+
+xml_writer::~xml_writer()
+{
+    finish();
+}
+
+void xml_writer::indent()
+{
+    if(open.empty() || open.back().formatted)
+        for(size_t i = 0; i < open.size(); ++i)
+            out.write("  ", 2);
+}
+
+void xml_writer::close_tag(const bool for_text)
+{
+    if(open.empty())
+        return;
+
+    level &top = open.back();
+    if(in_tag)
+    {
+        out.put('>');
+        in_tag = false;
+        if(for_text)
+            top.formatted = false;
+        else if(top.formatted)
+            out.put('\n');
+    }
+    top.children = true;
+}
+
+void xml_writer::start(const char *name)
+{
+    close_tag(false);
+    indent();
+    out.put('<');
+    out << name;
+
+    level l;
+    l.name      = name;
+    l.children  = false;
+    l.formatted = open.empty() || open.back().formatted;
+    open.push_back(l);
+    in_tag = true;
+}
+
+void xml_writer::escaped(const char *s, const size_t len, const bool attr)
+{
+    const char *run = s;
+    for(const char *c = s; c != s + len; ++c)
+    {
+        const char *rep = 0;
+        switch(*c)
+        {
+        case '&':  rep = "&amp;";                 break;
+        case '<':  rep = "&lt;";                  break;
+        case '>':  rep = "&gt;";                  break;
+        case '\r': rep = "&#13;";                 break;
+        case '"':  rep = attr ? "&quot;" : 0;     break;
+        case '\n': rep = attr ? "&#10;"  : 0;     break;
+        case '\t': rep = attr ? "&#9;"   : 0;     break;
+        default:                                  break;
+        }
+        if(rep)
+        {
+            out.write(run, c - run);
+            out << rep;
+            run = c + 1;
+        }
+    }
+    out.write(run, s + len - run);
+}
+
+void xml_writer::attribute(const char *name, const char *value)
+{
+    assert(in_tag);
+    out.put(' ');
+    out << name;
+    out.write("=\"", 2);
+    escaped(value, std::strlen(value), true);
+    out.put('"');
+}
+
+void xml_writer::attribute(const char *name, const str &value)
+{
+    assert(in_tag);
+    out.put(' ');
+    out << name;
+    out.write("=\"", 2);
+    escaped(value.raw().data(), value.raw().size(), true);
+    out.put('"');
+}
+
+void xml_writer::attribute(const char *name, const float value)
+{
+    char         buf[32];
+    const size_t len = format_float(buf, value);
+    buf[len] = 0;
+    attribute(name, buf);
+}
+
+void xml_writer::attribute(const char *name, const int value)
+{
+    char buf[32];
+    std::sprintf(buf, "%d", value);
+    attribute(name, buf);
+}
+
+void xml_writer::attribute(const char *name, const size_t value)
+{
+    char buf[32];
+    std::sprintf(buf, "%lu", static_cast<unsigned long>(value));
+    attribute(name, buf);
+}
+
+void xml_writer::text(const char *s)
+{
+    close_tag(true);
+    escaped(s, std::strlen(s), false);
+}
+
+void xml_writer::text(const float value)
+{
+    close_tag(true);
+    char buf[32];
+    out.write(buf, format_float(buf, value));
+}
+
+void xml_writer::end()
+{
+    assert(!open.empty());
+    const level top(open.back());
+    if(in_tag)
+    {
+        out.write("/>", 2);
+        in_tag = false;
+    }
+    else
+    {
+        if(top.formatted)
+        {
+            open.pop_back();
+            indent();
+            open.push_back(top);
+        }
+        out.write("</", 2);
+        out << top.name;
+        out.put('>');
+    }
+    open.pop_back();
+
+    if(open.empty() || open.back().formatted)
+        out.put('\n');
+}
+
+void xml_writer::finish()
+{
+    while(open.size() > base)
+        end();
+    out.flush();
+}
+
+void xml_writer::copy(std::istream &in)
+{
+    if(in.peek() == std::char_traits<char>::eof())
+        return;
+
+    close_tag(false);
+    out << in.rdbuf();
+}
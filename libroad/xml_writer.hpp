@@ -0,0 +1,49 @@
+#ifndef _XML_WRITER_HPP_
+#define _XML_WRITER_HPP_
+
+#include "libroad_common.hpp"
+
+// Shortest decimal representation that reads back as exactly v.
+// buf must hold at least 32 characters; returns the number written (no terminator).
+size_t format_float(char *buf, float v);
+
+// Streaming XML output, laid out the way xmlpp::Document::write_to_stream_formatted does it.
+// Only the names of the open elements are kept, so memory use doesn't grow with the document.
+// Elements that get text aren't indented inside, as with libxml2.
+struct xml_writer
+{
+    xml_writer(std::ostream &o);
+    // A fragment to be copied into another document where depth elements are open; no declaration is written
+    xml_writer(std::ostream &o, size_t depth);
+    ~xml_writer();
+
+    void start    (const char *name);
+    void attribute(const char *name, const str &value);
+    void attribute(const char *name, const char *value);
+    void attribute(const char *name, float value);
+    void attribute(const char *name, int value);
+    void attribute(const char *name, size_t value);
+    void text     (const char *s);
+    void text     (float value);
+    void end      ();
+    void finish   ();
+    // Copies in already-written content, such as a fragment, as children of the open element
+    void copy     (std::istream &in);
+
+    void close_tag(bool for_text);
+    void indent   ();
+    void escaped  (const char *s, size_t len, bool attr);
+
+    struct level
+    {
+        std::string name;
+        bool        children;
+        bool        formatted;
+    };
+
+    std::ostream       &out;
+    std::vector<level>  open;
+    size_t              base;
+    bool                in_tag;
+};
+#endif
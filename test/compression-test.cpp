@@ -0,0 +1,176 @@
+#include <libroad/compression.hpp>
+#include <libroad/hwm_network.hpp>
+#include "timer.hpp"
+#include <iostream>
+#include <unistd.h>
+
+static std::string slurp(std::istream &in)
+{
+    return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+// Writes data with c, reads it back with decompressing_istream and, for gzip codecs, with a plain gzip_decompressor
+static int round_trip(const std::string &data, const compression &c, const str &base, const bool report)
+{
+    static const char *names[] = {"none", "gzip", "pgzip"};
+
+    int    errors = 0;
+    double start  = time_now();
+    {
+        boost::iostreams::filtering_ostream *out = compressing_ostream(base, c);
+        out->write(data.data(), data.size());
+        delete out;
+    }
+    const double write_time = time_now() - start;
+
+    const str filename(c.codec == compression::NONE ? base : str(base + ".gz"));
+    start = time_now();
+    boost::iostreams::filtering_istream *in = decompressing_istream(filename);
+    const std::string back(slurp(*in));
+    delete in;
+    const double read_time = time_now() - start;
+
+    if(back != data)
+    {
+        std::cout << names[c.codec] << ": read back " << back.size() << " bytes of " << data.size() << std::endl;
+        ++errors;
+    }
+
+    if(c.codec != compression::NONE)
+    {
+        boost::iostreams::filtering_istream plain;
+        plain.push(boost::iostreams::gzip_decompressor());
+        plain.push(boost::iostreams::file_descriptor_source(filename.raw()));
+        if(slurp(plain) != data)
+        {
+            std::cout << names[c.codec] << ": gzip_decompressor doesn't read the file back" << std::endl;
+            ++errors;
+        }
+    }
+
+    if(report)
+        std::cout << names[c.codec] << " level " << c.level << ": " << bf::file_size(filename.raw()) << " bytes, write "
+                  << write_time << " s, read " << read_time << " s" << std::endl;
+
+    unlink(filename.c_str());
+    return errors;
+}
+
+// A scene big enough to take several PARALLEL_GZIP members must read back whole
+static int scene_round_trip(const str &base, const size_t count)
+{
+    std::vector<obj_record> objs(count);
+    for(size_t i = 0; i < count; ++i)
+    {
+        objs[i].name      = boost::str(boost::format("object%d") % i);
+        objs[i].mesh_name = boost::str(boost::format("mesh%d.obj") % (i % 17));
+        for(int j = 0; j < 16; ++j)
+            objs[i].matrix.data()[j] = static_cast<float>(i + j);
+    }
+
+    const compression old(default_compression());
+    default_compression() = compression(compression::PARALLEL_GZIP);
+    xml_write_scene(base, objs);
+    default_compression() = old;
+
+    const str filename(base + ".gz");
+    int errors = 0;
+    {
+        unsigned char header[pgzip::header_bytes];
+        size_t        member_bytes = 0;
+        std::ifstream in(filename.c_str(), std::ios::binary);
+        if(!in.read(reinterpret_cast<char*>(header), sizeof(header)) || !pgzip::member_header(header, member_bytes) ||
+           member_bytes >= bf::file_size(filename.raw()))
+        {
+            std::cout << "Scene wasn't written as several members" << std::endl;
+            ++errors;
+        }
+    }
+    const std::vector<obj_record> back(xml_read_scene(filename));
+    if(back.size() != objs.size())
+    {
+        std::cout << "Read back " << back.size() << " scene objects of " << objs.size() << std::endl;
+        ++errors;
+    }
+    for(size_t i = 0; i < std::min(back.size(), objs.size()); ++i)
+    {
+        if(back[i].name != objs[i].name || back[i].mesh_name != objs[i].mesh_name || back[i].matrix(3, 3) != objs[i].matrix(3, 3))
+        {
+            std::cout << "Scene object " << i << " differs" << std::endl;
+            ++errors;
+            break;
+        }
+    }
+    unlink(filename.c_str());
+    return errors;
+}
+
+int main(int argc, char *argv[])
+{
+    std::cerr << libroad_package_string() << std::endl;
+
+    const str    base(boost::str(boost::format("%s/compression-test-%d.xml") % (argc > 1 ? argv[1] : "/tmp") % getpid()));
+    const size_t big = argc > 2 ? boost::lexical_cast<size_t>(argv[2]) : 200000;
+
+    std::string data;
+    srand48(1);
+    for(size_t i = 0; i < big; ++i)
+        data += boost::str(boost::format("<point x=\"%d\" y=\"%f\"/>\n") % (i % 997) % drand48());
+
+    const compression::codec_t codecs[] = {compression::NONE, compression::GZIP, compression::PARALLEL_GZIP};
+
+    int errors = 0;
+    try
+    {
+        BOOST_FOREACH(const compression::codec_t codec, codecs)
+        {
+            // Empty, less than a block, exactly one block, and many blocks
+            errors += round_trip(std::string(),            compression(codec, 6, 0, 1 << 16), base, false);
+            errors += round_trip(data.substr(0, 1000),     compression(codec, 6, 0, 1 << 16), base, false);
+            errors += round_trip(data.substr(0, 1 << 16),  compression(codec, 6, 0, 1 << 16), base, false);
+            errors += round_trip(data,                     compression(codec, 1, 0, 1 << 16), base, true);
+            errors += round_trip(data,                     compression(codec, 9),             base, true);
+        }
+
+        // Well over the default 1 MiB block
+        errors += scene_round_trip(base, 20000);
+
+        // Damage inside a member must be caught, not passed on
+        const str filename(base + ".gz");
+        {
+            boost::iostreams::filtering_ostream *out = compressing_ostream(base, compression(compression::PARALLEL_GZIP, 6, 0, 1 << 16));
+            out->write(data.data(), data.size());
+            delete out;
+        }
+        std::string bytes;
+        {
+            std::ifstream in(filename.c_str(), std::ios::binary);
+            bytes = slurp(in);
+        }
+        bytes[bytes.size()/2] ^= 0x55;
+        {
+            std::ofstream out(filename.c_str(), std::ios::binary);
+            out.write(bytes.data(), bytes.size());
+        }
+        boost::iostreams::filtering_istream *in = decompressing_istream(filename);
+        try
+        {
+            slurp(*in);
+            std::cout << "Corrupt member was accepted" << std::endl;
+            ++errors;
+        }
+        catch(std::runtime_error &e)
+        {
+        }
+        delete in;
+        unlink(filename.c_str());
+    }
+    catch(std::runtime_error &e)
+    {
+        std::cout << "Error: " << e.what() << std::endl;
+        ++errors;
+    }
+
+    std::cout << errors << " errors" << std::endl;
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,233 @@
+#include <libroad/hwm_diff.hpp>
+#include <libroad/profile.hpp>
+#include <iostream>
+#include <unistd.h>
+
+static str lane_id(const hwm::lane *l)
+{
+    return l ? l->id : str("none");
+}
+
+static str terminus_desc(const hwm::lane::terminus *t)
+{
+    if(const hwm::lane::intersection_terminus *it = dynamic_cast<const hwm::lane::intersection_terminus*>(t))
+        return boost::str(boost::format("intersection %s/%d") % (it->adjacent_intersection ? it->adjacent_intersection->id : str("none")) % it->intersect_in_ref);
+    if(const hwm::lane::lane_terminus *lt = dynamic_cast<const hwm::lane::lane_terminus*>(t))
+        return "lane " + lane_id(lt->adjacent_lane);
+    return "end";
+}
+
+static str memberships_desc(const hwm::lane::road_membership::intervals &rms)
+{
+    str res;
+    BOOST_FOREACH(const hwm::lane::road_membership::intervals::entry &e, rms)
+    {
+        res += boost::str(boost::format("%g:%s[%g,%g]@%g ") % e.first % (e.second.parent_road ? e.second.parent_road->id : str("none"))
+                          % e.second.interval[0] % e.second.interval[1] % e.second.lane_position);
+    }
+    return res;
+}
+
+static str adjacencies_desc(const hwm::lane::adjacency::intervals &adjs)
+{
+    str res;
+    BOOST_FOREACH(const hwm::lane::adjacency::intervals::entry &e, adjs)
+    {
+        res += boost::str(boost::format("%g:%s[%g,%g] ") % e.first % lane_id(e.second.neighbor)
+                          % e.second.neighbor_interval[0] % e.second.neighbor_interval[1]);
+    }
+    return res;
+}
+
+// Checks the lanes field by field, by id rather than by pointer, so it doesn't lean on network_diff to spot its own mistakes
+static int compare_lanes(const hwm::network &patched, const hwm::network &variant, const char *what)
+{
+    int errors = 0;
+    if(patched.lanes.size() != variant.lanes.size())
+    {
+        std::cout << what << ": " << patched.lanes.size() << " lanes, not " << variant.lanes.size() << std::endl;
+        ++errors;
+    }
+    BOOST_FOREACH(const hwm::lane_pair &vp, variant.lanes)
+    {
+        const hwm::lane_map::const_iterator found = patched.lanes.find(vp.first);
+        if(found == patched.lanes.end())
+        {
+            std::cout << what << ": lane " << vp.first << " is missing" << std::endl;
+            ++errors;
+            continue;
+        }
+        const hwm::lane &p = found->second;
+        const hwm::lane &v = vp.second;
+
+        const char *fields[] = {"memberships", "left", "right", "start", "end"};
+        const str   got[]    = {memberships_desc(p.road_memberships), adjacencies_desc(p.left), adjacencies_desc(p.right),
+                                terminus_desc(p.start), terminus_desc(p.end)};
+        const str   want[]   = {memberships_desc(v.road_memberships), adjacencies_desc(v.left), adjacencies_desc(v.right),
+                                terminus_desc(v.start), terminus_desc(v.end)};
+        for(size_t i = 0; i < sizeof(fields)/sizeof(fields[0]); ++i)
+        {
+            if(got[i] != want[i])
+            {
+                std::cout << what << ": lane " << vp.first << " " << fields[i] << " are " << got[i] << "not " << want[i] << std::endl;
+                ++errors;
+            }
+        }
+    }
+    return errors;
+}
+
+// Patches variant's differences from base to disk and back onto a copy of base, which should then match variant
+static int round_trip(const hwm::network &base, const hwm::network &variant, const str &patch_file, const char *what)
+{
+    const hwm::network_diff d(base, variant);
+    d.write(patch_file.c_str());
+
+    const double      start = profile::now();
+    hwm::network_diff read;
+    read.read(patch_file.c_str());
+    hwm::network patched(base);
+    read.apply(patched);
+    const double      apply_time = profile::now() - start;
+
+    std::ifstream in(patch_file.c_str(), std::ios::binary | std::ios::ate);
+    std::cout << what << ": " << d.removed_roads.size() + d.removed_lanes.size() + d.removed_intersections.size() << " removed, "
+              << d.roads.size() << " roads, " << d.lanes.size() << " lanes, " << d.intersections.size() << " intersections changed; "
+              << in.tellg() << " byte patch, copy and apply took " << apply_time << " s" << std::endl;
+
+    int errors = compare_lanes(patched, variant, what);
+    if(!hwm::network_diff(patched, variant).empty())
+    {
+        std::cout << what << ": patched network doesn't match the variant" << std::endl;
+        ++errors;
+    }
+    return errors;
+}
+
+int main(int argc, char *argv[])
+{
+    std::cerr << libroad_package_string() << std::endl;
+    if(argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <input network> [scratch dir]" << std::endl;
+        return 1;
+    }
+
+    const str scratch(argc > 2 ? argv[2] : "/tmp");
+    const str patch_file(boost::str(boost::format("%s/diff-test-%d.hwmp") % scratch % getpid()));
+
+    int errors = 0;
+    try
+    {
+        const double       start = profile::now();
+        const hwm::network base(hwm::load_xml_network(argv[1]));
+        std::cout << "XML load: " << profile::now() - start << " s" << std::endl;
+
+        if(!hwm::network_diff(base, base).empty())
+        {
+            std::cout << "A network differs from itself" << std::endl;
+            ++errors;
+        }
+
+        // Move a road, slow a lane, retime a signal and add a road
+        hwm::network variant(base);
+        BOOST_FOREACH(hwm::road_pair &rp, variant.roads)
+        {
+            std::vector<vec3f> points(rp.second.rep.points_);
+            if(points.size() < 3)
+                continue;
+            points[points.size()/2][0] += 0.5f;
+            if(variant.set_road_points(rp.first, points, 0.7f))
+                break;
+        }
+        if(!variant.lanes.empty())
+            variant.lanes.begin()->second.speedlimit *= 0.5f;
+        BOOST_FOREACH(hwm::intersection_pair &ip, variant.intersections)
+        {
+            if(!ip.second.states.empty())
+            {
+                ip.second.states[0].duration += 5.0f;
+                break;
+            }
+        }
+        if(!variant.roads.empty())
+        {
+            hwm::road r(variant.roads.begin()->second);
+            r.id = "diff-test-road";
+            variant.roads.insert(std::make_pair(r.id, r));
+        }
+
+        errors += round_trip(base, variant, patch_file, "Edits");
+        errors += round_trip(variant, base, patch_file, "Undo");
+
+        // Move half a lane onto another road and give it new neighbours, so the patch has to rebuild several
+        // memberships and adjacencies
+        hwm::network rewired(base);
+        if(rewired.roads.size() > 1 && rewired.lanes.size() > 2)
+        {
+            hwm::lane_map::iterator moved    = rewired.lanes.begin();
+            hwm::lane_map::iterator neighbor = boost::next(moved);
+            hwm::lane_map::iterator other    = boost::next(neighbor);
+
+            hwm::lane::road_membership rm(moved->second.road_memberships.begin()->second);
+            hwm::road_map::iterator    target = rewired.roads.begin();
+            if(target->second.id == rm.parent_road->id)
+                ++target;
+            hwm::lane::road_membership first(rm);
+            first.parent_road   = &(target->second);
+            first.interval      = vec2f(0.0f, 0.5f);
+            first.lane_position = -1.0f;
+            hwm::lane::road_membership second(rm);
+            second.interval[0] = 0.5f*(rm.interval[0] + rm.interval[1]);
+            moved->second.road_memberships.clear();
+            moved->second.road_memberships.insert(0.0f, first);
+            moved->second.road_memberships.insert(0.5f, second);
+
+            hwm::lane::adjacency adj;
+            adj.neighbor          = &(neighbor->second);
+            adj.neighbor_interval = vec2f(0.25f, 0.75f);
+            hwm::lane::adjacency none;
+            none.neighbor          = 0;
+            none.neighbor_interval = vec2f(0.0f, 1.0f);
+            moved->second.left.clear();
+            moved->second.left.insert(0.0f, adj);
+            moved->second.left.insert(0.5f, none);
+            adj.neighbor          = &(other->second);
+            adj.neighbor_interval = vec2f(0.0f, 1.0f);
+            moved->second.right.clear();
+            moved->second.right.insert(0.0f, none);
+            moved->second.right.insert(0.3f, adj);
+
+            errors += round_trip(base, rewired, patch_file, "Rewired");
+            errors += round_trip(rewired, base, patch_file, "Unwired");
+        }
+
+        // Corrupt files must be rejected, not trusted
+        {
+            std::ifstream      in(patch_file.c_str(), std::ios::binary);
+            const std::string  b((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            std::ofstream      bad(patch_file.c_str(), std::ios::binary | std::ios::trunc);
+            bad.write(b.data(), b.size()/2);
+        }
+        try
+        {
+            hwm::network_diff d;
+            d.read(patch_file.c_str());
+            std::cout << "Truncated patch was accepted" << std::endl;
+            ++errors;
+        }
+        catch(std::runtime_error &e)
+        {
+        }
+    }
+    catch(std::runtime_error &e)
+    {
+        std::cout << "Error: " << e.what() << std::endl;
+        ++errors;
+    }
+
+    unlink(patch_file.c_str());
+
+    std::cout << errors << " errors" << std::endl;
+    return errors != 0;
+}
@@ -0,0 +1,356 @@
+#include <libroad/hwm_network.hpp>
+#include <libroad/profile.hpp>
+#include <iostream>
+#include <unistd.h>
+
+static size_t live_items(const std::vector<hwm::network_aux::road_spatial::entry> &items)
+{
+    size_t res = 0;
+    BOOST_FOREACH(const hwm::network_aux::road_spatial::entry &e, items)
+    {
+        if(e.lc)
+            ++res;
+    }
+    return res;
+}
+
+static size_t live_items(const std::vector<hwm::network_aux::lane_spatial::entry> &items)
+{
+    size_t res = 0;
+    BOOST_FOREACH(const hwm::network_aux::lane_spatial::entry &e, items)
+    {
+        if(e.lane)
+            ++res;
+    }
+    return res;
+}
+
+static str node_name(const int x, const int y)
+{
+    return boost::str(boost::format("n%d_%d") % x % y);
+}
+
+static void add_edge(sumo::network &snet, const str &from, const str &to)
+{
+    sumo::edge &e = snet.edges[from + "-" + to];
+    e.id     = from + "-" + to;
+    e.from   = &(snet.nodes[from]);
+    e.to     = &(snet.nodes[to]);
+    e.type   = &(snet.types["street"]);
+    e.spread = sumo::edge::right;
+
+    // A bend halfway, so every road has an interior point to move
+    const vec2d mid(0.5*(e.from->xy + e.to->xy));
+    const vec2d along(e.to->xy - e.from->xy);
+    e.shape.push_back(vec2d(mid[0] - 0.05*along[1], mid[1] + 0.05*along[0]));
+}
+
+// A grid of two-way, one-lane streets, with a connection from each street into every other at each junction
+static sumo::network make_grid(const int grid, const double spacing)
+{
+    sumo::network snet;
+
+    sumo::edge_type &et = snet.types["street"];
+    et.id       = "street";
+    et.nolanes  = 1;
+    et.speed    = 13.9;
+    et.priority = 1;
+    et.length   = 0.0;
+
+    for(int y = 0; y < grid; ++y)
+        for(int x = 0; x < grid; ++x)
+        {
+            sumo::node &n = snet.nodes[node_name(x, y)];
+            n.id   = node_name(x, y);
+            n.xy   = vec2d(x*spacing, y*spacing);
+            n.type = sumo::node::priority;
+        }
+
+    for(int y = 0; y < grid; ++y)
+        for(int x = 0; x < grid; ++x)
+        {
+            if(x + 1 < grid)
+            {
+                add_edge(snet, node_name(x, y), node_name(x + 1, y));
+                add_edge(snet, node_name(x + 1, y), node_name(x, y));
+            }
+            if(y + 1 < grid)
+            {
+                add_edge(snet, node_name(x, y), node_name(x, y + 1));
+                add_edge(snet, node_name(x, y + 1), node_name(x, y));
+            }
+        }
+
+    typedef strhash<sumo::edge>::type::value_type edge_pair;
+    BOOST_FOREACH(edge_pair &in, snet.edges)
+    {
+        BOOST_FOREACH(edge_pair &out, snet.edges)
+        {
+            if(out.second.from != in.second.to || out.second.to == in.second.from)
+                continue;
+            const sumo::connection c = {&(in.second), &(out.second), 0, 0, "", -1};
+            snet.connections.push_back(c);
+        }
+    }
+    return snet;
+}
+
+// Brings aux up to date, timing it, and checks that the edits were taken
+static int update(hwm::network &net, hwm::network_aux &aux, double &updates)
+{
+    const double start = profile::now();
+    aux.update();
+    updates += profile::now() - start;
+
+    if(!net.edits.empty())
+    {
+        std::cout << "Edits weren't cleared" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    std::cerr << libroad_package_string() << std::endl;
+
+    const int   grid       = argc > 1 ? boost::lexical_cast<int>(argv[1]) : 8;
+    const int   nedits     = argc > 2 ? boost::lexical_cast<int>(argv[2]) : 20;
+    const str   xml_name(boost::str(boost::format("%s/edit-test-%d.hwm.gz") % (argc > 3 ? argv[3] : "/tmp") % getpid()));
+    const float lane_width = 3.2f;
+
+    int    errors  = 0;
+    double updates = 0.0;
+    try
+    {
+        const sumo::network snet(make_grid(grid, 100.0));
+        hwm::network        net(hwm::from_sumo("edit-test", 0.5f, lane_width, snet));
+        net.build_intersections();
+        net.build_fictitious_lanes();
+
+        hwm::network_aux aux(net);
+
+        std::vector<str> ids;
+        BOOST_FOREACH(const hwm::road_pair &rp, net.roads)
+        {
+            if(rp.second.rep.points_.size() > 2)
+                ids.push_back(rp.first);
+        }
+        if(ids.empty())
+            throw std::runtime_error("No road with an interior point to move");
+
+        // Nudge an interior point of some roads sideways
+        for(int i = 0; i < nedits; ++i)
+        {
+            const str         &id(ids[(i*7919) % ids.size()]);
+            const hwm::road   &r(net.roads[id]);
+            const size_t       pt = r.rep.points_.size()/2;
+            const vec3f        p(r.rep.points_[pt] + vec3f(0.25f, 0.25f, 0.0f));
+            if(net.move_road_point(id, pt, p, lane_width))
+                errors += update(net, aux, updates);
+        }
+
+        // Give a road a new control polygon. Points closer than a lane width are culled, as from_sumo culled them,
+        // so the extra point next to the start doesn't survive the fit.
+        {
+            const str         &id(ids.front());
+            const hwm::road   &r(net.roads[id]);
+            const vec3f        a(r.rep.points_.front());
+            const vec3f        b(r.rep.points_.back());
+            const vec3f        dir(tvmet::normalize(b - a));
+            const vec3f        side(-dir[1], dir[0], 0.0f);
+            std::vector<vec3f> points;
+            points.push_back(a);
+            points.push_back(a + 0.1f*lane_width*dir);
+            points.push_back(a + 0.3f*(b - a) + 8.0f*side);
+            points.push_back(a + 0.7f*(b - a));
+            points.push_back(b);
+            if(!net.set_road_points(id, points, lane_width))
+            {
+                std::cout << "Couldn't give road " << id << " new points" << std::endl;
+                ++errors;
+            }
+            else if(r.rep.points_.size() != points.size() - 1)
+            {
+                std::cout << "Road " << id << " kept " << r.rep.points_.size() << " of " << points.size() << " points, not "
+                          << points.size() - 1 << std::endl;
+                ++errors;
+            }
+            errors += update(net, aux, updates);
+
+            // Points on top of each other can't be fitted; the road stays as it was and nothing is recorded
+            const std::vector<vec3f> before(r.rep.points_);
+            bool                     same = !net.set_road_points(id, std::vector<vec3f>(3, a), lane_width) && r.rep.points_.size() == before.size();
+            for(size_t i = 0; same && i < before.size(); ++i)
+                same = distance2(r.rep.points_[i], before[i]) == 0.0f;
+            if(!same || !net.edits.empty())
+            {
+                std::cout << "A failed fit changed road " << id << std::endl;
+                ++errors;
+            }
+        }
+
+        // Move a lane a lane width further from its road's centre
+        {
+            hwm::lane                             &l(net.lanes.begin()->second);
+            hwm::lane::road_membership::intervals  moved(l.road_memberships);
+            moved.begin()->second.lane_position -= lane_width;
+            net.set_lane_memberships(l.id, moved);
+            if(!net.edits.lanes.count(l.id) || !net.edits.roads.count(moved.begin()->second.parent_road->id))
+            {
+                std::cout << "Moving lane " << l.id << " wasn't recorded" << std::endl;
+                ++errors;
+            }
+            errors += update(net, aux, updates);
+
+            hwm::road                             stray;
+            hwm::lane::road_membership::intervals bad(moved);
+            bad.begin()->second.parent_road = &stray;
+            try
+            {
+                net.set_lane_memberships(l.id, bad);
+                std::cout << "A lane was put on a road outside the network" << std::endl;
+                ++errors;
+            }
+            catch(std::runtime_error &e)
+            {
+            }
+        }
+
+        // Give a junction one state per movement, in place of the ones it was made with
+        {
+            hwm::intersection_map::iterator busiest = net.intersections.begin();
+            for(hwm::intersection_map::iterator it = net.intersections.begin(); it != net.intersections.end(); ++it)
+            {
+                if(it->second.incoming.size() > busiest->second.incoming.size())
+                    busiest = it;
+            }
+            hwm::intersection &is(busiest->second);
+
+            std::vector<hwm::intersection::state> states;
+            BOOST_FOREACH(const hwm::intersection::state &s, is.states)
+            {
+                BOOST_FOREACH(const hwm::intersection::state::state_pair &sp, s.in_pair())
+                {
+                    hwm::intersection::state one;
+                    one.duration = 10.0f;
+                    one.state_pairs.insert(hwm::intersection::state::state_pair(sp.in_idx, sp.out_idx));
+                    states.push_back(one);
+                }
+            }
+            const size_t movements = is.fict_lanes.size();
+            net.set_intersection_states(is.id, states);
+            errors += update(net, aux, updates);
+
+            if(is.states.size() != states.size() || is.fict_lanes.size() != movements || is.current_state != 0)
+            {
+                std::cout << "Intersection " << is.id << " has " << is.states.size() << " states and " << is.fict_lanes.size()
+                          << " fictitious lanes, not " << states.size() << " and " << movements << std::endl;
+                ++errors;
+            }
+            for(size_t i = 0; i <= is.states.size(); ++i)
+            {
+                try
+                {
+                    is.check();
+                }
+                catch(std::runtime_error &e)
+                {
+                    std::cout << "In state " << is.current_state << ": " << e.what() << std::endl;
+                    ++errors;
+                }
+                is.advance_state();
+            }
+
+            std::vector<hwm::intersection::state> bad(1);
+            bad[0].duration = 10.0f;
+            bad[0].state_pairs.insert(hwm::intersection::state::state_pair(static_cast<int>(is.incoming.size()), 0));
+            try
+            {
+                net.set_intersection_states(is.id, bad);
+                std::cout << "A state with a lane the intersection doesn't have was taken" << std::endl;
+                ++errors;
+            }
+            catch(std::runtime_error &e)
+            {
+            }
+        }
+
+        const double           start = profile::now();
+        const hwm::network_aux fresh(net);
+        const double           rebuild = profile::now() - start;
+        std::cout << "Updates took " << updates << "s; one full rebuild took " << rebuild << "s" << std::endl;
+
+        if(live_items(aux.road_space.items) != fresh.road_space.items.size() ||
+           live_items(aux.lane_space.items) != fresh.lane_space.items.size())
+        {
+            std::cout << "Updated spatial indices don't have the same leaves as rebuilt ones" << std::endl;
+            ++errors;
+        }
+
+        // Every road's own box should find the same leaves in both
+        BOOST_FOREACH(const hwm::road_pair &rp, net.roads)
+        {
+            const aabb2d box(rp.second.rep.planar_bounding_box(0.0f, vec2f(0.0f, 1.0f)));
+            if(aux.road_space.query(box).size() != fresh.road_space.query(box).size() ||
+               aux.lane_space.query(box).size() != fresh.lane_space.query(box).size())
+            {
+                std::cout << "Queries around road " << rp.first << " differ" << std::endl;
+                ++errors;
+            }
+        }
+
+        net.check();
+
+        // A road loaded from XML was fitted with the loader's 0.7 culling, so points half a lane width apart are
+        // its own; moving one of them, at the distance it was fitted with, has to keep them all
+        {
+            const str         &id(ids.back());
+            hwm::network       written(net);
+            const hwm::road   &r(written.roads[id]);
+            const vec3f        a(r.rep.points_.front());
+            const vec3f        b(r.rep.points_.back());
+            const vec3f        dir(tvmet::normalize(b - a));
+            const vec3f        side(-dir[1], dir[0], 0.0f);
+            std::vector<vec3f> points;
+            points.push_back(a);
+            points.push_back(a + 0.5f*lane_width*dir);
+            points.push_back(a + 0.3f*(b - a) + 8.0f*side);
+            points.push_back(a + 0.7f*(b - a));
+            points.push_back(b);
+            if(!written.set_road_points(id, points, 0.7f))
+                throw std::runtime_error("Couldn't give road " + id + " closely spaced points");
+            written.xml_write(xml_name.c_str());
+
+            hwm::network     loaded(hwm::load_xml_network(xml_name.c_str()));
+            const hwm::road &lr(loaded.roads[id]);
+            const size_t     kept = lr.rep.points_.size();
+            if(kept != points.size())
+            {
+                std::cout << "Loading road " << id << " kept " << kept << " of " << points.size() << " points" << std::endl;
+                ++errors;
+            }
+            else if(!loaded.move_road_point(id, 2, lr.rep.points_[2] + vec3f(0.25f, 0.25f, 0.0f), 0.7f))
+            {
+                std::cout << "Couldn't move a point of loaded road " << id << std::endl;
+                ++errors;
+            }
+            else if(lr.rep.points_.size() != kept)
+            {
+                std::cout << "Moving a point of loaded road " << id << " left " << lr.rep.points_.size() << " of " << kept
+                          << " points" << std::endl;
+                ++errors;
+            }
+        }
+    }
+    catch(std::runtime_error &e)
+    {
+        std::cout << "Error: " << e.what() << std::endl;
+        ++errors;
+    }
+
+    unlink(xml_name.c_str());
+
+    std::cout << errors << " errors" << std::endl;
+    return errors != 0;
+}
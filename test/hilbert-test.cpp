@@ -0,0 +1,249 @@
+#include "libroad/hilbert.hpp"
+#include "timer.hpp"
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+
+static size_t random_bits(const size_t n)
+{
+    const size_t r = (static_cast<size_t>(lrand48()) << 31) ^ static_cast<size_t>(lrand48());
+    return n >= 64 ? r : r & ((1ULL << n) - 1);
+}
+
+static size_t naive_morton(const size_t *c, const size_t dim, const size_t n)
+{
+    size_t m = 0;
+    for(size_t b = 0; b < n; ++b)
+        for(size_t d = 0; d < dim; ++d)
+            m |= ((c[d] >> b) & 1) << (b*dim + d);
+    return m;
+}
+
+static int check_hilbert2()
+{
+    int errors = 0;
+    for(size_t n = 1; n <= 6; ++n)
+        for(size_t x = 0; x < (1U << n); ++x)
+            for(size_t y = 0; y < (1U << n); ++y)
+            {
+                const size_t z = hilbert::encode2(x, y, n);
+                if(z != hilbert::order_num(x, y, n))
+                {
+                    std::cout << "encode2(" << x << ", " << y << ", " << n << ") = " << z << " != " << hilbert::order_num(x, y, n) << std::endl;
+                    ++errors;
+                }
+                size_t dx, dy;
+                hilbert::decode2(dx, dy, z, n);
+                if(dx != x || dy != y)
+                {
+                    std::cout << "decode2(" << z << ", " << n << ") = (" << dx << ", " << dy << ") != (" << x << ", " << y << ")" << std::endl;
+                    ++errors;
+                }
+            }
+
+    for(size_t n = 7; n <= 32; ++n)
+        for(int i = 0; i < 100000; ++i)
+        {
+            const size_t x = random_bits(n);
+            const size_t y = random_bits(n);
+            const size_t z = hilbert::encode2(x, y, n);
+            if(z != hilbert::order_num(x, y, n))
+            {
+                std::cout << "encode2(" << x << ", " << y << ", " << n << ") = " << z << " != " << hilbert::order_num(x, y, n) << std::endl;
+                ++errors;
+            }
+            size_t dx, dy;
+            hilbert::decode2(dx, dy, z, n);
+            if(dx != x || dy != y)
+            {
+                std::cout << "decode2(" << z << ", " << n << ") = (" << dx << ", " << dy << ") != (" << x << ", " << y << ")" << std::endl;
+                ++errors;
+            }
+        }
+
+    for(int i = 0; i < 100000; ++i)
+    {
+        const float x = drand48();
+        const float y = drand48();
+        const size_t ref = hilbert::order_num(static_cast<size_t>(std::floor(x*((1LL << 24)-1))), static_cast<size_t>(std::floor(y*((1LL << 24)-1))), 24);
+        if(hilbert::order(x, y) != ref)
+        {
+            std::cout << "order(" << x << ", " << y << ") = " << hilbert::order(x, y) << " != " << ref << std::endl;
+            ++errors;
+        }
+    }
+
+    return errors;
+}
+
+static int check_hilbert3()
+{
+    int errors = 0;
+    // Every cell visited once, and successive keys are face neighbors
+    for(size_t n = 1; n <= 5; ++n)
+    {
+        const size_t      ncells = 1ULL << (3*n);
+        std::vector<bool> seen(ncells, false);
+        size_t            px = 0, py = 0, pz = 0;
+        for(size_t h = 0; h < ncells; ++h)
+        {
+            size_t x, y, z;
+            hilbert::decode3(x, y, z, h, n);
+            const size_t cell = (x << (2*n)) | (y << n) | z;
+            if(seen[cell])
+            {
+                std::cout << "decode3(" << h << ", " << n << ") revisits (" << x << ", " << y << ", " << z << ")" << std::endl;
+                ++errors;
+            }
+            seen[cell] = true;
+
+            if(hilbert::encode3(x, y, z, n) != h)
+            {
+                std::cout << "encode3(" << x << ", " << y << ", " << z << ", " << n << ") = " << hilbert::encode3(x, y, z, n) << " != " << h << std::endl;
+                ++errors;
+            }
+
+            if(h > 0)
+            {
+                const size_t step = (x > px ? x - px : px - x) + (y > py ? y - py : py - y) + (z > pz ? z - pz : pz - z);
+                if(step != 1)
+                {
+                    std::cout << "keys " << h-1 << " and " << h << " (n = " << n << ") are " << step << " apart" << std::endl;
+                    ++errors;
+                }
+            }
+            px = x;
+            py = y;
+            pz = z;
+        }
+    }
+
+    for(int i = 0; i < 100000; ++i)
+    {
+        const size_t x = random_bits(21);
+        const size_t y = random_bits(21);
+        const size_t z = random_bits(21);
+        size_t dx, dy, dz;
+        hilbert::decode3(dx, dy, dz, hilbert::encode3(x, y, z, 21), 21);
+        if(dx != x || dy != y || dz != z)
+        {
+            std::cout << "decode3(encode3(" << x << ", " << y << ", " << z << ")) failed" << std::endl;
+            ++errors;
+        }
+    }
+
+    return errors;
+}
+
+static int check_morton()
+{
+    int errors = 0;
+    for(int i = 0; i < 100000; ++i)
+    {
+        const size_t c2[2] = {random_bits(32), random_bits(32)};
+        const size_t m2    = morton::encode2(c2[0], c2[1]);
+        if(m2 != naive_morton(c2, 2, 32))
+        {
+            std::cout << "morton::encode2(" << c2[0] << ", " << c2[1] << ") = " << m2 << " != " << naive_morton(c2, 2, 32) << std::endl;
+            ++errors;
+        }
+        size_t x, y;
+        morton::decode2(x, y, m2);
+        if(x != c2[0] || y != c2[1])
+        {
+            std::cout << "morton::decode2(" << m2 << ") failed" << std::endl;
+            ++errors;
+        }
+
+        const size_t c3[3] = {random_bits(21), random_bits(21), random_bits(21)};
+        const size_t m3    = morton::encode3(c3[0], c3[1], c3[2]);
+        if(m3 != naive_morton(c3, 3, 21))
+        {
+            std::cout << "morton::encode3(" << c3[0] << ", " << c3[1] << ", " << c3[2] << ") = " << m3 << " != " << naive_morton(c3, 3, 21) << std::endl;
+            ++errors;
+        }
+        size_t z;
+        morton::decode3(x, y, z, m3);
+        if(x != c3[0] || y != c3[1] || z != c3[2])
+        {
+            std::cout << "morton::decode3(" << m3 << ") failed" << std::endl;
+            ++errors;
+        }
+    }
+    return errors;
+}
+
+static void benchmark(const size_t npoints)
+{
+    std::vector<size_t> xs(npoints);
+    std::vector<size_t> ys(npoints);
+    std::vector<size_t> zs(npoints);
+    for(size_t i = 0; i < npoints; ++i)
+    {
+        xs[i] = random_bits(21);
+        ys[i] = random_bits(21);
+        zs[i] = random_bits(21);
+    }
+
+    size_t sink = 0;
+    double start;
+
+    start = time_now();
+    for(size_t i = 0; i < npoints; ++i)
+        sink ^= hilbert::order_num(xs[i], ys[i], 21);
+    const double t_order_num = time_now() - start;
+
+    start = time_now();
+    for(size_t i = 0; i < npoints; ++i)
+        sink ^= hilbert::encode2(xs[i], ys[i], 21);
+    const double t_encode2 = time_now() - start;
+
+    start = time_now();
+    for(size_t i = 0; i < npoints; ++i)
+    {
+        size_t x, y;
+        hilbert::decode2(x, y, xs[i], 21);
+        sink ^= x ^ y;
+    }
+    const double t_decode2 = time_now() - start;
+
+    start = time_now();
+    for(size_t i = 0; i < npoints; ++i)
+        sink ^= hilbert::encode3(xs[i], ys[i], zs[i], 21);
+    const double t_encode3 = time_now() - start;
+
+    start = time_now();
+    for(size_t i = 0; i < npoints; ++i)
+        sink ^= morton::encode2(xs[i], ys[i]);
+    const double t_morton2 = time_now() - start;
+
+    start = time_now();
+    for(size_t i = 0; i < npoints; ++i)
+        sink ^= morton::encode3(xs[i], ys[i], zs[i]);
+    const double t_morton3 = time_now() - start;
+
+    std::cout << "Benchmark over " << npoints << " points (checksum " << sink << ")" << std::endl;
+    std::cout << "hilbert::order_num: " << 1e9*t_order_num/npoints << " ns/key" << std::endl;
+    std::cout << "hilbert::encode2:   " << 1e9*t_encode2/npoints   << " ns/key (" << t_order_num/t_encode2 << "x)" << std::endl;
+    std::cout << "hilbert::decode2:   " << 1e9*t_decode2/npoints   << " ns/key" << std::endl;
+    std::cout << "hilbert::encode3:   " << 1e9*t_encode3/npoints   << " ns/key" << std::endl;
+    std::cout << "morton::encode2:    " << 1e9*t_morton2/npoints   << " ns/key" << std::endl;
+    std::cout << "morton::encode3:    " << 1e9*t_morton3/npoints   << " ns/key" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    std::cerr << libroad_package_string() << std::endl;
+
+    srand48(argc > 2 ? atol(argv[2]) : 0);
+
+    int errors = 0;
+    errors += check_hilbert2();
+    errors += check_hilbert3();
+    errors += check_morton();
+    std::cout << errors << " errors" << std::endl;
+
+    benchmark(argc > 1 ? atol(argv[1]) : (1 << 22));
+
+    return errors ? 1 : 0;
+}
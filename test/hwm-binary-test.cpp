@@ -0,0 +1,262 @@
+#include <libroad/hwm_network.hpp>
+#include <libroad/hwm_binary.hpp>
+#include "timer.hpp"
+#include <iostream>
+#include <unistd.h>
+
+#include <boost/foreach.hpp>
+
+static bool close_enough(const float a, const float b, const float tol)
+{
+    return std::abs(a - b) <= tol*std::max(1.0f, std::max(std::abs(a), std::abs(b)));
+}
+
+template <class V>
+static bool vectors_equal(const std::vector<V> &a, const std::vector<V> &b, const size_t width, const float tol)
+{
+    if(a.size() != b.size())
+        return false;
+    for(size_t i = 0; i < a.size(); ++i)
+        for(size_t d = 0; d < width; ++d)
+            if(!close_enough(a[i][d], b[i][d], tol))
+                return false;
+    return true;
+}
+
+static bool floats_equal(const std::vector<float> &a, const std::vector<float> &b, const float tol)
+{
+    if(a.size() != b.size())
+        return false;
+    for(size_t i = 0; i < a.size(); ++i)
+        if(!close_enough(a[i], b[i], tol))
+            return false;
+    return true;
+}
+
+static bool frames_equal(const std::vector<mat4x4f> &a, const std::vector<mat4x4f> &b, const float tol)
+{
+    if(a.size() != b.size())
+        return false;
+    for(size_t i = 0; i < a.size(); ++i)
+        for(int r = 0; r < 4; ++r)
+            for(int c = 0; c < 4; ++c)
+                if(!close_enough(a[i](r, c), b[i](r, c), tol))
+                    return false;
+    return true;
+}
+
+static str terminus_desc(const hwm::lane::terminus *t)
+{
+    const hwm::lane::intersection_terminus *it = dynamic_cast<const hwm::lane::intersection_terminus*>(t);
+    const hwm::lane::lane_terminus         *lt = dynamic_cast<const hwm::lane::lane_terminus*>(t);
+    if(it)
+        return boost::str(boost::format("intersection %s/%d") % it->adjacent_intersection->id % it->intersect_in_ref);
+    if(lt)
+        return "lane " + lt->adjacent_lane->id;
+    return "dead end";
+}
+
+// Counts differences between two networks; arrays are compared with relative tolerance tol
+static int compare(const hwm::network &a, const hwm::network &b, const float tol)
+{
+    int errors = 0;
+    if(a.name != b.name || a.gamma != b.gamma || a.lane_width != b.lane_width)
+    {
+        std::cout << "Network attributes differ" << std::endl;
+        ++errors;
+    }
+
+    if(a.roads.size() != b.roads.size() || a.lanes.size() != b.lanes.size() || a.intersections.size() != b.intersections.size())
+    {
+        std::cout << "Networks have different sizes" << std::endl;
+        return errors + 1;
+    }
+
+    hwm::road_map::const_iterator rb = b.roads.begin();
+    BOOST_FOREACH(const hwm::road_pair &ra, a.roads)
+    {
+        const arc_road &x = ra.second.rep;
+        const arc_road &y = rb->second.rep;
+        if(ra.first != rb->first || ra.second.id != rb->second.id || ra.second.name != rb->second.name ||
+           !vectors_equal(x.points_,       y.points_,       3, tol) ||
+           !vectors_equal(x.normals_,      y.normals_,      3, tol) ||
+           !floats_equal (x.radii_,        y.radii_,           tol) ||
+           !floats_equal (x.arcs_,         y.arcs_,            tol) ||
+           !frames_equal (x.frames_,       y.frames_,          tol) ||
+           !floats_equal (x.seg_clengths_, y.seg_clengths_,    tol) ||
+           !vectors_equal(x.arc_clengths_, y.arc_clengths_, 2, tol))
+        {
+            std::cout << "Road " << ra.first << " differs" << std::endl;
+            ++errors;
+        }
+        ++rb;
+    }
+
+    hwm::lane_map::const_iterator lb = b.lanes.begin();
+    BOOST_FOREACH(const hwm::lane_pair &la, a.lanes)
+    {
+        const hwm::lane &x = la.second;
+        const hwm::lane &y = lb->second;
+        bool same = la.first == lb->first && x.id == y.id && x.speedlimit == y.speedlimit &&
+            terminus_desc(x.start) == terminus_desc(y.start) && terminus_desc(x.end) == terminus_desc(y.end) &&
+            x.road_memberships.size() == y.road_memberships.size() && x.left.size() == y.left.size() && x.right.size() == y.right.size();
+
+        typedef hwm::lane::road_membership::intervals::const_iterator rm_itr;
+        for(rm_itr mx = x.road_memberships.begin(), my = y.road_memberships.begin(); same && mx != x.road_memberships.end(); ++mx, ++my)
+            same = mx->first == my->first && (mx->second.parent_road ? mx->second.parent_road->id : str()) == (my->second.parent_road ? my->second.parent_road->id : str()) &&
+                mx->second.interval[0] == my->second.interval[0] && mx->second.interval[1] == my->second.interval[1] &&
+                mx->second.lane_position == my->second.lane_position;
+
+        const hwm::lane::adjacency::intervals *ax[2] = {&(x.left), &(x.right)};
+        const hwm::lane::adjacency::intervals *ay[2] = {&(y.left), &(y.right)};
+        typedef hwm::lane::adjacency::intervals::const_iterator adj_itr;
+        for(int s = 0; s < 2 && same; ++s)
+            for(adj_itr jx = ax[s]->begin(), jy = ay[s]->begin(); same && jx != ax[s]->end(); ++jx, ++jy)
+                same = jx->first == jy->first && (jx->second.neighbor ? jx->second.neighbor->id : str()) == (jy->second.neighbor ? jy->second.neighbor->id : str()) &&
+                    (!jx->second.neighbor || (jx->second.neighbor_interval[0] == jy->second.neighbor_interval[0] && jx->second.neighbor_interval[1] == jy->second.neighbor_interval[1]));
+
+        if(!same)
+        {
+            std::cout << "Lane " << la.first << " differs" << std::endl;
+            ++errors;
+        }
+        ++lb;
+    }
+
+    hwm::intersection_map::const_iterator ib = b.intersections.begin();
+    BOOST_FOREACH(const hwm::intersection_pair &ia, a.intersections)
+    {
+        const hwm::intersection &x = ia.second;
+        const hwm::intersection &y = ib->second;
+        bool same = ia.first == ib->first && x.id == y.id &&
+            x.incoming.size() == y.incoming.size() && x.outgoing.size() == y.outgoing.size() && x.states.size() == y.states.size();
+        for(size_t i = 0; same && i < x.incoming.size(); ++i)
+            same = x.incoming[i]->id == y.incoming[i]->id;
+        for(size_t i = 0; same && i < x.outgoing.size(); ++i)
+            same = x.outgoing[i]->id == y.outgoing[i]->id;
+        for(size_t s = 0; same && s < x.states.size(); ++s)
+        {
+            same = x.states[s].duration == y.states[s].duration && x.states[s].state_pairs.size() == y.states[s].state_pairs.size();
+            BOOST_FOREACH(const hwm::intersection::state::state_pair &sp, x.states[s].in_pair())
+            {
+                const hwm::intersection::state::state_pair_in::const_iterator f = y.states[s].in_pair().find(sp.in_idx);
+                same = same && f != y.states[s].in_pair().end() && f->out_idx == sp.out_idx;
+            }
+        }
+
+        if(!same)
+        {
+            std::cout << "Intersection " << ia.first << " differs" << std::endl;
+            ++errors;
+        }
+        ++ib;
+    }
+
+    return errors;
+}
+
+int main(int argc, char *argv[])
+{
+    std::cerr << libroad_package_string() << std::endl;
+    if(argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <network file> [scratch dir]" << std::endl;
+        return 1;
+    }
+
+    const str scratch(argc > 2 ? argv[2] : "/tmp");
+    const str bin_file(boost::str(boost::format("%s/hwm-binary-test-%d.hwmb")    % scratch % getpid()));
+    const str xml_file(boost::str(boost::format("%s/hwm-binary-test-%d.xml.gz") % scratch % getpid()));
+
+    int errors = 0;
+    try
+    {
+        double start = time_now();
+        hwm::network net(hwm::load_xml_network(argv[1]));
+        const double xml_time = time_now() - start;
+        net.build_fictitious_lanes();
+        net.check();
+
+        hwm::write_binary_network(net, bin_file.c_str());
+
+        start = time_now();
+        hwm::network bin_net(hwm::load_binary_network(bin_file.c_str()));
+        const double bin_time = time_now() - start;
+        bin_net.build_fictitious_lanes();
+        bin_net.check();
+
+        std::cout << "XML load: " << xml_time << " s, binary load: " << bin_time << " s (" << xml_time/bin_time << "x)" << std::endl;
+
+        // The binary file stores the arrays exactly
+        errors += compare(net, bin_net, 0.0f);
+
+        // Through XML again; points are written as text, so allow some slop
+        bin_net.xml_write(xml_file.c_str());
+        const hwm::network xml_net(hwm::load_xml_network(xml_file.c_str()));
+        errors += compare(net, xml_net, 1e-3f);
+
+        // A network from a binary file writes the same binary file
+        const str bin_file2(bin_file + "2");
+        hwm::write_binary_network(bin_net, bin_file2.c_str());
+        std::ifstream f1(bin_file.c_str(),  std::ios::binary);
+        std::ifstream f2(bin_file2.c_str(), std::ios::binary);
+        const std::string b1((std::istreambuf_iterator<char>(f1)), std::istreambuf_iterator<char>());
+        const std::string b2((std::istreambuf_iterator<char>(f2)), std::istreambuf_iterator<char>());
+        if(b1 != b2)
+        {
+            std::cout << "Rewritten binary file differs" << std::endl;
+            ++errors;
+        }
+        unlink(bin_file2.c_str());
+
+        // Corrupt files must be rejected, not trusted
+        {
+            std::ofstream bad(bin_file2.c_str(), std::ios::binary);
+            bad.write(b1.data(), b1.size()/2);
+        }
+        try
+        {
+            hwm::load_binary_network(bin_file2.c_str());
+            std::cout << "Truncated binary file was accepted" << std::endl;
+            ++errors;
+        }
+        catch(std::runtime_error &e)
+        {
+        }
+        unlink(bin_file2.c_str());
+
+        // So must states naming lanes their intersection doesn't have
+        const hwm::binary::header *hdr = reinterpret_cast<const hwm::binary::header*>(b1.data());
+        if(hdr->sections[hwm::binary::STATE_PAIRS].count)
+        {
+            std::string bad(b1);
+            hwm::binary::state_pair *sp = reinterpret_cast<hwm::binary::state_pair*>(&bad[hdr->sections[hwm::binary::STATE_PAIRS].offset]);
+            sp->in_idx = -1;
+            {
+                std::ofstream out(bin_file2.c_str(), std::ios::binary);
+                out.write(bad.data(), bad.size());
+            }
+            try
+            {
+                hwm::load_binary_network(bin_file2.c_str());
+                std::cout << "State with a bad incoming lane was accepted" << std::endl;
+                ++errors;
+            }
+            catch(std::runtime_error &e)
+            {
+            }
+            unlink(bin_file2.c_str());
+        }
+    }
+    catch(std::runtime_error &e)
+    {
+        std::cout << "Error: " << e.what() << std::endl;
+        ++errors;
+    }
+
+    unlink(bin_file.c_str());
+    unlink(xml_file.c_str());
+
+    std::cout << errors << " errors" << std::endl;
+    return errors ? 1 : 0;
+}
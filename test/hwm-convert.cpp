@@ -0,0 +1,72 @@
+#include <libroad/hwm_network.hpp>
+#include <iostream>
+#include <cstring>
+
+// Converts between XML and binary networks; the input format is detected from the file
+static bool is_binary(const char *filename)
+{
+    std::ifstream in(filename, std::ios::binary);
+    char          magic[6];
+    return in.read(magic, sizeof(magic)) && std::memcmp(magic, "HWMBIN", sizeof(magic)) == 0;
+}
+
+// none, gzip or pgzip, optionally followed by :level
+static compression parse_compression(const str &spec)
+{
+    const size_t colon = spec.find(':');
+    const str    codec(spec.substr(0, colon));
+
+    compression c;
+    if(codec == "none")
+        c.codec = compression::NONE;
+    else if(codec == "gzip")
+        c.codec = compression::GZIP;
+    else if(codec == "pgzip")
+        c.codec = compression::PARALLEL_GZIP;
+    else
+        throw std::runtime_error(boost::str(boost::format("Unknown compression %s") % codec));
+    if(colon != str::npos)
+        c.level = boost::lexical_cast<int>(spec.substr(colon+1));
+    return c;
+}
+
+int main(int argc, char *argv[])
+{
+    std::cerr << libroad_package_string() << std::endl;
+    if(argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <input network> <output network> [none|gzip|pgzip[:level]]" << std::endl;
+        std::cerr << "XML input is written as binary, binary input as XML (compressed as given)" << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        if(argc > 3)
+            default_compression() = parse_compression(argv[3]);
+
+        if(is_binary(argv[1]))
+        {
+            hwm::network net(hwm::load_binary_network(argv[1]));
+            net.build_fictitious_lanes();
+            net.check();
+            net.xml_write(argv[2]);
+            std::cerr << "Wrote XML network " << argv[2] << std::endl;
+        }
+        else
+        {
+            hwm::network net(hwm::load_xml_network_parallel(argv[1]));
+            net.build_fictitious_lanes();
+            net.check();
+            hwm::write_binary_network(net, argv[2]);
+            std::cerr << "Wrote binary network " << argv[2] << std::endl;
+        }
+    }
+    catch(std::runtime_error &e)
+    {
+        std::cerr << "Conversion failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
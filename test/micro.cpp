@@ -195,12 +195,9 @@ public:
         //Repeat for i_lanes
         BOOST_FOREACH(hwm::intersection_pair &ip, intersections)
         {
-            BOOST_FOREACH(hwm::intersection::state &current_state, ip.second.states)
+            BOOST_FOREACH(hwm::lane_pair &l, ip.second.fict_lanes)
             {
-                BOOST_FOREACH(hwm::lane_pair &l, current_state.fict_lanes)
-                {
-                    calc_lane_accel(timestep, l.second);
-                }
+                calc_lane_accel(timestep, l.second);
             }
         }
     }
@@ -221,16 +218,13 @@ public:
         }
         BOOST_FOREACH(hwm::intersection_pair &ip, intersections)
         {
-            BOOST_FOREACH(hwm::intersection::state &current_state, ip.second.states)
+            BOOST_FOREACH(hwm::lane_pair &l, ip.second.fict_lanes)
             {
-                BOOST_FOREACH(hwm::lane_pair &l, current_state.fict_lanes)
+                BOOST_FOREACH(car& c, l.second.user_data<micro_lane>()->cars)
                 {
-                    BOOST_FOREACH(car& c, l.second.user_data<micro_lane>()->cars)
-                    {
-                        c.dist += c.vel * timestep;
-                        c.vel += c.accel * timestep;
-                        c.pos = c.dist / l.second.user_data<micro_lane>()->length;
-                    }
+                    c.dist += c.vel * timestep;
+                    c.vel += c.accel * timestep;
+                    c.pos = c.dist / l.second.user_data<micro_lane>()->length;
                 }
             }
         }
@@ -264,33 +258,30 @@ public:
 
         BOOST_FOREACH(hwm::intersection_pair &ip, intersections)
         {
-            BOOST_FOREACH(hwm::intersection::state &current_state, ip.second.states)
+            BOOST_FOREACH(hwm::lane_pair &l, ip.second.fict_lanes)
             {
-                BOOST_FOREACH(hwm::lane_pair &l, current_state.fict_lanes)
+                micro_lane *micro = l.second.user_data<micro_lane>();
+                while(!micro->cars.empty() && micro->cars.back().dist > micro->length)
                 {
-                    micro_lane *micro = l.second.user_data<micro_lane>();
-                    while(!micro->cars.empty() && micro->cars.back().dist > micro->length)
-                    {
-                        car &c = micro->cars.back();
-                        assert(not isnan(c.dist) and  not isinf(c.dist));
+                    car &c = micro->cars.back();
+                    assert(not isnan(c.dist) and  not isinf(c.dist));
 
-                        hwm::lane *new_lane = l.second.downstream_lane();
-                        if (new_lane)
-                        {
-                            micro_lane *new_micro = new_lane->user_data<micro_lane>();
-                            //Update position and distance.
-                            c.dist -= micro->length;
-                            c.pos = (float) c.dist / new_micro->length;
-                            new_micro->cars.push_front(micro->cars.back());
-                        }
-                        else
-                        {
-                            c.dist = micro->length;
-                            c.pos = 1;
-                            assert(0);
-                        }
-                        micro->cars.pop_back();
+                    hwm::lane *new_lane = l.second.downstream_lane();
+                    if (new_lane)
+                    {
+                        micro_lane *new_micro = new_lane->user_data<micro_lane>();
+                        //Update position and distance.
+                        c.dist -= micro->length;
+                        c.pos = (float) c.dist / new_micro->length;
+                        new_micro->cars.push_front(micro->cars.back());
                     }
+                    else
+                    {
+                        c.dist = micro->length;
+                        c.pos = 1;
+                        assert(0);
+                    }
+                    micro->cars.pop_back();
                 }
             }
         }
@@ -530,21 +521,18 @@ public:
 
         BOOST_FOREACH(const hwm::intersection_pair &ip, hnet->intersections)
         {
-            BOOST_FOREACH(const hwm::intersection::state &current_state, ip.second.states)
+            BOOST_FOREACH(const hwm::lane_pair &l, ip.second.fict_lanes)
             {
-                BOOST_FOREACH(const hwm::lane_pair &l, current_state.fict_lanes)
+                BOOST_FOREACH(const car& c, l.second.user_data<micro_lane>()->cars)
                 {
-                    BOOST_FOREACH(const car& c, l.second.user_data<micro_lane>()->cars)
-                    {
-                        mat4x4f trans(l.second.point_frame(c.pos));
-                        mat4x4f ttrans(tvmet::trans(trans));
-                        glColor3f(1.0, 0.0, 0.0);
-
-                        glPushMatrix();
-                        glMultMatrixf(ttrans.data());
-                        car_drawer.draw();
-                        glPopMatrix();
-                    }
+                    mat4x4f trans(l.second.point_frame(c.pos));
+                    mat4x4f ttrans(tvmet::trans(trans));
+                    glColor3f(1.0, 0.0, 0.0);
+
+                    glPushMatrix();
+                    glMultMatrixf(ttrans.data());
+                    car_drawer.draw();
+                    glPopMatrix();
                 }
             }
         }
@@ -694,15 +682,12 @@ int main(int argc, char** argv)
 
     BOOST_FOREACH(hwm::intersection_pair &ip, hnet->intersections)
     {
-        BOOST_FOREACH(hwm::intersection::state &current_state, ip.second.states)
+        BOOST_FOREACH(hwm::lane_pair &l, ip.second.fict_lanes)
         {
-            BOOST_FOREACH(hwm::lane_pair &l, current_state.fict_lanes)
-            {
-                micro_lane *ml = new micro_lane;
-                l.second.user_datum = ml;
-                ml->parent_lane = &(l.second);
-                ml->length = l.second.length();
-            }
+            micro_lane *ml = new micro_lane;
+            l.second.user_datum = ml;
+            ml->parent_lane = &(l.second);
+            ml->length = l.second.length();
         }
     }
 
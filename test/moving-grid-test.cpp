@@ -0,0 +1,183 @@
+#include "libroad/moving_grid.hpp"
+#include "timer.hpp"
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <limits>
+
+static int compare(std::vector<size_t> &res, std::vector<size_t> &ref, const char *what)
+{
+    std::sort(res.begin(), res.end());
+    std::sort(ref.begin(), ref.end());
+    if(res != ref)
+    {
+        std::cout << what << ": got " << res.size() << " items, expected " << ref.size() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+static int check_queries(const moving_grid &mg, const std::vector<float> &x, const std::vector<float> &y, const std::vector<bool> &live, const bool lane_mode)
+{
+    int                                errors = 0;
+    std::vector<size_t>                res;
+    std::vector<size_t>                ref;
+    std::vector<moving_grid::dist_item> knn;
+
+    for(int q = 0; q < 200; ++q)
+    {
+        const float qx = lane_mode ? drand48()                          : 1000*drand48();
+        const float qy = lane_mode ? static_cast<float>(lrand48() % 50) : 1000*drand48();
+
+        const aabb2d rect = lane_mode ? aabb2d(qx, qx + 0.2f*drand48(), qy, qy) : aabb2d(qx, qx + 100*drand48(), qy, qy + 100*drand48());
+        mg.query(res, rect);
+        ref.clear();
+        for(size_t i = 0; i < x.size(); ++i)
+            if(live[i] && x[i] >= rect.bounds[0][0] && x[i] <= rect.bounds[1][0] && y[i] >= rect.bounds[0][1] && y[i] <= rect.bounds[1][1])
+                ref.push_back(i);
+        errors += compare(res, ref, "rect query");
+
+        if(!lane_mode)
+        {
+            const float r = 50*drand48();
+            mg.query_radius(res, qx, qy, r);
+            ref.clear();
+            for(size_t i = 0; i < x.size(); ++i)
+                if(live[i] && (x[i]-qx)*(x[i]-qx) + (y[i]-qy)*(y[i]-qy) <= r*r)
+                    ref.push_back(i);
+            errors += compare(res, ref, "radius query");
+        }
+
+        const size_t k = 1 + lrand48() % 16;
+        mg.query_knn(knn, qx, qy, k);
+        std::vector<float> dists;
+        for(size_t i = 0; i < x.size(); ++i)
+            if(live[i] && (!lane_mode || y[i] == qy))
+                dists.push_back(std::sqrt((x[i]-qx)*(x[i]-qx) + (y[i]-qy)*(y[i]-qy)));
+        std::sort(dists.begin(), dists.end());
+        if(knn.size() != std::min(k, dists.size()))
+        {
+            std::cout << "knn query: got " << knn.size() << " items, expected " << std::min(k, dists.size()) << std::endl;
+            ++errors;
+        }
+        else
+            for(size_t i = 0; i < knn.size(); ++i)
+                if(std::abs(knn[i].first - dists[i]) > 1e-3f)
+                {
+                    std::cout << "knn query: neighbor " << i << " at " << knn[i].first << ", expected " << dists[i] << std::endl;
+                    ++errors;
+                    break;
+                }
+    }
+    return errors;
+}
+
+static int run(const bool lane_mode, const size_t n)
+{
+    int errors = 0;
+
+    std::vector<float> x(n);
+    std::vector<float> y(n);
+    std::vector<bool>  live(n, true);
+    for(size_t i = 0; i < n; ++i)
+    {
+        x[i] = lane_mode ? drand48()                          : 1000*drand48();
+        y[i] = lane_mode ? static_cast<float>(lrand48() % 50) : 1000*drand48();
+    }
+
+    moving_grid mg(lane_mode ? moving_grid(50, 64, n) : moving_grid(aabb2d(0, 1000, 0, 1000), 10.0f, n));
+
+    double start = time_now();
+    mg.rebuild(&(x[0]), &(y[0]), n);
+    std::cout << (lane_mode ? "lane" : "world") << " rebuild of " << n << " items: " << time_now() - start << " s" << std::endl;
+
+    if(!mg.check())
+    {
+        std::cout << "check failed after rebuild" << std::endl;
+        ++errors;
+    }
+    errors += check_queries(mg, x, y, live, lane_mode);
+
+    start = time_now();
+    for(size_t i = 0; i < n; ++i)
+    {
+        if(lane_mode)
+        {
+            x[i] = std::min(1.0f, x[i] + 0.01f*static_cast<float>(drand48()));
+            mg.update_lane(i, static_cast<size_t>(y[i]), x[i]);
+        }
+        else
+        {
+            x[i] += 5*(drand48() - 0.5);
+            y[i] += 5*(drand48() - 0.5);
+            mg.update(i, x[i], y[i]);
+        }
+    }
+    std::cout << (lane_mode ? "lane" : "world") << " update of " << n << " items: " << time_now() - start << " s" << std::endl;
+
+    for(size_t i = 0; i < n; i += 7)
+    {
+        mg.remove(i);
+        live[i] = false;
+    }
+
+    if(!mg.check())
+    {
+        std::cout << "check failed after updates" << std::endl;
+        ++errors;
+    }
+    errors += check_queries(mg, x, y, live, lane_mode);
+
+    mg.rebuild();
+    if(!mg.check())
+    {
+        std::cout << "check failed after second rebuild" << std::endl;
+        ++errors;
+    }
+    errors += check_queries(mg, x, y, live, lane_mode);
+
+    return errors;
+}
+
+// Items far outside the bounds go to the border cells and are still found
+static int check_far_items()
+{
+    int                 errors = 0;
+    moving_grid         mg(aabb2d(0, 1000, 0, 1000), 10.0f, 4);
+    const float         big = std::numeric_limits<float>::max();
+    const float         x[4] = {1e30f, -1e30f, big, -big};
+    const float         y[4] = {5.0f, 1e25f, -big, big};
+    std::vector<size_t> res;
+    for(size_t i = 0; i < 4; ++i)
+        mg.insert(i, x[i], y[i]);
+    if(!mg.check())
+    {
+        std::cout << "check failed with far items" << std::endl;
+        ++errors;
+    }
+    for(size_t i = 0; i < 4; ++i)
+    {
+        mg.query(res, aabb2d(x[i], x[i], y[i], y[i]));
+        if(std::find(res.begin(), res.end(), i) == res.end())
+        {
+            std::cout << "far item " << i << " not found" << std::endl;
+            ++errors;
+        }
+    }
+    return errors;
+}
+
+int main(int argc, char *argv[])
+{
+    std::cerr << libroad_package_string() << std::endl;
+
+    const size_t n = argc > 1 ? atol(argv[1]) : 100000;
+
+    int errors = 0;
+    errors += run(false, n);
+    errors += run(true,  n);
+    errors += check_far_items();
+
+    std::cout << errors << " errors" << std::endl;
+    return errors ? 1 : 0;
+}
@@ -1,37 +1,51 @@
 #include <libroad/osm_network.hpp>
 #include <libroad/hwm_network.hpp>
+#include <libroad/profile.hpp>
+#include <cstdlib>
 
 int main(int argc, char *argv[])
 {
     std::cerr << libroad_package_string() << std::endl;
     if(argc < 3)
     {
-        std::cerr << "Usage: " << argv[0] << " <input osm> <output file>" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " <input osm> <output file> [simplify tolerance (m)] [equirectangular|web_mercator|utm]" << std::endl;
         return 1;
     }
 
     float lane_width =  2.5;
+    float simplify   = argc > 3 ? boost::lexical_cast<float>(argv[3]) : 0.0f;
 
-    //Load from file
-    osm::network onet(osm::load_xml_network(argv[1]));
-    onet.populate_edges_from_hash();
-    onet.remove_duplicate_nodes();
-    onet.compute_node_degrees();
-    onet.clip_roads_to_bounds();
-    onet.compute_edge_types();
-    onet.compute_node_degrees();
-    onet.scale_and_translate();
-    onet.split_into_road_segments();
-    onet.remove_highway_intersections();
-    onet.compute_node_heights();
-    onet.join_logical_roads();
-    onet.create_ramps(lane_width);
-    onet.remove_small_roads(50);
-    onet.join_logical_roads();
-    onet.create_intersections(lane_width);
+    //Load from file (.osm or .osm.pbf)
+    osm::network onet(osm::load_network(argv[1]));
+    if(argc > 4)
+    {
+        const projection::kind proj = projection::kind_from_string(argv[4]);
+        onet.clean_up(lane_width, &proj);
+    }
+    else
+        onet.clean_up(lane_width);
+    // The clean-up stages' times, in a build configured with --enable-profile
+    const std::vector<profile::phase> &phases = profile::phases();
+    for(size_t i = 0; i < phases.size(); ++i)
+    {
+        if(phases[i].parent >= 0 && phases[phases[i].parent].name == "osm::network::clean_up")
+            std::cerr << boost::format("%-30s %8.3fs") % phases[i].name % phases[i].seconds << std::endl;
+    }
+    if(argc > 4)
+        std::cerr << boost::format("Projected with %s: extent %.0fm, max float error %.4fm") % argv[4] % onet.frame.max_extent % onet.frame.max_error << std::endl;
+    std::vector<osm::crossing> crossings;
+    onet.find_crossings(crossings);
+    std::cerr << crossings.size() << " places where roads cross without meeting" << std::endl;
     onet.populate_edge_hash_from_edges();
 
-    hwm::network net(hwm::from_osm("test", 0.5f, lane_width, onet));
+    hwm::simplify_report report;
+    hwm::network net(hwm::from_osm("test", 0.5f, lane_width, onet, simplify, &report));
+    std::cerr << "Fitted " << report.roads << " roads: " << report.features_before << " features in, " << report.features_after
+              << " out, max deviation " << report.max_deviation << "m" << std::endl;
+    BOOST_FOREACH(const hwm::simplify_report::failure &f, report.failures)
+    {
+        std::cerr << "Left out road " << f.road << ": " << f.reason << std::endl;
+    }
     net.build_intersections();
     net.build_fictitious_lanes();
     net.auto_scale_memberships();
@@ -49,5 +63,9 @@ int main(int argc, char *argv[])
 
     net.xml_write(argv[2]);
 
+    // Phase timings, counters and memory as JSON, in a build configured with --enable-profile
+    if(const char *json_file = getenv("LIBROAD_PROFILE_JSON"))
+        profile::write_json(json_file);
+
     return 0;
 }
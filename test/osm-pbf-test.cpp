@@ -0,0 +1,369 @@
+#include <libroad/osm_network.hpp>
+#include <iostream>
+#include <cmath>
+#include <stdint.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// Just enough of a protobuf writer to build PBF files for the reader to check against the XML path
+struct pb
+{
+    void varint(uint64_t v)
+    {
+        while(v >= 0x80)
+        {
+            s.push_back(static_cast<char>((v & 0x7f) | 0x80));
+            v >>= 7;
+        }
+        s.push_back(static_cast<char>(v));
+    }
+
+    void key(const int field, const int wire)
+    {
+        varint((field << 3) | wire);
+    }
+
+    void uint(const int field, const uint64_t v)
+    {
+        key(field, 0);
+        varint(v);
+    }
+
+    void sint(const int field, const int64_t v)
+    {
+        key(field, 0);
+        varint((static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+    }
+
+    void bytes(const int field, const std::string &b)
+    {
+        key(field, 2);
+        varint(b.size());
+        s += b;
+    }
+
+    void packed(const int field, const std::vector<int64_t> &v, const bool zigzag)
+    {
+        pb p;
+        BOOST_FOREACH(const int64_t x, v)
+        {
+            p.varint(zigzag ? (static_cast<uint64_t>(x) << 1) ^ static_cast<uint64_t>(x >> 63) : static_cast<uint64_t>(x));
+        }
+        bytes(field, p.s);
+    }
+
+    std::string s;
+};
+
+struct test_node
+{
+    int64_t id;
+    int64_t lat; // in 1e-7 degrees
+    int64_t lon;
+};
+
+struct test_way
+{
+    int64_t              id;
+    std::string          highway;
+    std::vector<int64_t> refs;
+};
+
+static void write_blob(std::ofstream &out, const char *type, const std::string &contents, const bool zip)
+{
+    pb blob;
+    if(zip)
+    {
+        uLongf      len = compressBound(contents.size());
+        std::string z(len, '\0');
+        compress(reinterpret_cast<Bytef*>(&(z[0])), &len, reinterpret_cast<const Bytef*>(contents.data()), contents.size());
+        z.resize(len);
+        blob.uint(2, contents.size());
+        blob.bytes(3, z);
+    }
+    else
+        blob.bytes(1, contents);
+
+    pb header;
+    header.bytes(1, type);
+    header.uint(3, blob.s.size());
+
+    const uint32_t      n     = header.s.size();
+    const unsigned char be[4] = {static_cast<unsigned char>(n >> 24), static_cast<unsigned char>(n >> 16),
+                                 static_cast<unsigned char>(n >> 8),  static_cast<unsigned char>(n)};
+    out.write(reinterpret_cast<const char*>(be), 4);
+    out.write(header.s.data(), header.s.size());
+    out.write(blob.s.data(), blob.s.size());
+}
+
+static std::string string_table(const std::vector<std::string> &strings)
+{
+    pb table;
+    BOOST_FOREACH(const std::string &s, strings)
+    {
+        table.bytes(1, s);
+    }
+    return table.s;
+}
+
+static void write_pbf(const str &filename, const std::vector<test_node> &nodes, const std::vector<test_way> &ways, const int64_t bounds[4])
+{
+    std::ofstream out(filename.c_str(), std::ios::binary);
+
+    pb bbox;
+    for(int i = 0; i < 4; ++i)
+        bbox.sint(i + 1, bounds[i]*100);
+    pb hb;
+    hb.bytes(1, bbox.s);
+    hb.bytes(4, "OsmSchema-V0.6");
+    hb.bytes(4, "DenseNodes");
+    write_blob(out, "OSMHeader", hb.s, true);
+
+    // The first half of the nodes as DenseNodes stored against lat/lon offsets, the rest as plain nodes
+    const size_t half = nodes.size()/2;
+    {
+        std::vector<int64_t> ids, lats, lons;
+        int64_t              last[3] = {0, 0, 0};
+        for(size_t i = 0; i < half; ++i)
+        {
+            ids.push_back(nodes[i].id - last[0]);
+            lats.push_back((nodes[i].lat - 1000) - last[1]);
+            lons.push_back((nodes[i].lon + 500) - last[2]);
+            last[0] = nodes[i].id;
+            last[1] = nodes[i].lat - 1000;
+            last[2] = nodes[i].lon + 500;
+        }
+        pb dense;
+        dense.packed(1, ids, true);
+        dense.packed(8, lats, true);
+        dense.packed(9, lons, true);
+        pb group;
+        group.bytes(2, dense.s);
+        pb block;
+        block.bytes(1, string_table(std::vector<std::string>(1, "")));
+        block.bytes(2, group.s);
+        block.uint(17, 100);
+        block.uint(19, 100*1000);
+        block.uint(20, static_cast<uint64_t>(static_cast<int64_t>(-100*500)));
+        write_blob(out, "OSMData", block.s, true);
+    }
+    {
+        pb group;
+        for(size_t i = half; i < nodes.size(); ++i)
+        {
+            pb node;
+            node.sint(1, nodes[i].id);
+            node.sint(8, nodes[i].lat);
+            node.sint(9, nodes[i].lon);
+            group.bytes(1, node.s);
+        }
+        pb block;
+        block.bytes(1, string_table(std::vector<std::string>(1, "")));
+        block.bytes(2, group.s);
+        write_blob(out, "OSMData", block.s, false);
+    }
+
+    std::vector<std::string> strings;
+    strings.push_back("");
+    strings.push_back("name");
+    strings.push_back("highway");
+    strings.push_back("building");
+    strings.push_back("yes");
+    pb group;
+    BOOST_FOREACH(const test_way &w, ways)
+    {
+        std::vector<int64_t> keys(1, 1), vals(1, 4);
+        if(!w.highway.empty())
+        {
+            keys.push_back(2);
+            vals.push_back(strings.size());
+            strings.push_back(w.highway);
+        }
+        else
+        {
+            keys.push_back(3);
+            vals.push_back(4);
+        }
+        std::vector<int64_t> deltas;
+        int64_t              last = 0;
+        BOOST_FOREACH(const int64_t r, w.refs)
+        {
+            deltas.push_back(r - last);
+            last = r;
+        }
+        pb way;
+        way.uint(1, w.id);
+        way.packed(2, keys, false);
+        way.packed(3, vals, false);
+        way.packed(8, deltas, true);
+        group.bytes(3, way.s);
+    }
+    pb block;
+    block.bytes(1, string_table(strings));
+    block.bytes(2, group.s);
+    write_blob(out, "OSMData", block.s, true);
+}
+
+static void write_xml(const str &filename, const std::vector<test_node> &nodes, const std::vector<test_way> &ways, const int64_t bounds[4])
+{
+    std::ofstream out(filename.c_str());
+    out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<osm version=\"0.6\">\n";
+    out << boost::format(" <bounds minlat=\"%.7f\" minlon=\"%.7f\" maxlat=\"%.7f\" maxlon=\"%.7f\"/>\n")
+        % (1e-7*bounds[3]) % (1e-7*bounds[0]) % (1e-7*bounds[2]) % (1e-7*bounds[1]);
+    BOOST_FOREACH(const test_node &n, nodes)
+    {
+        out << boost::format(" <node id=\"%d\" lat=\"%.7f\" lon=\"%.7f\"/>\n") % n.id % (1e-7*n.lat) % (1e-7*n.lon);
+    }
+    BOOST_FOREACH(const test_way &w, ways)
+    {
+        out << boost::format(" <way id=\"%d\">\n") % w.id;
+        BOOST_FOREACH(const int64_t r, w.refs)
+        {
+            out << boost::format("  <nd ref=\"%d\"/>\n") % r;
+        }
+        out << "  <tag k=\"name\" v=\"yes\"/>\n";
+        if(w.highway.empty())
+            out << "  <tag k=\"building\" v=\"yes\"/>\n";
+        else
+            out << boost::format("  <tag k=\"highway\" v=\"%s\"/>\n") % w.highway;
+        out << " </way>\n";
+    }
+    out << "</osm>\n";
+}
+
+// Lon/lat have to come through in double; in float, these would be off by some 1e-6 degrees
+static int check_positions(const osm::network &n, const std::vector<test_node> &nodes)
+{
+    int errors = 0;
+    BOOST_FOREACH(const test_node &tn, nodes)
+    {
+        const osm::node *no = n.nodes.find(tn.id);
+        if(no && (std::abs(no->lonlat[0] - 1e-7*tn.lon) > 1e-9 || std::abs(no->lonlat[1] - 1e-7*tn.lat) > 1e-9))
+        {
+            std::cout << "Node " << tn.id << " is at " << no->lonlat << ", not " << 1e-7*tn.lon << ", " << 1e-7*tn.lat << std::endl;
+            ++errors;
+        }
+    }
+    return errors;
+}
+
+static int compare(const osm::network &a, const osm::network &b)
+{
+    int errors = 0;
+    if(std::abs(a.center[0] - b.center[0]) > 1e-4 || std::abs(a.center[1] - b.center[1]) > 1e-4)
+    {
+        std::cout << "Centers differ" << std::endl;
+        ++errors;
+    }
+    if(a.nodes.size() != b.nodes.size() || a.edge_hash.size() != b.edge_hash.size())
+    {
+        std::cout << "Sizes differ: " << a.nodes.size() << " nodes, " << a.edge_hash.size() << " edges vs "
+                  << b.nodes.size() << " nodes, " << b.edge_hash.size() << " edges" << std::endl;
+        return errors + 1;
+    }
+
+    osm::node_store::const_iterator nb = b.nodes.begin();
+    for(osm::node_store::const_iterator na = a.nodes.begin(); na != a.nodes.end(); ++na, ++nb)
+    {
+        if(na->id != nb->id || std::abs(na->lonlat[0] - nb->lonlat[0]) > 1e-9 || std::abs(na->lonlat[1] - nb->lonlat[1]) > 1e-9)
+        {
+            std::cout << "Node " << na->id << " differs" << std::endl;
+            ++errors;
+        }
+    }
+
+    strhash<osm::edge>::type::const_iterator eb = b.edge_hash.begin();
+    for(strhash<osm::edge>::type::const_iterator ea = a.edge_hash.begin(); ea != a.edge_hash.end(); ++ea, ++eb)
+    {
+        bool same = ea->first == eb->first && ea->second.highway_class == eb->second.highway_class &&
+            ea->second.from == eb->second.from && ea->second.to == eb->second.to && ea->second.shape.size() == eb->second.shape.size();
+        for(size_t i = 0; same && i < ea->second.shape.size(); ++i)
+            same = ea->second.shape[i]->id == eb->second.shape[i]->id;
+        if(!same)
+        {
+            std::cout << "Way " << ea->first << " differs" << std::endl;
+            ++errors;
+        }
+    }
+    return errors;
+}
+
+int main(int argc, char *argv[])
+{
+    std::cerr << libroad_package_string() << std::endl;
+
+    const str    base(boost::str(boost::format("%s/osm-pbf-test-%d") % (argc > 1 ? argv[1] : "/tmp") % getpid()));
+    const str    xml_name(base + ".osm");
+    const str    pbf_name(base + ".osm.pbf");
+    const int    grid = argc > 2 ? boost::lexical_cast<int>(argv[2]) : 40;
+
+    // A grid of nodes (some negative coordinates, sparse ids) with highways along rows and buildings on some blocks
+    srand48(1);
+    std::vector<test_node> nodes;
+    for(int y = 0; y < grid; ++y)
+        for(int x = 0; x < grid; ++x)
+        {
+            const test_node n = {1000 + 7*(y*grid + x), 400000000 + y*10000 + static_cast<int64_t>(drand48()*1000),
+                                 -800000000 + x*10000 + static_cast<int64_t>(drand48()*1000)};
+            nodes.push_back(n);
+        }
+    std::vector<test_way> ways;
+    for(int y = 0; y < grid; ++y)
+    {
+        test_way w;
+        w.id      = 5000000000LL + y;
+        w.highway = y % 3 ? "residential" : "primary";
+        for(int x = 0; x < grid; ++x)
+            w.refs.push_back(nodes[y*grid + x].id);
+        ways.push_back(w);
+
+        if(y + 1 < grid)
+        {
+            test_way b;
+            b.id = 9000 + y;
+            b.refs.push_back(nodes[y*grid].id);
+            b.refs.push_back(nodes[(y+1)*grid].id);
+            ways.push_back(b);
+        }
+    }
+    const int64_t bounds[4] = {-800000000, -800000000 + grid*10000, 400000000 + grid*10000, 400000000};
+
+    int errors = 0;
+    try
+    {
+        write_xml(xml_name, nodes, ways, bounds);
+        write_pbf(pbf_name, nodes, ways, bounds);
+
+        const osm::network from_xml(osm::load_xml_network(xml_name.c_str()));
+        const osm::network from_pbf(osm::load_network(pbf_name.c_str()));
+        errors += compare(from_xml, from_pbf);
+        errors += check_positions(from_pbf, nodes);
+        std::cout << from_pbf.nodes.size() << " nodes, " << from_pbf.edge_hash.size() << " highways" << std::endl;
+
+        // A damaged blob must be reported, not read as a smaller network
+        {
+            std::fstream f(pbf_name.c_str(), std::ios::binary | std::ios::in | std::ios::out);
+            f.seekp(200);
+            f.put('\xff');
+        }
+        try
+        {
+            osm::load_pbf_network(pbf_name.c_str());
+            std::cout << "Damaged file was accepted" << std::endl;
+            ++errors;
+        }
+        catch(std::runtime_error &e)
+        {
+        }
+    }
+    catch(std::exception &e)
+    {
+        std::cout << "Error: " << e.what() << std::endl;
+        ++errors;
+    }
+    unlink(xml_name.c_str());
+    unlink(pbf_name.c_str());
+
+    std::cout << errors << " errors" << std::endl;
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,216 @@
+#include <libroad/osm_network.hpp>
+#include <iostream>
+#include <map>
+#include <set>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+static void write_way(std::ostream &out, int &way_id, const int from, const int to, const char *highway)
+{
+    out << boost::format(" <way id=\"%d\"><nd ref=\"%d\"/><nd ref=\"%d\"/><tag k=\"highway\" v=\"%s\"/></way>\n")
+        % way_id++ % from % to % highway;
+}
+
+// A street grid, one way per block, with a primary every fourth row and column, and a bridge of its own nodes over
+// the first row of blocks
+static void write_grid(const str &filename, const int grid, const double spacing)
+{
+    std::ofstream out(filename.c_str());
+    out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<osm version=\"0.6\">\n";
+    out << boost::format(" <bounds minlat=\"%.7f\" minlon=\"%.7f\" maxlat=\"%.7f\" maxlon=\"%.7f\"/>\n")
+        % (-0.5*spacing) % (-0.5*spacing) % ((grid - 0.5)*spacing) % ((grid - 0.5)*spacing);
+    for(int y = 0; y < grid; ++y)
+        for(int x = 0; x < grid; ++x)
+            out << boost::format(" <node id=\"%d\" lat=\"%.7f\" lon=\"%.7f\"/>\n") % (100 + 3*(y*grid + x)) % (y*spacing) % (x*spacing);
+
+    out << boost::format(" <node id=\"%d\" lat=\"%.7f\" lon=\"%.7f\"/>\n") % 10 % (0.5*spacing) % (-0.3*spacing);
+    out << boost::format(" <node id=\"%d\" lat=\"%.7f\" lon=\"%.7f\"/>\n") % 11 % (0.6*spacing) % ((grid - 0.7)*spacing);
+
+    int way_id = 100000;
+    write_way(out, way_id, 10, 11, "secondary");
+    for(int y = 0; y < grid; ++y)
+        for(int x = 0; x < grid; ++x)
+        {
+            const int here = 100 + 3*(y*grid + x);
+            if(x + 1 < grid)
+                write_way(out, way_id, here, here + 3, y % 4 ? "residential" : "primary");
+            if(y + 1 < grid)
+                write_way(out, way_id, here, here + 3*grid, x % 4 ? "residential" : "primary");
+        }
+    out << "</osm>\n";
+}
+
+// Every node is found by its id, made-up ids stay clear of the file's, and the degrees and rows agree with the edges
+static int check_store(osm::network &n)
+{
+    int errors = 0;
+    BOOST_FOREACH(const osm::node &no, n.nodes)
+    {
+        if(n.nodes.find(no.id) != &no)
+        {
+            std::cout << "Node " << no.id << " isn't found by its id" << std::endl;
+            ++errors;
+        }
+    }
+
+    const osm::node_id low = n.nodes.begin()->id;
+    for(int i = 0; i < 3; ++i)
+    {
+        osm::node *made = n.nodes.add(vec3f(0.0f, 0.0f, 0.0f));
+        if(made->id >= low || made->id >= 0 || n.nodes.find(made->id) != made)
+        {
+            std::cout << "Made-up node " << made->id << " is misplaced" << std::endl;
+            ++errors;
+        }
+    }
+    if(n.nodes.find(low - 1) || n.nodes.find(1))
+    {
+        std::cout << "Found a node that isn't there" << std::endl;
+        ++errors;
+    }
+
+    n.populate_edges_from_hash();
+    n.compute_node_degrees();
+    std::map<osm::node_id, int> counts;
+    BOOST_FOREACH(const osm::edge &e, n.edges)
+    {
+        BOOST_FOREACH(const osm::node *no, e.shape)
+        {
+            ++counts[no->id];
+        }
+    }
+    BOOST_FOREACH(const osm::node &no, n.nodes)
+    {
+        const int c = counts.count(no.id) ? counts[no.id] : 0;
+        if(n.nodes.degree(no.id) != c || static_cast<int>(n.nodes.edge_count(no.id)) != c)
+        {
+            std::cout << "Node " << no.id << " has degree " << n.nodes.degree(no.id) << " and " << n.nodes.edge_count(no.id)
+                      << " edges, but is in " << c << std::endl;
+            ++errors;
+        }
+    }
+    return errors;
+}
+
+static bool segments_cross(const osm::node *a0, const osm::node *a1, const osm::node *b0, const osm::node *b1)
+{
+    if(a0->id == b0->id || a0->id == b1->id || a1->id == b0->id || a1->id == b1->id)
+        return false;
+    const double rx    = a1->xy[0] - a0->xy[0];
+    const double ry    = a1->xy[1] - a0->xy[1];
+    const double sx    = b1->xy[0] - b0->xy[0];
+    const double sy    = b1->xy[1] - b0->xy[1];
+    const double denom = rx*sy - ry*sx;
+    if(denom == 0.0)
+        return false;
+    const double dx = b0->xy[0] - a0->xy[0];
+    const double dy = b0->xy[1] - a0->xy[1];
+    const double s  = (dx*sy - dy*sx)/denom;
+    const double u  = (dx*ry - dy*rx)/denom;
+    return s >= 0.0 && s <= 1.0 && u >= 0.0 && u <= 1.0;
+}
+
+// find_crossings must report the same segment pairs as a test of all pairs; the bridge crosses every column once
+static int check_crossings(osm::network &n, const int grid)
+{
+    n.populate_edges_from_hash();
+    std::vector<osm::crossing> found;
+    n.find_crossings(found);
+
+    typedef std::pair<size_t, size_t> seg;
+    std::set<std::pair<seg, seg> > got;
+    BOOST_FOREACH(const osm::crossing &c, found)
+    {
+        const seg a(c.edge, c.seg);
+        const seg b(c.other_edge, c.other_seg);
+        got.insert(a < b ? std::make_pair(a, b) : std::make_pair(b, a));
+    }
+
+    std::set<std::pair<seg, seg> > want;
+    for(size_t e = 0; e < n.edges.size(); ++e)
+        for(size_t i = 0; i + 1 < n.edges[e].shape.size(); ++i)
+            for(size_t f = e; f < n.edges.size(); ++f)
+                for(size_t j = (f == e ? i + 1 : 0); j + 1 < n.edges[f].shape.size(); ++j)
+                {
+                    if(segments_cross(n.edges[e].shape[i], n.edges[e].shape[i+1], n.edges[f].shape[j], n.edges[f].shape[j+1]))
+                        want.insert(std::make_pair(seg(e, i), seg(f, j)));
+                }
+
+    int errors = 0;
+    if(got != want || found.size() != got.size())
+    {
+        std::cout << "find_crossings found " << found.size() << " crossings, the scan " << want.size() << std::endl;
+        ++errors;
+    }
+    if(want.size() != static_cast<size_t>(grid))
+    {
+        std::cout << "The bridge crosses " << want.size() << " streets, not " << grid << std::endl;
+        ++errors;
+    }
+    return errors;
+}
+
+#ifdef _OPENMP
+// The clean-up stages must come out the same on one thread as on all of them; split edges are numbered from a
+// global counter, so edges are compared by their ends and shapes rather than by id
+static int check_thread_independence(const str &filename, const float lane_width)
+{
+    const int    threads = omp_get_max_threads();
+    // Loaded twice, as copies would share nodes
+    osm::network serial(osm::load_network(filename.c_str()));
+    osm::network parallel(osm::load_network(filename.c_str()));
+
+    omp_set_num_threads(1);
+    serial.clean_up(lane_width);
+    omp_set_num_threads(threads);
+    parallel.clean_up(lane_width);
+
+    bool same = serial.edges.size() == parallel.edges.size();
+    for(size_t i = 0; same && i < serial.edges.size(); ++i)
+    {
+        const osm::edge &a = serial.edges[i];
+        const osm::edge &b = parallel.edges[i];
+        same = a.from == b.from && a.to == b.to && a.kind == b.kind && a.shape.size() == b.shape.size();
+        for(size_t j = 0; same && j < a.shape.size(); ++j)
+            same = a.shape[j]->id == b.shape[j]->id && distance(a.shape[j]->xy, b.shape[j]->xy) == 0.0f;
+    }
+    std::cout << "Clean-up on 1 and " << threads << " threads " << (same ? "agrees" : "differs") << std::endl;
+    return same ? 0 : 1;
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+    std::cerr << libroad_package_string() << std::endl;
+
+    const str   osm_name(boost::str(boost::format("%s/osm-test-%d.osm") % (argc > 1 ? argv[1] : "/tmp") % getpid()));
+    const int   grid       = argc > 2 ? boost::lexical_cast<int>(argv[2]) : 16;
+    const float lane_width = 2.5f;
+
+    int errors = 0;
+    try
+    {
+        write_grid(osm_name, grid, 0.002);
+
+        osm::network onet(osm::load_network(osm_name.c_str()));
+        std::cout << onet.nodes.size() << " nodes, " << onet.edge_hash.size() << " highways" << std::endl;
+        errors += check_store(onet);
+        osm::network crossings(osm::load_network(osm_name.c_str()));
+        crossings.scale_and_translate();
+        errors += check_crossings(crossings, grid);
+#ifdef _OPENMP
+        errors += check_thread_independence(osm_name, lane_width);
+#endif
+    }
+    catch(std::exception &e)
+    {
+        std::cout << "Exception: " << e.what() << std::endl;
+        ++errors;
+    }
+    unlink(osm_name.c_str());
+
+    std::cout << errors << " errors" << std::endl;
+    return errors != 0;
+}
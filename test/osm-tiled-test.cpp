@@ -0,0 +1,241 @@
+#include <libroad/osm_network.hpp>
+#include <libroad/hwm_network.hpp>
+#include <iostream>
+#include <set>
+#include <iterator>
+#include <unistd.h>
+
+static void write_way(std::ostream &out, int &way_id, const int from, const int to, const char *highway)
+{
+    out << boost::format(" <way id=\"%d\"><nd ref=\"%d\"/><nd ref=\"%d\"/><tag k=\"highway\" v=\"%s\"/></way>\n")
+        % way_id++ % from % to % highway;
+}
+
+// A street grid, one way per block, with a dense patch of streets off its lower right corner. Two bypasses run
+// through the blocks, one way per block, so the passes join them into roads that cross the grid; they meet in the
+// middle and end at grid nodes.
+static void write_grid(const str &filename, const int grid, const double spacing)
+{
+    const int    patch      = 2*grid;
+    const double fine       = spacing*0.4;
+    const double patch_x    = grid*spacing;
+    const int    patch_base = 2000000;
+    const int    half_base  = 1000000;
+    const int    row        = grid/3;
+    const int    column     = grid/2;
+
+    std::ofstream out(filename.c_str());
+    out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<osm version=\"0.6\">\n";
+    out << boost::format(" <bounds minlat=\"%.7f\" minlon=\"%.7f\" maxlat=\"%.7f\" maxlon=\"%.7f\"/>\n")
+        % (-0.5*spacing) % (-0.5*spacing) % ((grid - 0.5)*spacing) % (patch_x + (patch - 0.5)*fine);
+    for(int y = 0; y < grid; ++y)
+        for(int x = 0; x < grid; ++x)
+            out << boost::format(" <node id=\"%d\" lat=\"%.7f\" lon=\"%.7f\"/>\n") % (100 + y*grid + x) % (y*spacing) % (x*spacing);
+    for(int y = 0; y + 1 < grid; ++y)
+        for(int x = 0; x + 1 < grid; ++x)
+            out << boost::format(" <node id=\"%d\" lat=\"%.7f\" lon=\"%.7f\"/>\n") % (half_base + y*grid + x) % ((y + 0.5)*spacing) % ((x + 0.5)*spacing);
+    for(int y = 0; y < patch; ++y)
+        for(int x = 0; x < patch; ++x)
+            out << boost::format(" <node id=\"%d\" lat=\"%.7f\" lon=\"%.7f\"/>\n") % (patch_base + y*patch + x) % (y*fine) % (patch_x + x*fine);
+
+    int way_id = 100000;
+    for(int y = 0; y < grid; ++y)
+        for(int x = 0; x < grid; ++x)
+        {
+            const int here = 100 + y*grid + x;
+            if(x + 1 < grid)
+                write_way(out, way_id, here, here + 1, y % 4 ? "residential" : "primary");
+            if(y + 1 < grid)
+                write_way(out, way_id, here, here + grid, x % 4 ? "residential" : "secondary");
+        }
+
+    write_way(out, way_id, 100 + row*grid, half_base + row*grid, "tertiary");
+    for(int x = 0; x + 2 < grid; ++x)
+        write_way(out, way_id, half_base + row*grid + x, half_base + row*grid + x + 1, "tertiary");
+    write_way(out, way_id, half_base + row*grid + grid - 2, 100 + (row + 1)*grid + grid - 1, "tertiary");
+
+    write_way(out, way_id, 100 + column, half_base + column, "tertiary");
+    for(int y = 0; y + 2 < grid; ++y)
+        write_way(out, way_id, half_base + y*grid + column, half_base + (y + 1)*grid + column, "tertiary");
+    write_way(out, way_id, half_base + (grid - 2)*grid + column, 100 + (grid - 1)*grid + column + 1, "tertiary");
+
+    for(int y = 0; y < patch; ++y)
+        for(int x = 0; x < patch; ++x)
+        {
+            const int here = patch_base + y*patch + x;
+            if(x + 1 < patch)
+                write_way(out, way_id, here, here + 1, "residential");
+            if(y + 1 < patch)
+                write_way(out, way_id, here, here + patch, "residential");
+        }
+    write_way(out, way_id, 100 + grid - 1, patch_base, "residential");
+    out << "</osm>\n";
+}
+
+static hwm::network in_memory(const str &filename, const float lane_width)
+{
+    osm::network onet(osm::load_network(filename.c_str()));
+    onet.clean_up(lane_width);
+    onet.populate_edge_hash_from_edges();
+
+    hwm::network net(hwm::from_osm("test", 0.5f, lane_width, onet));
+    net.build_intersections();
+    net.build_fictitious_lanes();
+    net.auto_scale_memberships();
+    return net;
+}
+
+// Names differ between the two conversions, so everything is described by where its roads run
+static str road_key(const hwm::road *r)
+{
+    const std::vector<vec3f> &p = r->rep.points_;
+    return boost::str(boost::format("%.2f,%.2f>%.2f,%.2f/%d") % p.front()[0] % p.front()[1] % p.back()[0] % p.back()[1] % p.size());
+}
+
+static str lane_key(const hwm::lane *l)
+{
+    if(!l)
+        return "none";
+    str res;
+    BOOST_FOREACH(const hwm::lane::road_membership::intervals::entry &e, l->road_memberships)
+    {
+        res += boost::str(boost::format("%s[%.3f,%.3f]@%.2f ") % road_key(e.second.parent_road) % e.second.interval[0] % e.second.interval[1] % e.second.lane_position);
+    }
+    return res;
+}
+
+static str intersection_key(const hwm::intersection *is)
+{
+    std::set<str> roads;
+    BOOST_FOREACH(const hwm::lane *l, is->incoming)
+    {
+        roads.insert(lane_key(l));
+    }
+    BOOST_FOREACH(const hwm::lane *l, is->outgoing)
+    {
+        roads.insert(lane_key(l));
+    }
+    str res("intersection");
+    BOOST_FOREACH(const str &r, roads)
+    {
+        res += " | " + r;
+    }
+    return res;
+}
+
+static str terminus_key(const hwm::lane::terminus *t)
+{
+    if(const hwm::lane::intersection_terminus *it = dynamic_cast<const hwm::lane::intersection_terminus*>(t))
+        return intersection_key(it->adjacent_intersection);
+    if(const hwm::lane::lane_terminus *lt = dynamic_cast<const hwm::lane::lane_terminus*>(t))
+        return "lane " + lane_key(lt->adjacent_lane);
+    return "end";
+}
+
+static std::multiset<str> describe(const hwm::network &net)
+{
+    std::multiset<str> res;
+    BOOST_FOREACH(const hwm::road_pair &rp, net.roads)
+    {
+        res.insert("road " + road_key(&(rp.second)));
+    }
+    BOOST_FOREACH(const hwm::lane_pair &lp, net.lanes)
+    {
+        const hwm::lane &l = lp.second;
+        str desc("lane " + lane_key(&l) + "from " + terminus_key(l.start) + " to " + terminus_key(l.end));
+        const hwm::lane::adjacency::intervals *sides[2] = {&(l.left), &(l.right)};
+        for(int s = 0; s < 2; ++s)
+        {
+            BOOST_FOREACH(const hwm::lane::adjacency::intervals::entry &e, *sides[s])
+            {
+                desc += boost::str(boost::format(" %s %.3f: %s") % (s ? "right" : "left") % e.first % lane_key(e.second.neighbor));
+            }
+        }
+        res.insert(desc);
+    }
+    BOOST_FOREACH(const hwm::intersection_pair &ip, net.intersections)
+    {
+        res.insert(boost::str(boost::format("%s, %d states") % intersection_key(&(ip.second)) % ip.second.states.size()));
+    }
+    return res;
+}
+
+static int compare(const hwm::network &tiled, const hwm::network &whole)
+{
+    const std::multiset<str> got(describe(tiled));
+    const std::multiset<str> want(describe(whole));
+    std::vector<str> extra, missing;
+    std::set_difference(got.begin(), got.end(), want.begin(), want.end(), std::back_inserter(extra));
+    std::set_difference(want.begin(), want.end(), got.begin(), got.end(), std::back_inserter(missing));
+    for(size_t i = 0; i < std::min(extra.size(), static_cast<size_t>(5)); ++i)
+        std::cout << "Only tiled: " << extra[i] << std::endl;
+    for(size_t i = 0; i < std::min(missing.size(), static_cast<size_t>(5)); ++i)
+        std::cout << "Only in memory: " << missing[i] << std::endl;
+    if(extra.empty() && missing.empty())
+        return 0;
+    std::cout << "Tiled conversion doesn't match the in-memory one: " << extra.size() << " extra and " << missing.size() << " missing" << std::endl;
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    std::cerr << libroad_package_string() << std::endl;
+
+    const str   base(boost::str(boost::format("%s/osm-tiled-test-%d") % (argc > 1 ? argv[1] : "/tmp") % getpid()));
+    const str   osm_name(base + ".osm");
+    const str   hwm_name(base + ".hwm.gz");
+    const int   grid       = argc > 2 ? boost::lexical_cast<int>(argv[2]) : 16;
+    const float lane_width = 2.5f;
+
+    int errors = 0;
+    try
+    {
+        write_grid(osm_name, grid, 0.002);
+
+        const hwm::network whole(in_memory(osm_name, lane_width));
+
+        // Small enough that the grid has to be cut up, and the patch further
+        hwm::tiled_options opt;
+        opt.memory_budget = 64 << 10;
+        hwm::tiled_report  report;
+        const size_t tiles = hwm::tiled_from_osm(osm_name.c_str(), hwm_name.c_str(), "test", 0.5f, lane_width, opt, &report);
+        std::cout << "Converted " << tiles << " tiles, " << report.depth << " deep, the largest estimated at " << report.largest_tile << " bytes" << std::endl;
+        if(tiles < 4)
+        {
+            std::cout << "Expected the budget to force at least 4 tiles" << std::endl;
+            ++errors;
+        }
+        if(report.largest_tile > opt.memory_budget || report.over_budget)
+        {
+            std::cout << "The largest tile doesn't fit the budget; " << report.over_budget << " tiles are over it" << std::endl;
+            ++errors;
+        }
+
+        hwm::network tiled(hwm::load_xml_network(hwm_name.c_str()));
+        tiled.build_fictitious_lanes();
+        try
+        {
+            tiled.check();
+        }
+        catch(std::runtime_error &e)
+        {
+            std::cout << "Tiled network doesn't check out: " << e.what() << std::endl;
+            ++errors;
+        }
+
+        std::cout << "In memory: " << whole.roads.size() << " roads, " << whole.lanes.size() << " lanes, " << whole.intersections.size() << " intersections" << std::endl;
+        std::cout << "Tiled:     " << tiled.roads.size() << " roads, " << tiled.lanes.size() << " lanes, " << tiled.intersections.size() << " intersections" << std::endl;
+        errors += compare(tiled, whole);
+    }
+    catch(std::exception &e)
+    {
+        std::cout << "Exception: " << e.what() << std::endl;
+        ++errors;
+    }
+
+    unlink(osm_name.c_str());
+    unlink(hwm_name.c_str());
+
+    std::cout << errors << " errors" << std::endl;
+    return errors != 0;
+}
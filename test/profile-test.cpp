@@ -0,0 +1,67 @@
+#include <libroad/profile.hpp>
+#include <sstream>
+
+int main(int argc, char *argv[])
+{
+    std::cerr << libroad_package_string() << std::endl;
+    std::cout << "Library profiling " << (profile::enabled() ? "on" : "off") << std::endl;
+
+    int errors = 0;
+
+    profile::reset();
+    {
+        profile::scope outer("outer");
+        profile::count("items", 2);
+        {
+            profile::scope inner("inner");
+            std::vector<char> block(32 << 20, 1);
+            profile::count("bytes", block.size());
+        }
+        profile::count("items", 3);
+        profile::add("timed elsewhere", 0.25);
+    }
+
+    const std::vector<profile::phase> &ps = profile::phases();
+    if(ps.size() != 3 || ps[0].name != "outer" || ps[1].name != "inner" || ps[2].name != "timed elsewhere")
+    {
+        std::cout << "Wrong phases" << std::endl;
+        ++errors;
+    }
+    else
+    {
+        if(ps[0].parent != -1 || ps[1].parent != 0 || ps[2].parent != 0 || ps[1].depth != 1)
+        {
+            std::cout << "Phases aren't nested right" << std::endl;
+            ++errors;
+        }
+        if(ps[0].counters.size() != 1 || ps[0].counters[0].second != 5.0 || ps[1].counters.size() != 1)
+        {
+            std::cout << "Counters didn't go to the open phase" << std::endl;
+            ++errors;
+        }
+        if(ps[0].seconds < ps[1].seconds || std::abs(ps[2].seconds - 0.25) > 1e-6)
+        {
+            std::cout << "Bad timings" << std::endl;
+            ++errors;
+        }
+#ifdef __linux__
+        if(ps[1].peak_rss_kb < 32*1024)
+        {
+            std::cout << "Peak RSS missed the block" << std::endl;
+            ++errors;
+        }
+#endif
+    }
+
+    std::ostringstream json;
+    profile::write_json(json);
+    std::cout << json.str();
+    if(json.str().find("\"name\": \"timed elsewhere\"") == std::string::npos)
+    {
+        std::cout << "Report is missing a phase" << std::endl;
+        ++errors;
+    }
+
+    std::cout << errors << " errors" << std::endl;
+    return errors != 0;
+}
@@ -0,0 +1,124 @@
+#include <libroad/projection.hpp>
+#include <libroad/hwm_network.hpp>
+#include <iostream>
+#include <cfloat>
+#include <unistd.h>
+
+static int check(const bool ok, const char *what)
+{
+    if(!ok)
+        std::cout << what << std::endl;
+    return !ok;
+}
+
+// Two edges of a .net.xml in UTM metres, as netconvert writes them with a projection and no offset
+static void write_projected_net(const str &filename)
+{
+    std::ofstream out(filename.c_str());
+    out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<net version=\"1.9\">\n"
+        << " <edge id=\"AB\" from=\"A\" to=\"B\" priority=\"1\">\n"
+        << "  <lane id=\"AB_0\" index=\"0\" speed=\"13.89\" length=\"300\" shape=\"500000.00,4000000.00 500150.00,4000010.00 500300.00,4000000.00\"/>\n"
+        << " </edge>\n"
+        << " <edge id=\"BC\" from=\"B\" to=\"C\" priority=\"1\">\n"
+        << "  <lane id=\"BC_0\" index=\"0\" speed=\"13.89\" length=\"400\" shape=\"500300.00,4000000.00 500290.00,4000200.00 500300.00,4000400.00\"/>\n"
+        << " </edge>\n"
+        << " <junction id=\"A\" type=\"dead_end\" x=\"500000.00\" y=\"4000000.00\"/>\n"
+        << " <junction id=\"B\" type=\"priority\" x=\"500300.00\" y=\"4000000.00\"/>\n"
+        << " <junction id=\"C\" type=\"dead_end\" x=\"500300.00\" y=\"4000400.00\"/>\n"
+        << " <connection from=\"AB\" to=\"BC\" fromLane=\"0\" toLane=\"0\"/>\n"
+        << "</net>\n";
+}
+
+int main(int argc, char *argv[])
+{
+    std::cerr << libroad_package_string() << std::endl;
+
+    int errors = 0;
+
+    // Zone 17 is centred on 81W
+    const projection::projector utm(projection::UTM, -79.0, 35.9);
+    double                      x, y;
+    utm.forward(-81.0, 0.0, x, y);
+    std::cout << "UTM zone " << utm.zone << ", 81W on the equator: " << x << " " << y << std::endl;
+    errors += check(utm.zone == 17 && std::abs(x - 500000.0) < 1e-6 && std::abs(y) < 1e-6, "Central meridian at the equator isn't (500000, 0)");
+
+    // Meridian arc to 45N is 4984944.4m, scaled by k0
+    utm.forward(-81.0, 45.0, x, y);
+    std::cout << "81W 45N: " << x << " " << y << std::endl;
+    errors += check(std::abs(x - 500000.0) < 1e-6 && std::abs(y - 0.9996*4984944.378) < 1.0, "Wrong northing at 45N");
+
+    const projection::projector merc(projection::WEB_MERCATOR, 0.0, 0.0);
+    merc.forward(180.0, 0.0, x, y);
+    errors += check(std::abs(x - 20037508.3428) < 1e-3 && std::abs(y) < 1e-6, "Web Mercator doesn't span 20037508m");
+
+    // Over a few km the projections should agree on distances to within UTM's scale error
+    const projection::projector eq(projection::EQUIRECTANGULAR, -79.05, 35.91);
+    const double                lon[2] = {-79.05, -79.02};
+    const double                lat[2] = {35.91, 35.93};
+    double                      ex[2], ey[2], ux[2], uy[2];
+    eq.forward(lon, lat, ex, ey, 2);
+    utm.forward(lon, lat, ux, uy, 2);
+    const double ed = std::sqrt((ex[1] - ex[0])*(ex[1] - ex[0]) + (ey[1] - ey[0])*(ey[1] - ey[0]));
+    const double ud = std::sqrt((ux[1] - ux[0])*(ux[1] - ux[0]) + (uy[1] - uy[0])*(uy[1] - uy[0]));
+    std::cout << "Equirectangular " << ed << "m, UTM " << ud << "m" << std::endl;
+    errors += check(std::abs(ed - ud) < 0.005*ud, "Equirectangular and UTM disagree on a short distance");
+
+    // Enough points for several blocks; each must match projecting it alone
+    const size_t        n = argc > 1 ? boost::lexical_cast<size_t>(argv[1]) : 20000;
+    std::vector<double> blon(n), blat(n), bx(n), by(n);
+    srand48(11);
+    for(size_t i = 0; i < n; ++i)
+    {
+        blon[i] = -79.5 + drand48();
+        blat[i] =  35.5 + drand48();
+    }
+    const projection::kind kinds[3] = {projection::EQUIRECTANGULAR, projection::WEB_MERCATOR, projection::UTM};
+    for(int k = 0; k < 3; ++k)
+    {
+        const projection::projector p(kinds[k], -79.0, 36.0);
+        p.forward(&(blon[0]), &(blat[0]), &(bx[0]), &(by[0]), n);
+        double worst = 0.0;
+        for(size_t i = 0; i < n; ++i)
+        {
+            p.forward(blon[i], blat[i], x, y);
+            worst = std::max(worst, std::max(std::abs(x - bx[i]), std::abs(y - by[i])));
+        }
+        std::cout << projection::kind_name(kinds[k]) << ": batch and single differ by " << worst << "m" << std::endl;
+        errors += check(worst < 1e-6, "Batch projection disagrees with single points");
+    }
+
+    // Re-centred, a degree of UTM fits in float to within half a float ulp at 70km, about 6mm
+    double origin[2];
+    utm.forward(-79.0, 36.0, origin[0], origin[1]);
+    utm.forward(&(blon[0]), &(blat[0]), &(bx[0]), &(by[0]), n);
+    std::vector<float>            fx(n), fy(n);
+    const projection::local_frame lf(projection::to_local(&(bx[0]), &(by[0]), n, origin, &(fx[0]), &(fy[0])));
+    double                        measured = 0.0;
+    for(size_t i = 0; i < n; ++i)
+    {
+        const double dx = fx[i] - (bx[i] - origin[0]);
+        const double dy = fy[i] - (by[i] - origin[1]);
+        measured = std::max(measured, std::sqrt(dx*dx + dy*dy));
+    }
+    std::cout << "Local frame: extent " << lf.max_extent << "m, max error " << lf.max_error << "m (measured " << measured << ")" << std::endl;
+    errors += check(lf.max_error == measured && lf.max_error < std::sqrt(0.5)*std::ldexp(1.0, -7) && lf.max_extent > 50000.0, "Local frame error isn't reported right");
+
+    // A projected .net.xml is moved onto the origin before it becomes floats
+    const str net_name(boost::str(boost::format("/tmp/projection-test-%d.net.xml") % getpid()));
+    write_projected_net(net_name);
+    sumo::network                 snet(sumo::load_net_xml(net_name.c_str()));
+    unlink(net_name.c_str());
+    const projection::local_frame sf(snet.recentre());
+    const hwm::network            hnet(hwm::from_sumo("projected", 0.5f, 3.2f, snet));
+    vec3f low(FLT_MAX);
+    vec3f high(-FLT_MAX);
+    hnet.bounding_box(low, high);
+    std::cout << "Projected net centred on (" << sf.origin[0] << ", " << sf.origin[1] << "), bounds " << low << " to " << high << std::endl;
+    errors += check(std::abs(sf.origin[0] - 500150.0) < 1e-6 && std::abs(sf.origin[1] - 4000200.0) < 1e-6, "Projected net isn't centred on its bounds");
+    errors += check(std::abs(low[0] + high[0]) < 5.0f && std::abs(low[1] + high[1]) < 5.0f && high[0] - low[0] > 250.0f,
+                    "Projected net's roads aren't about the origin");
+    errors += check(sf.max_error < 1e-4 && std::abs(sf.max_extent - std::sqrt(150.0*150.0 + 200.0*200.0)) < 1e-6, "Projected net's frame is wrong");
+
+    std::cout << errors << " errors" << std::endl;
+    return errors != 0;
+}
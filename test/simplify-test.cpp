@@ -0,0 +1,85 @@
+#include <libroad/arc_road.hpp>
+#include <iostream>
+
+// Largest distance from a point of v to the polyline s
+static float deviation(const std::vector<vec3f> &v, const std::vector<vec3f> &s)
+{
+    float worst = 0.0f;
+    BOOST_FOREACH(const vec3f &p, v)
+    {
+        float best = FLT_MAX;
+        for(size_t i = 0; i + 1 < s.size(); ++i)
+        {
+            const vec3f ab(s[i+1] - s[i]);
+            const float len2 = tvmet::dot(ab, ab);
+            const float t    = len2 > 0.0f ? std::min(1.0f, std::max(0.0f, tvmet::dot(vec3f(p - s[i]), ab)/len2)) : 0.0f;
+            best = std::min(best, distance(vec3f(s[i] + ab*t), p));
+        }
+        worst = std::max(worst, best);
+    }
+    return worst;
+}
+
+int main(int argc, char *argv[])
+{
+    std::cerr << libroad_package_string() << std::endl;
+
+    const float tolerance = argc > 1 ? boost::lexical_cast<float>(argv[1]) : 0.5f;
+    int         errors    = 0;
+
+    // A gentle S-curve sampled every metre, with up to 0.2m of noise on it
+    std::vector<vec3f> noisy;
+    srand48(7);
+    for(int i = 0; i <= 400; ++i)
+        noisy.push_back(vec3f(i, 40.0f*std::sin(i/400.0f*2.0f*M_PI) + 0.4f*(drand48() - 0.5f), 0.0f));
+
+    float                    reported;
+    const std::vector<vec3f> simple(simplify_polyline(noisy, tolerance, &reported));
+    const float              actual = deviation(noisy, simple);
+    std::cout << noisy.size() << " points simplified to " << simple.size() << ", max deviation " << reported << " (measured " << actual << ")" << std::endl;
+    if(distance(simple.front(), noisy.front()) > 0.0f || distance(simple.back(), noisy.back()) > 0.0f)
+    {
+        std::cout << "Ends weren't kept" << std::endl;
+        ++errors;
+    }
+    if(simple.size() >= noisy.size()/4)
+    {
+        std::cout << "Expected a bigger reduction" << std::endl;
+        ++errors;
+    }
+    if(reported > tolerance || actual > tolerance + 1e-4f || std::abs(reported - actual) > 1e-4f)
+    {
+        std::cout << "Deviation isn't bounded by the tolerance or isn't reported right" << std::endl;
+        ++errors;
+    }
+
+    arc_road ar;
+    if(!ar.initialize_from_polyline(0.0f, noisy))
+    {
+        std::cout << "Couldn't fit the noisy polyline" << std::endl;
+        ++errors;
+    }
+    else
+    {
+        const size_t before = ar.frames_.size();
+        const float  length = ar.length(0.0f);
+        float        refit_deviation;
+        if(!ar.refit(tolerance, 0.0f, &refit_deviation))
+        {
+            std::cout << "Couldn't refit" << std::endl;
+            ++errors;
+        }
+        else
+        {
+            std::cout << "Refit: " << 2*before+1 << " features to " << 2*ar.frames_.size()+1 << ", length " << length << " to " << ar.length(0.0f) << std::endl;
+            if(ar.frames_.size() >= before || refit_deviation > tolerance || std::abs(ar.length(0.0f) - length) > 0.01f*length)
+            {
+                std::cout << "Refit didn't shrink the road within tolerance" << std::endl;
+                ++errors;
+            }
+        }
+    }
+
+    std::cout << errors << " errors" << std::endl;
+    return errors != 0;
+}
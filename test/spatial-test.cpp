@@ -0,0 +1,745 @@
+#include <libroad/hwm_network.hpp>
+#include <iostream>
+#include <cstdlib>
+#include <set>
+
+typedef hwm::network_aux::lane_spatial lane_spatial;
+typedef hwm::network_aux::road_spatial road_spatial;
+typedef lane_spatial::hit              hit;
+typedef std::pair<size_t, size_t>      idx_pair;
+
+static const int   lane_samples = 512;
+static const float eps          = 1e-3f;
+static const float pos_slop     = 1e-2f; // how far a hit may be from where the samples put it, near the origin
+
+static bool contains(const aabb2d &r, const vec2f &p, const float slop)
+{
+    return p[0] >= r.bounds[0][0] - slop && p[0] <= r.bounds[1][0] + slop &&
+           p[1] >= r.bounds[0][1] - slop && p[1] <= r.bounds[1][1] + slop;
+}
+
+// Points on each lane's centerline at t = s/lane_samples, in the order of net.lanes
+typedef std::vector<std::vector<vec2f> > lane_points;
+
+static void sample_lanes(lane_points &res, const hwm::network &net)
+{
+    res.clear();
+    BOOST_FOREACH(const hwm::lane_pair &lp, net.lanes)
+    {
+        res.push_back(std::vector<vec2f>());
+        for(int s = 0; s <= lane_samples; ++s)
+        {
+            const vec3f p(lp.second.point(s/static_cast<float>(lane_samples)));
+            res.back().push_back(vec2f(p[0], p[1]));
+        }
+    }
+}
+
+struct leaf_key
+{
+    leaf_key(const lane_spatial::entry &e) : lane(e.lane), membership(e.membership), feature(e.feature)
+    {}
+
+    bool operator<(const leaf_key &o) const
+    {
+        if(lane != o.lane)
+            return lane < o.lane;
+        if(membership != o.membership)
+            return membership < o.membership;
+        return feature < o.feature;
+    }
+
+    bool operator==(const leaf_key &o) const
+    {
+        return lane == o.lane && membership == o.membership && feature == o.feature;
+    }
+
+    const hwm::lane                  *lane;
+    const hwm::lane::road_membership *membership;
+    size_t                            feature;
+};
+
+// Every point of a lane lies in the box of one of its leaves, in the leaf's part of the lane
+static int check_leaves(const lane_spatial &ls, const hwm::network &net, const lane_points &pts)
+{
+    int    errors = 0;
+    size_t k      = 0;
+    BOOST_FOREACH(const hwm::lane_pair &lp, net.lanes)
+    {
+        const std::vector<vec2f> &mine = pts[k++];
+        const strhash<std::vector<size_t> >::type::const_iterator li = ls.lane_items.find(lp.first);
+        if(li == ls.lane_items.end())
+        {
+            std::cout << "Lane " << lp.first << " has no leaves" << std::endl;
+            ++errors;
+            continue;
+        }
+
+        for(int s = 0; s <= lane_samples; ++s)
+        {
+            const float  t = s/static_cast<float>(lane_samples);
+            const vec2f &p = mine[s];
+            bool         found = false;
+            BOOST_FOREACH(const size_t i, li->second)
+            {
+                const lane_spatial::entry &e = ls.items[i];
+                if(e.lane == &(lp.second) &&
+                   t >= std::min(e.lane_interval[0], e.lane_interval[1]) - eps && t <= std::max(e.lane_interval[0], e.lane_interval[1]) + eps &&
+                   contains(e.rect, p, eps))
+                {
+                    found = true;
+                    break;
+                }
+            }
+            if(!found)
+            {
+                std::cout << "Lane " << lp.first << " at " << t << " isn't covered by its leaves" << std::endl;
+                ++errors;
+                break;
+            }
+        }
+    }
+    return errors;
+}
+
+// Box queries find exactly the leaves whose boxes overlap, and so every lane with a point in the box
+static int check_box_queries(const lane_spatial &ls, const hwm::network &net, const lane_points &pts, const int nqueries)
+{
+    int errors = 0;
+    for(int q = 0; q < nqueries; ++q)
+    {
+        aabb2d box;
+        for(int d = 0; d < 2; ++d)
+        {
+            const float lo   = ls.bounds.bounds[0][d];
+            const float span = ls.bounds.bounds[1][d] - lo;
+            const float a    = lo + span*drand48();
+            box.bounds[0][d] = a;
+            box.bounds[1][d] = a + 0.2f*span*drand48();
+        }
+
+        std::vector<leaf_key>      got;
+        std::set<const hwm::lane*> got_lanes;
+        BOOST_FOREACH(const lane_spatial::entry &e, ls.query(box))
+        {
+            got.push_back(leaf_key(e));
+            got_lanes.insert(e.lane);
+        }
+
+        std::vector<leaf_key> expected;
+        BOOST_FOREACH(const lane_spatial::entry &e, ls.items)
+        {
+            if(e.lane && e.rect.overlap(box))
+                expected.push_back(leaf_key(e));
+        }
+
+        std::sort(got.begin(), got.end());
+        std::sort(expected.begin(), expected.end());
+        if(got != expected)
+        {
+            std::cout << "Box query " << q << " found " << got.size() << " leaves, a scan finds " << expected.size() << std::endl;
+            ++errors;
+        }
+
+        size_t k = 0;
+        BOOST_FOREACH(const hwm::lane_pair &lp, net.lanes)
+        {
+            BOOST_FOREACH(const vec2f &p, pts[k++])
+            {
+                if(contains(box, p, 0.0f))
+                {
+                    if(!got_lanes.count(&(lp.second)))
+                    {
+                        std::cout << "Box query " << q << " misses lane " << lp.first << std::endl;
+                        ++errors;
+                    }
+                    break;
+                }
+            }
+        }
+    }
+    return errors;
+}
+
+static inline float cross2(const vec2f &a, const vec2f &b)
+{
+    return a[0]*b[1] - a[1]*b[0];
+}
+
+static inline vec2f planar(const vec3f &p)
+{
+    return vec2f(p[0], p[1]);
+}
+
+static float segment_distance(const vec2f &p, const vec2f &p0, const vec2f &p1)
+{
+    const vec2f r(p1 - p0);
+    const float l2 = tvmet::dot(r, r);
+    const float s  = l2 > 0.0f ? std::min(std::max(tvmet::dot(vec2f(p - p0), r)/l2, 0.0f), 1.0f) : 0.0f;
+    return distance(p, vec2f(p0 + s*r));
+}
+
+// Float steps grow with the coordinates
+static float slop_near(const vec2f &p0, const vec2f &p1)
+{
+    const float mag = std::max(std::max(std::abs(p0[0]), std::abs(p0[1])), std::max(std::abs(p1[0]), std::abs(p1[1])));
+    return pos_slop + 4e-6f*mag;
+}
+
+static bool has_hit(const std::vector<hit> &hits, const hwm::lane *l, const vec2f &p, const float slop)
+{
+    BOOST_FOREACH(const hit &h, hits)
+    {
+        if(h.lane == l && distance(planar(h.point), p) <= slop)
+            return true;
+    }
+    return false;
+}
+
+// Each hit lies on the segment, on its lane at h.t, at the distance it reports, nearest first
+static int check_hits(const std::vector<hit> &hits, const vec2f &p0, const vec2f &p1, const char *what)
+{
+    int         errors = 0;
+    const float slop   = slop_near(p0, p1);
+    for(size_t i = 0; i < hits.size(); ++i)
+    {
+        const hit  &h = hits[i];
+        const vec2f hp(planar(h.point));
+        if(segment_distance(hp, p0, p1) > slop || distance(hp, planar(h.lane->point(h.t))) > slop ||
+           std::abs(distance(hp, p0) - h.distance) > slop || (i && h.distance < hits[i-1].distance))
+        {
+            std::cout << what << ": bad hit on lane " << h.lane->id << " at " << h.t << " " << segment_distance(hp, p0, p1) << " " << distance(hp, planar(h.lane->point(h.t))) << " " << std::abs(distance(hp, p0) - h.distance) << " " << (i && h.distance < hits[i-1].distance) << std::endl;
+            ++errors;
+        }
+    }
+    return errors;
+}
+
+// Every crossing of p0-p1 with a sampled centerline is among the hits
+static int check_crossings(const std::vector<hit> &hits, const hwm::network &net, const lane_points &pts,
+                           const vec2f &p0, const vec2f &p1, const char *what)
+{
+    int         errors = 0;
+    const float slop   = slop_near(p0, p1);
+    const vec2f r(p1 - p0);
+    size_t      k = 0;
+    BOOST_FOREACH(const hwm::lane_pair &lp, net.lanes)
+    {
+        const std::vector<vec2f> &mine = pts[k++];
+        for(int s = 0; s < lane_samples; ++s)
+        {
+            const vec2f sv(mine[s+1] - mine[s]);
+            const float denom = cross2(r, sv);
+            if(std::abs(denom) < 1e-12f)
+                continue;
+
+            const vec2f diff(mine[s] - p0);
+            const float sp = cross2(diff, sv)/denom;
+            const float u  = cross2(diff, r)/denom;
+            if(sp <= eps || sp >= 1.0f - eps || u < 0.0f || u >= 1.0f)
+                continue;
+
+            const vec2f c(p0 + sp*r);
+            if(!has_hit(hits, &(lp.second), c, slop))
+            {
+                std::cout << what << ": misses lane " << lp.first << " at (" << c[0] << ", " << c[1] << ")" << std::endl;
+                ++errors;
+            }
+        }
+    }
+    return errors;
+}
+
+// The hits of each list are near hits of the other
+static int check_same_hits(const std::vector<hit> &a, const std::vector<hit> &b, const float slop, const char *what)
+{
+    int errors = 0;
+    BOOST_FOREACH(const hit &h, a)
+    {
+        if(!has_hit(b, h.lane, planar(h.point), slop))
+            ++errors;
+    }
+    BOOST_FOREACH(const hit &h, b)
+    {
+        if(!has_hit(a, h.lane, planar(h.point), slop))
+            ++errors;
+    }
+    if(errors)
+        std::cout << what << ": " << a.size() << " hits against " << b.size() << std::endl;
+    return errors;
+}
+
+// Random segments and rays against the sampled centerlines, and the batched query against single ones
+static int check_segment_queries(const lane_spatial &ls, const hwm::network &net, const lane_points &pts, const int nqueries)
+{
+    int                errors = 0;
+    std::vector<vec2f> p0s;
+    std::vector<vec2f> p1s;
+    const vec2f        span(ls.bounds.bounds[1][0] - ls.bounds.bounds[0][0], ls.bounds.bounds[1][1] - ls.bounds.bounds[0][1]);
+    const float        reach = 2.0f*length(span);
+    for(int q = 0; q < nqueries; ++q)
+    {
+        vec2f p0;
+        vec2f p1;
+        for(int d = 0; d < 2; ++d)
+        {
+            p0[d] = ls.bounds.bounds[0][d] + span[d]*drand48();
+            p1[d] = p0[d] + 0.3f*span[d]*(2.0f*drand48() - 1.0f);
+        }
+        p0s.push_back(p0);
+        p1s.push_back(p1);
+
+        const std::vector<hit> hits(ls.query_segment(p0, p1));
+        errors += check_hits(hits, p0, p1, "Segment query");
+        errors += check_crossings(hits, net, pts, p0, p1, "Segment query");
+
+        const vec2f            dir(p1 - p0);
+        const vec2f            far(p0 + reach/length(dir)*dir);
+        const std::vector<hit> ray_hits(ls.query_ray(p0, dir));
+        errors += check_hits(ray_hits, p0, far, "Ray query");
+        errors += check_same_hits(ray_hits, ls.query_segment(p0, far), slop_near(p0, far), "Ray query");
+    }
+
+    std::vector<std::vector<hit> > batch;
+    ls.query_segments(batch, p0s, p1s);
+    for(size_t q = 0; q < p0s.size(); ++q)
+    {
+        const std::vector<hit> single(ls.query_segment(p0s[q], p1s[q]));
+        bool                   same = batch[q].size() == single.size();
+        for(size_t i = 0; same && i < single.size(); ++i)
+            same = batch[q][i].lane == single[i].lane && batch[q][i].t == single[i].t && batch[q][i].distance == single[i].distance;
+        if(!same)
+        {
+            std::cout << "Batched segment query " << q << " differs from a single one" << std::endl;
+            ++errors;
+        }
+    }
+    return errors;
+}
+
+// Segments across, ending on, starting on and (on arcs) tangent to the middle of each leaf's part of its lane,
+// and across each lane's ends
+static int check_contact_hits(const lane_spatial &ls, const hwm::network &net)
+{
+    int errors = 0;
+    BOOST_FOREACH(const lane_spatial::entry &e, ls.items)
+    {
+        if(!e.lane)
+            continue;
+
+        const vec2f a(planar(e.lane->point(e.lane_interval[0])));
+        const vec2f b(planar(e.lane->point(e.lane_interval[1])));
+        if(distance(a, b) < eps)
+            continue;
+
+        // On an arc, the chord is parallel to the tangent at its middle
+        const vec2f tan((b - a)/distance(a, b));
+        const vec2f normal(-tan[1], tan[0]);
+        const vec2f q(planar(e.lane->point(0.5f*(e.lane_interval[0] + e.lane_interval[1]))));
+        const vec2f out(q + net.lane_width*normal);
+        const vec2f in(q - net.lane_width*normal);
+        const float slop = slop_near(out, in);
+
+        std::vector<hit> own;
+        lane_spatial::feature_hits(own, e, out, in);
+        if(own.size() != 1 || distance(planar(own[0].point), q) > slop || std::abs(own[0].distance - net.lane_width) > slop)
+        {
+            std::cout << "Feature " << e.feature << " of lane " << e.lane->id << " has " << own.size() << " hits across its middle" << std::endl;
+            ++errors;
+        }
+
+        if(!has_hit(ls.query_segment(out, in), e.lane, q, slop))
+        {
+            std::cout << "Segment across lane " << e.lane->id << " at " << e.feature << " misses it" << std::endl;
+            ++errors;
+        }
+        if(!has_hit(ls.query_segment(out, q), e.lane, q, slop))
+        {
+            std::cout << "Segment ending on lane " << e.lane->id << " at " << e.feature << " misses it" << std::endl;
+            ++errors;
+        }
+        if(!has_hit(ls.query_segment(q, out), e.lane, q, slop))
+        {
+            std::cout << "Segment starting on lane " << e.lane->id << " at " << e.feature << " misses it" << std::endl;
+            ++errors;
+        }
+        // Rounding puts the tangent just inside or outside the arc, and inside it cuts the arc twice on either side
+        // of q, metres apart on wide arcs; so it spans the chord and any hit of the lane on both will do
+        const float            half = 0.5f*distance(a, b);
+        const vec2f            t0(q - half*tan);
+        const vec2f            t1(q + half*tan);
+        const std::vector<hit> tangent_hits((e.feature & 1) ? ls.query_segment(t0, t1) : std::vector<hit>());
+        if((e.feature & 1) && (!has_hit(tangent_hits, e.lane, q, half) || check_hits(tangent_hits, t0, t1, "Tangent")))
+        {
+            std::cout << "Tangent to lane " << e.lane->id << " at " << e.feature << " misses it" << std::endl;
+            ++errors;
+        }
+    }
+
+    BOOST_FOREACH(const hwm::lane_pair &lp, net.lanes)
+    {
+        for(int end = 0; end < 2; ++end)
+        {
+            const mat4x4f frame(lp.second.point_frame(end));
+            const vec2f   q(frame(0, 3), frame(1, 3));
+            const vec2f   normal(frame(0, 1), frame(1, 1));
+            const vec2f   out(q + net.lane_width*normal);
+            const vec2f   in(q - net.lane_width*normal);
+            if(!has_hit(ls.query_segment(out, in), &(lp.second), q, slop_near(out, in)))
+            {
+                std::cout << "Segment across the " << (end ? "end" : "start") << " of lane " << lp.first << " misses it" << std::endl;
+                ++errors;
+            }
+        }
+    }
+    return errors;
+}
+
+static int check_lane_space(const lane_spatial &ls, const hwm::network &net, const char *what)
+{
+    lane_points pts;
+    sample_lanes(pts, net);
+    const int errors = check_leaves(ls, net, pts) + check_box_queries(ls, net, pts, 200) +
+                       check_segment_queries(ls, net, pts, 200) + check_contact_hits(ls, net);
+    if(errors)
+        std::cout << what << ": " << errors << " errors" << std::endl;
+    return errors;
+}
+
+static aabb2d random_box(const float extent, const float size)
+{
+    aabb2d box;
+    for(int d = 0; d < 2; ++d)
+    {
+        box.bounds[0][d] = extent*drand48();
+        box.bounds[1][d] = box.bounds[0][d] + size*drand48();
+    }
+    return box;
+}
+
+static int compare_pairs(std::vector<idx_pair> &got, std::vector<idx_pair> &expected, const char *what)
+{
+    std::sort(got.begin(), got.end());
+    std::sort(expected.begin(), expected.end());
+    if(got != expected)
+    {
+        std::cout << what << " found " << got.size() << " pairs, a scan finds " << expected.size() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// join and self_join against all pairs of boxes, on bulk-loaded trees deep enough to have interior nodes and on
+// trees built by insertion
+static int check_joins()
+{
+    static const int nbig   = 30000;
+    static const int nsmall = 2000;
+
+    std::vector<rtree2d::entry> big;
+    for(int i = 0; i < nbig; ++i)
+        big.push_back(rtree2d::entry(random_box(1000.0f, 4.0f), i));
+    std::vector<rtree2d::entry> small;
+    for(int i = 0; i < nsmall; ++i)
+        small.push_back(rtree2d::entry(random_box(1000.0f, 20.0f), i));
+
+    rtree2d *big_tree   = rtree2d::hilbert_rtree(big);
+    rtree2d *small_tree = new rtree2d();
+    for(int i = 0; i < nsmall; ++i)
+        small_tree->insert(small[i]);
+
+    int errors = 0;
+    {
+        std::vector<idx_pair> got;
+        big_tree->join(got, *small_tree);
+        std::vector<idx_pair> expected;
+        for(int i = 0; i < nbig; ++i)
+            for(int j = 0; j < nsmall; ++j)
+                if(big[i].rect.overlap(small[j].rect))
+                    expected.push_back(std::make_pair(i, j));
+        errors += compare_pairs(got, expected, "Join");
+    }
+    {
+        std::vector<idx_pair> got;
+        small_tree->join(got, *big_tree);
+        std::vector<idx_pair> expected;
+        for(int i = 0; i < nsmall; ++i)
+            for(int j = 0; j < nbig; ++j)
+                if(small[i].rect.overlap(big[j].rect))
+                    expected.push_back(std::make_pair(i, j));
+        errors += compare_pairs(got, expected, "Join with an inserted tree first");
+    }
+    {
+        std::vector<idx_pair> got;
+        big_tree->self_join(got);
+        std::vector<idx_pair> expected;
+        for(int i = 0; i < nbig; ++i)
+            for(int j = i + 1; j < nbig; ++j)
+                if(big[i].rect.overlap(big[j].rect))
+                    expected.push_back(std::make_pair(i, j));
+        errors += compare_pairs(got, expected, "Self join");
+    }
+    {
+        std::vector<idx_pair> got;
+        small_tree->self_join(got);
+        std::vector<idx_pair> expected;
+        for(int i = 0; i < nsmall; ++i)
+            for(int j = i + 1; j < nsmall; ++j)
+                if(small[i].rect.overlap(small[j].rect))
+                    expected.push_back(std::make_pair(i, j));
+        errors += compare_pairs(got, expected, "Self join of an inserted tree");
+    }
+
+    delete big_tree;
+    delete small_tree;
+    if(errors)
+        std::cout << "Joins: " << errors << " errors" << std::endl;
+    return errors;
+}
+
+// A lane_cont's band: a grid of points across and along it, and its middle
+struct band
+{
+    enum {across = 5};
+
+    band(const road_spatial::entry &e, const float lane_width) : road(0)
+    {
+        if(!e.lc)
+            return;
+
+        const hwm::network_aux::road_rev_map::lane_cont &lc(*e.lc);
+        road = lc.begin()->second.membership->parent_road;
+        const float low  = lc.begin()->first - lane_width/2;
+        const float high = boost::prior(lc.end())->first + lane_width/2;
+        const float mid  = 0.5f*(low + high);
+        half             = 0.5f*(high - low);
+
+        const arc_road &ar(road->rep);
+        const int       n = std::max(8, static_cast<int>(std::ceil(ar.length(mid)*std::abs(e.interval[1] - e.interval[0])/half)));
+        spacing           = 0.0f;
+        for(int i = 0; i <= n; ++i)
+        {
+            const float t = e.interval[0] + (e.interval[1] - e.interval[0])*i/static_cast<float>(n);
+            for(int k = 0; k < across; ++k)
+            {
+                grid.push_back(planar(ar.point(t, low + (high - low)*k/static_cast<float>(across - 1))));
+                bounds.enclose_point(grid.back()[0], grid.back()[1]);
+            }
+            middle.push_back(planar(ar.point(t, mid)));
+            if(i)
+                spacing = std::max(spacing, distance(middle[i], middle[i-1]));
+        }
+    }
+
+    // Distance to the middle; at_end says the nearest point is an end of it
+    float distance_to(const vec2f &p, const float reach, bool &at_end) const
+    {
+        float best = std::numeric_limits<float>::max();
+        at_end     = false;
+        if(p[0] < bounds.bounds[0][0] - reach || p[0] > bounds.bounds[1][0] + reach ||
+           p[1] < bounds.bounds[0][1] - reach || p[1] > bounds.bounds[1][1] + reach)
+            return best;
+
+        for(size_t i = 0; i + 1 < middle.size(); ++i)
+        {
+            const vec2f r(middle[i+1] - middle[i]);
+            const float l2 = tvmet::dot(r, r);
+            const float s  = l2 > 0.0f ? tvmet::dot(vec2f(p - middle[i]), r)/l2 : 0.0f;
+            const float d  = segment_distance(p, middle[i], middle[i+1]);
+            if(d < best)
+            {
+                best   = d;
+                at_end = (i == 0 && s <= 0.0f) || (i + 2 == middle.size() && s >= 1.0f);
+            }
+        }
+        return best;
+    }
+
+    bool near(const band &o, const float reach) const
+    {
+        for(int d = 0; d < 2; ++d)
+        {
+            if(bounds.bounds[0][d] > o.bounds.bounds[1][d] + reach || o.bounds.bounds[0][d] > bounds.bounds[1][d] + reach)
+                return false;
+        }
+        return true;
+    }
+
+    // Some point well inside this band is well inside o
+    bool surely_overlaps(const band &o) const
+    {
+        if(!near(o, o.half))
+            return false;
+
+        const size_t rows = grid.size()/across;
+        for(size_t i = 1; i + 1 < rows; ++i)
+        {
+            for(int k = 1; k < across - 1; ++k)
+            {
+                bool        at_end;
+                const float d = o.distance_to(grid[i*across + k], o.half, at_end);
+                if(d < 0.5f*o.half && !at_end)
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    // Some point of this band is within sampling error of o
+    bool maybe_overlaps(const band &o) const
+    {
+        const float reach = o.half + spacing + o.spacing;
+        if(!near(o, reach))
+            return false;
+
+        BOOST_FOREACH(const vec2f &p, grid)
+        {
+            bool at_end;
+            if(o.distance_to(p, reach, at_end) <= reach)
+                return true;
+        }
+        return false;
+    }
+
+    const hwm::road   *road;
+    float              half;
+    float              spacing;
+    std::vector<vec2f> grid;
+    std::vector<vec2f> middle;
+    aabb2d             bounds;
+};
+
+// overlapping reports each pair of bands on different roads once, every pair a scan over all pairs finds
+// overlapping well inside both, and no pair the scan finds apart
+static int check_overlapping(const road_spatial &rs, const float lane_width)
+{
+    std::vector<band> bands;
+    BOOST_FOREACH(const road_spatial::entry &e, rs.items)
+    {
+        bands.push_back(band(e, lane_width));
+    }
+
+    int                errors = 0;
+    std::set<idx_pair> got;
+    BOOST_FOREACH(const idx_pair &ip, rs.overlapping(lane_width, 0.1f))
+    {
+        const band &a = bands[ip.first];
+        const band &b = bands[ip.second];
+        if(ip.first >= ip.second || !got.insert(ip).second || !a.road || !b.road || a.road == b.road ||
+           !(a.maybe_overlaps(b) || b.maybe_overlaps(a)))
+        {
+            std::cout << "Overlap of " << ip.first << " and " << ip.second << " is wrong" << std::endl;
+            ++errors;
+        }
+    }
+
+    size_t surely = 0;
+    for(size_t i = 0; i < bands.size(); ++i)
+    {
+        for(size_t j = i + 1; j < bands.size(); ++j)
+        {
+            const band &a = bands[i];
+            const band &b = bands[j];
+            if(!a.road || !b.road || a.road == b.road || !(a.surely_overlaps(b) || b.surely_overlaps(a)))
+                continue;
+
+            ++surely;
+            if(!got.count(std::make_pair(i, j)))
+            {
+                std::cout << "Overlap of " << a.road->id << " and " << b.road->id << " is missed" << std::endl;
+                ++errors;
+            }
+        }
+    }
+
+    if(!surely)
+    {
+        std::cout << "No bands overlap; nothing was checked" << std::endl;
+        ++errors;
+    }
+    if(errors)
+        std::cout << "Road overlaps: " << errors << " errors" << std::endl;
+    return errors;
+}
+
+// Shifts every fourth road so that bands cross and lie over each other, and slides one road a quarter of its
+// length along another like it, so that neither band's edges cross the other's
+static void shift_roads(hwm::network &net, const aabb2d &b)
+{
+    const float             shift = 0.1f*std::max(b.bounds[1][0] - b.bounds[0][0], b.bounds[1][1] - b.bounds[0][1]);
+    std::vector<hwm::road*> kept;
+    int                     n = 0;
+    BOOST_FOREACH(hwm::road_pair &rp, net.roads)
+    {
+        if(n++ % 4 == 0)
+            rp.second.translate(vec3f(shift*(2.0f*drand48() - 1.0f), shift*(2.0f*drand48() - 1.0f), 0.0f));
+        else
+            kept.push_back(&(rp.second));
+    }
+
+    for(size_t i = 0; i < kept.size(); ++i)
+    {
+        const vec3f a0(kept[i]->rep.points_.front());
+        const vec3f a1(kept[i]->rep.points_.back());
+        const float alen = distance(a0, a1);
+        for(size_t j = i + 1; j < kept.size(); ++j)
+        {
+            const vec3f b0(kept[j]->rep.points_.front());
+            const vec3f b1(kept[j]->rep.points_.back());
+            if(alen > 0.0f && std::abs(distance(b0, b1) - alen) < eps && distance(vec3f(b1 - b0), vec3f(a1 - a0)) < eps)
+            {
+                kept[j]->translate(vec3f(a0 - b0 + 0.25f*(a1 - a0)));
+                return;
+            }
+        }
+    }
+    std::cout << "No two roads are alike; containment isn't checked" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    std::cerr << libroad_package_string() << std::endl;
+    if(argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <input network>" << std::endl;
+        return 1;
+    }
+
+    srand48(1);
+
+    int errors = 0;
+    try
+    {
+        hwm::network net(hwm::load_xml_network(argv[1]));
+        net.build_intersections();
+        net.build_fictitious_lanes();
+
+        hwm::network_aux aux(net);
+        errors += check_lane_space(aux.lane_space, net, "Built lane index");
+
+        // Take some lanes out and put them back, so the tree is also exercised incrementally
+        int n = 0;
+        BOOST_FOREACH(hwm::lane_pair &lp, net.lanes)
+        {
+            if(n++ % 3)
+                continue;
+            aux.lane_space.remove_lane(lp.first);
+            aux.lane_space.add_lane(net.lane_width, &(lp.second));
+        }
+        errors += check_lane_space(aux.lane_space, net, "Updated lane index");
+
+        errors += check_joins();
+
+        shift_roads(net, aux.lane_space.bounds);
+        hwm::network_aux shifted(net);
+        errors += check_overlapping(shifted.road_space, net.lane_width);
+    }
+    catch(std::runtime_error &e)
+    {
+        std::cout << "Error: " << e.what() << std::endl;
+        ++errors;
+    }
+
+    std::cout << errors << " errors" << std::endl;
+    return errors != 0;
+}
@@ -0,0 +1,332 @@
+#include <libroad/hwm_network.hpp>
+#include <iostream>
+#include <fstream>
+#include <set>
+#include <unistd.h>
+
+typedef std::set<std::string> movement_set;
+
+struct expected_state
+{
+    float       duration;
+    const char *movements[3];
+};
+
+// tl-junction.net.xml's light: its first phase splits in two, its yellow phases give nothing, and only the first
+// program counts
+static const expected_state expected[] = {{15.0f, {"WC_00>CE_00", "EC_00>CW_00", 0}},
+                                          {15.0f, {"WC_00>CN_00", "EC_00>CS_00", 0}},
+                                          {20.0f, {"NC_00>CS_00", "SC_00>CN_00", 0}}};
+
+static movement_set movements(const hwm::intersection &is, const hwm::intersection::state &st)
+{
+    movement_set res;
+    BOOST_FOREACH(const hwm::intersection::state::state_pair &sp, st.in_pair())
+    {
+        res.insert(std::string(is.incoming[sp.in_idx]->id) + ">" + std::string(is.outgoing[sp.out_idx]->id));
+    }
+    return res;
+}
+
+// Every fictitious lane is on exactly when the current state lets its movement go
+static int check_flags(const hwm::intersection &is)
+{
+    std::set<const hwm::lane*> on;
+    BOOST_FOREACH(const hwm::intersection::state::state_pair &sp, is.states[is.current_state].in_pair())
+    {
+        on.insert(sp.fict_lane);
+    }
+    int errors = 0;
+    BOOST_FOREACH(const hwm::lane_pair &lp, is.fict_lanes)
+    {
+        if(lp.second.active != (on.count(&(lp.second)) != 0))
+        {
+            std::cout << "In state " << is.current_state << ", " << lp.first << " is " << (lp.second.active ? "on" : "off") << std::endl;
+            ++errors;
+        }
+    }
+    return errors;
+}
+
+// A T of three-file SUMO input, without connections: A-B is two lanes spread right, B-C one lane, B-D two lanes
+// spread center. With degenerate, D-E goes on from D but has no length, so it can't be fitted.
+static void write_legacy(const str &base, const bool degenerate=false)
+{
+    std::ofstream nodes((base + ".nod.xml").c_str());
+    nodes << "<nodes>\n"
+          << " <node id=\"A\" x=\"0\" y=\"0\"/>\n"
+          << " <node id=\"B\" x=\"100\" y=\"0\" type=\"priority\"/>\n"
+          << " <node id=\"C\" x=\"100\" y=\"100\"/>\n"
+          << " <node id=\"D\" x=\"200\" y=\"0\"/>\n";
+    if(degenerate)
+        nodes << " <node id=\"E\" x=\"200\" y=\"0\"/>\n";
+    nodes << "</nodes>\n";
+
+    std::ofstream types((base + ".typ.xml").c_str());
+    types << "<types>\n"
+          << " <type id=\"one\" priority=\"1\" nolanes=\"1\" speed=\"13.9\"/>\n"
+          << " <type id=\"two\" priority=\"2\" nolanes=\"2\" speed=\"27.8\"/>\n"
+          << "</types>\n";
+
+    std::ofstream edges((base + ".edg.xml").c_str());
+    edges << "<edges>\n"
+          << " <edge id=\"AB\" fromnode=\"A\" tonode=\"B\" type=\"two\" spread=\"right\"/>\n"
+          << " <edge id=\"BC\" fromnode=\"B\" tonode=\"C\" type=\"one\"/>\n"
+          << " <edge id=\"BD\" fromnode=\"B\" tonode=\"D\" type=\"two\" spread=\"center\" shape=\"150,10\"/>\n";
+    if(degenerate)
+        edges << " <edge id=\"DE\" fromnode=\"D\" tonode=\"E\" type=\"one\"/>\n";
+    edges << "</edges>\n";
+}
+
+static void remove_legacy(const str &base)
+{
+    unlink((base + ".nod.xml").c_str());
+    unlink((base + ".typ.xml").c_str());
+    unlink((base + ".edg.xml").c_str());
+}
+
+static sumo::network load_legacy(const str &base)
+{
+    return sumo::load_xml_network((base + ".nod.xml").c_str(), (base + ".typ.xml").c_str(), (base + ".edg.xml").c_str());
+}
+
+// Positions are in lane widths
+struct expected_lane
+{
+    const char *id;
+    float       position;
+    const char *right;
+    const char *left;
+    bool        start_at_b;
+    bool        end_at_b;
+};
+
+static const hwm::lane *find_lane(const hwm::network &net, const char *id)
+{
+    const hwm::lane_map::const_iterator found = net.lanes.find(id);
+    if(found == net.lanes.end())
+        throw std::runtime_error(boost::str(boost::format("No lane %s") % id));
+    return &(found->second);
+}
+
+// The three-file path gets the same layout as a .net.xml: SUMO lane order, termini at nodes more than one edge
+// meets and plain termini elsewhere, and intersections with no states, as there are no connections to make them of
+static int check_legacy(const str &base, const float lane_width)
+{
+    write_legacy(base);
+    const sumo::network snet(load_legacy(base));
+    remove_legacy(base);
+    const hwm::network  net(hwm::from_sumo("legacy", 0.5f, lane_width, snet));
+
+    int errors = 0;
+    if(net.intersections.size() != 1 || !net.intersections.count("B") || !net.intersections.find("B")->second.states.empty())
+    {
+        std::cout << "The legacy network should have one intersection, B, with no states" << std::endl;
+        ++errors;
+    }
+
+    const expected_lane lanes[] = {{"AB_00", -1.5f, 0,       "AB_01", false, true},
+                                   {"AB_01", -0.5f, "AB_00", 0,       false, true},
+                                   {"BC_00", -0.5f, 0,       0,       true,  false},
+                                   {"BD_00", -0.5f, 0,       "BD_01", true,  false},
+                                   {"BD_01",  0.5f, "BD_00", 0,       true,  false}};
+
+    BOOST_FOREACH(const expected_lane &el, lanes)
+    {
+        const hwm::lane *l = find_lane(net, el.id);
+        const float      position = l->road_memberships.begin()->second.lane_position;
+        if(std::abs(position - el.position*lane_width) > 1e-4f)
+        {
+            std::cout << el.id << " sits at " << position << ", not " << el.position*lane_width << std::endl;
+            ++errors;
+        }
+
+        const hwm::lane *right = l->right.empty() ? 0 : l->right.begin()->second.neighbor;
+        const hwm::lane *left  = l->left.empty()  ? 0 : l->left.begin()->second.neighbor;
+        if(right != (el.right ? find_lane(net, el.right) : 0) || left != (el.left ? find_lane(net, el.left) : 0))
+        {
+            std::cout << el.id << " has the wrong neighbours" << std::endl;
+            ++errors;
+        }
+
+        const bool start_at_b = dynamic_cast<const hwm::lane::intersection_terminus*>(l->start) != 0;
+        const bool end_at_b   = dynamic_cast<const hwm::lane::intersection_terminus*>(l->end)   != 0;
+        if(!l->start || !l->end || start_at_b != el.start_at_b || end_at_b != el.end_at_b)
+        {
+            std::cout << el.id << " has the wrong termini" << std::endl;
+            ++errors;
+        }
+    }
+
+    try
+    {
+        net.check();
+    }
+    catch(std::runtime_error &e)
+    {
+        std::cout << "Legacy network: " << e.what() << std::endl;
+        ++errors;
+    }
+    return errors;
+}
+
+// A road that can't be fitted makes the conversion throw, unless there is a report to list it in; then it is left
+// out, and D, which it made a junction of, isn't one
+static int check_unfittable(const str &base, const float lane_width)
+{
+    write_legacy(base, true);
+    const sumo::network snet(load_legacy(base));
+    remove_legacy(base);
+
+    int errors = 0;
+    try
+    {
+        hwm::from_sumo("unfittable", 0.5f, lane_width, snet);
+        std::cout << "An unfittable road didn't throw without a report" << std::endl;
+        ++errors;
+    }
+    catch(std::runtime_error &e)
+    {
+    }
+
+    hwm::simplify_report report;
+    const hwm::network   net(hwm::from_sumo("unfittable", 0.5f, lane_width, snet, 0.0f, &report));
+    if(report.failures.size() != 1 || report.failures.front().road != "DE" || report.roads != 3)
+    {
+        std::cout << report.failures.size() << " roads failed and " << report.roads << " were fitted, not DE and 3" << std::endl;
+        ++errors;
+    }
+    if(net.roads.count("DE") || net.lanes.count("DE_00") || net.roads.size() != 3 || net.lanes.size() != 5)
+    {
+        std::cout << "DE wasn't left out: " << net.roads.size() << " roads, " << net.lanes.size() << " lanes" << std::endl;
+        ++errors;
+    }
+    if(net.intersections.size() != 1 || !net.intersections.count("B"))
+    {
+        std::cout << "Leaving out DE should leave B the only intersection" << std::endl;
+        ++errors;
+    }
+    try
+    {
+        net.check();
+    }
+    catch(std::runtime_error &e)
+    {
+        std::cout << "Without DE: " << e.what() << std::endl;
+        ++errors;
+    }
+    return errors;
+}
+
+int main(int argc, char *argv[])
+{
+    std::cerr << libroad_package_string() << std::endl;
+    if(argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <tl-junction.net.xml> [scratch directory]" << std::endl;
+        return 1;
+    }
+
+    int errors = 0;
+    try
+    {
+        const sumo::network snet(sumo::load_net_xml(argv[1]));
+        const hwm::network  net(hwm::from_sumo("tl-junction", 0.5f, 3.2f, snet));
+
+        const hwm::intersection_map::const_iterator found = net.intersections.find("C");
+        if(found == net.intersections.end())
+            throw std::runtime_error("No intersection C");
+        const hwm::intersection &is = found->second;
+
+        const size_t nexpected = sizeof(expected)/sizeof(expected[0]);
+        if(is.states.size() != nexpected)
+        {
+            std::cout << "C has " << is.states.size() << " states, not " << nexpected << std::endl;
+            ++errors;
+        }
+
+        for(size_t i = 0; i < std::min(is.states.size(), nexpected); ++i)
+        {
+            const hwm::intersection::state &st = is.states[i];
+            if(std::abs(st.duration - expected[i].duration) > 1e-4f)
+            {
+                std::cout << "State " << i << " lasts " << st.duration << "s, not " << expected[i].duration << "s" << std::endl;
+                ++errors;
+            }
+
+            movement_set want;
+            for(int m = 0; m < 3 && expected[i].movements[m]; ++m)
+                want.insert(expected[i].movements[m]);
+            const movement_set got(movements(is, st));
+            if(got != want)
+            {
+                std::cout << "State " << i << " lets";
+                BOOST_FOREACH(const std::string &m, got)
+                {
+                    std::cout << " " << m;
+                }
+                std::cout << " go" << std::endl;
+                ++errors;
+            }
+        }
+
+        // The dead ends aren't junctions
+        if(net.intersections.size() != 1)
+        {
+            std::cout << net.intersections.size() << " intersections, not 1" << std::endl;
+            ++errors;
+        }
+
+        // Let the last state share the first's straight movement, then walk the states twice; only the current
+        // state's lanes may be active, and a shared lane has to stay on across the change
+        hwm::network       shared(net);
+        hwm::intersection &sis = shared.intersections.find("C")->second;
+        const hwm::intersection::state::state_pair &first = *(sis.states.front().in_pair().begin());
+        const hwm::intersection::state::state_pair  sp(first.in_idx, first.out_idx);
+        if(!sis.states.back().state_pairs.insert(sp).second)
+            throw std::runtime_error("Couldn't share a movement between states");
+        sis.rebuild(3.2f);
+        if(sis.fict_lanes.size() != 6)
+        {
+            std::cout << "Sharing a movement made " << sis.fict_lanes.size() << " fictitious lanes, not 6" << std::endl;
+            ++errors;
+        }
+        const hwm::lane *shared_lane = sis.states.front().in_pair().find(sp.in_idx)->fict_lane;
+        if(!shared_lane || sis.states.back().in_pair().find(sp.in_idx)->fict_lane != shared_lane)
+        {
+            std::cout << "The first and last states don't point at the same fictitious lane" << std::endl;
+            ++errors;
+        }
+        for(size_t i = 0; i <= 2*sis.states.size(); ++i)
+        {
+            errors += check_flags(sis);
+            if(shared_lane && (sis.current_state == 0 || sis.current_state + 1 == sis.states.size()) && !shared_lane->active)
+            {
+                std::cout << "Shared lane is off in state " << sis.current_state << std::endl;
+                ++errors;
+            }
+            try
+            {
+                sis.check();
+            }
+            catch(std::runtime_error &e)
+            {
+                std::cout << "In state " << sis.current_state << ": " << e.what() << std::endl;
+                ++errors;
+            }
+            sis.advance_state();
+        }
+
+        const str scratch(boost::str(boost::format("%s/sumo-states-test-%d") % (argc > 2 ? argv[2] : "/tmp") % getpid()));
+        errors += check_legacy(scratch, 3.2f);
+        errors += check_unfittable(scratch, 3.2f);
+    }
+    catch(std::runtime_error &e)
+    {
+        std::cout << "Error: " << e.what() << std::endl;
+        ++errors;
+    }
+
+    std::cout << errors << " errors" << std::endl;
+    return errors != 0;
+}
@@ -6,15 +6,16 @@
 int main(int argc, char *argv[])
 {
     std::cerr << libroad_package_string() << std::endl;
-    if(argc < 4)
+    if(argc != 2 && argc != 4)
     {
         std::cerr << "Usage: " << argv[0] << " <node file> <edge type file> <edge file>" << std::endl;
+        std::cerr << "       " << argv[0] << " <net.xml file>" << std::endl;
         return 1;
     }
 
-    sumo::network net = sumo::load_xml_network(argv[1],
-                                               argv[2],
-                                               argv[3]);
+    sumo::network net = argc == 2 ? sumo::load_net_xml(argv[1]) : sumo::load_xml_network(argv[1],
+                                                                                      argv[2],
+                                                                                      argv[3]);
 
     {
         typedef std::pair<std::string, sumo::node> maptype;
@@ -45,6 +46,14 @@ int main(int argc, char *argv[])
         }
     }
 
+    BOOST_FOREACH(const sumo::connection &c, net.connections)
+    {
+        std::cout << c.from->id << "_" << c.from_lane << " -> " << c.to->id << "_" << c.to_lane;
+        if(!c.tl.empty())
+            std::cout << " tl " << c.tl << " " << c.link_index;
+        std::cout << std::endl;
+    }
+
     if(net.check())
         std::cout << "Network checks out" << std::endl;
     else
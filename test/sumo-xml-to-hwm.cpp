@@ -1,4 +1,5 @@
 #include <libroad/hwm_network.hpp>
+#include <libroad/profile.hpp>
 #include <iostream>
 
 #include <boost/foreach.hpp>
@@ -6,18 +7,36 @@
 int main(int argc, char *argv[])
 {
     std::cerr << libroad_package_string() << std::endl;
-    if(argc < 5)
+    if(argc != 3 && argc != 5)
     {
         std::cerr << "Usage: " << argv[0] << " <node file> <edge type file> <edge file> <hwm output file>" << std::endl;
+        std::cerr << "       " << argv[0] << " <net.xml file> <hwm output file>" << std::endl;
         return 1;
     }
 
-    sumo::network snet(sumo::load_xml_network(argv[1],
-                                              argv[2],
-                                              argv[3]));
-    std::cerr << "SUMO input net loaded successfully" << std::endl;
+    sumo::network snet(argc == 3 ? sumo::load_net_xml(argv[1]) : sumo::load_xml_network(argv[1],
+                                                                                         argv[2],
+                                                                                         argv[3]));
+    std::cerr << "SUMO input net loaded successfully: " << snet.edges.size() << " edges, " << snet.connections.size() << " connections" << std::endl;
+    if(argc == 3)
+    {
+        // netconvert writes projected coordinates, which can be far from the origin for float
+        const projection::local_frame frame(snet.recentre());
+        std::cerr << boost::format("Centred on (%.2f, %.2f): extent %.0fm, max float error %.4fm")
+            % frame.origin[0] % frame.origin[1] % frame.max_extent % frame.max_error << std::endl;
+    }
 
-    hwm::network hnet(hwm::from_sumo("test", 0.5f, 2.5f, snet));
+    hwm::simplify_report report;
+    hwm::network         hnet(hwm::from_sumo("test", 0.5f, 2.5f, snet, 0.0f, &report));
+    BOOST_FOREACH(const hwm::simplify_report::failure &f, report.failures)
+    {
+        std::cerr << "Left out road " << f.road << ": " << f.reason << std::endl;
+    }
+    if(!snet.connections.empty())
+    {
+        hnet.build_intersections();
+        hnet.build_fictitious_lanes();
+    }
 
     try
     {
@@ -26,7 +45,7 @@ int main(int argc, char *argv[])
     }
     catch(std::runtime_error &e)
     {
-        std::cerr << "Derived HWM net doesn't check out" << std::endl;
+        std::cerr << "Derived HWM net doesn't check out: " << e.what() << std::endl;
         exit(1);
     }
 
@@ -93,7 +112,11 @@ int main(int argc, char *argv[])
         std::cout << " } " << std::endl;
     }
 
-    hnet.xml_write(argv[4]);
+    hnet.xml_write(argv[argc-1]);
+
+    // Phase timings, counters and memory as JSON, in a build configured with --enable-profile
+    if(const char *report = getenv("LIBROAD_PROFILE_JSON"))
+        profile::write_json(report);
 
     return 0;
 }
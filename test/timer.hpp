@@ -0,0 +1,14 @@
+#ifndef _TIMER_HPP_
+#define _TIMER_HPP_
+
+#include <time.h>
+
+// Seconds on a monotonic clock, for the timings the tests print
+static inline double time_now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+#endif
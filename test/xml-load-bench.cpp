@@ -0,0 +1,273 @@
+#include <libroad/hwm_network.hpp>
+#include <libroad/xml_util.hpp>
+#include <libroad/xml_writer.hpp>
+#include "timer.hpp"
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+
+// parse_number must agree bit-for-bit with strtof/strtod wherever those succeed
+static int check_floats(const size_t count)
+{
+    static const char *formats[] = {"%.9g", "%.7g", "%.3f", "%.12g", "%.17g", "%e"};
+
+    int  errors = 0;
+    char buf[64];
+    for(size_t i = 0; i < count; ++i)
+    {
+        const double d = (drand48() - 0.5)*std::pow(10.0, static_cast<int>(drand48()*30) - 15);
+        const float  f = static_cast<float>(d);
+
+        if(i % 7 == 0)
+            buf[format_float(buf, f)] = 0;
+        else
+            std::sprintf(buf, formats[i % 6], d);
+
+        char *end;
+        errno = 0;
+        const float ref_f = std::strtof(buf, &end);
+        float       got_f;
+        if(errno != ERANGE && (parse_number(got_f, buf) != end || std::memcmp(&got_f, &ref_f, sizeof(float))))
+        {
+            std::cout << "float " << buf << " parsed wrong" << std::endl;
+            ++errors;
+        }
+
+        errno = 0;
+        const double ref_d = std::strtod(buf, &end);
+        double       got_d;
+        if(errno != ERANGE && (parse_number(got_d, buf) != end || std::memcmp(&got_d, &ref_d, sizeof(double))))
+        {
+            std::cout << "double " << buf << " parsed wrong" << std::endl;
+            ++errors;
+        }
+    }
+    return errors;
+}
+
+static int check_ints()
+{
+    struct int_case
+    {
+        const char *s;
+        bool        ok;
+        int         val;
+    };
+    static const int_case cases[] = {{"0", true, 0}, {"-17", true, -17}, {"+5", true, 5}, {"2147483647", true, 2147483647},
+                                     {"-2147483648", true, -2147483647-1}, {"2147483648", false, 0}, {"-", false, 0}, {"x1", false, 0}};
+
+    int errors = 0;
+    BOOST_FOREACH(const int_case &c, cases)
+    {
+        int         v;
+        const char *end = parse_number(v, c.s);
+        if((end != 0) != c.ok || (c.ok && (*end || v != c.val)))
+        {
+            std::cout << "int " << c.s << " parsed wrong" << std::endl;
+            ++errors;
+        }
+    }
+
+    unsigned long u;
+    if(parse_number(u, "-1"))
+    {
+        std::cout << "unsigned -1 accepted" << std::endl;
+        ++errors;
+    }
+    return errors;
+}
+
+static void bench_floats(const size_t count)
+{
+    std::vector<std::string> strings(count);
+    char                     buf[32];
+    BOOST_FOREACH(std::string &s, strings)
+    {
+        buf[format_float(buf, static_cast<float>((drand48() - 0.5)*1000.0))] = 0;
+        s = buf;
+    }
+
+    float  sum   = 0.0f;
+    double start = time_now();
+    BOOST_FOREACH(const std::string &s, strings)
+    {
+        float v;
+        parse_number(v, s.c_str());
+        sum += v;
+    }
+    const double parse_time = time_now() - start;
+
+    start = time_now();
+    BOOST_FOREACH(const std::string &s, strings)
+    {
+        sum -= boost::lexical_cast<float>(s);
+    }
+    const double cast_time = time_now() - start;
+
+    std::cout << count << " floats: parse_number " << parse_time << " s, lexical_cast " << cast_time << " s ("
+              << cast_time/parse_time << "x); residue " << sum << std::endl;
+}
+
+static int compare(const hwm::network &a, const hwm::network &b)
+{
+    if(a.name != b.name || a.gamma != b.gamma || a.lane_width != b.lane_width ||
+       a.roads.size() != b.roads.size() || a.lanes.size() != b.lanes.size() || a.intersections.size() != b.intersections.size())
+    {
+        std::cout << "Loaders disagree on the network's attributes or sizes" << std::endl;
+        return 1;
+    }
+
+    int errors = 0;
+    hwm::road_map::const_iterator rb = b.roads.begin();
+    BOOST_FOREACH(const hwm::road_pair &ra, a.roads)
+    {
+        if(ra.first != rb->first || ra.second.name != rb->second.name || ra.second.rep.points_.size() != rb->second.rep.points_.size() ||
+           ra.second.rep.radii_ != rb->second.rep.radii_)
+        {
+            std::cout << "Road " << ra.first << " differs" << std::endl;
+            ++errors;
+        }
+        ++rb;
+    }
+
+    hwm::lane_map::const_iterator lb = b.lanes.begin();
+    BOOST_FOREACH(const hwm::lane_pair &la, a.lanes)
+    {
+        const hwm::lane *ab[] = {&(la.second), &(lb->second)};
+        bool same = la.first == lb->first && la.second.speedlimit == lb->second.speedlimit &&
+            la.second.road_memberships.size() == lb->second.road_memberships.size();
+        for(int s = 0; s < 2 && same; ++s)
+        {
+            const hwm::lane::intersection_terminus *ta = dynamic_cast<const hwm::lane::intersection_terminus*>(s ? ab[0]->start : ab[0]->end);
+            const hwm::lane::intersection_terminus *tb = dynamic_cast<const hwm::lane::intersection_terminus*>(s ? ab[1]->start : ab[1]->end);
+            same = (!ta && !tb) || (ta && tb && ta->intersect_in_ref == tb->intersect_in_ref &&
+                                    (ta->adjacent_intersection ? ta->adjacent_intersection->id : str()) == (tb->adjacent_intersection ? tb->adjacent_intersection->id : str()));
+        }
+        if(!same)
+        {
+            std::cout << "Lane " << la.first << " differs" << std::endl;
+            ++errors;
+        }
+        ++lb;
+    }
+
+    hwm::intersection_map::const_iterator ib = b.intersections.begin();
+    BOOST_FOREACH(const hwm::intersection_pair &ia, a.intersections)
+    {
+        if(ia.first != ib->first || ia.second.incoming.size() != ib->second.incoming.size() ||
+           ia.second.outgoing.size() != ib->second.outgoing.size() || ia.second.states.size() != ib->second.states.size())
+        {
+            std::cout << "Intersection " << ia.first << " differs" << std::endl;
+            ++errors;
+        }
+        ++ib;
+    }
+
+    return errors;
+}
+
+static aabb2d road_bounds(const hwm::road &r)
+{
+    aabb2d res;
+    BOOST_FOREACH(const vec3f &p, r.rep.points_)
+    {
+        res.enclose_point(p[0], p[1]);
+    }
+    return res;
+}
+
+// Loads the western half of the network on its own: every road there must come along, and nothing may dangle
+static int check_region(const char *filename, const hwm::network &full)
+{
+    aabb2d all;
+    BOOST_FOREACH(const hwm::road_pair &rp, full.roads)
+    {
+        const aabb2d b(road_bounds(rp.second));
+        all.enclose_point(b.bounds[0][0], b.bounds[0][1]);
+        all.enclose_point(b.bounds[1][0], b.bounds[1][1]);
+    }
+    const aabb2d region(all.bounds[0][0], 0.5f*(all.bounds[0][0] + all.bounds[1][0]), all.bounds[0][1], all.bounds[1][1]);
+
+    const double       start = time_now();
+    const hwm::network part(hwm::load_xml_network_region(filename, region, vec3f(1.0f, 1.0f, 1.0f)));
+    std::cout << filename << ": region load of " << part.roads.size() << " roads, " << part.lanes.size() << " lanes, "
+              << part.intersections.size() << " intersections in " << time_now() - start << " s" << std::endl;
+
+    int errors = 0;
+    try
+    {
+        part.check();
+    }
+    catch(std::exception &e)
+    {
+        std::cout << "Region network fails its check: " << e.what() << std::endl;
+        ++errors;
+    }
+
+    BOOST_FOREACH(const hwm::road_pair &rp, full.roads)
+    {
+        if(road_bounds(rp.second).overlap(region) && !part.roads.count(rp.first))
+        {
+            std::cout << "Road " << rp.first << " is in the region but wasn't loaded" << std::endl;
+            ++errors;
+        }
+    }
+    if(part.roads.size() > full.roads.size() || part.lanes.size() > full.lanes.size() || part.intersections.size() > full.intersections.size())
+    {
+        std::cout << "Region network is bigger than the whole" << std::endl;
+        ++errors;
+    }
+    return errors;
+}
+
+int main(int argc, char *argv[])
+{
+    std::cerr << libroad_package_string() << std::endl;
+
+    srand48(1);
+    int errors = 0;
+    errors += check_floats(1000000);
+    errors += check_ints();
+    bench_floats(1000000);
+
+    // Load times for whatever networks are given, with both loaders
+    typedef hwm::network (*loader)(const char *, const vec3f &);
+    const loader  loaders[]      = {hwm::load_xml_network, hwm::load_xml_network_parallel};
+    const char   *loader_names[] = {"streaming", "parallel"};
+    const int     repeats        = 3;
+    for(int i = 1; i < argc; ++i)
+    {
+        try
+        {
+            hwm::network nets[2];
+            for(int l = 0; l < 2; ++l)
+            {
+                double best = 0.0;
+                for(int r = 0; r < repeats; ++r)
+                {
+                    const double       start = time_now();
+                    const hwm::network net(loaders[l](argv[i], vec3f(1.0f, 1.0f, 1.0f)));
+                    const double       t     = time_now() - start;
+                    if(r == 0 || t < best)
+                        best = t;
+                    if(r == 0)
+                        nets[l] = net;
+                }
+                std::cout << argv[i] << ": " << loader_names[l] << " best load of " << repeats << " in " << best << " s" << std::endl;
+            }
+            std::cout << argv[i] << ": " << nets[0].roads.size() << " roads, " << nets[0].lanes.size() << " lanes, "
+                      << nets[0].intersections.size() << " intersections" << std::endl;
+            nets[1].check();
+            errors += compare(nets[0], nets[1]);
+            errors += check_region(argv[i], nets[0]);
+        }
+        catch(std::exception &e)
+        {
+            std::cout << argv[i] << ": " << e.what() << std::endl;
+            ++errors;
+        }
+    }
+
+    std::cout << errors << " errors" << std::endl;
+    return errors ? 1 : 0;
+}
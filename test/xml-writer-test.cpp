@@ -0,0 +1,195 @@
+#include <libroad/hwm_network.hpp>
+#include <libroad/xml_writer.hpp>
+#include "timer.hpp"
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+
+static float random_float(const int i)
+{
+    switch(i % 3)
+    {
+    case 0:
+        return (drand48() - 0.5)*2000.0;
+    case 1:
+        return static_cast<float>(lrand48() % 100000)/100.0f;
+    default:
+        {
+            float              v;
+            const unsigned int u = static_cast<unsigned int>(lrand48()) ^ (static_cast<unsigned int>(lrand48()) << 16);
+            std::memcpy(&v, &u, sizeof(v));
+            return xisfinite(v) ? v : 1.0f;
+        }
+    }
+}
+
+static int check_format_float(const int n)
+{
+    int errors = 0;
+    for(int i = 0; i < n; ++i)
+    {
+        const float v = random_float(i);
+        char        buf[32];
+        buf[format_float(buf, v)] = 0;
+        if(std::strtod(buf, 0) != v && static_cast<float>(std::strtod(buf, 0)) != v)
+        {
+            std::cout << "format_float(" << boost::str(boost::format("%.9g") % v) << ") = " << buf << " doesn't read back" << std::endl;
+            ++errors;
+        }
+
+        // Every digit counts but the zeros that only place the point: those of a leading "0.00" and the trailing
+        // ones of a whole number. No %e with fewer digits may read back.
+        const char  *m     = buf + (buf[0] == '-');
+        const size_t mlen  = std::strcspn(m, "e");
+        size_t       first = 0;
+        size_t       last  = mlen;
+        if(mlen > 1 && m[0] == '0' && m[1] == '.')
+            for(first = 2; first < mlen && m[first] == '0'; ++first)
+                ;
+        if(!std::memchr(m, '.', mlen))
+            while(last > first + 1 && m[last-1] == '0')
+                --last;
+        int digits = 0;
+        for(size_t c = first; c < last; ++c)
+            if(m[c] >= '0' && m[c] <= '9')
+                ++digits;
+        char shorter[32];
+        std::sprintf(shorter, "%.*e", std::max(digits-2, 0), v);
+        if(digits > 1 && static_cast<float>(std::strtod(shorter, 0)) == v)
+        {
+            std::cout << "format_float(" << boost::str(boost::format("%.9g") % v) << ") = " << buf << " isn't shortest (" << shorter << ")" << std::endl;
+            ++errors;
+        }
+    }
+
+    // Values whose shortest digits carry into the next power of ten at a shorter length
+    static const struct
+    {
+        float       v;
+        const char *text;
+    } cases[] = {{9.6f, "9.6"}, {95.0f, "95"}, {99.7f, "99.7"}, {9.96f, "9.96"}, {0.996f, "0.996"}, {9.5e10f, "9.5e10"},
+                 {-99.7f, "-99.7"}, {100.0f, "100"}, {0.05f, "0.05"}};
+    for(size_t i = 0; i < sizeof(cases)/sizeof(cases[0]); ++i)
+    {
+        char buf[32];
+        buf[format_float(buf, cases[i].v)] = 0;
+        if(std::strcmp(buf, cases[i].text))
+        {
+            std::cout << "format_float(" << cases[i].text << ") = " << buf << std::endl;
+            ++errors;
+        }
+    }
+
+    float  sink  = 0;
+    double start = time_now();
+    for(int i = 0; i < n; ++i)
+    {
+        char buf[32];
+        sink += format_float(buf, random_float(i));
+    }
+    const double t_fast = time_now() - start;
+
+    start = time_now();
+    for(int i = 0; i < n; ++i)
+        sink += boost::lexical_cast<str>(random_float(i)).size();
+    const double t_lexical = time_now() - start;
+
+    std::cout << "format_float: " << 1e9*t_fast/n << " ns, lexical_cast: " << 1e9*t_lexical/n << " ns (checksum " << sink << ")" << std::endl;
+    return errors;
+}
+
+// The streaming writer lays out a document exactly as libxml++ does
+static int check_layout()
+{
+    xmlpp::Document doc;
+    xmlpp::Element *root = doc.create_root_node("network");
+    root->set_attribute("name", "a&b<\"c\">\n\tx");
+    root->set_attribute("version", "1.3");
+    xmlpp::Element *road = root->add_child("roads")->add_child("road");
+    road->set_attribute("id", "r0");
+    xmlpp::Element *rep = road->add_child("arc_line_rep");
+    xmlpp::Element *pts = rep->add_child("points");
+    pts->add_child_text("1 2.5 -3 0.0\n");
+    pts->add_child_text("4 5 6 0.0\n");
+    rep->add_child("radii");
+    root->add_child("lanes")->add_child("lane")->add_child("start")->add_child("dead_end");
+    root->add_child("intersections");
+
+    std::ostringstream dom;
+    doc.write_to_stream_formatted(dom, "utf-8");
+
+    std::ostringstream stream;
+    {
+        xml_writer w(stream);
+        w.start("network");
+        w.attribute("name", str("a&b<\"c\">\n\tx"));
+        w.attribute("version", "1.3");
+        w.start("roads");
+        w.start("road");
+        w.attribute("id", "r0");
+        w.start("arc_line_rep");
+        w.start("points");
+        w.text(1.0f);
+        w.text(" ");
+        w.text(2.5f);
+        w.text(" ");
+        w.text(-3.0f);
+        w.text(" 0.0\n");
+        w.text("4 5 6 0.0\n");
+        w.end();
+        w.start("radii");
+        w.end();
+        w.end();
+        w.end();
+        w.end();
+        w.start("lanes");
+        w.start("lane");
+        w.start("start");
+        w.start("dead_end");
+        w.end();
+        w.end();
+        w.end();
+        w.end();
+        w.start("intersections");
+        w.end();
+        w.end();
+    }
+
+    if(stream.str() != dom.str())
+    {
+        std::cout << "Streamed document differs:" << std::endl << stream.str() << "expected:" << std::endl << dom.str();
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    std::cerr << libroad_package_string() << std::endl;
+
+    int errors = 0;
+    errors += check_format_float(argc > 1 ? atoi(argv[1]) : 1000000);
+    errors += check_layout();
+
+    if(argc > 2)
+    {
+        const hwm::network net(hwm::load_xml_network(argv[2]));
+        const str          out(argc > 3 ? argv[3] : "/tmp/xml-writer-test.xml.gz");
+
+        const double start = time_now();
+        net.xml_write(out.c_str());
+        std::cout << "Streamed " << argv[2] << " in " << time_now() - start << " s" << std::endl;
+
+        const hwm::network reread(hwm::load_xml_network(out.c_str()));
+        if(reread.roads.size() != net.roads.size() || reread.lanes.size() != net.lanes.size() || reread.intersections.size() != net.intersections.size())
+        {
+            std::cout << "Rereading the streamed network gives a different network" << std::endl;
+            ++errors;
+        }
+        reread.check();
+    }
+
+    std::cout << errors << " errors" << std::endl;
+    return errors ? 1 : 0;
+}